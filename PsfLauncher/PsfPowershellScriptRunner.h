@@ -262,12 +262,10 @@ private:
 		if (!std::filesystem::exists(SSWrapper))
 		{
 			// The wrapper isn't in this folder, so we should search for it elewhere in the package.
-			for (const auto& file : std::filesystem::recursive_directory_iterator(packageRoot))
+			auto paths = PSFFindPackageFiles(SSWrapper.c_str());
+			if (paths && *paths)
 			{
-				if (file.path().filename().compare(SSWrapper) == 0)
-				{
-					SSWrapper = file.path();
-				}
+				SSWrapper = *paths;
 			}
 
 			if (!std::filesystem::exists(SSWrapper))
@@ -17,32 +17,25 @@ bool IsUnderUserAppDataAndReplace(const CharT* fileName, CharT* cmdLine, bool Ap
     {
         return result;
     }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
 
-    GUID appDataFolderId = AppDataLocal ? FOLDERID_LocalAppData : FOLDERID_RoamingAppData;
-
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + wcslen(root_local_device_prefix), fileName))
-    {
-        isUnderAppData = is_path_relative(fileName + wcslen(root_local_device_prefix), psf::known_folder(appDataFolderId));
-    }
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + wcslen(root_local_device_prefix_dot), fileName))
-    {
-        isUnderAppData = is_path_relative(fileName + wcslen(root_local_device_prefix_dot), psf::known_folder(appDataFolderId));
-    }
-    else
-    {
-        isUnderAppData = is_path_relative(fileName, psf::known_folder(appDataFolderId));
-    }
+    // The known folder table is resolved once per process, so this is a single walk over 'fileName' rather than a
+    // SHGetKnownFolderPath call (or three) per command line token
+    auto& knownFolders = psf::known_folders();
+    auto knownRoot = knownFolders.classify(fileName);
+    auto appDataRoot = AppDataLocal ? psf::known_root::local_app_data : psf::known_root::roaming_app_data;
+    isUnderAppData = AppDataLocal ? knownRoot.is_local_app_data() : (knownRoot.root == appDataRoot);
 
     size_t remBufSize = MAX_CMDLINE_PATH - strlenImpl(cmdLine);
     if (isUnderAppData)
     {
-        std::filesystem::path strLocalRoaming = AppDataLocal ? std::filesystem::path(L"Local") : std::filesystem::path(L"Roaming");
-        std::filesystem::path appDataPath = psf::known_folder(appDataFolderId);
-        auto packageAppDataPath = psf::known_folder(FOLDERID_LocalAppData) / std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache)" / strLocalRoaming;
-        std::wstring relativePath = widen(fileName + (appDataPath.native().length()));
-        std::wstring fullPath = packageAppDataPath.native() + relativePath;
+        static const std::wstring packageLocalCachePath = (std::filesystem::path(knownFolders.get(psf::known_root::local_app_data_packages).path) /
+            psf::current_package_family_name() / LR"(LocalCache)").native();
+
+        // NOTE: For LocalAppData\Packages, the match covers more than the LocalAppData root, so compute the relative
+        // path from the length of the device prefix (if any) and the root that we care about
+        auto prefixLength = knownRoot.length - knownFolders.get(knownRoot.root).path.length();
+        std::wstring relativePath = widen(fileName + prefixLength + knownFolders.get(appDataRoot).path.length());
+        std::wstring fullPath = packageLocalCachePath + (AppDataLocal ? LR"(\Local)" : LR"(\Roaming)") + relativePath;
 
         if (GetFileAttributesImpl(fullPath.c_str()) != INVALID_FILE_ATTRIBUTES)
         {
@@ -277,27 +277,20 @@ void load_json()
         {
             Log("Config.json not found in executable folder of package %ls, continue looking elsewhere.", g_PackageRootPath.c_str());
             // If not in those two locations, must check everywhere in package.
-            for (auto& dentry : std::filesystem::recursive_directory_iterator(g_PackageRootPath))
+            if (auto paths = PSFFindPackageFiles(L"config.json"))
             {
-                try
+                if (*paths)
                 {
-                    if (dentry.is_regular_file())
-                    {
-                        if (dentry.path().filename().compare(L"config.json") == 0)
-                        {
-                            Log("Found config at: %ls", dentry.path().c_str());
+                    Log("Found config at: %ls", *paths);
 #pragma warning(suppress:4996) // Nonsense warning; _wfopen is perfectly safe
-                            file = _wfopen(dentry.path().c_str(), L"rb, ccs=UTF-8");
-                            break;
-                        }
-                    }
-                }
-                catch (...)
-                {
-                    Log("Non-fatal error enumerating directories while looking for config.json.");
-                    psf::TraceLogExceptions("PSFConfigException", L"Non-fatal error enumerating directories while looking for config.json.");
+                    file = _wfopen(*paths, L"rb, ccs=UTF-8");
                 }
             }
+            else
+            {
+                Log("Non-fatal error enumerating directories while looking for config.json.");
+                psf::TraceLogExceptions("PSFConfigException", L"Non-fatal error enumerating directories while looking for config.json.");
+            }
         }
 
         if (!file)
@@ -11,6 +11,7 @@ void LoadConfig();
 
 // Globals set by `LoadConfig`, to avoid continuously querying them
 const std::wstring& PackageFullName() noexcept;
+const std::wstring& PackageFamilyName() noexcept;
 const std::wstring& ApplicationUserModelId() noexcept;
 const std::wstring& ApplicationId() noexcept;
 const std::filesystem::path& PackageRootPath() noexcept;
@@ -291,26 +291,22 @@ BOOL WINAPI CreateProcessFixup(
 #endif
                 // If not in those two locations, must check everywhere in package.
                 // The child process might also be in another package folder, so look elsewhere in the package.
-                for (auto& dentry : std::filesystem::recursive_directory_iterator(PackageRootPath()))
+                if (auto paths = PSFFindPackageFiles(wtargetDllName.c_str()))
                 {
-                    try
+                    if (*paths)
                     {
-                        if (dentry.path().filename().compare(wtargetDllName) == 0)
-                        {
-                            static const auto altDirPathToPsfRuntime = narrow(dentry.path().c_str());
+                        static const auto altDirPathToPsfRuntime = narrow(*paths);
 #if _DEBUG
-                            Log("\tFound match as %ls", dentry.path().c_str());
+                        Log("\tFound match as %ls", *paths);
 #endif
-                            targetDllPath = altDirPathToPsfRuntime.c_str();
-                            break;
-                        }
-                    }
-                    catch (...)
-                    {
-                        psf::TraceLogExceptions("PSFRuntimeException", "Non-fatal error enumerating directories while looking for PsfRuntime");
-                        Log("Non-fatal error enumerating directories while looking for PsfRuntime.");
+                        targetDllPath = altDirPathToPsfRuntime.c_str();
                     }
                 }
+                else
+                {
+                    psf::TraceLogExceptions("PSFRuntimeException", "Non-fatal error enumerating directories while looking for PsfRuntime");
+                    Log("Non-fatal error enumerating directories while looking for PsfRuntime.");
+                }
 
             }
         }
@@ -0,0 +1,391 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// PSFFindPackageFiles: finds files by name anywhere in the package. The first call maps the package's file index from
+// an earlier launch, or else enumerates the package once and saves the index for the launches that follow.
+//
+
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <windows.h>
+#include <winternl.h>
+#include <psf_runtime.h>
+
+#include "Config.h"
+#include "package_file_locator.h"
+
+void Log(const char* fmt, ...);
+
+// Loaded once, and rebuilt at most once if it turns out to be stale; g_PackageFilePathsMutex guards both
+static std::once_flag g_PackageFilesOnce;
+static package_file_locator g_PackageFiles;
+static std::vector<std::uint8_t> g_PackageFilesData;
+static const void* g_PackageFilesView = nullptr;
+static bool g_PackageFilesRebuilt = false;
+
+// The arrays returned by PSFFindPackageFiles, by folded file name, so that asking again returns the same array
+struct package_file_paths
+{
+    std::vector<std::wstring> paths;
+    std::vector<const wchar_t*> pointers;
+};
+static std::mutex g_PackageFilePathsMutex;
+static std::unordered_map<std::wstring, std::unique_ptr<package_file_paths>> g_PackageFilePaths;
+
+static std::filesystem::path PackageFileIndexPath()
+{
+    // E.g. "%LocalAppData%\Packages\<PFN>\LocalCache\Local\Microsoft\PackageFileLocator\<PackageFullName>.idx".
+    // The first lookup can happen under the loader lock (config.json is loaded from DllMain), so this avoids the
+    // shell's known folder APIs
+    wchar_t localAppData[MAX_PATH];
+    auto length = ::GetEnvironmentVariableW(L"LOCALAPPDATA", localAppData, MAX_PATH);
+    if ((length == 0) || (length >= MAX_PATH))
+    {
+        return {};
+    }
+    return std::filesystem::path(localAppData) / L"Packages" / PackageFamilyName() /
+        LR"(LocalCache\Local\Microsoft\PackageFileLocator)" / (PackageFullName() + L".idx");
+}
+
+static bool MapPackageFileIndex(const std::filesystem::path& indexPath, const std::wstring& key)
+{
+    auto file = ::CreateFileW(indexPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    auto mapping = ::GetFileSizeEx(file, &size) ? ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    ::CloseHandle(file);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    // The view keeps the file mapped after the mapping handle is closed
+    auto view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(mapping);
+    if (!view)
+    {
+        return false;
+    }
+
+    if (!g_PackageFiles.open(view, static_cast<std::size_t>(size.QuadPart), key))
+    {
+        Log("Package file index %ls is stale or invalid", indexPath.c_str());
+        ::UnmapViewOfFile(view);
+        return false;
+    }
+    g_PackageFilesView = view;
+    return true;
+}
+
+// The package is enumerated through ntdll, beneath any fixup's hooks. Once the FileRedirectionFixup is loaded,
+// FindFirstFile/FindNextFile would also report the files that the app has written to its redirected copy of the package
+struct file_directory_information
+{
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+};
+
+using NtQueryDirectoryFile_t = NTSTATUS(NTAPI*)(HANDLE, HANDLE, PIO_APC_ROUTINE, PVOID, PIO_STATUS_BLOCK, PVOID, ULONG,
+    FILE_INFORMATION_CLASS, BOOLEAN, PUNICODE_STRING, BOOLEAN);
+
+static constexpr NTSTATUS status_no_more_files = static_cast<NTSTATUS>(0x80000006);
+
+struct nt_directory_functions
+{
+    decltype(&::NtOpenFile) NtOpenFile;
+    NtQueryDirectoryFile_t NtQueryDirectoryFile;
+    decltype(&::NtClose) NtClose;
+};
+
+static const nt_directory_functions* NtDirectoryFunctions()
+{
+    static const nt_directory_functions functions = []
+    {
+        auto ntdll = ::GetModuleHandleW(L"ntdll.dll");
+        return nt_directory_functions{
+            reinterpret_cast<decltype(&::NtOpenFile)>(::GetProcAddress(ntdll, "NtOpenFile")),
+            reinterpret_cast<NtQueryDirectoryFile_t>(::GetProcAddress(ntdll, "NtQueryDirectoryFile")),
+            reinterpret_cast<decltype(&::NtClose)>(::GetProcAddress(ntdll, "NtClose")) };
+    }();
+    return (functions.NtOpenFile && functions.NtQueryDirectoryFile && functions.NtClose) ? &functions : nullptr;
+}
+
+// 'name' is either an NT path (when 'parent' is null), or a name relative to 'parent'. Returns null on failure
+static HANDLE OpenDirectory(const nt_directory_functions& nt, HANDLE parent, std::wstring_view name)
+{
+    UNICODE_STRING objectName;
+    objectName.Buffer = const_cast<PWSTR>(name.data());
+    objectName.Length = objectName.MaximumLength = static_cast<USHORT>(name.length() * sizeof(wchar_t));
+
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &objectName, OBJ_CASE_INSENSITIVE, parent, nullptr);
+
+    HANDLE result = nullptr;
+    IO_STATUS_BLOCK ioStatus = {};
+    auto status = nt.NtOpenFile(&result, FILE_LIST_DIRECTORY | SYNCHRONIZE, &attributes, &ioStatus,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT);
+    return (status >= 0) ? result : nullptr;
+}
+
+// E.g. "C:\Program Files\WindowsApps\..." -> "\??\C:\Program Files\WindowsApps\..."
+static std::wstring NtPathName(const std::wstring& path)
+{
+    if ((path.compare(0, 4, LR"(\\?\)") == 0) || (path.compare(0, 4, LR"(\\.\)") == 0))
+    {
+        return LR"(\??\)" + path.substr(4);
+    }
+    else if (path.compare(0, 2, LR"(\\)") == 0)
+    {
+        return LR"(\??\UNC\)" + path.substr(2);
+    }
+    return LR"(\??\)" + path;
+}
+
+// Returns false if some part of the package could not be enumerated. The files that were found can still be used, but
+// the index is not saved, so that the next launch tries again
+static bool EnumeratePackageFiles(const nt_directory_functions& nt, HANDLE directory, std::wstring& path, std::size_t rootLength, package_file_locator_builder& builder)
+{
+    // 8 byte aligned, as the entries require
+    std::vector<std::uint64_t> buffer(64 * 1024 / sizeof(std::uint64_t));
+
+    bool result = true;
+    for (BOOLEAN restartScan = TRUE; ; restartScan = FALSE)
+    {
+        IO_STATUS_BLOCK ioStatus = {};
+        auto status = nt.NtQueryDirectoryFile(directory, nullptr, nullptr, nullptr, &ioStatus, buffer.data(),
+            static_cast<ULONG>(buffer.size() * sizeof(buffer[0])), FileDirectoryInformation, FALSE, nullptr, restartScan);
+        if (status == status_no_more_files)
+        {
+            break;
+        }
+        else if (status < 0)
+        {
+            result = false;
+            break;
+        }
+
+        auto entry = reinterpret_cast<const file_directory_information*>(buffer.data());
+        while (true)
+        {
+            std::wstring_view fileName(entry->FileName, entry->FileNameLength / sizeof(wchar_t));
+            if ((fileName != L".") && (fileName != L".."))
+            {
+                auto pathLength = path.length();
+                path += L'\\';
+                path += fileName;
+                if ((entry->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+                {
+                    // Reparse points are not followed, the same as recursive_directory_iterator; what they point to is
+                    // not part of the package
+                    if ((entry->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+                    {
+                        auto child = OpenDirectory(nt, directory, fileName);
+                        if (child)
+                        {
+                            result = EnumeratePackageFiles(nt, child, path, rootLength, builder) && result;
+                            nt.NtClose(child);
+                        }
+                        else
+                        {
+                            result = false;
+                        }
+                    }
+                }
+                else
+                {
+                    builder.add(std::wstring_view(path).substr(rootLength + 1));
+                }
+                path.resize(pathLength);
+            }
+
+            if (entry->NextEntryOffset == 0)
+            {
+                break;
+            }
+            entry = reinterpret_cast<const file_directory_information*>(
+                reinterpret_cast<const std::uint8_t*>(entry) + entry->NextEntryOffset);
+        }
+    }
+
+    return result;
+}
+
+static void PersistPackageFileIndex(const std::filesystem::path& indexPath, const std::vector<std::uint8_t>& data)
+{
+    std::filesystem::create_directories(indexPath.parent_path());
+
+    // Write to a temporary name first so that a concurrently starting process never maps a partial file
+    auto tempPath = indexPath;
+    tempPath += L"." + std::to_wstring(::GetCurrentProcessId()) + L".tmp";
+    auto file = ::CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD written = 0;
+    auto success = ::WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &written, nullptr) && (written == data.size());
+    ::CloseHandle(file);
+
+    if (!success || !::MoveFileExW(tempPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        ::DeleteFileW(tempPath.c_str());
+        return;
+    }
+
+    // The indexes of other versions of the package are of no further use once it has been updated
+    std::error_code ec;
+    for (std::filesystem::directory_iterator itr(indexPath.parent_path(), ec), end; !ec && (itr != end); itr.increment(ec))
+    {
+        auto& otherPath = itr->path();
+        if ((otherPath.extension() == L".idx") && (otherPath.filename() != indexPath.filename()))
+        {
+            ::DeleteFileW(otherPath.c_str());
+        }
+    }
+}
+
+static void BuildPackageFileIndex(const std::filesystem::path& indexPath)
+{
+    auto nt = NtDirectoryFunctions();
+    if (!nt)
+    {
+        return;
+    }
+
+    auto root = OpenDirectory(*nt, nullptr, NtPathName(PackageRootPath().native()));
+    if (!root)
+    {
+        Log("Package file index not built; %ls could not be opened", PackageRootPath().c_str());
+        return;
+    }
+
+    package_file_locator_builder builder;
+    std::wstring path = PackageRootPath().native();
+    auto complete = EnumeratePackageFiles(*nt, root, path, path.length(), builder);
+    nt->NtClose(root);
+
+    // Moving the vector keeps its buffer, so 'index' still points into it
+    auto data = builder.serialize(PackageFullName());
+    package_file_locator index;
+    if (!index.open(data.data(), data.size(), PackageFullName()))
+    {
+        return;
+    }
+    g_PackageFilesData = std::move(data);
+    g_PackageFiles = index;
+    if (g_PackageFilesView)
+    {
+        ::UnmapViewOfFile(g_PackageFilesView);
+        g_PackageFilesView = nullptr;
+    }
+    Log("Package file index built with %llu files", static_cast<std::uint64_t>(builder.size()));
+
+    if (!complete)
+    {
+        Log("Package file index not saved; part of %ls could not be enumerated", PackageRootPath().c_str());
+    }
+    else if (!indexPath.empty())
+    {
+        PersistPackageFileIndex(indexPath, g_PackageFilesData);
+    }
+}
+
+static void LoadPackageFileIndex() noexcept try
+{
+    auto indexPath = PackageFileIndexPath();
+    if (!indexPath.empty() && MapPackageFileIndex(indexPath, PackageFullName()))
+    {
+        Log("Package file index mapped from %ls", indexPath.c_str());
+        return;
+    }
+
+    // The callers need an answer now, so unlike the fixups' indexes this one is built on the calling thread
+    g_PackageFilesRebuilt = true;
+    BuildPackageFileIndex(indexPath);
+}
+catch (...)
+{
+    // Without an index, nothing is found
+}
+
+static std::unique_ptr<package_file_paths> FindPackageFilePaths(const wchar_t* fileName, bool& stale)
+{
+    auto result = std::make_unique<package_file_paths>();
+    stale = false;
+    for (auto& relativePath : g_PackageFiles.find(fileName))
+    {
+        auto path = (PackageRootPath() / relativePath).native();
+        stale = stale || (::GetFileAttributesW(path.c_str()) == INVALID_FILE_ATTRIBUTES);
+        result->paths.push_back(std::move(path));
+    }
+    for (auto& path : result->paths)
+    {
+        result->pointers.push_back(path.c_str());
+    }
+    result->pointers.push_back(nullptr);
+    return result;
+}
+
+PSFAPI const wchar_t* const* __stdcall PSFFindPackageFiles(_In_ const wchar_t* fileName) noexcept try
+{
+    if (!fileName)
+    {
+        return nullptr;
+    }
+
+    std::call_once(g_PackageFilesOnce, LoadPackageFileIndex);
+
+    std::lock_guard<std::mutex> lock(g_PackageFilePathsMutex);
+    if (!g_PackageFiles.is_open())
+    {
+        return nullptr;
+    }
+
+    auto& result = g_PackageFilePaths[package_file_locator::fold(fileName)];
+    if (!result)
+    {
+        // A saved index that names a file that isn't there is out of date (e.g. it was left behind by an interrupted
+        // update), so it is rebuilt once. Finding nothing is not taken as a sign of that: the DynamicLibraryFixup looks
+        // up every module name that the loader fails to find, and most of those are not in the package either. Arrays
+        // already handed out stay as they are
+        bool stale;
+        result = FindPackageFilePaths(fileName, stale);
+        if (stale && !g_PackageFilesRebuilt)
+        {
+            g_PackageFilesRebuilt = true;
+            Log("Package file index rebuilt after looking up %ls", fileName);
+            BuildPackageFileIndex(PackageFileIndexPath());
+            if (g_PackageFiles.is_open())
+            {
+                result = FindPackageFilePaths(fileName, stale);
+            }
+        }
+    }
+    return result->pointers.data();
+}
+catch (...)
+{
+    return nullptr;
+}
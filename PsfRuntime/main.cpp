@@ -83,35 +83,33 @@ void load_fixups()
                         Log("\tfixup not found at root of package, look elsewhere %ls.", path.filename().c_str());
 #endif
                         // just try to find it elsewhere as it isn't at the root
-                        for (auto& dentry : std::filesystem::recursive_directory_iterator(PackageRootPath()))
+                        if (auto paths = PSFFindPackageFiles(path.filename().c_str()))
                         {
-                            try
+                            for (; *paths; ++paths)
                             {
-                                if (dentry.path().filename().compare(path.filename().c_str()) == 0)
+                                std::filesystem::path candidate = *paths;
+                                fixup.module_handle = ::LoadLibraryW(candidate.c_str());
+                                if (!fixup.module_handle)
+                                {
+                                    auto d2 = candidate;
+                                    d2.replace_extension();
+                                    d2.concat((sizeof(void*) == 4) ? L"32.dll" : L"64.dll");
+                                    fixup.module_handle = ::LoadLibraryW(d2.c_str());
+                                }
+                                if (fixup.module_handle)
                                 {
-                                    fixup.module_handle = ::LoadLibraryW(dentry.path().c_str());
-                                    if (!fixup.module_handle)
-                                    {
-                                        auto d2 = dentry.path();
-                                        d2.replace_extension();
-                                        d2.concat((sizeof(void*) == 4) ? L"32.dll" : L"64.dll");
-                                        fixup.module_handle = ::LoadLibraryW(d2.c_str());
-                                    }
-                                    if (fixup.module_handle)
-                                    {
 #if _DEBUG
-                                        Log("\tfixup found at . %ls", dentry.path().c_str());
-#endif                            
-                                        path = dentry.path();
-                                        break;
-                                    }
+                                    Log("\tfixup found at . %ls", candidate.c_str());
+#endif
+                                    path = candidate;
+                                    break;
                                 }
                             }
-                            catch (...)
-                            {
-                                psf::TraceLogExceptions("PSFRuntimeException", "Non-fatal error enumerating directories while looking for fixup");
-                                Log("Non-fatal error enumerating directories while looking for fixup.");
-                            }
+                        }
+                        else
+                        {
+                            psf::TraceLogExceptions("PSFRuntimeException", "Non-fatal error enumerating directories while looking for fixup");
+                            Log("Non-fatal error enumerating directories while looking for fixup.");
                         }
                     }
 
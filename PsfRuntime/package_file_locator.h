@@ -0,0 +1,376 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// An immutable index of every file in the package, by file name, behind PSFFindPackageFiles. It stands in for walking
+// the whole package when the PsfRuntime, a fixup or the launcher has to find a file that isn't where it was expected
+// (config.json, a fixup dll, the PsfRuntime dll for a child process, ...). The package install directory never changes
+// for a given package full name, so the index is built once, persisted, and memory-mapped on later launches.
+//
+// The serialized form is a single blob that can be used in place (e.g. from a read-only file mapping):
+//      header                      See index_header below
+//      key                         UTF-16, header.key_length code units, padded to 8 bytes. E.g. the package full name
+//      buckets[bucket_count + 1]   The first entry of each hash bucket, then the entry count; padded to 8 bytes
+//      entries[entry_count]        See index_entry below, grouped by bucket
+//      strings                     UTF-16, header.strings_length code units. File names, then relative paths
+// File names are stored as fold() leaves them, so that they are compared as Windows compares file names, without
+// regard to case. Entries for the same file name are sorted shallowest path first, then by path.
+//
+// The saved index lives in the app's writable LocalAppData, so open() doesn't trust it: besides the structure, it
+// rejects any path that could lead out of the package root (rooted, "..", a drive or stream ':'). The caller still
+// checks that the paths it is given exist.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include <file_name_case.h>
+
+class package_file_locator
+{
+public:
+    package_file_locator() = default;
+
+    // Validates 'data' and, if it is a well formed index for 'key', uses it in place. 'data' must outlive this object
+    bool open(const void* data, std::size_t size, std::wstring_view key) noexcept
+    {
+        *this = {};
+        if (size < sizeof(index_header))
+        {
+            return false;
+        }
+
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        index_header header;
+        std::memcpy(&header, bytes, sizeof(header));
+        if ((header.magic != index_magic) || (header.version != index_version) || (header.total_size != size) ||
+            (header.bucket_count == 0))
+        {
+            return false;
+        }
+
+        auto keyOffset = sizeof(index_header);
+        auto bucketsOffset = align(keyOffset + std::uint64_t(header.key_length) * sizeof(std::uint16_t));
+        auto entriesOffset = align(bucketsOffset + (std::uint64_t(header.bucket_count) + 1) * sizeof(std::uint32_t));
+        auto stringsOffset = entriesOffset + std::uint64_t(header.entry_count) * sizeof(index_entry);
+        if (stringsOffset + std::uint64_t(header.strings_length) * sizeof(std::uint16_t) != size)
+        {
+            return false;
+        }
+
+        auto keyData = reinterpret_cast<const std::uint16_t*>(bytes + keyOffset);
+        auto keyUnits = to_utf16(key);
+        if ((keyUnits.length() != header.key_length) ||
+            !std::equal(keyUnits.begin(), keyUnits.end(), keyData))
+        {
+            return false;
+        }
+
+        // Validate everything up front so that lookups don't have to
+        auto buckets = reinterpret_cast<const std::uint32_t*>(bytes + bucketsOffset);
+        for (std::uint32_t i = 0; i < header.bucket_count; ++i)
+        {
+            if ((buckets[i] > buckets[i + 1]) || (buckets[i + 1] > header.entry_count))
+            {
+                return false;
+            }
+        }
+        if ((buckets[0] != 0) || (buckets[header.bucket_count] != header.entry_count))
+        {
+            return false;
+        }
+
+        auto entries = reinterpret_cast<const index_entry*>(bytes + entriesOffset);
+        auto strings = reinterpret_cast<const std::uint16_t*>(bytes + stringsOffset);
+        for (std::uint32_t i = 0; i < header.entry_count; ++i)
+        {
+            auto& entry = entries[i];
+            if ((std::uint64_t(entry.name_offset) + entry.name_length > header.strings_length) ||
+                (std::uint64_t(entry.path_offset) + entry.path_length > header.strings_length))
+            {
+                return false;
+            }
+
+            if (!is_package_relative_path(std::u16string_view(
+                reinterpret_cast<const char16_t*>(strings + entry.path_offset), entry.path_length)))
+            {
+                return false;
+            }
+        }
+
+        m_bucketCount = header.bucket_count;
+        m_buckets = buckets;
+        m_entries = entries;
+        m_entryCount = header.entry_count;
+        m_strings = strings;
+        return true;
+    }
+
+    bool is_open() const noexcept
+    {
+        return m_entries != nullptr;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_entryCount;
+    }
+
+    // The paths, relative to the package root, of every file named 'fileName' (a file name only, without a directory),
+    // shallowest first. Returns an empty list if there are none
+    std::vector<std::wstring> find(std::wstring_view fileName) const
+    {
+        std::vector<std::wstring> result;
+        if (!is_open())
+        {
+            return result;
+        }
+
+        auto name = to_utf16(fold(fileName));
+        auto hash = hash_name(name);
+        auto bucket = hash % m_bucketCount;
+        for (auto i = m_buckets[bucket]; i < m_buckets[bucket + 1]; ++i)
+        {
+            auto& entry = m_entries[i];
+            if ((entry.hash == hash) && (entry.name_length == name.length()) &&
+                std::equal(name.begin(), name.end(), m_strings + entry.name_offset))
+            {
+                result.push_back(path(entry));
+            }
+        }
+        return result;
+    }
+
+    // Upper case, the way the file system compares names regardless of the locale
+    static std::wstring fold(std::wstring_view name)
+    {
+        return psf::fold_file_name(name);
+    }
+
+private:
+    friend class package_file_locator_builder;
+
+    static constexpr std::uint32_t index_magic = 0x4C465350; // "PSFL"
+    static constexpr std::uint32_t index_version = 2;
+
+    struct index_header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t entry_count;
+        std::uint32_t key_length;
+        std::uint32_t bucket_count;
+        std::uint32_t strings_length;
+        std::uint64_t total_size;
+    };
+    static_assert(sizeof(index_header) == 32);
+
+    struct index_entry
+    {
+        std::uint32_t hash;
+        std::uint32_t name_offset;
+        std::uint32_t path_offset;
+        std::uint16_t name_length;
+        std::uint16_t path_length;
+    };
+    static_assert(sizeof(index_entry) == 16);
+
+    std::uint32_t m_bucketCount = 0;
+    const std::uint32_t* m_buckets = nullptr;
+    const index_entry* m_entries = nullptr;
+    std::uint32_t m_entryCount = 0;
+    const std::uint16_t* m_strings = nullptr;
+
+    static constexpr std::uint64_t align(std::uint64_t value) noexcept
+    {
+        return (value + 7) & ~std::uint64_t(7);
+    }
+
+    // wchar_t is UTF-32 on some platforms
+    static std::u16string to_utf16(std::wstring_view str)
+    {
+        std::u16string result;
+        result.reserve(str.length());
+        for (auto ch : str)
+        {
+            auto value = static_cast<std::uint32_t>(ch);
+            if (value > 0xFFFF)
+            {
+                value -= 0x10000;
+                result.push_back(static_cast<char16_t>(0xD800 + (value >> 10)));
+                result.push_back(static_cast<char16_t>(0xDC00 + (value & 0x3FF)));
+            }
+            else
+            {
+                result.push_back(static_cast<char16_t>(value));
+            }
+        }
+        return result;
+    }
+
+    // One or more names separated by single backslashes or slashes, none of them "." or "..", and no ':' anywhere
+    static bool is_package_relative_path(std::u16string_view path) noexcept
+    {
+        if (path.find(u':') != std::u16string_view::npos)
+        {
+            return false;
+        }
+
+        std::size_t start = 0;
+        while (true)
+        {
+            auto end = path.find_first_of(u"\\/", start);
+            auto name = path.substr(start, (end == std::u16string_view::npos) ? end : end - start);
+            if (name.empty() || (name == u".") || (name == u".."))
+            {
+                return false;
+            }
+            else if (end == std::u16string_view::npos)
+            {
+                return true;
+            }
+            start = end + 1;
+        }
+    }
+
+    // FNV-1a
+    static std::uint32_t hash_name(std::u16string_view name) noexcept
+    {
+        std::uint32_t result = 2166136261u;
+        for (auto unit : name)
+        {
+            result = (result ^ unit) * 16777619u;
+        }
+        return result;
+    }
+
+    std::wstring path(const index_entry& entry) const
+    {
+        std::wstring result;
+        auto units = m_strings + entry.path_offset;
+        for (std::size_t i = 0; i < entry.path_length; ++i)
+        {
+            std::uint32_t value = units[i];
+            if ((sizeof(wchar_t) > 2) && (value >= 0xD800) && (value < 0xDC00) && (i + 1 < entry.path_length))
+            {
+                value = 0x10000 + ((value - 0xD800) << 10) + (units[++i] - 0xDC00);
+            }
+            result.push_back(static_cast<wchar_t>(value));
+        }
+        return result;
+    }
+};
+
+// Accumulates files (in any order) and produces the serialized form that package_file_locator::open consumes
+class package_file_locator_builder
+{
+public:
+    // 'relativePath' is relative to the package root and names a file, not a directory
+    void add(std::wstring_view relativePath)
+    {
+        auto nameStart = relativePath.find_last_of(L"\\/");
+        auto fileName = relativePath.substr((nameStart == std::wstring_view::npos) ? 0 : nameStart + 1);
+        auto depth = std::count_if(relativePath.begin(), relativePath.end(), [](wchar_t ch) { return (ch == L'\\') || (ch == L'/'); });
+        m_files.push_back({ package_file_locator::to_utf16(package_file_locator::fold(fileName)),
+            package_file_locator::to_utf16(relativePath), static_cast<std::size_t>(depth) });
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_files.size();
+    }
+
+    std::vector<std::uint8_t> serialize(std::wstring_view key) const
+    {
+        using index = package_file_locator;
+
+        auto keyData = index::to_utf16(key);
+
+        std::uint32_t bucketCount = 1;
+        while (bucketCount < m_files.size())
+        {
+            bucketCount *= 2;
+        }
+
+        // By bucket, then by file name, then shallowest first
+        std::vector<std::pair<std::uint32_t, const file*>> order;
+        order.reserve(m_files.size());
+        for (auto& item : m_files)
+        {
+            order.emplace_back(index::hash_name(item.name), &item);
+        }
+        std::sort(order.begin(), order.end(), [bucketCount](auto& lhs, auto& rhs)
+        {
+            return std::forward_as_tuple(lhs.first % bucketCount, lhs.second->name, lhs.second->depth, lhs.second->path) <
+                std::forward_as_tuple(rhs.first % bucketCount, rhs.second->name, rhs.second->depth, rhs.second->path);
+        });
+
+        std::vector<std::uint32_t> buckets(bucketCount + 1, 0);
+        std::vector<index::index_entry> entries;
+        std::vector<std::uint16_t> strings;
+        entries.reserve(order.size());
+        for (auto& [hash, item] : order)
+        {
+            ++buckets[hash % bucketCount + 1];
+
+            index::index_entry entry = {};
+            entry.hash = hash;
+            entry.name_offset = static_cast<std::uint32_t>(strings.size());
+            entry.name_length = static_cast<std::uint16_t>(item->name.length());
+            strings.insert(strings.end(), item->name.begin(), item->name.end());
+            entry.path_offset = static_cast<std::uint32_t>(strings.size());
+            entry.path_length = static_cast<std::uint16_t>(item->path.length());
+            strings.insert(strings.end(), item->path.begin(), item->path.end());
+            entries.push_back(entry);
+        }
+        for (std::uint32_t i = 0; i < bucketCount; ++i)
+        {
+            buckets[i + 1] += buckets[i];
+        }
+
+        index::index_header header = {};
+        header.magic = index::index_magic;
+        header.version = index::index_version;
+        header.entry_count = static_cast<std::uint32_t>(entries.size());
+        header.key_length = static_cast<std::uint32_t>(keyData.size());
+        header.bucket_count = bucketCount;
+        header.strings_length = static_cast<std::uint32_t>(strings.size());
+
+        auto bucketsOffset = index::align(sizeof(header) + keyData.size() * sizeof(std::uint16_t));
+        auto entriesOffset = index::align(bucketsOffset + buckets.size() * sizeof(std::uint32_t));
+        auto stringsOffset = entriesOffset + entries.size() * sizeof(index::index_entry);
+        header.total_size = stringsOffset + strings.size() * sizeof(std::uint16_t);
+
+        // An empty key, package or string table has no data() to copy from
+        std::vector<std::uint8_t> result(static_cast<std::size_t>(header.total_size));
+        auto copy = [&](std::uint64_t offset, const void* data, std::size_t size)
+        {
+            if (size != 0)
+            {
+                std::memcpy(result.data() + offset, data, size);
+            }
+        };
+        copy(0, &header, sizeof(header));
+        copy(sizeof(header), keyData.data(), keyData.size() * sizeof(std::uint16_t));
+        copy(bucketsOffset, buckets.data(), buckets.size() * sizeof(std::uint32_t));
+        copy(entriesOffset, entries.data(), entries.size() * sizeof(index::index_entry));
+        copy(stringsOffset, strings.data(), strings.size() * sizeof(std::uint16_t));
+        return result;
+    }
+
+private:
+    struct file
+    {
+        std::u16string name;
+        std::u16string path;
+        std::size_t depth;
+    };
+
+    std::vector<file> m_files;
+};
@@ -0,0 +1,96 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <vector>
+
+#include <psf_framework.h>
+#include <utilities.h>
+
+#include "FunctionImplementations.h"
+#include "dll_discovery.h"
+
+extern std::filesystem::path g_dynf_packageRootPath;
+
+// The machine type of the DLLs that this process can load
+constexpr std::uint16_t g_dynf_processMachine =
+#if defined(_M_ARM64)
+    dll_discovery::machine_arm64;
+#elif defined(_M_X64)
+    dll_discovery::machine_amd64;
+#else
+    dll_discovery::machine_i386;
+#endif
+
+// Only called for the DLLs that have the name a failed load asked for
+static std::uint16_t ReadDllMachine(const wchar_t* path)
+{
+    auto file = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return dll_discovery::machine_unknown;
+    }
+
+    std::uint8_t headers[4096];
+    DWORD read = 0;
+    auto success = ::ReadFile(file, headers, sizeof(headers), &read, nullptr);
+    ::CloseHandle(file);
+    return success ? dll_discovery::pe_machine(headers, read) : dll_discovery::machine_unknown;
+}
+
+// PSFFindPackageFiles returns full paths under the PsfRuntime's package root, which may carry a "\\?\" prefix that
+// g_dynf_packageRootPath does not. Returns an empty string for a path outside the package root
+static std::wstring RelativePackagePath(std::wstring_view path)
+{
+    if (path.compare(0, 4, LR"(\\?\)") == 0)
+    {
+        path.remove_prefix(4);
+    }
+
+    auto& root = g_dynf_packageRootPath.native();
+    if ((path.length() <= root.length() + 1) || (path[root.length()] != L'\\') ||
+        (_wcsnicmp(path.data(), root.c_str(), root.length()) != 0))
+    {
+        return {};
+    }
+    return std::wstring(path.substr(root.length() + 1));
+}
+
+// The package DLL to load for 'libFileName' after the loader failed to find it, if it is a module name without a path
+// and the package has a DLL of that name for this process. Returns an empty path otherwise
+std::filesystem::path FindDiscoveredDll(std::wstring_view libFileName)
+{
+    if (libFileName.empty() || (libFileName.find_first_of(L"\\/") != std::wstring_view::npos))
+    {
+        return {};
+    }
+
+    // The package file index is shared with the PsfRuntime, which builds it on the first lookup in any process of the
+    // package version and saves it for the rest
+    auto paths = ::PSFFindPackageFiles(dll_discovery::file_name(libFileName).c_str());
+    if (!paths)
+    {
+        return {};
+    }
+
+    std::vector<std::wstring> candidates;
+    for (; *paths; ++paths)
+    {
+        if (auto relativePath = RelativePackagePath(*paths); !relativePath.empty())
+        {
+            candidates.push_back(std::move(relativePath));
+        }
+    }
+
+    auto machineOf = [](const std::wstring& candidate)
+    {
+        return ReadDllMachine((g_dynf_packageRootPath / candidate).c_str());
+    };
+    auto relativePath = dll_discovery::select(std::move(candidates), g_dynf_processMachine, machineOf);
+    if (relativePath.empty())
+    {
+        return {};
+    }
+    return g_dynf_packageRootPath / relativePath;
+}
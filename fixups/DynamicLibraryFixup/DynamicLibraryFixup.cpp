@@ -7,10 +7,43 @@
 #include <psf_framework.h>
 #include "FunctionImplementations.h"
 #include "dll_location_spec.h"
+#include "dll_location_map.h"
 #include "psf_tracelogging.h"
 
 extern bool                  g_dynf_forcepackagedlluse;
-extern std::vector<dll_location_spec> g_dynf_dllSpecs;
+extern dll_location_map g_dynf_dllLocations;
+extern bool                  g_dynf_autodiscoverdlls;
+
+std::filesystem::path FindDiscoveredDll(std::wstring_view libFileName);
+
+// Flags that ask the loader to look only in specific places, or that load the file as data rather than as a module to run.
+// Searching the whole package when these are given would load something that the caller didn't ask for
+constexpr DWORD g_dynf_noDiscoveryFlags = LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_DATAFILE_EXCLUSIVE |
+    LOAD_LIBRARY_AS_IMAGE_RESOURCE | LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR | LOAD_LIBRARY_SEARCH_APPLICATION_DIR |
+    LOAD_LIBRARY_SEARCH_USER_DIRS | LOAD_LIBRARY_SEARCH_SYSTEM32 | LOAD_LIBRARY_SEARCH_DEFAULT_DIRS |
+    LOAD_LIBRARY_SEARCH_SYSTEM32_NO_FORWARDER;
+
+// The package is only searched once the loader has failed to find the module, so that whatever the loader would have
+// found (a module that's already loaded, the application directory, the search path, ...) still wins
+template <typename CharT, typename LoadFunc>
+HMODULE LoadDiscoveredDll(const CharT* libFileName, const char* caller, LoadFunc&& load)
+{
+    try
+    {
+        if (auto discoveredPath = FindDiscoveredDll(InterpretStringW(libFileName)); !discoveredPath.empty())
+        {
+            LogString(caller, discoveredPath.c_str());
+            return load(discoveredPath.c_str());
+        }
+    }
+    catch (...)
+    {
+        psf::TraceLogExceptions("DynamicLibraryFixupException", L"LoadDiscoveredDll ERROR");
+    }
+
+    ::SetLastError(ERROR_MOD_NOT_FOUND);
+    return nullptr;
+}
 
 
 auto LoadLibraryImpl = psf::detoured_string_function(&::LoadLibraryA, &::LoadLibraryW);
@@ -36,33 +69,28 @@ HMODULE __stdcall LoadLibraryFixup(_In_ const CharT* libFileName)
 #if _DEBUG
             Log("LoadLibraryFixup forcepackagedlluse.");
 #endif
-            for (dll_location_spec spec : g_dynf_dllSpecs)
+            try
             {
-#if _DEBUG
-                Log("LoadLibraryFixup test");
-#endif
-                try
-                {
-#if _DEBUG
-                    LogString("LoadLibraryFixup testing against", spec.filename.data());
-#endif
-                    if (spec.filename.compare(libFileNameW + L".dll") == 0 ||
-                        spec.filename.compare(libFileNameW) == 0)
-                    {
-                        LogString("LoadLibraryFixup using", spec.full_filepath.c_str());
-                        result = LoadLibraryImpl(spec.full_filepath.c_str());
-                        return result;
-                    }
-                }
-                catch (...)
+                if (auto fullpath = g_dynf_dllLocations.find(libFileNameW))
                 {
-                    psf::TraceLogExceptions("DynamicLibraryFixupException", L"LoadLibraryFixup: LoadLibraryFixup ERROR");
-                    Log("LoadLibraryFixup ERROR");
+                    LogString("LoadLibraryFixup using", fullpath->c_str());
+                    result = LoadLibraryImpl(fullpath->c_str());
+                    return result;
                 }
             }
+            catch (...)
+            {
+                psf::TraceLogExceptions("DynamicLibraryFixupException", L"LoadLibraryFixup: LoadLibraryFixup ERROR");
+                Log("LoadLibraryFixup ERROR");
+            }
         }
     }
     result = LoadLibraryImpl(libFileName);
+    if (!result && guard && g_dynf_forcepackagedlluse && g_dynf_autodiscoverdlls && (::GetLastError() == ERROR_MOD_NOT_FOUND))
+    {
+        result = LoadDiscoveredDll(libFileName, "LoadLibraryFixup using discovered",
+            [](const wchar_t* path) { return LoadLibraryImpl(path); });
+    }
     ///QueryPerformanceCounter(&TickEnd);
     return result;
 }
@@ -88,31 +116,29 @@ HMODULE __stdcall LoadLibraryExFixup(_In_ const CharT* libFileName, _Reserved_ H
         
         if (g_dynf_forcepackagedlluse)
         {
-            for (dll_location_spec spec : g_dynf_dllSpecs)
+            try
             {
-                try
+                if (auto fullpath = g_dynf_dllLocations.find(libFileNameW))
                 {
-#if _DEBUG
-                    //Log("LoadLibraryExFixup testing %ls against %ls", libFileNameW.c_str(), spec.full_filepath.native().c_str());
-                    LogString("LoadLibraryExFixup testing against", spec.filename.data());
-#endif
-                    if (spec.filename.compare(libFileNameW + L".dll") == 0 ||
-                        spec.filename.compare(libFileNameW) == 0)
-                    {
-                        LogString("LoadLibraryExFixup using", spec.full_filepath.c_str());
-                        result = LoadLibraryExImpl(spec.full_filepath.c_str(), file, flags);
-                        return result;
-                    }
-                }
-                catch (...)
-                {
-                    psf::TraceLogExceptions("DynamicLibraryFixupException", L"LoadLibraryExFixup: LoadLibraryExFixup ERROR");
-                    Log("LoadLibraryExFixup Error");
+                    LogString("LoadLibraryExFixup using", fullpath->c_str());
+                    result = LoadLibraryExImpl(fullpath->c_str(), file, flags);
+                    return result;
                 }
             }
+            catch (...)
+            {
+                psf::TraceLogExceptions("DynamicLibraryFixupException", L"LoadLibraryExFixup: LoadLibraryExFixup ERROR");
+                Log("LoadLibraryExFixup Error");
+            }
         }
     }
     result = LoadLibraryExImpl(libFileName, file, flags);
+    if (!result && guard && g_dynf_forcepackagedlluse && g_dynf_autodiscoverdlls && ((flags & g_dynf_noDiscoveryFlags) == 0) &&
+        (::GetLastError() == ERROR_MOD_NOT_FOUND))
+    {
+        result = LoadDiscoveredDll(libFileName, "LoadLibraryExFixup using discovered",
+            [&](const wchar_t* path) { return LoadLibraryExImpl(path, file, flags); });
+    }
     ///QueryPerformanceCounter(&TickEnd);
     return result;
 }
@@ -11,6 +11,7 @@
 
 #include <reentrancy_guard.h>
 #include <psf_framework.h>
+#include <psf_logging.h>
 
 // A much bigger hammer to avoid reentrancy. Still, the impl::* functions are good to have around to prevent the
 // unnecessary invocation of the fixup
@@ -39,6 +40,26 @@ inline std::wstring GetFilenameOnly(std::wstring path)
     return path.substr(index + 1);
 }
 
-void Log(const char* fmt, ...);
-void LogString(const char* name, const char* value);
-void LogString(const char* name, const wchar_t* value);
\ No newline at end of file
+// Log sites go through psf_logging.h. LogString is a macro, like Log, so that a disabled site is just the level check
+// and its arguments (often a converted copy of a path) are never evaluated
+inline void LogNameValue(const char* name, const char* value)
+{
+    psf::log_message("%s=%s\n", name, value);
+}
+
+inline void LogNameValue(const char* name, const wchar_t* value)
+{
+    psf::log_message("%s=%ls\n", name, value);
+}
+
+inline void LogNameValue(const wchar_t* name, const char* value)
+{
+    psf::log_message("%ls=%s\n", name, value);
+}
+
+inline void LogNameValue(const wchar_t* name, const wchar_t* value)
+{
+    psf::log_message(L"%ls=%ls\n", name, value);
+}
+
+#define LogString(...) PSF_LOG_CALL(::psf::log_level::verbose, LogNameValue, __VA_ARGS__)
@@ -18,6 +18,7 @@
 
 #include "FunctionImplementations.h"
 #include "dll_location_spec.h"
+#include "dll_location_map.h"
 #include "psf_tracelogging.h"
 
 using namespace std::literals;
@@ -25,93 +26,11 @@ using namespace std::literals;
 std::filesystem::path g_dynf_packageRootPath;
 std::filesystem::path g_dynf_packageVfsRootPath;
 bool                  g_dynf_forcepackagedlluse = false;
+bool                  g_dynf_autodiscoverdlls = false;
 
 
 std::vector<dll_location_spec> g_dynf_dllSpecs;
-
-void Log(const char* fmt, ...)
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-        std::string str;
-        str.resize(256);
-        std::size_t count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
-        assert(count >= 0);
-        va_end(args);
-
-        if (count > str.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            str.resize(count);
-
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vsnprintf(str.data(), str.size() + 1, fmt, args2);
-            assert(count >= 0);
-            va_end(args2);
-        }
-
-        str.resize(count);
-#if _DEBUG
-        ::OutputDebugStringA(str.c_str());
-#endif
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in Log()");
-        ::OutputDebugStringA(fmt);
-    }
-}
-void Log(const wchar_t* fmt, ...)
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-
-        std::wstring wstr;
-        wstr.resize(256);
-        std::size_t count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
-        va_end(args);
-
-        if (count > wstr.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            wstr.resize(count);
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args2);
-            va_end(args2);
-        }
-        wstr.resize(count);
-#if _DEBUG
-        ::OutputDebugStringW(wstr.c_str());
-#endif
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in wide Log()");
-        ::OutputDebugStringW(fmt);
-    }
-}
-void LogString(const char* name, const char* value)
-{
-    Log("%s=%s\n", name, value);
-}
-void LogString(const char* name, const wchar_t* value)
-{
-    Log("%s=%ls\n", name, value);
-}
-void LogString(const wchar_t* name, const char* value)
-{
-    Log("%ls=%s\n", name, value);
-}
-void LogString(const wchar_t* name, const wchar_t* value)
-{
-    Log(L"%ls=%ls\n", name, value);
-}
+dll_location_map g_dynf_dllLocations;
 
 void InitializeFixups()
 {
@@ -142,6 +61,17 @@ void InitializeConfiguration()
         auto& rootObject = rootConfig->as_object();
         traceDataStream << " config:\n";
 
+        if (auto logLevelValue = rootObject.try_get("logLevel"))
+        {
+            auto logLevel = logLevelValue->as_string().wstring();
+            psf::log_level level;
+            if (psf::parse_log_level(logLevel, level))
+            {
+                psf::set_log_level(level);
+            }
+            traceDataStream << " logLevel:" << logLevel << " ;";
+        }
+
         if (auto forceValue = rootObject.try_get("forcePackageDllUse"))  
         {
             if (forceValue)
@@ -178,10 +108,21 @@ void InitializeConfiguration()
                         count++;
                     };
                     Log("DynamicLibraryFixup: %d relative items read.", count);
+
+                    for (auto& dllSpec : g_dynf_dllSpecs)
+                    {
+                        g_dynf_dllLocations.insert(dllSpec.filename, dllSpec.full_filepath);
+                    }
                 }
             }
             else
                 Log("DynamicLibraryFixup ForcePacageDllUse=false");
+
+            if (auto autoDiscoverValue = rootObject.try_get("autoDiscoverDlls"))
+            {
+                g_dynf_autodiscoverdlls = autoDiscoverValue->as_boolean().get();
+                traceDataStream << " autoDiscoverDlls:" << (g_dynf_autodiscoverdlls ? L"true" : L"false") << " ;";
+            }
         }
 
         psf::TraceLogFixupConfig("DynamicLibraryFixup", traceDataStream.str().c_str());
@@ -0,0 +1,128 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Chooses the package DLL that LoadLibrary should use for a module name that was not listed in 'relativeDllPaths',
+// once the loader has failed to find it. The DLLs with that name come from PSFFindPackageFiles, whose index of the
+// package is shared with the PsfRuntime and saved across launches, so the fixup never walks the package itself. A
+// package can hold several DLLs with the same name, for example one in VFS\SystemX86 and another in VFS\SystemX64:
+// they are tried in order of preference, and the first one built for the process is used. The machine type comes from
+// a DLL's PE header, which is only read when a lookup reaches it.
+//
+// Everything here works on what the caller has found or read: the relative paths of the candidates, and the start of a
+// DLL for its PE header. Finding and reading the files is left to DllDiscovery.cpp.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+class dll_discovery
+{
+public:
+    // IMAGE_FILE_MACHINE_*
+    static constexpr std::uint16_t machine_unknown = 0;
+    static constexpr std::uint16_t machine_i386 = 0x014C;
+    static constexpr std::uint16_t machine_amd64 = 0x8664;
+    static constexpr std::uint16_t machine_arm64 = 0xAA64;
+
+    // The name of the file to look for when LoadLibrary is given the module name 'name': the name itself if it ends in
+    // ".dll", and otherwise the name with ".dll" appended
+    static std::wstring file_name(std::wstring_view name)
+    {
+        constexpr std::wstring_view extension = L".dll";
+        if ((name.length() > extension.length()) && std::equal(extension.begin(), extension.end(),
+            name.end() - extension.length(), [](wchar_t lhs, wchar_t rhs) { return lhs == fold_ascii(rhs); }))
+        {
+            return std::wstring(name);
+        }
+        return std::wstring(name) + std::wstring(extension);
+    }
+
+    // The path, out of 'relativePaths' (relative to the package root, all naming a DLL of the same name), of the
+    // preferred DLL that is built for 'machine'. A DLL whose machine type could not be read is used if there is no
+    // such DLL. Returns an empty string if there is neither. 'machineOf' is called with the relative path of each
+    // candidate, in order of preference, until one is built for 'machine', and returns its machine type (see
+    // pe_machine)
+    template <typename MachineFunc>
+    static std::wstring select(std::vector<std::wstring> relativePaths, std::uint16_t machine, MachineFunc&& machineOf)
+    {
+        std::sort(relativePaths.begin(), relativePaths.end(), [](const std::wstring& lhs, const std::wstring& rhs)
+        {
+            return std::forward_as_tuple(preference(lhs), lhs.length(), lhs) <
+                std::forward_as_tuple(preference(rhs), rhs.length(), rhs);
+        });
+
+        std::wstring fallback;
+        for (auto& relativePath : relativePaths)
+        {
+            auto candidateMachine = machineOf(relativePath);
+            if (candidateMachine == machine)
+            {
+                return std::move(relativePath);
+            }
+            else if ((candidateMachine == machine_unknown) && fallback.empty())
+            {
+                fallback = std::move(relativePath);
+            }
+        }
+
+        return fallback;
+    }
+
+    // DLLs that the application installed itself come first, then those in the VFS system folders, then the rest of
+    // the VFS. Within each, the shallower path is preferred
+    static std::uint16_t preference(std::wstring_view relativePath) noexcept
+    {
+        auto startsWith = [relativePath](std::wstring_view prefix)
+        {
+            if (relativePath.length() < prefix.length())
+            {
+                return false;
+            }
+            return std::equal(prefix.begin(), prefix.end(), relativePath.begin(), [](wchar_t lhs, wchar_t rhs)
+            {
+                return fold_ascii(lhs) == fold_ascii(rhs);
+            });
+        };
+
+        if (!startsWith(LR"(vfs\)"))
+        {
+            return 0;
+        }
+        return startsWith(LR"(vfs\system)") ? 1 : 2;
+    }
+
+    // The machine type from the PE header at the start of 'data', or machine_unknown if it isn't one
+    static std::uint16_t pe_machine(const void* data, std::size_t size) noexcept
+    {
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        if ((size < 0x40) || (bytes[0] != 'M') || (bytes[1] != 'Z'))
+        {
+            return machine_unknown;
+        }
+
+        std::uint32_t ntHeaderOffset;
+        std::memcpy(&ntHeaderOffset, bytes + 0x3C, sizeof(ntHeaderOffset));
+        if ((std::uint64_t(ntHeaderOffset) + 6 > size) || (std::memcmp(bytes + ntHeaderOffset, "PE\0\0", 4) != 0))
+        {
+            return machine_unknown;
+        }
+
+        std::uint16_t machine;
+        std::memcpy(&machine, bytes + ntHeaderOffset + 4, sizeof(machine));
+        return machine;
+    }
+
+private:
+    // Lower case in the ASCII range, with either separator as a backslash
+    static constexpr wchar_t fold_ascii(wchar_t ch) noexcept
+    {
+        return ((ch >= L'A') && (ch <= L'Z')) ? static_cast<wchar_t>(ch - L'A' + L'a') : (ch == L'/') ? L'\\' : ch;
+    }
+};
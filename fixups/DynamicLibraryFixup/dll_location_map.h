@@ -0,0 +1,65 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The package DLLs of g_dynf_dllSpecs, by module name, so that LoadLibrary finds the one that it is asked for with a
+// single lookup. Module names are compared as Windows compares file names, without regard to case, and "name" and
+// "name.dll" are the same module.
+//
+// The map is filled once the configuration has been read and is not changed afterwards, so it needs no lock. Names are
+// folded with file_name_case.h rather than towupper, whose result depends on the thread's locale.
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <file_name_case.h>
+
+class dll_location_map
+{
+public:
+    // When two DLLs have the same module name, the first one inserted is used
+    void insert(std::wstring_view filename, const std::filesystem::path& fullpath)
+    {
+        m_locations.emplace(normalize(filename), fullpath);
+    }
+
+    const std::filesystem::path* find(std::wstring_view libFileName) const
+    {
+        if (auto itr = m_locations.find(normalize(libFileName)); itr != m_locations.end())
+        {
+            return &itr->second;
+        }
+        return nullptr;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_locations.empty();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_locations.size();
+    }
+
+    // Upper case, without any ".dll" extension
+    static std::wstring normalize(std::wstring_view name)
+    {
+        auto result = psf::fold_file_name(name);
+
+        constexpr std::wstring_view extension = L".DLL";
+        if ((result.length() > extension.length()) &&
+            (std::wstring_view(result).substr(result.length() - extension.length()) == extension))
+        {
+            result.resize(result.length() - extension.length());
+        }
+        return result;
+    }
+
+private:
+    std::unordered_map<std::wstring, std::filesystem::path> m_locations;
+};
@@ -8,5 +8,5 @@
 struct dll_location_spec
 {
     std::filesystem::path full_filepath;
-    std::wstring_view filename;
+    std::wstring filename;
 };
\ No newline at end of file
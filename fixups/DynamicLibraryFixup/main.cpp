@@ -6,6 +6,7 @@
 
 #define PSF_DEFINE_EXPORTS
 #include <psf_framework.h>
+#include <psf_logging.h>
 #include "psf_tracelogging.h"
 
 TRACELOGGING_DEFINE_PROVIDER(
@@ -16,7 +17,6 @@ TRACELOGGING_DEFINE_PROVIDER(
 
 void InitializeFixups();
 void InitializeConfiguration();
-void Log(const char* fmt, ...);
 
 extern "C" {
 
@@ -40,7 +40,7 @@ extern "C" {
     {
         psf::TraceLogExceptions("DynamicLibraryFixupException", L"DynamicLibraryFixup attach ERROR");
         TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
-        Log("RuntDynamicLibraryFixup attach ERROR");
+        PSF_LOG_ERROR("DynamicLibraryFixup attach ERROR");
         ::SetLastError(win32_from_caught_exception());
         return FALSE;
     }
@@ -8,10 +8,13 @@
 #include <psf_framework.h>
 #include "FunctionImplementations.h"
 #include "EnvVar_spec.h"
+#include "EnvVarRules.h"
+#include "EnvVarValueCache.h"
 #include "psf_tracelogging.h"
 #include "pch.h"
 
 extern std::vector<env_var_spec> g_envvar_envVarSpecs;
+extern env_var_rules g_envvar_rules;
 
 using namespace winrt::Windows::Management::Deployment;
 using namespace winrt::Windows::ApplicationModel;
@@ -22,6 +25,194 @@ using namespace winrt::Windows::System::Profile;
 DWORD g_EnvVarInterceptInstance = 0;
 
 
+// Values read from the Environment keys for specs that set useregistry. The cache is only used while both keys are
+// watched for changes, which starts the first time that such a spec is used
+env_var_value_cache g_envvar_registryValues;
+std::atomic<bool> g_envvar_registryValuesWatched{ false };
+
+struct environment_key_watch
+{
+    HKEY hive;
+    const wchar_t* subKey;
+    HKEY key = nullptr;
+    HANDLE event = nullptr;
+    PTP_WAIT wait = nullptr;
+};
+
+// Asks for the next change to the values of the key to signal its event. Notifications are one shot, so this is done
+// again each time one arrives.
+bool ArmEnvironmentKeyWatch(environment_key_watch& watch)
+{
+    auto ret = RegNotifyChangeKeyValue(watch.key, FALSE,
+        REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, watch.event, TRUE);
+    if (ret != ERROR_SUCCESS)
+    {
+        Log("EnvVarFixup: RegNotifyChangeKeyValue failed 0x%x.", ret);
+        return false;
+    }
+    SetThreadpoolWait(watch.wait, watch.event, nullptr);
+    return true;
+}
+
+void CALLBACK EnvironmentKeyChanged(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT)
+{
+    // Re-arm before invalidating, so that a change made in between is not missed
+    if (!ArmEnvironmentKeyWatch(*static_cast<environment_key_watch*>(context)))
+    {
+        g_envvar_registryValuesWatched = false;
+    }
+    g_envvar_registryValues.invalidate();
+}
+
+// The watches live as long as the process, as the fixup does
+bool WatchEnvironmentKeys()
+{
+    static environment_key_watch watches[] =
+    {
+        { HKEY_CURRENT_USER, L"Environment" },
+        { HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment" },
+    };
+    for (auto& watch : watches)
+    {
+        if (RegOpenKeyExW(watch.hive, watch.subKey, 0, KEY_NOTIFY, &watch.key) != ERROR_SUCCESS)
+        {
+            Log("EnvVarFixup: Unable to watch %LS, registry values will not be cached.", watch.subKey);
+            return false;
+        }
+
+        watch.event = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        watch.wait = watch.event ? ::CreateThreadpoolWait(EnvironmentKeyChanged, &watch, nullptr) : nullptr;
+        if (!watch.wait || !ArmEnvironmentKeyWatch(watch))
+        {
+            Log("EnvVarFixup: Unable to watch %LS, registry values will not be cached.", watch.subKey);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename CharT>
+std::optional<std::basic_string<CharT>> GetEnvironmentKeyValue(HKEY hive, const CharT* lpName)
+{
+    const char* subKey = (hive == HKEY_CURRENT_USER) ? "Environment" : "SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment";
+    std::basic_string<CharT> value;
+    for (;;)
+    {
+        DWORD type;
+        DWORD size = static_cast<DWORD>(value.size() * sizeof(CharT));
+        LSTATUS ret;
+        if constexpr (psf::is_ansi<CharT>)
+        {
+            ret = RegGetValueA(hive, subKey, lpName, RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ, &type,
+                value.empty() ? nullptr : value.data(), &size);
+        }
+        else
+        {
+            ret = RegGetValueW(hive, widen(subKey).c_str(), lpName, RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ, &type,
+                value.empty() ? nullptr : value.data(), &size);
+        }
+
+        if ((ret == ERROR_SUCCESS) && !value.empty())
+        {
+            value.resize(std::char_traits<CharT>::length(value.c_str()));
+            return value;
+        }
+        else if ((ret != ERROR_SUCCESS) && (ret != ERROR_MORE_DATA))
+        {
+            return std::nullopt;
+        }
+        value.resize(std::max<std::size_t>(size / sizeof(CharT) + 1, value.size() * 2));
+    }
+}
+
+// The values of the variable in HKCU and HKLM, from the cache if they were read before and have not changed since
+template <typename CharT>
+std::shared_ptr<const env_var_registry_value<CharT>> GetRegistryEnvironmentValue(const std::wstring& name, const CharT* lpName)
+{
+    static std::once_flag watchOnce;
+    std::call_once(watchOnce, [] { g_envvar_registryValuesWatched = WatchEnvironmentKeys(); });
+
+    bool cached = g_envvar_registryValuesWatched;
+    if (cached)
+    {
+        if (auto values = g_envvar_registryValues.find<CharT>(name))
+        {
+            return values;
+        }
+    }
+
+    auto generation = g_envvar_registryValues.generation();
+    auto values = std::make_shared<env_var_registry_value<CharT>>();
+    values->user = GetEnvironmentKeyValue(HKEY_CURRENT_USER, lpName);
+    values->machine = GetEnvironmentKeyValue(HKEY_LOCAL_MACHINE, lpName);
+    if (cached)
+    {
+        g_envvar_registryValues.store<CharT>(name, generation, values);
+    }
+    return values;
+}
+
+// Finds the dependency of a Env_Remediation_Type_Dependency spec and replaces the meta-variables in its value
+Env_Dependency_States ResolveDependencyValue(const env_var_spec& spec, std::wstring& value)
+{
+    if (!ApiInformation::IsPropertyPresent(L"Windows.ApplicationModel.Package", L"EffectivePath"))
+    {
+        std::wstringstream msgStream;
+        msgStream << "Redirect fixup type is not supported on " << AnalyticsInfo::VersionInfo().DeviceFamilyVersion().c_str() << " version of windows";
+        psf::TraceLogExceptions("EnvVarFixup", msgStream.str().c_str());
+        return Env_Dependency_State_Unsupported;
+    }
+
+    Package pkg = Package::Current();
+    IVectorView<Package> dependencies = pkg.Dependencies();
+
+    Package depedency = nullptr;
+    Log("Filtering required dependency\n");
+    for (auto&& dep : dependencies) {
+        std::wstring_view name = dep.Id().Name();
+        Log("Checking package dependency %.*LS\n", name.length(), name.data());
+
+        if (name.find(spec.dependency) != std::wstring::npos) {
+            Log("Found required dependency\n");
+            depedency = dep;
+            break;
+        }
+    }
+    if (!depedency)
+    {
+        Log("No package with name %LS found\n", spec.dependency.c_str());
+        psf::TraceLogExceptions("EnvVarFixup", "No configured dependency found");
+        return Env_Dependency_State_NotFound;
+    }
+
+    std::wstring dependency_path(depedency.EffectivePath());
+    auto version = depedency.Id().Version();
+    std::wstring dependency_version = std::to_wstring(version.Major) + L"." + std::to_wstring(version.Minor) + L"." + std::to_wstring(version.Build) + L"." + std::to_wstring(version.Revision);
+    Log("Dependency path: %LS, version: %LS\n", dependency_path.c_str(), dependency_version.c_str());
+
+    std::wregex dependency_version_regex = std::wregex(L"%dependency_version%");
+    std::wregex dependency_path_regex(L"%dependency_root_path%");
+
+    value = std::regex_replace(std::wstring(spec.variablevalue), dependency_path_regex, dependency_path);
+    value = std::regex_replace(value, dependency_version_regex, dependency_version);
+    return Env_Dependency_State_Resolved;
+}
+
+template <typename CharT>
+DWORD CopyEnvironmentValue(const std::basic_string<CharT>& value, CharT* lpValue, DWORD lenBuf)
+{
+    if (lenBuf > value.size())
+    {
+        std::memcpy(lpValue, value.c_str(), (value.size() + 1) * sizeof(CharT));
+        return static_cast<DWORD>(value.size());
+    }
+    else
+    {
+        SetLastError(ERROR_BUFFER_OVERFLOW);
+        return static_cast<DWORD>(value.size() + 1 /* To include NULL terminator */);
+    }
+}
+
 //ExpandEnvironmentStrings
 //  [DllImport("kernel32.dll", SetLastError = true, CharSet = CharSet.Auto)]
 //  public static extern int ExpandEnvironmentStrings([MarshalAs(UnmanagedType.LPTStr)] String source, [Out] StringBuilder destination, int size);
@@ -54,250 +245,135 @@ DWORD __stdcall GetEnvironmentVariableFixup(_In_ const CharC* lpName, _Inout_ Ch
             eName =lpName;
         }
 
-        for (env_var_spec spec : g_envvar_envVarSpecs)
+        auto matches = g_envvar_rules.find(eName);
+        for (auto index : *matches)
         {
+            const env_var_spec& spec = g_envvar_envVarSpecs[index];
             try
             {
-                if (std::regex_match(eName, spec.variablename))
+                size_t valuelen = spec.variablevalue.length();
+                if (spec.remediationType == Env_Remediation_Type_Registry)
                 {
-                    size_t valuelen = spec.variablevalue.length();
-                    if (spec.remediationType == Env_Remediation_Type_Registry)
+                    if (spec.useregistry == true)
                     {
-                        if (spec.useregistry == true)
+                        Log("[%d] GetEnvironmentVariableFixup: Registry supplied case.", GetEnvVarInstance);
+                        // Check app registry for an answer instead of the Json. Note: this allows value to be modified possibly also.
+                        auto values = GetRegistryEnvironmentValue<CharT>(eName, lpName);
+                        for (auto [hive, value] : { std::pair{ "HKCU", &values->user }, std::pair{ "HKLM", &values->machine } })
                         {
-                            Log("[%d] GetEnvironmentVariableFixup: Registry supplied case.", GetEnvVarInstance);
-                            // Check app registry for an answer instead of the Json. Note: this allows value to be modified possibly also.
-                            HKEY hKeyCU;
-                            if constexpr (psf::is_ansi<CharT>)
-                            {
-                                if (RegOpenKeyExA(HKEY_CURRENT_USER, "Environment",
-                                    0, KEY_ENUMERATE_SUB_KEYS | KEY_READ | KEY_QUERY_VALUE, &hKeyCU) == ERROR_SUCCESS)
-                                {
-                                    Log("[%d] GetEnvironmentVariableFixup:(A) HKCU key found.", GetEnvVarInstance);
-                                    DWORD type = RRF_RT_REG_SZ;
-                                    DWORD dLen = (DWORD)lenBuf;
-                                    auto ret = RegGetValueA(HKEY_CURRENT_USER, "Environment", lpName,
-                                        RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ | RRF_ZEROONFAILURE, &type, lpValue, &dLen);
-                                    if (ret == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(A) HKCU value found %s", GetEnvVarInstance, lpValue);
-                                        result = dLen;
-                                        RegCloseKey(hKeyCU);
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(A) HKCU value Failed 0x%x.", GetEnvVarInstance, ret);
-                                    }
-                                    RegCloseKey(hKeyCU);
-                                }
-                            }
-                            else
+                            if (!value->has_value())
                             {
-                                if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Environment",
-                                    0, KEY_ENUMERATE_SUB_KEYS | KEY_READ | KEY_QUERY_VALUE, &hKeyCU) == ERROR_SUCCESS)
-                                {
-                                    Log("[%d] GetEnvironmentVariableFixup:(W) HKCU key found.", GetEnvVarInstance);
-                                    LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(W) Looking for ", lpName);
-                                    DWORD type = RRF_RT_REG_SZ;
-                                    DWORD dLen = lenBuf;
-                                    auto ret = RegGetValueW(HKEY_CURRENT_USER, L"Environment", lpName,
-                                        RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ | RRF_ZEROONFAILURE, &type, lpValue, &dLen);
-                                    if (ret == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(W) HKCU value found %ls", GetEnvVarInstance, lpValue);
-                                        result = dLen;
-                                        RegCloseKey(hKeyCU);
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(W) HKCU value Failed 0x%x.", GetEnvVarInstance, ret);
-                                    }
-                                    RegCloseKey(hKeyCU);
-                                }
+                                Log("[%d] GetEnvironmentVariableFixup: %s value not found.", GetEnvVarInstance, hive);
+                                continue;
                             }
-                            result = 0;
 
-                            HKEY hKeyLM;
-                            if constexpr (psf::is_ansi<CharT>)
+                            // As RegGetValue reported it, given lenBuf as the size of the buffer in bytes
+                            DWORD size = static_cast<DWORD>(((*value)->length() + 1) * sizeof(CharT));
+                            if (size <= lenBuf)
                             {
-                                if (RegOpenKeyExA(HKEY_LOCAL_MACHINE, "SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment",
-                                    0, KEY_ENUMERATE_SUB_KEYS | KEY_READ | KEY_QUERY_VALUE, &hKeyLM) == ERROR_SUCCESS)
-                                {
-                                    Log("[%d] GetEnvironmentVariableFixup:(A) HKLM key found.", GetEnvVarInstance);
-
-                                    LONG dLen0 = (LONG)lenBuf;
-                                    auto ret00 = RegQueryValueA(hKeyLM, lpName, lpValue, &dLen0);
-                                    if (ret00 == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(A) HKLM value queried! %s", GetEnvVarInstance, lpValue);
-                                        result = (DWORD)dLen0;
-                                        RegCloseKey(hKeyLM);
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(W) HKCU value Failed 0x%x.", GetEnvVarInstance, ret00);
-                                    }
-
-                                    RegCloseKey(hKeyLM);
-                                }
+                                std::memcpy(lpValue, (*value)->c_str(), size);
+                                Log("[%d] GetEnvironmentVariableFixup: %s value found.", GetEnvVarInstance, hive);
+                                LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup: value is ", lpValue);
+                                return size;
                             }
-                            else
-                            {
-                                if (RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment",
-                                    0, KEY_ENUMERATE_SUB_KEYS | STANDARD_RIGHTS_READ | KEY_QUERY_VALUE, &hKeyLM) == ERROR_SUCCESS)
-                                {
-                                    Log("[%d] GetEnvironmentVariableFixup:(W) HKLM key found.", GetEnvVarInstance);
-                                    DWORD type = RRF_RT_REG_SZ;
-                                    DWORD dLen = lenBuf;
-                                    auto ret = RegGetValueW(HKEY_LOCAL_MACHINE, L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Environment", lpName,
-                                        RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ | RRF_ZEROONFAILURE, &type, lpValue, &dLen);
-                                    if (ret == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(W) HKLM value found %ls", GetEnvVarInstance, lpValue);
-                                        result = dLen;
-                                        RegCloseKey(hKeyLM);
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] GetEnvironmentVariableFixup:(W) HKLM value Failed 0x%x.", GetEnvVarInstance, ret);
-                                    }
-                                    RegCloseKey(hKeyLM);
-                                }
-                            }
-                            // allow to fall through to system
-                            //return result;
-                            result = 0;
+                            Log("[%d] GetEnvironmentVariableFixup: %s value does not fit, 0x%x bytes.", GetEnvVarInstance, hive, size);
                         }
+                        // allow to fall through to system
+                        //return result;
+                        result = 0;
+                    }
 
-                        // Sometimes HKLM\System reg items from the package are not visible to the app.  We think this is a bug, so
-                        // allow a check to see if there is a value field in the JSON and use that.
-                        // Of course, we should always look at the json if useregistry was set to false anyway.
-                        Log("[%d] GetEnvironmentVariableFixup: Json supplied case.", GetEnvVarInstance);
+                    // Sometimes HKLM\System reg items from the package are not visible to the app.  We think this is a bug, so
+                    // allow a check to see if there is a value field in the JSON and use that.
+                    // Of course, we should always look at the json if useregistry was set to false anyway.
+                    Log("[%d] GetEnvironmentVariableFixup: Json supplied case.", GetEnvVarInstance);
 
-                        if (valuelen < lenBuf)
+                    if (valuelen < lenBuf)
+                    {
+                        Log("[%d] GetEnvironmentVariableFixup: Match to be returned.", GetEnvVarInstance);
+                        // copy into lpValue, but might need form conversion
+                        if constexpr (psf::is_ansi<CharT>)
                         {
-                            Log("[%d] GetEnvironmentVariableFixup: Match to be returned.", GetEnvVarInstance);
-                            // copy into lpValue, but might need form conversion
-                            if constexpr (psf::is_ansi<CharT>)
-                            {
-                                std::string sval = narrow(spec.variablevalue);
-                                LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(A) HKCU value is ", sval.c_str());
-                                ZeroMemory(lpValue, lenBuf);
-                                sval.copy(lpValue, lenBuf, 0);
-                                //strcpy_s(lpValue, lenBuf, sval.c_str());
-                                LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(A) HKCU value copied is ", lpValue);
-                                result = (DWORD)sval.length();
-                            }
-                            else
-                            {
-                                LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(W) HKCU value is ", spec.variablevalue.data());
-                                ZeroMemory(lpValue, lenBuf);
-                                spec.variablevalue.copy(lpValue, lenBuf, 0);
-                                LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(W) HKCU value copied is ", lpValue);
-                                result = (DWORD)valuelen;
-                            }
-                            Log("GetEnvironmentVariableFixup: Value saved.");
-                            SetLastError(ERROR_SUCCESS);
-                            return(result);
+                            std::string sval = narrow(spec.variablevalue);
+                            LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(A) HKCU value is ", sval.c_str());
+                            ZeroMemory(lpValue, lenBuf);
+                            sval.copy(lpValue, lenBuf, 0);
+                            //strcpy_s(lpValue, lenBuf, sval.c_str());
+                            LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(A) HKCU value copied is ", lpValue);
+                            result = (DWORD)sval.length();
                         }
                         else
                         {
-                            Log("GetEnvironmentVariableFixup: Match returns bufferoverflow.");
-                            // return buffer overflow
-                            result = ERROR_BUFFER_OVERFLOW;
-                            SetLastError(ERROR_BUFFER_OVERFLOW);
-                            return(result);
+                            LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(W) HKCU value is ", spec.variablevalue.data());
+                            ZeroMemory(lpValue, lenBuf);
+                            spec.variablevalue.copy(lpValue, lenBuf, 0);
+                            LogString(GetEnvVarInstance, "GetEnvironmentVariableFixup:(W) HKCU value copied is ", lpValue);
+                            result = (DWORD)valuelen;
                         }
-
+                        Log("GetEnvironmentVariableFixup: Value saved.");
+                        SetLastError(ERROR_SUCCESS);
+                        return(result);
                     }
-                    else if (spec.remediationType == Env_Remediation_Type_Dependency)
+                    else
                     {
-                        if (!ApiInformation::IsPropertyPresent(L"Windows.ApplicationModel.Package", L"EffectivePath"))
-                        {
-                            std::wstringstream msgStream;
-                            msgStream << "Redirect fixup type is not supported on " << AnalyticsInfo::VersionInfo().DeviceFamilyVersion().c_str() << " version of windows";
-                            psf::TraceLogExceptions("EnvVarFixup", msgStream.str().c_str());
-                            return 0;
-                        }
-
-                        Package pkg = Package::Current();
-                        IVectorView<Package> dependencies = pkg.Dependencies();
-
-                        Package depedency = nullptr;
-                        Log("Filtering required dependency\n");
-                        for (auto&& dep : dependencies) {
-                            std::wstring_view name = dep.Id().Name();
-                            Log("Checking package dependency %.*LS\n", name.length(), name.data());
-
-                            if (name.find(spec.dependency) != std::wstring::npos) {
-                                Log("Found required dependency\n");
-                                depedency = dep;
-                                break;
-                            }
-                        }
-                        if (!depedency)
-                        {
-                            Log("No package with name %LS found\n", spec.dependency.c_str());
-                            psf::TraceLogExceptions("EnvVarFixup", "No configured dependency found");
-                            continue;
-                        }
-
-                        std::wstring dependency_path(depedency.EffectivePath());
-                        auto version = depedency.Id().Version();
-                        std::wstring dependency_version = std::to_wstring(version.Major) + L"." + std::to_wstring(version.Minor) + L"." + std::to_wstring(version.Build) + L"." + std::to_wstring(version.Revision);
-                        Log("Dependency path: %LS, version: %LS\n", dependency_path.c_str(), dependency_version.c_str());
-
-                        std::wregex dependency_version_regex = std::wregex(L"%dependency_version%");
-                        std::wregex dependency_path_regex(L"%dependency_root_path%");
-
-                        std::wstring value_data = std::regex_replace(std::wstring(spec.variablevalue), dependency_path_regex, dependency_path);
-                        value_data = std::regex_replace(value_data, dependency_version_regex, dependency_version);
+                        Log("GetEnvironmentVariableFixup: Match returns bufferoverflow.");
+                        // return buffer overflow
+                        result = ERROR_BUFFER_OVERFLOW;
+                        SetLastError(ERROR_BUFFER_OVERFLOW);
+                        return(result);
+                    }
 
+                }
+                else if (spec.remediationType == Env_Remediation_Type_Dependency)
+                {
+                    if (spec.dependencystate == Env_Dependency_State_Resolved)
+                    {
                         if constexpr (psf::is_ansi<CharT>)
                         {
-                            std::string value_data_ansi = narrow(value_data);
-
-                            if (lenBuf > value_data_ansi.size())
-                            {
-                                ZeroMemory(lpValue, lenBuf);
-                                value_data_ansi.copy(lpValue, lenBuf);
-                                return static_cast<DWORD>(value_data_ansi.size());
-                            }
-                            else
-                            {
-                                SetLastError(ERROR_BUFFER_OVERFLOW);
-                                return static_cast<DWORD>(value_data_ansi.size() + 1 /* To include NULL terminator */);
-                            }
+                            return CopyEnvironmentValue(spec.dependencyvalueansi, lpValue, lenBuf);
                         }
                         else
                         {
-                            if (lenBuf > value_data.size())
-                            {
-                                ZeroMemory(lpValue, lenBuf * sizeof(wchar_t));
-                                value_data.copy(lpValue, lenBuf);
-                                return static_cast<DWORD>(value_data.size());
-                            }
-                            else
-                            {
-                                SetLastError(ERROR_BUFFER_OVERFLOW);
-                                return static_cast<DWORD>(value_data.size() + 1 /* To include NULL terminator */);
-                            }
+                            return CopyEnvironmentValue(spec.dependencyvalue, lpValue, lenBuf);
                         }
                     }
+
+                    // Not resolved when the configuration was read, so try again
+                    std::wstring value_data;
+                    auto state = spec.dependencystate;
+                    if (state == Env_Dependency_State_Unresolved)
+                    {
+                        state = ResolveDependencyValue(spec, value_data);
+                    }
+
+                    if (state == Env_Dependency_State_Unsupported)
+                    {
+                        return 0;
+                    }
+                    else if (state == Env_Dependency_State_NotFound)
+                    {
+                        Log("No package with name %LS found\n", spec.dependency.c_str());
+                        continue;
+                    }
+
+                    if constexpr (psf::is_ansi<CharT>)
+                    {
+                        return CopyEnvironmentValue(narrow(value_data), lpValue, lenBuf);
+                    }
                     else
                     {
-                        Log("[%d] Unknown EnvVarFixup.\n", GetEnvVarInstance);
+                        return CopyEnvironmentValue(value_data, lpValue, lenBuf);
                     }
                 }
+                else
+                {
+                    Log("[%d] Unknown EnvVarFixup.\n", GetEnvVarInstance);
+                }
             }
             catch (...)
             {
-                psf::TraceLogExceptions("EnvVarFixupException", "GetEnvironmentVariableFixup: Bad Regex pattern ignored in EnvVarFixup");
-                Log("[%d] Bad Regex pattern ignored in EnvVarFixup.\n", GetEnvVarInstance);
+                psf::TraceLogExceptions("EnvVarFixupException", "GetEnvironmentVariableFixup: Exception while applying spec ignored in EnvVarFixup");
+                Log("[%d] Exception while applying spec ignored in EnvVarFixup.\n", GetEnvVarInstance);
             }
         }
 
@@ -336,76 +412,77 @@ BOOL __stdcall SetEnvironmentVariableFixup(_In_ const CharT* lpName, _In_ const
         {
             eName = lpName;
         }
-        for (env_var_spec spec : g_envvar_envVarSpecs)
+        auto matches = g_envvar_rules.find(eName);
+        for (auto index : *matches)
         {
+            const env_var_spec& spec = g_envvar_envVarSpecs[index];
             try
             {
-                if (std::regex_match(eName, spec.variablename))
+                if (spec.remediationType == Env_Remediation_Type_Registry)
                 {
-                    if (spec.remediationType == Env_Remediation_Type_Registry)
+                    if (spec.useregistry == true)
                     {
-                        if (spec.useregistry == true)
-                        {
-                            Log("[%d] GetEnvironmentVariableFixup: registry case.", SetEnvVarInstance);
+                        Log("[%d] GetEnvironmentVariableFixup: registry case.", SetEnvVarInstance);
 
-                            HKEY hKeyCU;
-                            if constexpr (psf::is_ansi<CharT>)
+                        HKEY hKeyCU;
+                        if constexpr (psf::is_ansi<CharT>)
+                        {
+                            if (RegOpenKeyExA(HKEY_CURRENT_USER, "Environment", 0, MAXIMUM_ALLOWED, &hKeyCU) == ERROR_SUCCESS)
                             {
-                                if (RegOpenKeyExA(HKEY_CURRENT_USER, "Environment", 0, MAXIMUM_ALLOWED, &hKeyCU) == ERROR_SUCCESS)
+                                DWORD dLen = (DWORD)((strlen(lpValue) + 1) * sizeof(CharT));
+                                auto ret = RegSetValueExA(hKeyCU, lpName, NULL, REG_SZ, (BYTE*)lpValue, dLen);
+                                if (ret == ERROR_SUCCESS)
                                 {
-                                    DWORD dLen = (DWORD)((strlen(lpValue) + 1) * sizeof(CharT));
-                                    auto ret = RegSetValueExA(hKeyCU, lpName, NULL, REG_SZ, (BYTE*)lpValue, dLen);
-                                    if (ret == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] SetEnvironmentVariableFixup: success. %s=%s", SetEnvVarInstance, lpName, lpValue);
-                                        result = 1;
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] SetEnvironmentVariableFixup: Failure 0x%x.", SetEnvVarInstance, GetLastError());
-                                        result = 0;
-                                        return result;
-                                    }
+                                    g_envvar_registryValues.invalidate();
+                                    Log("[%d] SetEnvironmentVariableFixup: success. %s=%s", SetEnvVarInstance, lpName, lpValue);
+                                    result = 1;
+                                    return result;
                                 }
-                            }
-                            else
-                            {
-                                if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Environment", 0, MAXIMUM_ALLOWED, &hKeyCU) == ERROR_SUCCESS)
+                                else
                                 {
-                                    DWORD dLen = (DWORD)((wcslen(lpValue) + 1) * sizeof(CharT));
-                                    auto ret = RegSetValueExW(hKeyCU, lpName, NULL, REG_SZ, (BYTE*)lpValue, dLen);
-                                    if (ret == ERROR_SUCCESS)
-                                    {
-                                        Log("[%d] SetEnvironmentVariableFixup: success. %ls=%ls", SetEnvVarInstance, lpName, lpValue);
-                                        result = 1;
-                                        return result;
-                                    }
-                                    else
-                                    {
-                                        Log("[%d] SetEnvironmentVariableFixup: Failure 0x%x.", SetEnvVarInstance, GetLastError());
-                                        result = 0;
-                                        return result;
-                                    }
+                                    Log("[%d] SetEnvironmentVariableFixup: Failure 0x%x.", SetEnvVarInstance, GetLastError());
+                                    result = 0;
+                                    return result;
                                 }
                             }
                         }
                         else
                         {
-                            Log("[%d] GetEnvironmentVariableFixup: JSON case - return ACCESS_DENIED.", SetEnvVarInstance);
-                            // Unable to overwrite json, return ACCESS_DENIED
-                            SetLastError(ERROR_ACCESS_DENIED);
-                            result = 0;
-                            return result;
+                            if (RegOpenKeyExW(HKEY_CURRENT_USER, L"Environment", 0, MAXIMUM_ALLOWED, &hKeyCU) == ERROR_SUCCESS)
+                            {
+                                DWORD dLen = (DWORD)((wcslen(lpValue) + 1) * sizeof(CharT));
+                                auto ret = RegSetValueExW(hKeyCU, lpName, NULL, REG_SZ, (BYTE*)lpValue, dLen);
+                                if (ret == ERROR_SUCCESS)
+                                {
+                                    g_envvar_registryValues.invalidate();
+                                    Log("[%d] SetEnvironmentVariableFixup: success. %ls=%ls", SetEnvVarInstance, lpName, lpValue);
+                                    result = 1;
+                                    return result;
+                                }
+                                else
+                                {
+                                    Log("[%d] SetEnvironmentVariableFixup: Failure 0x%x.", SetEnvVarInstance, GetLastError());
+                                    result = 0;
+                                    return result;
+                                }
+                            }
                         }
                     }
+                    else
+                    {
+                        Log("[%d] GetEnvironmentVariableFixup: JSON case - return ACCESS_DENIED.", SetEnvVarInstance);
+                        // Unable to overwrite json, return ACCESS_DENIED
+                        SetLastError(ERROR_ACCESS_DENIED);
+                        result = 0;
+                        return result;
+                    }
                 }
             }
             catch (...)
             {
-                psf::TraceLogExceptions("EnvVarFixupException", "SetEnvironmentVariableFixup: Bad Regex pattern ignored in EnvVarFixup");
+                psf::TraceLogExceptions("EnvVarFixupException", "SetEnvironmentVariableFixup: Exception while applying spec ignored in EnvVarFixup");
 #ifdef _DEBUG
-                Log("[%d] Bad Regex pattern ignored in EnvVarFixup.\n", SetEnvVarInstance);
+                Log("[%d] Exception while applying spec ignored in EnvVarFixup.\n", SetEnvVarInstance);
 #endif
             }
         }
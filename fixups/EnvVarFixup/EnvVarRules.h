@@ -0,0 +1,162 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The names of g_envvar_envVarSpecs, compiled once the configuration has been read, so that finding the specs for an
+// environment variable does not walk (and copy) every spec. Names without any regex syntax are kept in a hash table by
+// their upper case form, since environment variable names are case insensitive; the rest are regex patterns, matched as
+// before. The specs that match a name are remembered by name, so a variable that the app asks for again costs a single
+// hash lookup, whether or not any spec matches it.
+//
+// NOTE: compile() takes no lock, so it must be done before the first find(), and no spec may be added afterwards: a
+// vector that grows moves the regexes that the rules point at. Literal names are folded with std::towupper, which folds
+// no more than the current C locale does (only ASCII letters in the default "C" locale), so a name that differs from a
+// literal spec in the case of any other letter does not match it
+#pragma once
+
+#include <algorithm>
+#include <cwctype>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "EnvVar_spec.h"
+
+class env_var_rules
+{
+public:
+    // Indexes into the specs, in the order in which they were configured
+    using matches = std::vector<std::size_t>;
+
+    explicit env_var_rules(std::size_t capacity = 1024) :
+        m_capacity(capacity)
+    {
+    }
+
+    // NOTE: The specs must outlive the rules, which refer to their patterns
+    void compile(const std::vector<env_var_spec>& specs)
+    {
+        std::unordered_map<std::wstring, matches> literals;
+        for (std::size_t index = 0; index < specs.size(); ++index)
+        {
+            auto& spec = specs[index];
+            if (is_literal(spec.variablenamepattern))
+            {
+                literals[fold(spec.variablenamepattern)].push_back(index);
+            }
+            else
+            {
+                m_patterns.push_back({ index, &spec.variablename });
+            }
+        }
+
+        for (auto& [name, indexes] : literals)
+        {
+            m_literals.emplace(name, std::make_shared<const matches>(std::move(indexes)));
+        }
+    }
+
+    // The specs whose names match 'name'
+    std::shared_ptr<const matches> find(const std::wstring& name)
+    {
+        if (m_patterns.empty())
+        {
+            return find_literal(name);
+        }
+
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            if (auto itr = m_remembered.find(name); itr != m_remembered.end())
+            {
+                return itr->second;
+            }
+        }
+
+        auto result = evaluate(name);
+
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        if (m_remembered.size() >= m_capacity)
+        {
+            m_remembered.clear();
+        }
+        m_remembered.emplace(name, result);
+        return result;
+    }
+
+    // Names that only hold characters without meaning in a regex match themselves and nothing else
+    static bool is_literal(std::wstring_view pattern) noexcept
+    {
+        return !pattern.empty() && (pattern.find_first_of(LR"(\^$.|?*+()[]{})") == std::wstring_view::npos);
+    }
+
+    static std::wstring fold(std::wstring_view name)
+    {
+        std::wstring result(name);
+        for (auto& ch : result)
+        {
+            ch = static_cast<wchar_t>(std::towupper(ch));
+        }
+        return result;
+    }
+
+private:
+    std::shared_ptr<const matches> find_literal(const std::wstring& name) const
+    {
+        if (auto itr = m_literals.find(fold(name)); itr != m_literals.end())
+        {
+            return itr->second;
+        }
+        return m_none;
+    }
+
+    std::shared_ptr<const matches> evaluate(const std::wstring& name) const
+    {
+        matches patternMatches;
+        for (auto& [index, regex] : m_patterns)
+        {
+            try
+            {
+                if (std::regex_match(name, *regex))
+                {
+                    patternMatches.push_back(index);
+                }
+            }
+            catch (...)
+            {
+                // E.g. std::regex_constants::error_complexity; the pattern is treated as not matching
+            }
+        }
+
+        auto literalMatches = find_literal(name);
+        if (patternMatches.empty())
+        {
+            return literalMatches;
+        }
+
+        auto result = std::make_shared<matches>();
+        std::merge(literalMatches->begin(), literalMatches->end(), patternMatches.begin(), patternMatches.end(),
+            std::back_inserter(*result));
+        return result;
+    }
+
+    struct pattern
+    {
+        std::size_t index;
+        const std::wregex* regex;
+    };
+
+    std::unordered_map<std::wstring, std::shared_ptr<const matches>> m_literals;
+    std::vector<pattern> m_patterns;
+    const std::shared_ptr<const matches> m_none = std::make_shared<const matches>();
+
+    const std::size_t m_capacity;
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::wstring, std::shared_ptr<const matches>> m_remembered;
+};
@@ -0,0 +1,107 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The values that GetEnvironmentVariableFixup reads from the Environment keys of HKCU and HKLM for specs that set
+// 'useregistry', remembered by variable name so that a variable read again is copied from memory instead of opening
+// and reading the keys. The ANSI and wide functions read the registry through different APIs, so they are remembered
+// separately.
+//
+// Every value is stamped with the generation of the cache that was current before it was read. invalidate() starts a
+// new generation, and values from an earlier one are read again, so a change that invalidates the cache while a value
+// is being read cannot leave the old value behind.
+//
+// NOTE: The cache never looks at the registry itself, so a value is only as fresh as the calls to invalidate().
+// EnvVarFixup.cpp makes one for every change notification on either Environment key and for every value that it writes,
+// and stops using the cache once a watch can't be re-armed. Entries are never evicted; there is one per variable name
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+#include "EnvVarRules.h"
+
+template <typename CharT>
+struct env_var_registry_value
+{
+    // Unset when the key or the value does not exist
+    std::optional<std::basic_string<CharT>> user;
+    std::optional<std::basic_string<CharT>> machine;
+};
+
+class env_var_value_cache
+{
+public:
+    std::uint64_t generation() const noexcept
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    void invalidate() noexcept
+    {
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    template <typename CharT>
+    std::shared_ptr<const env_var_registry_value<CharT>> find(const std::wstring& name)
+    {
+        auto& entries = this->entries<CharT>();
+        auto currentGeneration = generation();
+
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        if (auto itr = entries.find(env_var_rules::fold(name)); (itr != entries.end()) && (itr->second.generation == currentGeneration))
+        {
+            return itr->second.value;
+        }
+        return nullptr;
+    }
+
+    // 'readGeneration' is the generation() from before the value was read; the value is dropped if the cache has been
+    // invalidated since
+    template <typename CharT>
+    void store(const std::wstring& name, std::uint64_t readGeneration, std::shared_ptr<const env_var_registry_value<CharT>> value)
+    {
+        auto key = env_var_rules::fold(name);
+
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        if (readGeneration == generation())
+        {
+            this->entries<CharT>()[std::move(key)] = { readGeneration, std::move(value) };
+        }
+    }
+
+private:
+    template <typename CharT>
+    struct entry
+    {
+        std::uint64_t generation;
+        std::shared_ptr<const env_var_registry_value<CharT>> value;
+    };
+
+    template <typename CharT>
+    std::unordered_map<std::wstring, entry<CharT>>& entries() noexcept
+    {
+        if constexpr (std::is_same_v<CharT, char>)
+        {
+            return m_ansiEntries;
+        }
+        else
+        {
+            return m_wideEntries;
+        }
+    }
+
+    std::atomic<std::uint64_t> m_generation{ 0 };
+
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::wstring, entry<char>> m_ansiEntries;
+    std::unordered_map<std::wstring, entry<wchar_t>> m_wideEntries;
+};
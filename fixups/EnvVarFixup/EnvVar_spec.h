@@ -12,13 +12,27 @@ enum  Env_Remediation_Types
     Env_Remediation_Type_Dependency,
 };
 
+enum  Env_Dependency_States
+{
+    Env_Dependency_State_Unresolved = 0,
+    Env_Dependency_State_Resolved,
+    Env_Dependency_State_Unsupported,
+    Env_Dependency_State_NotFound,
+};
+
 
 struct env_var_spec
 {
     Env_Remediation_Types remediationType;
 
+    std::wstring_view variablenamepattern;
     std::wregex variablename;
     std::wstring_view variablevalue;
     bool useregistry;
     std::wstring dependency;
+
+    // Env_Remediation_Type_Dependency only: the value with the meta-variables replaced, once the dependency is found
+    Env_Dependency_States dependencystate;
+    std::wstring dependencyvalue;
+    std::string dependencyvalueansi;
 };
\ No newline at end of file
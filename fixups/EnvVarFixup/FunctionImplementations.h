@@ -11,6 +11,7 @@
 
 #include <reentrancy_guard.h>
 #include <psf_framework.h>
+#include <psf_logging.h>
 
 // A much bigger hammer to avoid reentrancy. Still, the impl::* functions are good to have around to prevent the
 // unnecessary invocation of the fixup
@@ -32,6 +33,37 @@ inline std::wstring InterpretStringW(const wchar_t* value)
 }
 
 
-void Log(const char* fmt, ...);
-void LogString(DWORD inst, const char* name, const char* value);
-void LogString(DWORD inst, const char* name, const wchar_t* value);
\ No newline at end of file
+// Log sites go through psf_logging.h. LogString is a macro, like Log, so that a disabled site is just the level check
+// and its arguments (often a converted copy of a path) are never evaluated
+inline void LogNameValue(DWORD inst, const char* name, const char* value)
+{
+    psf::log_message("[%d] %s=%s\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const char* name, const wchar_t* value)
+{
+    psf::log_message("[%d] %s=%ls\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const char* name, std::string_view value)
+{
+    psf::log_message("[%d] %s=%.*s\n", inst, name, static_cast<int>(value.length()), value.data());
+}
+
+inline void LogNameValue(DWORD inst, const wchar_t* name, const char* value)
+{
+    psf::log_message("[%d] %ls=%s\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const wchar_t* name, const wchar_t* value)
+{
+    psf::log_message(L"[%d] %ls=%ls\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const char* name, std::wstring_view value)
+{
+    psf::log_message("[%d] %s=%.*ls\n", inst, name, static_cast<int>(value.length()), value.data());
+}
+
+#define LogString(...) PSF_LOG_CALL(::psf::log_level::verbose, LogNameValue, __VA_ARGS__)
+
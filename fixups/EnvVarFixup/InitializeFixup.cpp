@@ -18,6 +18,7 @@
 
 #include "FunctionImplementations.h"
 #include "EnvVar_spec.h"
+#include "EnvVarRules.h"
 #include "psf_tracelogging.h"
 
 using namespace std::literals;
@@ -28,102 +29,9 @@ bool                  g_envvar_forcepackagedlluse = false;
 
 
 std::vector<env_var_spec> g_envvar_envVarSpecs;
+env_var_rules g_envvar_rules;
 
-void Log(const char* fmt, ...)
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-        std::string str;
-        str.resize(256);
-        std::size_t count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
-        assert(count >= 0);
-        va_end(args);
-
-        if (count > str.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            str.resize(count);
-
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vsnprintf(str.data(), str.size() + 1, fmt, args2);
-            assert(count >= 0);
-            va_end(args2);
-        }
-
-        str.resize(count);
-#if _DEBUG
-        ::OutputDebugStringA(str.c_str());
-#endif
-    }
-    catch (...)
-    {
-#if _DEBUG
-        ::OutputDebugStringA("Exception in Log()");
-        ::OutputDebugStringA(fmt);
-#endif
-    }
-}
-void Log(const wchar_t* fmt, ...)
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-
-        std::wstring wstr;
-        wstr.resize(256);
-        std::size_t count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
-        va_end(args);
-
-        if (count > wstr.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            wstr.resize(count);
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args2);
-            va_end(args2);
-        }
-#if _DEBUG
-        wstr.resize(count);
-        ::OutputDebugStringW(wstr.c_str());
-#endif
-    }
-    catch (...)
-    {
-#if _DEBUG
-        ::OutputDebugStringA("Exception in wide Log()");
-        ::OutputDebugStringW(fmt);
-#endif
-    }
-}
-void LogString(DWORD inst, const char* name, const char* value)
-{
-    Log("[%d] %s=%s\n", inst, name, value);
-}
-void LogString(DWORD inst, const char* name, const wchar_t* value)
-{
-    Log("[%d] %s=%ls\n", inst, name, value);
-}
-void LogString(DWORD inst, const char* name, std::string_view value)
-{
-    Log("[%d] %s=%.*s\n", inst, name, value.length(), value.data());
-}
-void LogString(DWORD inst, const wchar_t* name, const char* value)
-{
-    Log("[%d] %ls=%s\n", inst, name, value);
-}
-void LogString(DWORD inst, const wchar_t* name, const wchar_t* value)
-{
-    Log(L"[%d] %ls=%ls\n", inst, name, value);
-}
-void LogString(DWORD inst, const char* name, std::wstring_view value)
-{
-    Log("[%d] %s=%.*ls\n", inst, name, value.length(), value.data());
-}
+Env_Dependency_States ResolveDependencyValue(const env_var_spec& spec, std::wstring& value);
 
 void InitializeFixups()
 {
@@ -154,6 +62,17 @@ void InitializeConfiguration()
         auto& rootObject = rootConfig->as_object();
         traceDataStream << " config:\n";
 
+        if (auto logLevelValue = rootObject.try_get("logLevel"))
+        {
+            auto logLevel = logLevelValue->as_string().wstring();
+            psf::log_level level;
+            if (psf::parse_log_level(logLevel, level))
+            {
+                psf::set_log_level(level);
+            }
+            traceDataStream << " logLevel:" << logLevel << " ;";
+        }
+
         if (auto EnvVarsValue = rootObject.try_get("envVars"))
         {
             if (EnvVarsValue)
@@ -191,6 +110,7 @@ void InitializeConfiguration()
                         LogString(0, "GetEnvFixup Config: useregistry", useRegistry);
                         g_envvar_envVarSpecs.emplace_back();
                         g_envvar_envVarSpecs.back().remediationType = Env_Remediation_Type_Registry;
+                        g_envvar_envVarSpecs.back().variablenamepattern = variableNamePattern;
                         g_envvar_envVarSpecs.back().variablename.assign(variableNamePattern.data(), variableNamePattern.length());
                         g_envvar_envVarSpecs.back().variablevalue = variableValue;
                         if (useRegistry.compare(L"true") == 0 ||
@@ -213,6 +133,7 @@ void InitializeConfiguration()
                         LogString(0, "GetEnvFixup Config: dependency", dep);
                         g_envvar_envVarSpecs.emplace_back();
                         g_envvar_envVarSpecs.back().remediationType = Env_Remediation_Type_Dependency;
+                        g_envvar_envVarSpecs.back().variablenamepattern = variableNamePattern;
                         g_envvar_envVarSpecs.back().variablename.assign(variableNamePattern.data(), variableNamePattern.length());
                         g_envvar_envVarSpecs.back().variablevalue = variableValue;
                         g_envvar_envVarSpecs.back().dependency = dep;
@@ -226,6 +147,26 @@ void InitializeConfiguration()
         {
             Log("EnvVarFixup: Zero config items read.");
         }
+        g_envvar_rules.compile(g_envvar_envVarSpecs);
+
+        // Dependencies do not change while the app runs, so their values are worked out once, here
+        for (auto& spec : g_envvar_envVarSpecs)
+        {
+            if (spec.remediationType == Env_Remediation_Type_Dependency)
+            {
+                try
+                {
+                    spec.dependencystate = ResolveDependencyValue(spec, spec.dependencyvalue);
+                    spec.dependencyvalueansi = narrow(spec.dependencyvalue);
+                }
+                catch (...)
+                {
+                    // Resolved on each use instead, as before
+                    spec.dependencystate = Env_Dependency_State_Unresolved;
+                    Log("EnvVarFixup: Unable to resolve dependency %LS now.", spec.dependency.c_str());
+                }
+            }
+        }
 
         psf::TraceLogFixupConfig("EnvVarFixup", traceDataStream.str().c_str());
     }
@@ -6,6 +6,7 @@
 
 #define PSF_DEFINE_EXPORTS
 #include <psf_framework.h>
+#include <psf_logging.h>
 #include "psf_tracelogging.h"
 
 TRACELOGGING_DEFINE_PROVIDER(
@@ -16,7 +17,6 @@ TRACELOGGING_DEFINE_PROVIDER(
 
 void InitializeFixups();
 void InitializeConfiguration();
-void Log(const char* fmt, ...);
 extern "C" {
 
     BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
@@ -39,7 +39,7 @@ extern "C" {
     {
         psf::TraceLogExceptions("EnvVarFixupException", "EnvVarFixup attach ERROR");
         TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
-        Log("EnvVarFixup attach ERROR");
+        PSF_LOG_ERROR("EnvVarFixup attach ERROR");
         ::SetLastError(win32_from_caught_exception());
         return FALSE;
     }
@@ -43,6 +43,16 @@ DWORD inline ConvertToReadOnlyAccess(DWORD desiredAccess)
     return redirectedAccess;
 }
 
+/// IsWriteOpen: Whether an open could modify, truncate or delete the file (as opposed to only reading it).
+bool inline IsWriteOpen(DWORD desiredAccess, DWORD creationDisposition, DWORD flagsAndAttributes)
+{
+    constexpr DWORD writeAccess = GENERIC_WRITE | GENERIC_ALL | MAXIMUM_ALLOWED | FILE_WRITE_DATA | FILE_APPEND_DATA |
+        FILE_WRITE_ATTRIBUTES | FILE_WRITE_EA | DELETE | WRITE_DAC | WRITE_OWNER;
+    return ((desiredAccess & writeAccess) != 0) ||
+        ((creationDisposition != OPEN_EXISTING) && (creationDisposition != OPEN_ALWAYS)) ||
+        ((flagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0);
+}
+
 
 
 template <typename CharT>
@@ -64,21 +74,24 @@ HANDLE __stdcall CreateFileFixup(
 
             LogString(CreateFileInstance, L"CreateFileFixup for fileName", widen(fileName, CP_ACP).c_str());
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto knownRoot = psf::known_folders().classify(fileName);
+            if (knownRoot.root != psf::known_root::local_app_data_packages)
             {
                 // FUTURE: If 'creationDisposition' is something like 'CREATE_ALWAYS', we could get away with something
                 //         cheaper than copy-on-read, but we'd also need to be mindful of ensuring the correct error if so
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read, CreateFileInstance);
+                auto redirectFlags = IsWriteOpen(desiredAccess, creationDisposition, flagsAndAttributes) ?
+                    redirect_flags::copy_on_read : redirect_flags::open_for_read;
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirectFlags, CreateFileInstance);
                 if (shouldRedirect)
                 {
-                    if (IsUnderUserAppDataLocal(fileName))
+                    if (knownRoot.is_local_app_data())
                     {
                         Log(L"[%d]Under LocalAppData", CreateFileInstance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (IndexedPathExists(PackageVersion.c_str()))
                             {
                                 if (!impl::PathExists(redirectPath.c_str()))
                                 {
@@ -89,14 +102,14 @@ HANDLE __stdcall CreateFileFixup(
                             }
                         }
                     }
-                    else if (IsUnderUserAppDataRoaming(fileName))
+                    else if (knownRoot.root == psf::known_root::roaming_app_data)
                     {
                         Log(L"[%d]Under AppData(roaming)", CreateFileInstance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (IndexedPathExists(PackageVersion.c_str()))
                             {
                                 if (!impl::PathExists(redirectPath.c_str()))
                                 {
@@ -116,6 +129,11 @@ HANDLE __stdcall CreateFileFixup(
                     Log(L"[%d]CreateFile pre create", CreateFileInstance);
                     HANDLE hRet = impl::CreateFile(redirectPath.c_str(), desiredAccess, shareMode, securityAttributes, creationDisposition, flagsAndAttributes, templateFile);
                     Log(L"[%d]CreateFile post create. Handle=0x%x", CreateFileInstance,hRet);
+                    if ((hRet != INVALID_HANDLE_VALUE) && ((flagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0))
+                    {
+                        // The redirected copy goes away when the handle is closed
+                        InvalidateRedirectCache(redirectPath);
+                    }
                     return hRet;
                 }
             }
@@ -150,21 +168,24 @@ HANDLE __stdcall CreateFile2Fixup(
 
             Log(L"[%d]CreateFile2Fixup for %ls", CreateFile2Instance, widen(fileName, CP_ACP).c_str());
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto knownRoot = psf::known_folders().classify(fileName);
+            if (knownRoot.root != psf::known_root::local_app_data_packages)
             {
                 // FUTURE: See comment in CreateFileFixup about using 'creationDisposition' to choose a potentially better
             //         redirect flags value
-                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read, CreateFile2Instance);
+                auto redirectFlags = IsWriteOpen(desiredAccess, creationDisposition, createExParams ? createExParams->dwFileFlags : 0) ?
+                    redirect_flags::copy_on_read : redirect_flags::open_for_read;
+                auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirectFlags, CreateFile2Instance);
                 if (shouldRedirect)
                 {
-                    if (IsUnderUserAppDataLocal(fileName))
+                    if (knownRoot.is_local_app_data())
                     {
                         Log(L"[%d]Under LocalAppData", CreateFile2Instance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (IndexedPathExists(PackageVersion.c_str()))
                             {
                                 if (!impl::PathExists(redirectPath.c_str()))
                                 {
@@ -175,14 +196,14 @@ HANDLE __stdcall CreateFile2Fixup(
                             }
                         }
                     }
-                    else if (IsUnderUserAppDataRoaming(fileName))
+                    else if (knownRoot.root == psf::known_root::roaming_app_data)
                     {
                         Log(L"[%d]Under AppData(roaming)", CreateFile2Instance);
                         // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                        std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                         if (wcslen(PackageVersion.c_str()) >= 0)
                         {
-                            if (impl::PathExists(PackageVersion.c_str()))
+                            if (IndexedPathExists(PackageVersion.c_str()))
                             {
                                 if (!impl::PathExists(redirectPath.c_str()))
                                 {
@@ -199,7 +220,13 @@ HANDLE __stdcall CreateFile2Fixup(
                         redirectedAccess = ConvertToReadOnlyAccess(desiredAccess);
                     }
 
-                    return impl::CreateFile2(redirectPath.c_str(), desiredAccess, shareMode, creationDisposition, createExParams);
+                    HANDLE hRet = impl::CreateFile2(redirectPath.c_str(), desiredAccess, shareMode, creationDisposition, createExParams);
+                    if ((hRet != INVALID_HANDLE_VALUE) && createExParams && ((createExParams->dwFileFlags & FILE_FLAG_DELETE_ON_CLOSE) != 0))
+                    {
+                        // The redirected copy goes away when the handle is closed
+                        InvalidateRedirectCache(redirectPath);
+                    }
+                    return hRet;
                 }
             }
             else
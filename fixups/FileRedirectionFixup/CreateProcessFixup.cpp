@@ -0,0 +1,38 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <type_traits>
+
+#include "FunctionImplementations.h"
+#include "PathRedirection.h"
+
+template <typename CharT>
+using startup_info_t = std::conditional_t<std::is_same_v<CharT, char>, STARTUPINFOA, STARTUPINFOW>;
+
+// Nothing is redirected here. A child process reads redirected INI files from disk, so changes that the private
+// profile cache is still holding on to are written back first. The call then goes on to the PsfRuntime's own fixup
+template <typename CharT>
+BOOL __stdcall CreateProcessFixup(
+    _In_opt_ const CharT* applicationName,
+    _Inout_opt_ CharT* commandLine,
+    _In_opt_ LPSECURITY_ATTRIBUTES processAttributes,
+    _In_opt_ LPSECURITY_ATTRIBUTES threadAttributes,
+    _In_ BOOL inheritHandles,
+    _In_ DWORD creationFlags,
+    _In_opt_ LPVOID environment,
+    _In_opt_ const CharT* currentDirectory,
+    _In_ startup_info_t<CharT>* startupInfo,
+    _Out_ LPPROCESS_INFORMATION processInformation) noexcept
+{
+    auto guard = g_reentrancyGuard.enter();
+    if (guard)
+    {
+        FlushPrivateProfileCache();
+    }
+
+    return impl::CreateProcess(applicationName, commandLine, processAttributes, threadAttributes, inheritHandles,
+        creationFlags, environment, currentDirectory, startupInfo, processInformation);
+}
+DECLARE_STRING_FIXUP(impl::CreateProcess, CreateProcessFixup);
@@ -37,7 +37,9 @@ BOOL __stdcall DeleteFileFixup(_In_ const CharT* fileName) noexcept
                     }
                     else
                     {
-                        return impl::DeleteFile(redirectPath.c_str());
+                        auto result = impl::DeleteFile(redirectPath.c_str());
+                        InvalidateRedirectCache(redirectPath);
+                        return result;
                     }
                 }
             }
@@ -0,0 +1,359 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Block-level copy-on-write for large package files. Rather than copying a whole file out of the package the first
+// time it is written to, the redirected copy is a sparse "delta" file that only holds the blocks that have been
+// written, at the same offsets as in the original. A block map records which blocks live in the delta; reads are
+// assembled from the delta for those blocks and from the (read-only) package file for everything else.
+//
+// Truncation is tracked with a "base limit": package data at or beyond it reads as zeros, which is what the file would
+// contain had it been truncated and then extended again. The invariant base_limit <= size always holds.
+//
+// The base and delta are accessed through any type with these members (e.g. a file handle wrapper):
+//      std::size_t read(std::uint64_t offset, void* buffer, std::size_t length);          // Returns bytes read
+//      void write(std::uint64_t offset, const void* buffer, std::size_t length);          // Delta only
+// The delta may read back short (or as zeros) anywhere that hasn't been written.
+//
+// NOTE: Nothing here locks or owns a file: the caller serializes every call for a file, keeps the base, delta and map
+// alive for as long as the overlay, and persists the map (serialize()) with the delta, which is meaningless without it.
+// Nothing in FileRedirectionFixup uses the overlay yet; serving it needs a handle whose I/O the fixup intercepts.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class delta_block_map
+{
+public:
+    static constexpr std::uint32_t default_block_size = 64 * 1024;
+
+    delta_block_map() = default;
+
+    // 'baseStamp' identifies the version of the package file that the delta applies to (e.g. derived from its size and
+    // last write time); a persisted map is only reloaded against the same stamp. 'blockSize' must be a power of two
+    delta_block_map(std::uint64_t baseSize, std::uint64_t baseStamp, std::uint32_t blockSize = default_block_size) :
+        m_blockSize(blockSize),
+        m_baseStamp(baseStamp),
+        m_baseLimit(baseSize),
+        m_size(baseSize)
+    {
+    }
+
+    std::uint32_t block_size() const noexcept
+    {
+        return m_blockSize;
+    }
+
+    std::uint64_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    std::uint64_t base_limit() const noexcept
+    {
+        return m_baseLimit;
+    }
+
+    std::uint64_t base_stamp() const noexcept
+    {
+        return m_baseStamp;
+    }
+
+    bool contains(std::uint64_t block) const noexcept
+    {
+        auto word = static_cast<std::size_t>(block / 64);
+        return (word < m_bits.size()) && ((m_bits[word] >> (block % 64)) & 1);
+    }
+
+    void insert(std::uint64_t block)
+    {
+        auto word = static_cast<std::size_t>(block / 64);
+        if (word >= m_bits.size())
+        {
+            m_bits.resize(word + 1);
+        }
+        m_bits[word] |= std::uint64_t(1) << (block % 64);
+    }
+
+    // Number of blocks held by the delta
+    std::uint64_t count() const noexcept
+    {
+        std::uint64_t result = 0;
+        for (auto bits : m_bits)
+        {
+            for (; bits; bits &= bits - 1)
+            {
+                ++result;
+            }
+        }
+        return result;
+    }
+
+    void set_size(std::uint64_t size) noexcept
+    {
+        m_size = size;
+        m_baseLimit = std::min(m_baseLimit, size);
+    }
+
+    // Drops every block that starts at or beyond 'offset'
+    void erase_from(std::uint64_t offset) noexcept
+    {
+        auto firstBlock = (offset + m_blockSize - 1) / m_blockSize;
+        for (auto word = static_cast<std::size_t>(firstBlock / 64); word < m_bits.size(); ++word)
+        {
+            auto keep = (word == firstBlock / 64) ? ((std::uint64_t(1) << (firstBlock % 64)) - 1) : 0;
+            m_bits[word] &= keep;
+        }
+
+        while (!m_bits.empty() && (m_bits.back() == 0))
+        {
+            m_bits.pop_back();
+        }
+    }
+
+    std::vector<std::uint8_t> serialize() const
+    {
+        map_header header = {};
+        header.magic = map_magic;
+        header.version = map_version;
+        header.block_size = m_blockSize;
+        header.word_count = static_cast<std::uint32_t>(m_bits.size());
+        header.base_stamp = m_baseStamp;
+        header.base_limit = m_baseLimit;
+        header.size = m_size;
+
+        std::vector<std::uint8_t> result(sizeof(header) + m_bits.size() * sizeof(std::uint64_t));
+        std::memcpy(result.data(), &header, sizeof(header));
+        if (!m_bits.empty())
+        {
+            std::memcpy(result.data() + sizeof(header), m_bits.data(), m_bits.size() * sizeof(std::uint64_t));
+        }
+        return result;
+    }
+
+    // Returns false (leaving this object unchanged) if 'data' isn't a well formed map for the given base
+    bool deserialize(const void* data, std::size_t length, std::uint64_t baseStamp)
+    {
+        map_header header;
+        if (length < sizeof(header))
+        {
+            return false;
+        }
+
+        std::memcpy(&header, data, sizeof(header));
+        if ((header.magic != map_magic) || (header.version != map_version) || (header.base_stamp != baseStamp) ||
+            (header.block_size == 0) || ((header.block_size & (header.block_size - 1)) != 0) ||
+            (header.base_limit > header.size) ||
+            (length != sizeof(header) + std::uint64_t(header.word_count) * sizeof(std::uint64_t)))
+        {
+            return false;
+        }
+
+        m_blockSize = header.block_size;
+        m_baseStamp = header.base_stamp;
+        m_baseLimit = header.base_limit;
+        m_size = header.size;
+        m_bits.resize(header.word_count);
+        if (header.word_count)
+        {
+            std::memcpy(m_bits.data(), static_cast<const std::uint8_t*>(data) + sizeof(header), header.word_count * sizeof(std::uint64_t));
+        }
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t map_magic = 0x4D424450; // "PDBM"
+    static constexpr std::uint32_t map_version = 1;
+
+    struct map_header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t block_size;
+        std::uint32_t word_count;
+        std::uint64_t base_stamp;
+        std::uint64_t base_limit;
+        std::uint64_t size;
+    };
+    static_assert(sizeof(map_header) == 40);
+
+    std::uint32_t m_blockSize = default_block_size;
+    std::uint64_t m_baseStamp = 0;
+    std::uint64_t m_baseLimit = 0;
+    std::uint64_t m_size = 0;
+    std::vector<std::uint64_t> m_bits;
+};
+
+template <typename BaseT, typename DeltaT>
+class delta_overlay
+{
+public:
+    delta_overlay(BaseT& base, DeltaT& delta, delta_block_map& map) :
+        m_base(base),
+        m_delta(delta),
+        m_map(map)
+    {
+    }
+
+    std::uint64_t size() const noexcept
+    {
+        return m_map.size();
+    }
+
+    // Reads up to 'length' bytes at 'offset', stopping at the end of the file. Returns the number of bytes read
+    std::size_t read(std::uint64_t offset, void* buffer, std::size_t length)
+    {
+        if (offset >= m_map.size())
+        {
+            return 0;
+        }
+
+        length = static_cast<std::size_t>(std::min<std::uint64_t>(length, m_map.size() - offset));
+        auto out = static_cast<std::uint8_t*>(buffer);
+        const std::uint64_t blockSize = m_map.block_size();
+        std::size_t done = 0;
+        while (done < length)
+        {
+            auto position = offset + done;
+            auto block = position / blockSize;
+
+            // Coalesce runs of blocks that come from the same place into a single read
+            auto fromDelta = m_map.contains(block);
+            auto runEnd = (block + 1) * blockSize;
+            while ((runEnd < offset + length) && (m_map.contains(runEnd / blockSize) == fromDelta))
+            {
+                runEnd += blockSize;
+            }
+
+            auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>(runEnd, offset + length) - position);
+            if (fromDelta)
+            {
+                fill(out + done, chunk, m_delta.read(position, out + done, chunk));
+            }
+            else
+            {
+                read_base(position, out + done, chunk);
+            }
+            done += chunk;
+        }
+
+        return length;
+    }
+
+    // Writes 'length' bytes at 'offset', extending the file if needed. Blocks that are only partially overwritten are
+    // first copied up from the package file
+    void write(std::uint64_t offset, const void* buffer, std::size_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        auto in = static_cast<const std::uint8_t*>(buffer);
+        const std::uint64_t blockSize = m_map.block_size();
+        std::size_t done = 0;
+        while (done < length)
+        {
+            auto position = offset + done;
+            auto block = position / blockSize;
+            auto blockStart = block * blockSize;
+            auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>(blockStart + blockSize - position, length - done));
+
+            if (!m_map.contains(block))
+            {
+                if (chunk < blockSize)
+                {
+                    // Bring the rest of the block over from the package first. Past the end of the file (or anything
+                    // the delta held before a truncation) that's zeros
+                    m_scratch.assign(static_cast<std::size_t>(blockSize), 0);
+                    auto validEnd = std::min<std::uint64_t>(blockStart + blockSize, m_map.size());
+                    if (blockStart < validEnd)
+                    {
+                        read_base(blockStart, m_scratch.data(), static_cast<std::size_t>(validEnd - blockStart));
+                    }
+
+                    std::memcpy(m_scratch.data() + (position - blockStart), in + done, chunk);
+                    m_delta.write(blockStart, m_scratch.data(), m_scratch.size());
+                    m_map.insert(block);
+                    done += chunk;
+                    continue;
+                }
+
+                m_map.insert(block);
+            }
+
+            m_delta.write(position, in + done, chunk);
+            done += chunk;
+        }
+
+        if (offset + length > m_map.size())
+        {
+            m_map.set_size(offset + length);
+        }
+    }
+
+    // Truncates or extends the file. Extended space reads as zeros
+    void resize(std::uint64_t size)
+    {
+        if (size < m_map.size())
+        {
+            // Anything in the delta past the new end must read as zeros if the file grows again
+            auto blockSize = m_map.block_size();
+            auto tailBlock = size / blockSize;
+            if ((size % blockSize != 0) && m_map.contains(tailBlock))
+            {
+                auto tailEnd = std::min<std::uint64_t>((tailBlock + 1) * blockSize, m_map.size());
+                m_scratch.assign(static_cast<std::size_t>(tailEnd - size), 0);
+                m_delta.write(size, m_scratch.data(), m_scratch.size());
+            }
+
+            m_map.erase_from(size);
+        }
+
+        m_map.set_size(size);
+    }
+
+    // Writes the full contents of the file to 'out' (same interface as the delta), e.g. to turn the overlay back into a
+    // plain copy
+    template <typename OutT>
+    void materialize(OutT& out, std::size_t chunkSize = 1024 * 1024)
+    {
+        std::vector<std::uint8_t> buffer(chunkSize);
+        for (std::uint64_t offset = 0; offset < m_map.size(); )
+        {
+            auto length = read(offset, buffer.data(), buffer.size());
+            out.write(offset, buffer.data(), length);
+            offset += length;
+        }
+    }
+
+private:
+    BaseT& m_base;
+    DeltaT& m_delta;
+    delta_block_map& m_map;
+    std::vector<std::uint8_t> m_scratch;
+
+    static void fill(std::uint8_t* buffer, std::size_t length, std::size_t valid) noexcept
+    {
+        if (valid < length)
+        {
+            std::memset(buffer + valid, 0, length - valid);
+        }
+    }
+
+    // Package data, up to the base limit; zeros after that
+    void read_base(std::uint64_t offset, std::uint8_t* buffer, std::size_t length)
+    {
+        std::size_t valid = 0;
+        if (offset < m_map.base_limit())
+        {
+            auto baseLength = static_cast<std::size_t>(std::min<std::uint64_t>(length, m_map.base_limit() - offset));
+            valid = m_base.read(offset, buffer, baseLength);
+        }
+        fill(buffer, length, valid);
+    }
+};
@@ -0,0 +1,153 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// A case-insensitive set of file names (single path components, as returned by FindNextFile), used to merge several
+// directory enumerations without returning the same name twice. Names are folded once on insert and kept in a single
+// character pool; lookups fold on the fly, so neither insert nor lookup allocates per name beyond amortized growth.
+// Names are folded as the file system compares them (see file_name_case.h), so that a name differing from another only
+// in the case of a non-ASCII letter is still the same name.
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <file_name_case.h>
+
+class directory_name_set
+{
+public:
+    std::size_t size() const noexcept
+    {
+        return m_count;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_count == 0;
+    }
+
+    // Returns false if an equivalent name was already present
+    bool insert(std::wstring_view name)
+    {
+        if ((m_count + 1) * 2 > m_slots.size())
+        {
+            grow();
+        }
+
+        auto hash = hash_of(name);
+        auto index = find_slot(name, hash);
+        if (m_slots[index].length != empty_slot)
+        {
+            return false;
+        }
+
+        m_slots[index] = slot{ static_cast<std::uint32_t>(m_pool.size()), static_cast<std::uint32_t>(name.length()), hash };
+        for (auto ch : name)
+        {
+            m_pool.push_back(fold(ch));
+        }
+        ++m_count;
+        return true;
+    }
+
+    bool contains(std::wstring_view name) const noexcept
+    {
+        if (m_count == 0)
+        {
+            return false;
+        }
+
+        return m_slots[find_slot(name, hash_of(name))].length != empty_slot;
+    }
+
+    void clear() noexcept
+    {
+        m_slots.clear();
+        m_pool.clear();
+        m_count = 0;
+    }
+
+private:
+    static constexpr std::uint32_t empty_slot = 0xFFFFFFFF;
+
+    struct slot
+    {
+        std::uint32_t offset = 0;
+        std::uint32_t length = empty_slot;
+        std::uint32_t hash = 0;
+    };
+
+    std::vector<slot> m_slots;  // Open addressing with linear probing; the size is always a power of two
+    std::vector<wchar_t> m_pool;
+    std::size_t m_count = 0;
+
+    static wchar_t fold(wchar_t ch) noexcept
+    {
+        return psf::fold_file_name_char(ch);
+    }
+
+    static std::uint32_t hash_of(std::wstring_view name) noexcept
+    {
+        // FNV-1a over the folded characters
+        std::uint32_t hash = 2166136261u;
+        for (auto ch : name)
+        {
+            hash = (hash ^ static_cast<std::uint32_t>(fold(ch))) * 16777619u;
+        }
+        return hash;
+    }
+
+    bool equals(const slot& entry, std::wstring_view name) const noexcept
+    {
+        if (entry.length != name.length())
+        {
+            return false;
+        }
+
+        auto folded = m_pool.data() + entry.offset;
+        for (std::size_t i = 0; i < name.length(); ++i)
+        {
+            if (folded[i] != fold(name[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Index of the slot holding 'name', or of the empty slot where it would go
+    std::size_t find_slot(std::wstring_view name, std::uint32_t hash) const noexcept
+    {
+        auto mask = m_slots.size() - 1;
+        for (auto index = hash & mask; ; index = (index + 1) & mask)
+        {
+            auto& entry = m_slots[index];
+            if ((entry.length == empty_slot) || ((entry.hash == hash) && equals(entry, name)))
+            {
+                return index;
+            }
+        }
+    }
+
+    void grow()
+    {
+        std::vector<slot> slots(m_slots.empty() ? 64 : m_slots.size() * 2);
+        auto mask = slots.size() - 1;
+        for (auto& entry : m_slots)
+        {
+            if (entry.length != empty_slot)
+            {
+                auto index = entry.hash & mask;
+                while (slots[index].length != empty_slot)
+                {
+                    index = (index + 1) & mask;
+                }
+                slots[index] = entry;
+            }
+        }
+        m_slots = std::move(slots);
+    }
+};
@@ -17,7 +17,8 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName) noexcept
             DWORD GetFileAttributesInstance = ++g_FileIntceptInstance;
             LogString(GetFileAttributesInstance,L"GetFileAttributesFixup for fileName", fileName);
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto knownRoot = psf::known_folders().classify(fileName);
+            if (knownRoot.root != psf::known_root::local_app_data_packages)
             {
                 auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::check_file_presence, GetFileAttributesInstance);
                 if (shouldRedirect)
@@ -26,15 +27,14 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName) noexcept
                     if (attributes == INVALID_FILE_ATTRIBUTES)
                     {
                         // Might be file/dir has not been copied yet, but might also be funky ADL/ADR.
-                        if (IsUnderUserAppDataLocal(fileName) ||
-                            IsUnderUserAppDataRoaming(fileName))
+                        if (knownRoot.root != psf::known_root::none)
                         {
                             // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                             if (wcslen(PackageVersion.c_str()) > 0)
                             {
                                 Log(L"[%d]GetFileAttributes: uncopied ADL/ADR case %ls", GetFileAttributesInstance,PackageVersion.c_str());
-                                attributes = impl::GetFileAttributes(PackageVersion.c_str());
+                                attributes = IndexedGetFileAttributes(PackageVersion.c_str());
                                 if (attributes == INVALID_FILE_ATTRIBUTES)
                                 {
                                     Log(L"[%d]GetFileAttributes: fall back to original request location.", GetFileAttributesInstance);
@@ -93,7 +93,8 @@ BOOL __stdcall GetFileAttributesExFixup(
             DWORD GetFileAttributesExInstance = ++g_FileIntceptInstance;
             LogString(GetFileAttributesExInstance,L"GetFileAttributesExFixup for fileName", fileName);
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto knownRoot = psf::known_folders().classify(fileName);
+            if (knownRoot.root != psf::known_root::local_app_data_packages)
             {
                 auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::check_file_presence, GetFileAttributesExInstance);
                 if (shouldRedirect)
@@ -102,11 +103,10 @@ BOOL __stdcall GetFileAttributesExFixup(
                     if (retval == 0)
                     {
                         // We know it exists, so must be file/dir has not been copied yet.
-                        if (IsUnderUserAppDataLocal(fileName) ||
-                            IsUnderUserAppDataRoaming(fileName))
+                        if (knownRoot.root != psf::known_root::none)
                         {
                             // special case.  Need to do the copy ourselves if present in the package as MSIX Runtime doesn't take care of these cases.
-                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName);
+                            std::filesystem::path PackageVersion = GetPackageVFSPath(fileName, knownRoot);
                             if (wcslen(PackageVersion.c_str()) > 0)
                             {
                                 Log(L"[%d]GetFileAttributesEx: uncopied ADL/ADR case %ls", GetFileAttributesExInstance,PackageVersion.c_str());
@@ -179,7 +179,8 @@ BOOL __stdcall SetFileAttributesFixup(_In_ const CharT* fileName, _In_ DWORD fil
             DWORD SetFileAttributesInstance = ++g_FileIntceptInstance;
             LogString(SetFileAttributesInstance,L"SetFileAttributesFixup for fileName", fileName);
 
-            if (!IsUnderUserAppDataLocalPackages(fileName))
+            auto knownRoot = psf::known_folders().classify(fileName);
+            if (knownRoot.root != psf::known_root::local_app_data_packages)
             {
                 auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
                 if (shouldRedirect)
@@ -9,14 +9,20 @@
 // the non-redirected directory, ignoring files that exist in the redirected directory. Note that this order is
 // important since it could be the case that a file gets copied to the redirected directory in the middle of enumeration
 // and we could otherwise return the same file twice.
+// Rather than probing the file system for every entry of the later enumerations, the names handed out by the earlier
+// ones are remembered as we go (see DirectoryNameSet.h). A name is therefore returned exactly once, from the first
+// enumeration that produced it, even if a copy shows up in the redirected directory after that enumeration has passed
+// it.
 // NOTE: If we ever address the "delete package file" problem, we'll need to address that here, too
 
+#include <algorithm>
 #include <array>
 
 #include <dos_paths.h>
 #include <fancy_handle.h>
 #include <psf_framework.h>
 
+#include "DirectoryNameSet.h"
 #include "FunctionImplementations.h"
 #include "PathRedirection.h"
 
@@ -37,8 +43,8 @@ using unique_find_handle = std::unique_ptr<void, find_deleter>;
 
 struct find_data
 {
-    // Redirected path directory so that we can avoid returning duplicate filenames. This value will be empty if the
-    // path does not exist/match any existing files at the start of the enumeration, for a slight optimization
+    // Redirected path directory. This value will be empty if the path does not exist/match any existing files at the
+    // start of the enumeration
     std::wstring redirect_path;
     std::wstring package_vfs_path;
     std::wstring requested_path;
@@ -54,10 +60,61 @@ struct find_data
     //       We need the second handle only for VFS/AppData and VFS/LocalAppdata in the package because the underlying runtime doesn't layer those folders in when we use %Appdata% and %LocalAppData% for the third handle.
     unique_find_handle find_handles[3];
 
-    // We need to hold on to the results of FindFirstFile for find_handles[1/2] 
-    WIN32_FIND_DATAW cached_data;
+    // The entry that FindFirstFileEx produced for each of find_handles, until it has been handed out (or skipped)
+    WIN32_FIND_DATAW first_data[3];
+    bool has_first_data[3] = {};
+
+    // Names handed out from find_handles[0] and [1], which the later handles skip
+    directory_name_set returned_names;
 };
 
+// Produces the next entry of the merged enumeration. Returns false with the last error set (ERROR_NO_MORE_FILES at the
+// end) if there isn't one
+static bool next_find_data(find_data& data, WIN32_FIND_DATAW& findData)
+{
+    for (std::size_t index = 0; index < std::size(data.find_handles); ++index)
+    {
+        while (data.find_handles[index])
+        {
+            if (data.has_first_data[index])
+            {
+                findData = data.first_data[index];
+                data.has_first_data[index] = false;
+            }
+            else if (!impl::FindNextFile(data.find_handles[index].get(), &findData))
+            {
+                if (::GetLastError() != ERROR_NO_MORE_FILES)
+                {
+                    // Error due to something other than reaching the end
+                    return false;
+                }
+
+                data.find_handles[index].reset();
+                break;
+            }
+
+            if ((index > 0) && data.returned_names.contains(findData.cFileName))
+            {
+                // Already returned from the redirected (or package VFS) location
+                continue;
+            }
+
+            // Only names that a later handle could also produce need remembering
+            if (std::any_of(std::begin(data.find_handles) + index + 1, std::end(data.find_handles), [](auto& handle) { return static_cast<bool>(handle); }))
+            {
+                data.returned_names.insert(findData.cFileName);
+            }
+
+            ::SetLastError(ERROR_SUCCESS);
+            return true;
+        }
+    }
+
+    // We ran out of data either on a previous call, or by ignoring files that have been redirected
+    ::SetLastError(ERROR_NO_MORE_FILES);
+    return false;
+}
+
 template <typename CharT>
 using win32_find_data_t = std::conditional_t<psf::is_ansi<CharT>, WIN32_FIND_DATAA, WIN32_FIND_DATAW>;
 
@@ -164,7 +221,11 @@ HANDLE __stdcall FindFirstFileExFixup(
  
     //Basically, what goes into RedirectedPath here also needs to go into 
     // RedirectedPath in PathRedirection.cpp
-    dir = NormalizePath(dir.drive_absolute_path);
+    if (dir.drive_absolute_path != dir.full_path.data())
+    {
+        // Drop any "\\?\" or "\\.\" prefix. Otherwise dir is already normalized and drive-absolute
+        dir = NormalizePath(dir.drive_absolute_path);
+    }
     dir = VirtualizePath(std::move(dir), FindFirstFileExInstance);
 
     auto result = std::make_unique<find_data>();
@@ -178,7 +239,8 @@ HANDLE __stdcall FindFirstFileExFixup(
     Log(L"[%d]FindFirstFile redirected_path is", FindFirstFileExInstance);
     Log(result->redirect_path.c_str());
     
-    std::filesystem::path vfspath = GetPackageVFSPath(path.c_str());
+    auto knownRoot = psf::known_folders().classify(path.c_str());
+    std::filesystem::path vfspath = GetPackageVFSPath(path.c_str(), knownRoot);
     if (wcslen(vfspath.c_str()) > 0)
     {
         result->package_vfs_path = vfspath.c_str();
@@ -194,15 +256,11 @@ HANDLE __stdcall FindFirstFileExFixup(
         Log(L"[%d]FindFirstFile package_vfs_path is [empty]", FindFirstFileExInstance);
     }
 
-    [[maybe_unused]] auto ansiData = reinterpret_cast<WIN32_FIND_DATAA*>(findFileData);
-    [[maybe_unused]] auto wideData = reinterpret_cast<WIN32_FIND_DATAW*>(findFileData);
-    WIN32_FIND_DATAW* findData = psf::is_ansi<CharT> ? &result->cached_data : wideData;
-
     //
     // Open the redirected find handle
     auto revertSize = result->redirect_path.length();
     result->redirect_path += pattern;
-    result->find_handles[0].reset(impl::FindFirstFileEx(result->redirect_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
+    result->find_handles[0].reset(impl::FindFirstFileEx(result->redirect_path.c_str(), infoLevelId, &result->first_data[0], searchOp, searchFilter, additionalFlags));
     result->redirect_path.resize(revertSize);
 
     // Some applications really care about the failure reason. Try and make this the best that we can, preferring
@@ -211,38 +269,19 @@ HANDLE __stdcall FindFirstFileExFixup(
 
     if (result->find_handles[0])
     {
-        if constexpr (psf::is_ansi<CharT>)
-        {
-            if (copy_find_data(*findData, *ansiData))
-            {
-                // NOTE: Last error set by caller
-                return INVALID_HANDLE_VALUE;
-            }
-        }
-        else
-        {
-            // No need to copy since we wrote directly into the output buffer
-            assert(findData == wideData);
-        }
         Log(L"[%d]FindFirstFile[0] redirected (from redirected): had results", FindFirstFileExInstance);
     }
     else
     {
-        // Path doesn't exist or match any files. We can safely get away without the redirected file exists check
         result->redirect_path.clear();
         Log(L"[%d]FindFirstFile[0] redirected (from redirected): no results", FindFirstFileExInstance);
     }
 
-    findData = (result->find_handles[0] || psf::is_ansi<CharT>) ? &result->cached_data : wideData;
-
     //
     // Open the package_vfsP_path handle if AppData or LocalAppData (letting the runtime handle other VFSs)
-    if (IsUnderUserAppDataLocal(path.c_str()) || IsUnderUserAppDataRoaming(path.c_str()))
+    if (knownRoot.root != psf::known_root::none)
     {
-        ///auto vfspathSize = result->package_vfs_path.length();
-        ///result->package_vfs_path += pattern;
-        result->find_handles[1].reset(impl::FindFirstFileEx(result->package_vfs_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
-        ///result->package_vfs_path.resize(vfspathSize);
+        result->find_handles[1].reset(impl::FindFirstFileEx(result->package_vfs_path.c_str(), infoLevelId, &result->first_data[1], searchOp, searchFilter, additionalFlags));
         if (result->find_handles[1])
         {
             Log(L"[%d]FindFirstFile[1] (from vfs_path): had results", FindFirstFileExInstance);
@@ -252,28 +291,11 @@ HANDLE __stdcall FindFirstFileExFixup(
             result->package_vfs_path.clear();
             Log(L"[%d]FindFirstFile[1] (from vfs_path): no results", FindFirstFileExInstance);
         }
-        if (!result->find_handles[0])
-        {
-            if constexpr (psf::is_ansi<CharT>)
-            {
-                if (copy_find_data(*findData, *ansiData))
-                {
-                    Log(L"[%d]FindFirstFile error set by caller", FindFirstFileExInstance);
-                    // NOTE: Last error set by caller
-                    return INVALID_HANDLE_VALUE;
-                }
-            }
-            else
-            {
-                // No need to copy since we wrote directly into the output buffer
-                assert(findData == wideData);
-            }
-        }
     }
 
     //
     // Open the non-redirected find handle
-    result->find_handles[2].reset(impl::FindFirstFileEx(result->requested_path.c_str(), infoLevelId, findData, searchOp, searchFilter, additionalFlags));
+    result->find_handles[2].reset(impl::FindFirstFileEx(result->requested_path.c_str(), infoLevelId, &result->first_data[2], searchOp, searchFilter, additionalFlags));
     if (result->find_handles[2])
     {
         Log(L"[%d]FindFirstFile[2] (from origial): had results", FindFirstFileExInstance);
@@ -283,40 +305,38 @@ HANDLE __stdcall FindFirstFileExFixup(
         result->requested_path.clear();
         Log(L"[%d]FindFirstFile[2] (from original): no results", FindFirstFileExInstance);
     }
-    if (!result->find_handles[0] &&
-        !result->find_handles[1])
+
+    if (!result->find_handles[0] && !result->find_handles[1] && !result->find_handles[2])
     {
-        if (!result->find_handles[2])
+        // Neither path exists. The last error should still be set by FindFirstFileEx, but prefer the initial error
+        // if it indicates that the redirected directory structure exists
+        if (initialFindError == ERROR_FILE_NOT_FOUND)
         {
-            // Neither path exists. The last error should still be set by FindFirstFileEx, but prefer the initial error
-            // if it indicates that the redirected directory structure exists
-            if (initialFindError == ERROR_FILE_NOT_FOUND)
-            {
-                Log(L"[%d]FindFirstFile error 0x%x", FindFirstFileExInstance, initialFindError);
-                ::SetLastError(initialFindError);
-            }
-
-            return INVALID_HANDLE_VALUE;
-        }
-        else
-        {
-            if constexpr (psf::is_ansi<CharT>)
-            {
-                if (copy_find_data(*findData, *ansiData))
-                {
-                    Log(L"[%d]FindFirstFile error set by caller", FindFirstFileExInstance);
-                    // NOTE: Last error set by caller
-                    return INVALID_HANDLE_VALUE;
-                }
-            }
-            else
-            {
-                // No need to copy since we wrote directly into the output buffer
-                assert(findData == wideData);
-            }
+            Log(L"[%d]FindFirstFile error 0x%x", FindFirstFileExInstance, initialFindError);
+            ::SetLastError(initialFindError);
         }
+
+        return INVALID_HANDLE_VALUE;
+    }
+
+    for (std::size_t index = 0; index < std::size(result->find_handles); ++index)
+    {
+        result->has_first_data[index] = static_cast<bool>(result->find_handles[index]);
+    }
+
+    // The first handle that opened always produces an entry, so this only fails on a real error
+    WIN32_FIND_DATAW findData;
+    if (!next_find_data(*result, findData))
+    {
+        return INVALID_HANDLE_VALUE;
     }
 
+    if (copy_find_data(findData, *reinterpret_cast<win32_find_data_t<CharT>*>(findFileData)))
+    {
+        Log(L"[%d]FindFirstFile error set by caller", FindFirstFileExInstance);
+        // NOTE: Last error set by caller
+        return INVALID_HANDLE_VALUE;
+    }
 
     ::SetLastError(ERROR_SUCCESS);
     return reinterpret_cast<HANDLE>(result.release());
@@ -368,177 +388,25 @@ BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<C
     Log(L"[%d]FindNextFileFixup is against request=%ls", FindNextFileInstance, data->requested_path.c_str());
 #endif
 
-    auto redirectedFileExists = [&](auto filename)
+    WIN32_FIND_DATAW findData;
+    if (!next_find_data(*data, findData))
     {
-        if (data->redirect_path.empty())
-        {
-            Log(L"[%d]FindNextFile redirectedFileExists returns false.", FindNextFileInstance);
-            return false;
-        }
-
-        auto revertSize = data->redirect_path.length();
-
-        // NOTE: 'is_ansi' evaluation not inline due to the bug:
-        //       https://developercommunity.visualstudio.com/content/problem/324366/illegal-indirection-error-when-the-evaluation-of-i.html
-        constexpr bool is_ansi = psf::is_ansi<std::decay_t<decltype(*filename)>>;
-        if constexpr (is_ansi)
-        {
-            data->redirect_path += widen(filename);
-        }
-        else
-        {
-            data->redirect_path += filename;
-        }
-
-        auto result = impl::PathExists(data->redirect_path.c_str());
-        data->redirect_path.resize(revertSize);
-        Log(L"[%d]FindNextFile redirectedFileExists returns %ls", FindNextFileInstance, data->redirect_path.c_str());
-        return result;
-    };
-    auto vfspathFileExists = [&](auto filename)
-    {
-        if (data->package_vfs_path.empty())
-        {
-            Log(L"[%d]FindNextFile vfspathFileExists returns false.", FindNextFileInstance);
-            return false;
-        }
-
-        auto revertSize = data->package_vfs_path.length();
-
-        // NOTE: 'is_ansi' evaluation not inline due to the bug:
-        //       https://developercommunity.visualstudio.com/content/problem/324366/illegal-indirection-error-when-the-evaluation-of-i.html
-        constexpr bool is_ansi = psf::is_ansi<std::decay_t<decltype(*filename)>>;
-        if constexpr (is_ansi)
-        {
-            data->package_vfs_path += widen(filename);
-        }
-        else
-        {
-            data->package_vfs_path += filename;
-        }
-
-        auto result = impl::PathExists(data->package_vfs_path.c_str());
-        data->package_vfs_path.resize(revertSize);
-        Log(L"[%d]FindNextFile vfspathFileExists returns %ls", FindNextFileInstance, data->package_vfs_path.c_str());
-        return result;
-    };
-
-    if (!data->redirect_path.empty())
-    {
-        if (data->find_handles[0])
-        {
-            Log(L"[%d]FindNextFile[0] to be checked.", FindNextFileInstance);
-            if (impl::FindNextFile(data->find_handles[0].get(), findFileData))
-            {
-                Log(L"[%d]FindNextFile[0] returns TRUE: %ls", FindNextFileInstance, data->cached_data.cFileName);
-                return TRUE;
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[0] had FALSE with ERROR_NO_MORE_FILES.", FindNextFileInstance);
-                data->find_handles[0].reset();
-
-                if (data->package_vfs_path.empty() || !data->find_handles[1])
-                {
-                    Log(L"[%d]FindNextFile[1] not in use.", FindNextFileInstance);
-                    if (data->requested_path.empty() || !data->find_handles[2])
-                    {
-                        Log(L"[%d]FindNextFile[2] not in use, so return ERROR_NO_MORE_FILES.", FindNextFileInstance);
-                        // NOTE: Last error scribbled over by closing find_handles[0]
-                        ::SetLastError(ERROR_NO_MORE_FILES);
-                        return FALSE;
-                    }
-                    // else check[1]
-                }
-
-                if (!redirectedFileExists(data->cached_data.cFileName))
-                {
-                    if (copy_find_data(data->cached_data, *findFileData))
-                    {
-                        Log(L"[%d]FindNextFile[0] returns FALSE with last error set by caller", FindNextFileInstance);
-                        // NOTE: Last error set by caller
-                        return FALSE;
-                    }
-
-                    LogString(FindNextFileInstance, L"FindNextFile[0] returns TRUE with ERROR_SUCCESS and file %ls", data->cached_data.cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-            }
-            else
-            {
-                // Error due to something other than reaching the end 
-                Log(L"[%d]FindNextFile[0] returns FALSE", FindNextFileInstance);
-                return FALSE;
-            }
-        }
-    }
-
-    if (!data->package_vfs_path.empty())
-    {
-        while (data->find_handles[1])
-        {
-            if (impl::FindNextFile(data->find_handles[1].get(), findFileData))
-            {
-                // Skip the file if it exists in the redirected path
-                if (!redirectedFileExists(findFileData->cFileName))
-                {
-                    LogString(FindNextFileInstance, L"FindNextFile[1] returns TRUE with ERROR_SUCCESS and %ls", findFileData->cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-                // Otherwise, skip this file and check the next one
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[1] returns FALSE with ERROR_NO_MORE_FILES_FOUND.", FindNextFileInstance);
-                data->find_handles[1].reset();
-                // now check [2]
-            }
-            else
-            {
-                Log(L"[%d]FindNextFile[1] returns FALSE", FindNextFileInstance);
-                // Error due to something other than reaching the end
-                return FALSE;
-            }
-        }
+        auto err = ::GetLastError();
+        Log(L"[%d]FindNextFile returns FALSE with error 0x%x", FindNextFileInstance, err);
+        ::SetLastError(err);
+        return FALSE;
     }
 
-    if (!data->requested_path.empty())
+    if (copy_find_data(findData, *findFileData))
     {
-        while (data->find_handles[2])
-        {
-            if (impl::FindNextFile(data->find_handles[2].get(), findFileData))
-            {
-                // Skip the file if it exists in the redirected path
-                if (!redirectedFileExists(findFileData->cFileName) &&
-                    !vfspathFileExists(findFileData->cFileName))
-                {
-                    LogString(FindNextFileInstance, L"FindNextFile[2] returns TRUE with ERROR_SUCCESS and %ls", findFileData->cFileName);
-                    ::SetLastError(ERROR_SUCCESS);
-                    return TRUE;
-                }
-                // Otherwise, skip this file and check the next one
-            }
-            else if (::GetLastError() == ERROR_NO_MORE_FILES)
-            {
-                Log(L"[%d]FindNextFile[2] returns FALSE with ERROR_NO_MORE_FILES_FOUND.", FindNextFileInstance);
-                data->find_handles[2].reset();
-                ::SetLastError(ERROR_NO_MORE_FILES);
-                return FALSE;
-            }
-            else
-            {
-                Log(L"[%d]FindNextFile[2] returns FALSE", FindNextFileInstance);
-                // Error due to something other than reaching the end
-                return FALSE;
-            }
-        }
+        Log(L"[%d]FindNextFile returns FALSE with last error set by caller", FindNextFileInstance);
+        // NOTE: Last error set by caller
+        return FALSE;
     }
-    // We ran out of data either on a previous call, or by ignoring files that have been redirected
-    ::SetLastError(ERROR_NO_MORE_FILES);
-    return FALSE;
 
+    LogString(FindNextFileInstance, L"FindNextFile returns TRUE with ERROR_SUCCESS and", findData.cFileName);
+    ::SetLastError(ERROR_SUCCESS);
+    return TRUE;
 }
 catch (...)
 {
@@ -30,6 +30,8 @@ namespace impl
 
     inline auto CreateHardLink = psf::detoured_string_function(&::CreateHardLinkA, &::CreateHardLinkW);
 
+    inline auto CreateProcess = psf::detoured_string_function(&::CreateProcessA, &::CreateProcessW);
+
     inline auto CreateSymbolicLink = psf::detoured_string_function(&::CreateSymbolicLinkA, &::CreateSymbolicLinkW);
 
     inline auto DeleteFile = psf::detoured_string_function(&::DeleteFileA, &::DeleteFileW);
@@ -54,9 +54,16 @@ UINT __stdcall GetPrivateProfileIntFixup(
             {
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::open_for_read);
                     if (shouldRedirect)
                     {
+                        UINT cachedResult;
+                        if (CachedGetPrivateProfileInt(redirectPath, sectionName, key, nDefault, cachedResult))
+                        {
+                            Log(L" [%d]Cached returned uint: %d ", GetPrivateProfileIntInstance, cachedResult);
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             UINT retval = impl::GetPrivateProfileIntW(widen_argument(sectionName).c_str(), widen_argument(key).c_str(), nDefault, redirectPath.c_str());
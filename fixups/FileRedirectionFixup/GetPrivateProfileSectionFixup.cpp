@@ -25,9 +25,15 @@ DWORD __stdcall GetPrivateProfileSectionFixup(
                 LogString(GetPrivateProfileSectionInstance,L"GetPrivateProfileSectionFixup for fileName", widen(fileName, CP_ACP).c_str());
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::open_for_read);
                     if (shouldRedirect)
                     {
+                        DWORD cachedResult;
+                        if (CachedGetPrivateProfileSection(redirectPath, appName, string, stringLength, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             auto wideString = std::make_unique<wchar_t[]>(stringLength);
@@ -24,9 +24,15 @@ DWORD __stdcall GetPrivateProfileSectionNamesFixup(
                 LogString(GetPrivateProfileSectionNamesInstance,L"GetPrivateProfileSectionNamesFixup for fileName", widen(fileName, CP_ACP).c_str());
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::open_for_read);
                     if (shouldRedirect)
                     {
+                        DWORD cachedResult;
+                        if (CachedGetPrivateProfileSectionNames(redirectPath, string, stringLength, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             auto wideString = std::make_unique<wchar_t[]>(stringLength);
@@ -57,9 +57,16 @@ DWORD __stdcall GetPrivateProfileStringFixup(
             {
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::open_for_read);
                     if (shouldRedirect)
                     {
+                        DWORD cachedResult;
+                        if (CachedGetPrivateProfileString(redirectPath, appName, keyName, defaultString, string, stringLength, cachedResult))
+                        {
+                            Log(L"[%d] Cached returned length=0x%x", GetPrivateProfileStringInstance, cachedResult);
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             
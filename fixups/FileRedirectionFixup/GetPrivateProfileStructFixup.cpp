@@ -26,9 +26,15 @@ BOOL __stdcall GetPrivateProfileStructFixup(
                 LogString(GetPrivateProfileStructInstance,L"GetPrivateProfileStructFixup for fileName", widen(fileName, CP_ACP).c_str());
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::open_for_read);
                     if (shouldRedirect)
                     {
+                        BOOL cachedResult;
+                        if (CachedGetPrivateProfileStruct(redirectPath, sectionName, key, structArea, uSizeStruct, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             return impl::GetPrivateProfileStructW(widen_argument(sectionName).c_str(), widen_argument(key).c_str(),
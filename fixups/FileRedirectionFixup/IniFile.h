@@ -0,0 +1,833 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// An in-memory model of an INI file, with the lookup and update semantics of the GetPrivateProfile* and
+// WritePrivateProfile* functions, so that a redirected INI file can be parsed once and then served from memory rather
+// than being re-opened and re-parsed by the OS on every key. Section and key names compare case insensitively and the
+// first of any duplicates wins. Lines that aren't changed (comments, blank lines, formatting) are written back exactly
+// as they were read.
+//
+// ini_file_cache holds one ini_file per redirected path. An ini_file remembers the identity and last write time of the
+// file that it was loaded from, so that a change made by someone else is noticed, and whether it has changes of its
+// own that have not been written back yet.
+//
+// Nothing here touches the disk. Reading and decoding the file, filling in its stamp, taking ini_file::mutex around the
+// document and writing it back are left to PrivateProfileCache.cpp.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace details
+{
+    inline bool is_ini_space(wchar_t ch) noexcept
+    {
+        return (ch == L' ') || (ch == L'\t') || (ch == L'\r') || (ch == L'\n') || (ch == L'\v') || (ch == L'\f');
+    }
+
+    inline std::wstring_view trim_ini_text(std::wstring_view text) noexcept
+    {
+        while (!text.empty() && is_ini_space(text.front()))
+        {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && is_ini_space(text.back()))
+        {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    inline std::wstring fold_ini_name(std::wstring_view name)
+    {
+        std::wstring result(name);
+        for (auto& ch : result)
+        {
+            ch = static_cast<wchar_t>(std::towupper(ch));
+        }
+        return result;
+    }
+}
+
+class ini_document
+{
+public:
+    ini_document()
+    {
+        m_sections.emplace_back();
+    }
+
+    void parse(std::wstring_view text)
+    {
+        m_sections.clear();
+        m_sectionIndex.clear();
+        m_sections.emplace_back();
+
+        while (!text.empty())
+        {
+            auto end = text.find_first_of(L"\r\n");
+            auto lineText = text.substr(0, end);
+            if (end == std::wstring_view::npos)
+            {
+                text = {};
+            }
+            else
+            {
+                // CRLF, LF and CR alone all end a line
+                text.remove_prefix(end + (((text[end] == L'\r') && (end + 1 < text.length()) && (text[end + 1] == L'\n')) ? 2 : 1));
+            }
+
+            auto line = parse_line(lineText);
+            if (line.kind == line_kind::section)
+            {
+                add_section(std::wstring(lineText), std::move(line.name));
+            }
+            else
+            {
+                m_sections.back().lines.push_back(std::move(line));
+            }
+        }
+
+        for (auto& section : m_sections)
+        {
+            index_keys(section);
+        }
+    }
+
+    // Every line ends with CRLF, which is what the OS writes
+    std::wstring serialize() const
+    {
+        std::wstring result;
+        for (auto& section : m_sections)
+        {
+            if (&section != &m_sections.front())
+            {
+                result += section.header;
+                result += L"\r\n";
+            }
+
+            for (auto& line : section.lines)
+            {
+                result += line.text;
+                result += L"\r\n";
+            }
+        }
+        return result;
+    }
+
+    // The result of a GetPrivateProfileString query. Lists (section or key names) hold each name followed by a null
+    // character, but not the final, second null character that terminates the list
+    struct query_result
+    {
+        std::wstring text;
+        bool is_list = false;
+        bool found = false;
+    };
+
+    // A null 'section' lists the section names, and a null 'key' lists the key names in 'section'. Otherwise this is
+    // the key's value, with a matching pair of surrounding quotes removed. The default is used, with trailing spaces
+    // removed, when the key (or a section with keys) doesn't exist
+    query_result query_string(const wchar_t* section, const wchar_t* key, const wchar_t* defaultValue) const
+    {
+        query_result result;
+        if (!section)
+        {
+            result.text = section_names();
+            result.is_list = true;
+            result.found = true;
+            return result;
+        }
+
+        if (!key)
+        {
+            result.text = key_names(section);
+            if (!result.text.empty())
+            {
+                result.is_list = true;
+                result.found = true;
+                return result;
+            }
+        }
+        else if (auto line = find(section, key); line && line->has_value)
+        {
+            result.text = unquote(line->value);
+            result.found = true;
+            return result;
+        }
+
+        std::wstring_view defaultText = defaultValue ? defaultValue : L"";
+        while (!defaultText.empty() && (defaultText.back() == L' '))
+        {
+            defaultText.remove_suffix(1);
+        }
+        result.text = unquote(defaultText);
+        return result;
+    }
+
+    // Each section name followed by a null character, in file order
+    std::wstring section_names() const
+    {
+        std::wstring result;
+        for (std::size_t index = 1; index < m_sections.size(); ++index)
+        {
+            if (!m_sections[index].name.empty())
+            {
+                result += m_sections[index].name;
+                result += L'\0';
+            }
+        }
+        return result;
+    }
+
+    // Each key name in the section followed by a null character. Lines without an '=' are not keys
+    std::wstring key_names(std::wstring_view section) const
+    {
+        std::wstring result;
+        if (auto found = find_section(section))
+        {
+            for (auto& line : found->lines)
+            {
+                if ((line.kind == line_kind::entry) && line.has_value)
+                {
+                    result += line.name;
+                    result += L'\0';
+                }
+            }
+        }
+        return result;
+    }
+
+    // Each "key=value" line in the section (or the line itself, for lines without an '=') followed by a null character.
+    // Comments and blank lines are left out
+    std::wstring section_lines(std::wstring_view section) const
+    {
+        std::wstring result;
+        if (auto found = find_section(section))
+        {
+            for (auto& line : found->lines)
+            {
+                if (line.kind == line_kind::entry)
+                {
+                    result += line.name;
+                    if (line.has_value)
+                    {
+                        result += L'=';
+                        result += line.value;
+                    }
+                    result += L'\0';
+                }
+            }
+        }
+        return result;
+    }
+
+    // The raw (still quoted) value of the key, or nullptr if there is no such key or the line has no '='
+    const std::wstring* value(std::wstring_view section, std::wstring_view key) const
+    {
+        auto line = find(section, key);
+        return (line && line->has_value) ? &line->value : nullptr;
+    }
+
+    // The WritePrivateProfileString operations. Each returns true if the document changed
+    bool set_value(std::wstring_view section, std::wstring_view key, std::wstring_view value)
+    {
+        // Leading white space is dropped, which is also what a later read would do
+        while (!value.empty() && details::is_ini_space(value.front()))
+        {
+            value.remove_prefix(1);
+        }
+
+        auto& target = get_or_add_section(section);
+        if (auto itr = target.keys.find(details::fold_ini_name(key)); itr != target.keys.end())
+        {
+            auto& line = target.lines[itr->second];
+            if (line.has_value && (line.value == value))
+            {
+                return false;
+            }
+
+            line.text = line.name + L"=" + std::wstring(value);
+            line.value = value;
+            line.has_value = true;
+            return true;
+        }
+
+        auto text = std::wstring(details::trim_ini_text(key)) + L"=" + std::wstring(value);
+        insert_line(target, parse_line(text));
+        return true;
+    }
+
+    bool remove_key(std::wstring_view section, std::wstring_view key)
+    {
+        auto target = find_section(section);
+        if (!target)
+        {
+            return false;
+        }
+
+        auto itr = target->keys.find(details::fold_ini_name(key));
+        if (itr == target->keys.end())
+        {
+            return false;
+        }
+
+        target->lines.erase(target->lines.begin() + itr->second);
+        index_keys(*target);
+        return true;
+    }
+
+    bool remove_section(std::wstring_view section)
+    {
+        auto itr = m_sectionIndex.find(details::fold_ini_name(section));
+        if (itr == m_sectionIndex.end())
+        {
+            return false;
+        }
+
+        m_sections.erase(m_sections.begin() + itr->second);
+        index_sections();
+        return true;
+    }
+
+    // WritePrivateProfileSection: 'lines' is a list of "key=value" strings, each followed by a null character, that
+    // replaces the whole content of the section
+    bool replace_section(std::wstring_view section, std::wstring_view lines)
+    {
+        auto& target = get_or_add_section(section);
+        std::vector<ini_line> replacement;
+        while (!lines.empty() && (lines.front() != L'\0'))
+        {
+            auto end = lines.find(L'\0');
+            auto text = lines.substr(0, end);
+            lines.remove_prefix((end == std::wstring_view::npos) ? lines.length() : end + 1);
+
+            auto line = parse_line(text);
+            if (line.kind == line_kind::entry)
+            {
+                // Written the way WritePrivateProfileString would write it
+                line.text = line.has_value ? (line.name + L"=" + line.value) : line.name;
+                replacement.push_back(std::move(line));
+            }
+        }
+
+        if (equal_lines(target.lines, replacement))
+        {
+            return false;
+        }
+
+        target.lines = std::move(replacement);
+        index_keys(target);
+        return true;
+    }
+
+    std::size_t section_count() const noexcept
+    {
+        return m_sections.size() - 1;
+    }
+
+private:
+    enum class line_kind
+    {
+        other,      // Blank lines, comments and malformed section headers
+        section,
+        entry,
+    };
+
+    struct ini_line
+    {
+        std::wstring text;  // As read from (or to be written to) the file, without the line break
+        std::wstring name;  // Trimmed section or key name
+        std::wstring value; // Trimmed value, if has_value
+        line_kind kind = line_kind::other;
+        bool has_value = false;
+    };
+
+    struct ini_section
+    {
+        std::wstring header;
+        std::wstring name;
+        std::vector<ini_line> lines;
+
+        // Folded key name -> index of the first line with that name
+        std::unordered_map<std::wstring, std::size_t> keys;
+    };
+
+    static ini_line parse_line(std::wstring_view text)
+    {
+        ini_line line;
+        line.text = text;
+
+        auto trimmed = details::trim_ini_text(text);
+        if (trimmed.empty() || (trimmed.front() == L';'))
+        {
+            return line;
+        }
+
+        if (trimmed.front() == L'[')
+        {
+            auto close = trimmed.rfind(L']');
+            if (close != std::wstring_view::npos)
+            {
+                line.kind = line_kind::section;
+                line.name = details::trim_ini_text(trimmed.substr(1, close - 1));
+            }
+            return line;
+        }
+
+        line.kind = line_kind::entry;
+        if (auto equals = trimmed.find(L'='); equals != std::wstring_view::npos)
+        {
+            line.name = details::trim_ini_text(trimmed.substr(0, equals));
+            line.value = details::trim_ini_text(trimmed.substr(equals + 1));
+            line.has_value = true;
+        }
+        else
+        {
+            line.name = trimmed;
+        }
+        return line;
+    }
+
+    static std::wstring unquote(std::wstring_view value)
+    {
+        if ((value.length() >= 2) && ((value.front() == L'"') || (value.front() == L'\'')) && (value.back() == value.front()))
+        {
+            value = value.substr(1, value.length() - 2);
+        }
+        return std::wstring(value);
+    }
+
+    static bool equal_lines(const std::vector<ini_line>& lhs, const std::vector<ini_line>& rhs)
+    {
+        if (lhs.size() != rhs.size())
+        {
+            return false;
+        }
+
+        for (std::size_t index = 0; index < lhs.size(); ++index)
+        {
+            if (lhs[index].text != rhs[index].text)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const ini_line* find(std::wstring_view section, std::wstring_view key) const
+    {
+        if (auto found = find_section(section))
+        {
+            if (auto itr = found->keys.find(details::fold_ini_name(key)); itr != found->keys.end())
+            {
+                return &found->lines[itr->second];
+            }
+        }
+        return nullptr;
+    }
+
+    const ini_section* find_section(std::wstring_view section) const
+    {
+        auto itr = m_sectionIndex.find(details::fold_ini_name(section));
+        return (itr == m_sectionIndex.end()) ? nullptr : &m_sections[itr->second];
+    }
+
+    ini_section* find_section(std::wstring_view section)
+    {
+        auto itr = m_sectionIndex.find(details::fold_ini_name(section));
+        return (itr == m_sectionIndex.end()) ? nullptr : &m_sections[itr->second];
+    }
+
+    ini_section& get_or_add_section(std::wstring_view section)
+    {
+        if (auto found = find_section(section))
+        {
+            return *found;
+        }
+
+        auto name = details::trim_ini_text(section);
+        add_section(L"[" + std::wstring(name) + L"]", std::wstring(name));
+        return m_sections.back();
+    }
+
+    void add_section(std::wstring header, std::wstring name)
+    {
+        m_sectionIndex.emplace(details::fold_ini_name(name), m_sections.size());
+        auto& section = m_sections.emplace_back();
+        section.header = std::move(header);
+        section.name = std::move(name);
+    }
+
+    // New keys go after the last non-blank line of the section, so that blank lines separating it from the next section
+    // stay where they are
+    static void insert_line(ini_section& section, ini_line line)
+    {
+        auto position = section.lines.size();
+        while ((position > 0) && details::trim_ini_text(section.lines[position - 1].text).empty())
+        {
+            --position;
+        }
+
+        section.lines.insert(section.lines.begin() + position, std::move(line));
+        index_keys(section);
+    }
+
+    static void index_keys(ini_section& section)
+    {
+        section.keys.clear();
+        for (std::size_t index = 0; index < section.lines.size(); ++index)
+        {
+            if (section.lines[index].kind == line_kind::entry)
+            {
+                section.keys.emplace(details::fold_ini_name(section.lines[index].name), index);
+            }
+        }
+    }
+
+    void index_sections()
+    {
+        m_sectionIndex.clear();
+        for (std::size_t index = 1; index < m_sections.size(); ++index)
+        {
+            m_sectionIndex.emplace(details::fold_ini_name(m_sections[index].name), index);
+        }
+    }
+
+    // m_sections[0] holds the lines ahead of the first section header, which no name can refer to
+    std::vector<ini_section> m_sections;
+
+    // Folded section name -> index of the first section with that name
+    std::unordered_map<std::wstring, std::size_t> m_sectionIndex;
+};
+
+// Copies a GetPrivateProfileString result to the caller's buffer the way the OS does: a string that doesn't fit is
+// truncated and the return value is size - 1, while a list that doesn't fit has its last string truncated, is still
+// terminated by two null characters, and the return value is size - 2
+template <typename CharT>
+std::uint32_t copy_profile_result(std::basic_string_view<CharT> text, bool isList, CharT* buffer, std::uint32_t size) noexcept
+{
+    if (!buffer || (size == 0))
+    {
+        return 0;
+    }
+
+    if (!isList)
+    {
+        auto count = (text.length() < size) ? static_cast<std::uint32_t>(text.length()) : size - 1;
+        text.copy(buffer, count);
+        buffer[count] = CharT{};
+        return count;
+    }
+
+    if (text.length() + 1 <= size)
+    {
+        text.copy(buffer, text.length());
+        buffer[text.length()] = CharT{};
+        if (text.empty() && (size > 1))
+        {
+            buffer[1] = CharT{};
+        }
+        return static_cast<std::uint32_t>(text.length());
+    }
+
+    if (size < 2)
+    {
+        buffer[0] = CharT{};
+        return 0;
+    }
+
+    text.copy(buffer, size - 2);
+    buffer[size - 2] = CharT{};
+    buffer[size - 1] = CharT{};
+    return size - 2;
+}
+
+// GetPrivateProfileInt: the leading integer of the value, as RtlUnicodeStringToInteger parses it with base 0. I.e. an
+// optional sign and an optional "0x", "0o" or "0b" prefix, and overflow wraps
+inline std::uint32_t parse_profile_int(std::wstring_view text) noexcept
+{
+    while (!text.empty() && (text.front() <= L' '))
+    {
+        text.remove_prefix(1);
+    }
+
+    bool negative = false;
+    if (!text.empty() && ((text.front() == L'-') || (text.front() == L'+')))
+    {
+        negative = (text.front() == L'-');
+        text.remove_prefix(1);
+    }
+
+    std::uint32_t base = 10;
+    if ((text.length() >= 2) && (text[0] == L'0'))
+    {
+        switch (text[1])
+        {
+        case L'x': case L'X': base = 16; break;
+        case L'o': case L'O': base = 8; break;
+        case L'b': case L'B': base = 2; break;
+        }
+
+        if (base != 10)
+        {
+            text.remove_prefix(2);
+        }
+    }
+
+    std::uint32_t result = 0;
+    for (auto ch : text)
+    {
+        std::uint32_t digit;
+        if ((ch >= L'0') && (ch <= L'9'))
+        {
+            digit = ch - L'0';
+        }
+        else if ((ch >= L'a') && (ch <= L'f'))
+        {
+            digit = ch - L'a' + 10;
+        }
+        else if ((ch >= L'A') && (ch <= L'F'))
+        {
+            digit = ch - L'A' + 10;
+        }
+        else
+        {
+            break;
+        }
+
+        if (digit >= base)
+        {
+            break;
+        }
+        result = result * base + digit;
+    }
+
+    return negative ? (0 - result) : result;
+}
+
+// GetPrivateProfileStruct/WritePrivateProfileStruct store the bytes as upper case hex digits, followed by the low byte
+// of their sum as a checksum
+enum class profile_struct_status
+{
+    success,
+    not_found,
+    bad_length,
+    bad_checksum,
+};
+
+inline std::wstring encode_profile_struct(const void* data, std::uint32_t size)
+{
+    constexpr wchar_t digits[] = L"0123456789ABCDEF";
+    std::wstring result;
+    result.reserve((static_cast<std::size_t>(size) + 1) * 2);
+
+    std::uint8_t checksum = 0;
+    auto bytes = static_cast<const std::uint8_t*>(data);
+    for (std::uint32_t index = 0; index < size; ++index)
+    {
+        result += digits[bytes[index] >> 4];
+        result += digits[bytes[index] & 0x0F];
+        checksum = static_cast<std::uint8_t>(checksum + bytes[index]);
+    }
+
+    result += digits[checksum >> 4];
+    result += digits[checksum & 0x0F];
+    return result;
+}
+
+// Nothing is written to 'data' unless the whole value decodes
+inline profile_struct_status decode_profile_struct(const std::wstring* value, void* data, std::uint32_t size)
+{
+    if (!value)
+    {
+        return profile_struct_status::not_found;
+    }
+
+    if (value->length() != (static_cast<std::size_t>(size) + 1) * 2)
+    {
+        return profile_struct_status::bad_length;
+    }
+
+    auto hexValue = [](wchar_t ch) -> int
+    {
+        if ((ch >= L'0') && (ch <= L'9')) return ch - L'0';
+        if ((ch >= L'a') && (ch <= L'f')) return ch - L'a' + 10;
+        if ((ch >= L'A') && (ch <= L'F')) return ch - L'A' + 10;
+        return -1;
+    };
+
+    std::vector<std::uint8_t> bytes;
+    bytes.reserve(static_cast<std::size_t>(size) + 1);
+    for (std::size_t index = 0; index < value->length(); index += 2)
+    {
+        auto high = hexValue((*value)[index]);
+        auto low = hexValue((*value)[index + 1]);
+        if ((high < 0) || (low < 0))
+        {
+            return profile_struct_status::bad_checksum;
+        }
+        bytes.push_back(static_cast<std::uint8_t>((high << 4) | low));
+    }
+
+    std::uint8_t checksum = 0;
+    for (std::uint32_t index = 0; index < size; ++index)
+    {
+        checksum = static_cast<std::uint8_t>(checksum + bytes[index]);
+    }
+    if (checksum != bytes.back())
+    {
+        return profile_struct_status::bad_checksum;
+    }
+
+    std::copy(bytes.begin(), bytes.end() - 1, static_cast<std::uint8_t*>(data));
+    return profile_struct_status::success;
+}
+
+// Only files that the OS would read as UTF-16 (little endian, with a byte order mark) or as ANSI are cached
+enum class ini_text_encoding
+{
+    unsupported,
+    ansi,
+    utf16,
+};
+
+inline ini_text_encoding detect_ini_encoding(const std::uint8_t* data, std::size_t size) noexcept
+{
+    if ((size >= 2) && (data[0] == 0xFF) && (data[1] == 0xFE))
+    {
+        return ini_text_encoding::utf16;
+    }
+    if (((size >= 2) && (data[0] == 0xFE) && (data[1] == 0xFF)) ||
+        ((size >= 3) && (data[0] == 0xEF) && (data[1] == 0xBB) && (data[2] == 0xBF)))
+    {
+        return ini_text_encoding::unsupported;
+    }
+    return ini_text_encoding::ansi;
+}
+
+// What identifies the content of a file on disk without reading it: a replaced file has a different file index, and a
+// modified one a different last write time or size
+struct ini_file_stamp
+{
+    std::uint64_t volume_serial = 0;
+    std::uint64_t file_index = 0;
+    std::uint64_t last_write_time = 0;
+    std::uint64_t size = 0;
+
+    bool operator==(const ini_file_stamp& other) const noexcept
+    {
+        return (volume_serial == other.volume_serial) && (file_index == other.file_index) &&
+            (last_write_time == other.last_write_time) && (size == other.size);
+    }
+
+    bool operator!=(const ini_file_stamp& other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+struct ini_file
+{
+    // The path the entry was created for. Never changes
+    std::wstring path;
+
+    // Guards everything below. Lookups take it shared; loads, updates and flushes take it exclusive
+    std::shared_mutex mutex;
+
+    // 'document' is the content of the file described by 'stamp'
+    bool loaded = false;
+
+    // 'document' has changes that have not been written to the file yet. The file on disk is not consulted while this
+    // is set
+    bool dirty = false;
+
+    // Writing 'document' back failed. Until it succeeds, writes are written through as they are made, so that a failure
+    // is reported to the caller that made the change, the same as the OS would
+    bool write_through = false;
+
+    ini_file_stamp stamp;
+    ini_text_encoding encoding = ini_text_encoding::ansi;
+    ini_document document;
+};
+
+class ini_file_cache
+{
+public:
+    explicit ini_file_cache(std::size_t capacity = 64) noexcept :
+        m_capacity(capacity)
+    {
+    }
+
+    // Returns the entry for 'path', creating it if necessary. When the cache is full, an entry without unwritten changes
+    // is dropped to make room; entries with changes are never dropped
+    std::shared_ptr<ini_file> get(const std::wstring& path)
+    {
+        auto key = details::fold_ini_name(path);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (auto itr = m_files.find(key); itr != m_files.end())
+        {
+            return itr->second;
+        }
+
+        if (m_files.size() >= m_capacity)
+        {
+            for (auto itr = m_files.begin(); itr != m_files.end(); ++itr)
+            {
+                std::unique_lock<std::shared_mutex> fileLock(itr->second->mutex, std::try_to_lock);
+                if (fileLock && !itr->second->dirty)
+                {
+                    fileLock.unlock();
+                    m_files.erase(itr);
+                    break;
+                }
+            }
+        }
+
+        auto file = std::make_shared<ini_file>();
+        file->path = path;
+        return m_files.emplace(std::move(key), std::move(file)).first->second;
+    }
+
+    // Returns the entry for 'path' if there is one, without creating it
+    std::shared_ptr<ini_file> find(const std::wstring& path) const
+    {
+        auto key = details::fold_ini_name(path);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto itr = m_files.find(key);
+        return (itr == m_files.end()) ? nullptr : itr->second;
+    }
+
+    // Invokes 'func' with every entry, without holding the cache lock
+    template <typename Func>
+    void for_each(Func&& func) const
+    {
+        std::vector<std::shared_ptr<ini_file>> files;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& entry : m_files)
+            {
+                files.push_back(entry.second);
+            }
+        }
+
+        for (auto& file : files)
+        {
+            func(*file);
+        }
+    }
+
+private:
+    const std::size_t m_capacity;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::wstring, std::shared_ptr<ini_file>> m_files;
+};
@@ -0,0 +1,187 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Directories in the redirected location that are known to exist. Redirecting a path with ensure_directory_structure
+// needs every parent directory of the redirected path to exist, and nearly all of them already do; remembering which
+// ones have been created (or found to exist) means that only the missing tail of the path needs CreateDirectory calls.
+// A directory is only ever remembered together with all of its parents, so invalidating a directory must also drop
+// everything beneath it, which is what invalidate does.
+//
+// Paths are remembered in the form the file system compares them: without a "\\?\" or "\\.\" prefix, with
+// backslashes, and case folded (see file_name_case.h). Redirected paths always carry the prefix, but a directory can be
+// removed through a plain DOS path (e.g. by an app that works under LocalAppData\Packages directly), and the two must
+// name the same entry. Directories can also disappear without going through the fixups (another process, or an API
+// that isn't hooked), so the deepest directory found in the set is checked before it is trusted; that one check still
+// replaces a CreateDirectory call per level.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <file_name_case.h>
+
+#include "RedirectCache.h"
+
+struct known_directory_statistics
+{
+    std::uint64_t create_calls = 0;
+    std::uint64_t skipped_creates = 0;
+    std::uint64_t stale_directories = 0;
+    path_cache_statistics cache;
+};
+
+class known_directory_set
+{
+public:
+    explicit known_directory_set(std::size_t capacity = 8192) noexcept :
+        m_directories(capacity)
+    {
+    }
+
+    // Appends 'relativePath' to 'result' and makes sure that the resulting path's parent directories exist, i.e. the
+    // original 'result' plus every leading component of 'relativePath' other than the last. 'create' is invoked with
+    // the full path of each directory not known to exist, deepest last, and returns true if the directory exists
+    // afterwards (either because it was created or because it was already there). 'exists' is invoked with the full
+    // path of the deepest directory found in the set and returns true if it still exists.
+    template <typename CreateFunc, typename ExistsFunc>
+    std::wstring ensure_parent_directories(std::wstring_view relativePath, std::wstring result, CreateFunc&& create, ExistsFunc&& exists)
+    {
+        std::vector<std::size_t> directoryLengths;
+        for (std::size_t pos = 0; pos < relativePath.length(); )
+        {
+            directoryLengths.push_back(result.length());
+
+            auto nextPos = relativePath.find_first_of(LR"(\/)", pos + 1);
+            if (nextPos == relativePath.length())
+            {
+                // Ignore trailing path separators. E.g. if the call is to CreateDirectory, we don't want it to "fail"
+                // with an "already exists" error
+                nextPos = std::wstring_view::npos;
+            }
+
+            result += relativePath.substr(pos, nextPos - pos);
+            pos = nextPos;
+        }
+
+        // Find the deepest directory that is known to exist; all of its parents exist too. If it has been removed behind
+        // our back, so has everything beneath it, and the search continues with its parent
+        auto missing = directoryLengths.size();
+        std::wstring key;
+        std::wstring directory;
+        while (missing > 0)
+        {
+            directory.assign(result, 0, directoryLengths[missing - 1]);
+            make_key(directory, key);
+            if (m_directories.find(key, [](char) { return true; }))
+            {
+                if (exists(directory.c_str()))
+                {
+                    break;
+                }
+                ++m_staleDirectories;
+                invalidate(directory);
+            }
+            --missing;
+        }
+        m_skippedCreates += missing;
+
+        bool remember = true;
+        for (auto index = missing; index < directoryLengths.size(); ++index)
+        {
+            directory.assign(result, 0, directoryLengths[index]);
+            ++m_createCalls;
+
+            // Once a directory fails to be created, nothing beneath it can be known to exist
+            remember = create(directory.c_str()) && remember;
+            if (remember)
+            {
+                make_key(directory, key);
+                m_directories.update(key, [](char&) {});
+            }
+        }
+
+        return result;
+    }
+
+    // Forgets 'path' and everything beneath it, e.g. after the directory has been removed or moved
+    void invalidate(std::wstring_view path)
+    {
+        std::wstring key;
+        make_key(path, key);
+        if (key.empty())
+        {
+            return;
+        }
+
+        m_directories.erase_if([&](const std::wstring& directory, char&)
+        {
+            return (directory.compare(0, key.length(), key) == 0) &&
+                ((directory.length() == key.length()) || (directory[key.length()] == L'\\'));
+        });
+    }
+
+    void clear()
+    {
+        m_directories.clear();
+    }
+
+    known_directory_statistics statistics() const noexcept
+    {
+        known_directory_statistics result;
+        result.create_calls = m_createCalls.load(std::memory_order_relaxed);
+        result.skipped_creates = m_skippedCreates.load(std::memory_order_relaxed);
+        result.stale_directories = m_staleDirectories.load(std::memory_order_relaxed);
+        result.cache = m_directories.statistics();
+        return result;
+    }
+
+private:
+    concurrent_path_cache<char> m_directories;
+    std::atomic<std::uint64_t> m_createCalls{ 0 };
+    std::atomic<std::uint64_t> m_skippedCreates{ 0 };
+    std::atomic<std::uint64_t> m_staleDirectories{ 0 };
+
+    // Directory names are case insensitive, either separator may be used, and the same directory can be named with or
+    // without a device prefix. E.g. "\\?\C:\Dir\" and "c:/dir" are both "C:\DIR"
+    static void make_key(std::wstring_view path, std::wstring& key)
+    {
+        key.clear();
+        if ((path.length() >= 4) && is_separator(path[0]) && is_separator(path[1]) &&
+            ((path[2] == L'?') || (path[2] == L'.')) && is_separator(path[3]))
+        {
+            path.remove_prefix(4);
+            if ((path.length() >= 4) && (psf::fold_file_name_char(path[0]) == L'U') &&
+                (psf::fold_file_name_char(path[1]) == L'N') && (psf::fold_file_name_char(path[2]) == L'C') &&
+                is_separator(path[3]))
+            {
+                // "\\?\UNC\server\share" is "\\server\share"
+                path.remove_prefix(3);
+                key = L"\\";
+            }
+        }
+        else if ((path.length() >= 4) && (path[0] == L'\\') && (path[1] == L'?') && (path[2] == L'?') && (path[3] == L'\\'))
+        {
+            path.remove_prefix(4);
+        }
+
+        while (!path.empty() && is_separator(path.back()))
+        {
+            path.remove_suffix(1);
+        }
+
+        for (auto ch : path)
+        {
+            key.push_back(is_separator(ch) ? L'\\' : psf::fold_file_name_char(ch));
+        }
+    }
+
+    static bool is_separator(wchar_t ch) noexcept
+    {
+        return (ch == L'\\') || (ch == L'/');
+    }
+};
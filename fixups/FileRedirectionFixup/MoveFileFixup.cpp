@@ -33,11 +33,26 @@ BOOL __stdcall MoveFileFixup(_In_ const CharT* existingFileName, _In_ const Char
                     redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str(),
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str());
                 if (bRet)
+                {
+                    // The source may have been a directory, and may have been in the redirected location even if it
+                    // wasn't redirected (e.g. when the app works under LocalAppData\Packages directly)
+                    InvalidateRedirectCache(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
+                    InvalidateKnownDirectories(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
                     Log(L"[%d]MoveFile returns true.", MoveFileInstance);
+                }
                 else
                     Log(L"[%d]MoveFile returns false.", MoveFileInstance);
                 return bRet;
             }
+
+            // See above; the source may still have been in the redirected location
+            BOOL bRet = impl::MoveFile(existingFileName, newFileName);
+            if (bRet)
+            {
+                InvalidateRedirectCache(widen_argument(existingFileName).c_str());
+                InvalidateKnownDirectories(widen_argument(existingFileName).c_str());
+            }
+            return bRet;
         }
     }
     catch (...)
@@ -77,11 +92,25 @@ BOOL __stdcall MoveFileExFixup(
                     redirectDest ? destRedirectPath.c_str() : widen_argument(newFileName).c_str(),
                     flags);
                 if (bRet)
+                {
+                    // See note in MoveFile
+                    InvalidateRedirectCache(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
+                    InvalidateKnownDirectories(redirectExisting ? existingRedirectPath.c_str() : widen_argument(existingFileName).c_str());
                     Log(L"[%d]MoveFileEx returns true.", MoveFileExInstance);
+                }
                 else
                     Log(L"[%d]MoveFileEx returns false.", MoveFileExInstance);
                 return bRet;
             }
+
+            // See note in MoveFile
+            BOOL bRet = impl::MoveFileEx(existingFileName, newFileName, flags);
+            if (bRet)
+            {
+                InvalidateRedirectCache(widen_argument(existingFileName).c_str());
+                InvalidateKnownDirectories(widen_argument(existingFileName).c_str());
+            }
+            return bRet;
         }
     }
     catch (...)
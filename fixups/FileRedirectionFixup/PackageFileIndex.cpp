@@ -0,0 +1,262 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <atomic>
+#include <mutex>
+
+#include <psf_framework.h>
+#include <utilities.h>
+
+#include "FunctionImplementations.h"
+#include "PackageFileIndex.h"
+#include "PathRedirection.h"
+
+extern std::filesystem::path g_packageRootPath;
+extern std::filesystem::path g_writablePackageRootPath;
+extern bool g_packageFileIndexEnabled;
+
+// Published once, either from the persisted file or from a fresh enumeration, and never torn down; lookups may be in
+// flight on any thread right up until the process exits
+std::once_flag g_packageFileIndexOnce;
+std::atomic<const package_file_index*> g_packageFileIndex{ nullptr };
+package_file_index g_packageFileIndexStorage;
+std::vector<std::uint8_t> g_packageFileIndexData;
+
+std::atomic<std::uint64_t> g_packageFileIndexHits{ 0 };
+std::atomic<std::uint64_t> g_packageFileIndexFallbacks{ 0 };
+
+static std::filesystem::path PackageFileIndexPath()
+{
+    // Next to the WritablePackageRoot, i.e. "%LocalAppData%\Packages\<PFN>\LocalCache\Local\Microsoft\PackageFileIndex"
+    return g_writablePackageRootPath.parent_path() / L"PackageFileIndex" / (psf::current_package_full_name() + L".idx");
+}
+
+static bool MapPackageFileIndex(const std::filesystem::path& indexPath, const std::wstring& key)
+{
+    auto file = impl::CreateFile(indexPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    auto mapping = ::GetFileSizeEx(file, &size) ? ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    ::CloseHandle(file);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    // The view keeps the file mapped after the mapping handle is closed
+    auto view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(mapping);
+    if (!view)
+    {
+        return false;
+    }
+
+    if (!g_packageFileIndexStorage.open(view, static_cast<std::size_t>(size.QuadPart), key))
+    {
+        Log(L"FRF package file index %ls is stale or invalid", indexPath.c_str());
+        ::UnmapViewOfFile(view);
+        return false;
+    }
+
+    g_packageFileIndex.store(&g_packageFileIndexStorage, std::memory_order_release);
+    return true;
+}
+
+// Returns false if some part of the package could not be enumerated, since an incomplete index would report files as
+// missing when they aren't
+static bool EnumeratePackageFiles(std::wstring& path, std::size_t rootLength, package_file_index_builder& builder)
+{
+    auto pathLength = path.length();
+    path += LR"(\*)";
+
+    WIN32_FIND_DATAW findData;
+    auto findHandle = impl::FindFirstFileEx(path.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    path.resize(pathLength);
+    if (findHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    bool result = true;
+    do
+    {
+        if ((std::wcscmp(findData.cFileName, L".") == 0) || (std::wcscmp(findData.cFileName, L"..") == 0))
+        {
+            continue;
+        }
+
+        path += L'\\';
+        path += findData.cFileName;
+        auto size = (static_cast<std::uint64_t>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+        builder.add(std::wstring_view(path).substr(rootLength), findData.dwFileAttributes, size);
+
+        // Reparse points are recorded, but not followed. Lookups beneath them go to the file system
+        if (((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) &&
+            ((findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0))
+        {
+            result = EnumeratePackageFiles(path, rootLength, builder);
+        }
+
+        path.resize(pathLength);
+    } while (result && impl::FindNextFile(findHandle, &findData));
+
+    if (result && (::GetLastError() != ERROR_NO_MORE_FILES))
+    {
+        result = false;
+    }
+
+    impl::FindClose(findHandle);
+    return result;
+}
+
+static void PersistPackageFileIndex(const std::filesystem::path& indexPath, const std::vector<std::uint8_t>& data)
+{
+    std::filesystem::create_directories(indexPath.parent_path());
+
+    // Write to a temporary name first so that a concurrently starting process never maps a partial file
+    auto tempPath = indexPath;
+    tempPath += L"." + std::to_wstring(::GetCurrentProcessId()) + L".tmp";
+    auto file = impl::CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD written = 0;
+    auto success = ::WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &written, nullptr) && (written == data.size());
+    ::CloseHandle(file);
+
+    if (!success || !impl::MoveFileEx(tempPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        impl::DeleteFile(tempPath.c_str());
+    }
+}
+
+static void CALLBACK BuildPackageFileIndex(PTP_CALLBACK_INSTANCE, PVOID) noexcept try
+{
+    auto indexPath = PackageFileIndexPath();
+    auto key = psf::current_package_full_name();
+    package_file_index_builder builder;
+    std::wstring path = g_packageRootPath.native();
+    if (!EnumeratePackageFiles(path, path.length(), builder))
+    {
+        Log(L"FRF package file index not built; enumeration of %ls failed with %d", path.c_str(), ::GetLastError());
+        return;
+    }
+
+    g_packageFileIndexData = builder.serialize(key);
+    if (!g_packageFileIndexStorage.open(g_packageFileIndexData.data(), g_packageFileIndexData.size(), key))
+    {
+        return;
+    }
+
+    g_packageFileIndex.store(&g_packageFileIndexStorage, std::memory_order_release);
+    Log(L"FRF package file index built with %llu entries", static_cast<std::uint64_t>(builder.size()));
+
+    PersistPackageFileIndex(indexPath, g_packageFileIndexData);
+}
+catch (...)
+{
+    // Without an index, everything just goes to the file system
+}
+
+// Runs on the first lookup, which comes from an intercepted call and so only once the fixups' detours transaction has
+// committed. Anything started while it is still open could be running the functions it is patching, impl::* included
+static void LoadPackageFileIndex() noexcept try
+{
+    auto indexPath = PackageFileIndexPath();
+    if (MapPackageFileIndex(indexPath, psf::current_package_full_name()))
+    {
+        Log(L"FRF package file index mapped from %ls", indexPath.c_str());
+        return;
+    }
+
+    // Enumerating a large package can take a while, so don't hold up the application for it. Lookups fall back to the
+    // file system until the index is published. The callback holds a reference on this dll while it runs
+    HMODULE module = nullptr;
+    ::GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        reinterpret_cast<LPCWSTR>(&LoadPackageFileIndex), &module);
+    TP_CALLBACK_ENVIRON environment;
+    ::InitializeThreadpoolEnvironment(&environment);
+    ::SetThreadpoolCallbackLibrary(&environment, module);
+    if (!::TrySubmitThreadpoolCallback(BuildPackageFileIndex, nullptr, &environment))
+    {
+        Log(L"FRF package file index not built; unable to queue its enumeration (%d)", ::GetLastError());
+    }
+    ::DestroyThreadpoolEnvironment(&environment);
+}
+catch (...)
+{
+    // Not fatal; lookups just go to the file system
+}
+
+static package_file_index::lookup_result LookupPackageFile(const wchar_t* path) noexcept
+{
+    if (!g_packageFileIndexEnabled || !path)
+    {
+        return {};
+    }
+
+    std::call_once(g_packageFileIndexOnce, LoadPackageFileIndex);
+    auto index = g_packageFileIndex.load(std::memory_order_acquire);
+    if (!index || !path_relative_to(path, g_packageRootPath))
+    {
+        return {};
+    }
+
+    auto relativePath = path + g_packageRootPath.native().length();
+    if ((relativePath[0] != L'\0') && !psf::is_path_separator(relativePath[0]))
+    {
+        // E.g. "C:\...\Package_1.0_x64__abc" vs. "C:\...\Package_1.0_x64__abcdef"
+        return {};
+    }
+
+    auto result = index->find(relativePath);
+    if (result.status == package_file_index::lookup_status::unknown)
+    {
+        ++g_packageFileIndexFallbacks;
+    }
+    else
+    {
+        ++g_packageFileIndexHits;
+    }
+
+    return result;
+}
+
+DWORD IndexedGetFileAttributes(const wchar_t* path)
+{
+    auto result = LookupPackageFile(path);
+    switch (result.status)
+    {
+    case package_file_index::lookup_status::found:
+        return result.attributes;
+
+    case package_file_index::lookup_status::not_found:
+        ::SetLastError(result.parent_missing ? ERROR_PATH_NOT_FOUND : ERROR_FILE_NOT_FOUND);
+        return INVALID_FILE_ATTRIBUTES;
+
+    default:
+        return impl::GetFileAttributes(path);
+    }
+}
+
+bool IndexedPathExists(const wchar_t* path)
+{
+    return IndexedGetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
+}
+
+void LogPackageFileIndexStatistics()
+{
+    if (auto index = g_packageFileIndex.load(std::memory_order_acquire))
+    {
+        PSF_LOG_INFO(L"FRF package file index: entries=%llu hits=%llu fallbacks=%llu\n", static_cast<std::uint64_t>(index->size()),
+            g_packageFileIndexHits.load(), g_packageFileIndexFallbacks.load());
+    }
+}
@@ -0,0 +1,495 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// A compact, immutable index of every file and directory under the package root. The package install directory never
+// changes for a given package full name, so the index is built once, persisted, and memory-mapped on later launches.
+// Existence and attribute checks against package paths can then be answered without a syscall.
+//
+// The serialized form is a single blob that can be used in place (e.g. from a read-only file mapping):
+//      header                      See index_header below
+//      key                         UTF-16, header.key_length code units, padded to 8 bytes. E.g. the package full name
+//      entries[header.entry_count] See index_entry below. Entry 0 is the package root
+//      names                       UTF-16, header.names_length code units. Names are ASCII lowercased
+// Entries are laid out breadth first, so the children of a directory are contiguous and sorted by name. A lookup is a
+// binary search per path component, starting from the root.
+//
+// Names are only folded in the ASCII range, where that is exactly how the file system compares them. Anything that
+// could match through some other rule (non-ASCII case folding, 8.3 short names, trailing dots/spaces, "." and "..",
+// streams, anything beneath a reparse point) reports 'unknown' rather than 'not_found', so that the caller asks the file
+// system.
+//
+// The index only knows what it is given: the serialized blob, or the entries added to the builder. Enumerating the
+// package and mapping the saved index are left to PackageFileIndex.cpp.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class package_file_index
+{
+public:
+    static constexpr std::uint32_t attribute_directory = 0x10; // FILE_ATTRIBUTE_DIRECTORY
+    static constexpr std::uint32_t attribute_reparse_point = 0x400; // FILE_ATTRIBUTE_REPARSE_POINT
+
+    enum class lookup_status
+    {
+        found,
+        not_found,
+        unknown,    // The index can't answer; ask the file system
+    };
+
+    struct lookup_result
+    {
+        lookup_status status = lookup_status::unknown;
+        std::uint32_t attributes = 0;
+        std::uint64_t size = 0;
+
+        // For not_found, whether it was a parent directory that was missing (i.e. ERROR_PATH_NOT_FOUND rather than
+        // ERROR_FILE_NOT_FOUND)
+        bool parent_missing = false;
+    };
+
+    package_file_index() = default;
+
+    // Validates 'data' and, if it is a well formed index for 'key', uses it in place. 'data' must outlive this object
+    bool open(const void* data, std::size_t size, std::wstring_view key) noexcept
+    {
+        *this = {};
+        if (size < sizeof(index_header))
+        {
+            return false;
+        }
+
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        index_header header;
+        std::memcpy(&header, bytes, sizeof(header));
+        if ((header.magic != index_magic) || (header.version != index_version) || (header.total_size != size))
+        {
+            return false;
+        }
+
+        auto keyOffset = sizeof(index_header);
+        auto entriesOffset = align(keyOffset + std::uint64_t(header.key_length) * sizeof(std::uint16_t));
+        auto namesOffset = entriesOffset + std::uint64_t(header.entry_count) * sizeof(index_entry);
+        if ((header.entry_count == 0) || (namesOffset + std::uint64_t(header.names_length) * sizeof(std::uint16_t) != size))
+        {
+            return false;
+        }
+
+        auto keyData = reinterpret_cast<const std::uint16_t*>(bytes + keyOffset);
+        if (!utf16_equal(key, keyData, header.key_length))
+        {
+            return false;
+        }
+
+        // Validate everything up front so that lookups don't have to. Children always come after their parent
+        auto entries = reinterpret_cast<const index_entry*>(bytes + entriesOffset);
+        for (std::uint32_t i = 0; i < header.entry_count; ++i)
+        {
+            auto& entry = entries[i];
+            if ((std::uint64_t(entry.name_offset) + entry.name_length > header.names_length) ||
+                ((entry.child_count != 0) && ((entry.first_child <= i) ||
+                    (std::uint64_t(entry.first_child) + entry.child_count > header.entry_count))))
+            {
+                return false;
+            }
+        }
+
+        m_entries = entries;
+        m_entryCount = header.entry_count;
+        m_names = reinterpret_cast<const std::uint16_t*>(bytes + namesOffset);
+        return true;
+    }
+
+    bool is_open() const noexcept
+    {
+        return m_entries != nullptr;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_entryCount;
+    }
+
+    // Looks up a path relative to the package root. Either separator is accepted, as are repeated separators
+    lookup_result find(std::wstring_view relativePath) const noexcept
+    {
+        lookup_result result;
+        if (!is_open())
+        {
+            return result;
+        }
+
+        std::uint32_t current = 0;
+        bool trailingSeparator = false;
+        std::size_t pos = 0;
+        while (pos < relativePath.length())
+        {
+            if (is_separator(relativePath[pos]))
+            {
+                ++pos;
+                trailingSeparator = true;
+                continue;
+            }
+
+            auto end = pos;
+            while ((end < relativePath.length()) && !is_separator(relativePath[end]))
+            {
+                ++end;
+            }
+
+            auto component = relativePath.substr(pos, end - pos);
+            trailingSeparator = false;
+            pos = end;
+
+            auto kind = classify_component(component);
+            if (kind == component_kind::unsupported)
+            {
+                return result;
+            }
+
+            if ((m_entries[current].attributes & attribute_reparse_point) != 0)
+            {
+                // Contents weren't indexed; the link may point anywhere
+                return result;
+            }
+
+            auto child = find_child(m_entries[current], component);
+            if (child == no_entry)
+            {
+                // Not there, unless the file system would have matched it some other way
+                result.status = (kind == component_kind::exact) ? lookup_status::not_found : lookup_status::unknown;
+                result.parent_missing = std::any_of(relativePath.begin() + pos, relativePath.end(), [](wchar_t ch)
+                {
+                    return !is_separator(ch);
+                });
+                return result;
+            }
+
+            current = child;
+        }
+
+        auto& entry = m_entries[current];
+        if (trailingSeparator && ((entry.attributes & attribute_directory) == 0))
+        {
+            // E.g. "foo.txt\"; let the file system decide what error that is
+            return result;
+        }
+
+        result.status = lookup_status::found;
+        result.attributes = entry.attributes;
+        result.size = entry.size;
+        return result;
+    }
+
+private:
+    friend class package_file_index_builder;
+
+    static constexpr std::uint32_t index_magic = 0x49465350; // "PSFI"
+    static constexpr std::uint32_t index_version = 1;
+    static constexpr std::uint32_t no_entry = 0xFFFFFFFF;
+
+    struct index_header
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t entry_count;
+        std::uint32_t key_length;
+        std::uint32_t names_length;
+        std::uint32_t reserved;
+        std::uint64_t total_size;
+    };
+    static_assert(sizeof(index_header) == 32);
+
+    struct index_entry
+    {
+        std::uint64_t size;
+        std::uint32_t name_offset;
+        std::uint32_t attributes;
+        std::uint32_t first_child;
+        std::uint32_t child_count;
+        std::uint16_t name_length;
+        std::uint16_t reserved0;
+        std::uint32_t reserved1;
+    };
+    static_assert(sizeof(index_entry) == 32);
+
+    enum class component_kind
+    {
+        exact,          // Plain ASCII name; if it isn't in the index, it doesn't exist
+        inexact,        // Might match an entry by some rule other than ASCII case folding
+        unsupported,    // Never answered from the index
+    };
+
+    const index_entry* m_entries = nullptr;
+    std::uint32_t m_entryCount = 0;
+    const std::uint16_t* m_names = nullptr;
+
+    static constexpr std::uint64_t align(std::uint64_t value) noexcept
+    {
+        return (value + 7) & ~std::uint64_t(7);
+    }
+
+    static constexpr bool is_separator(wchar_t ch) noexcept
+    {
+        return (ch == L'\\') || (ch == L'/');
+    }
+
+    static constexpr std::uint32_t fold(std::uint32_t ch) noexcept
+    {
+        return ((ch >= 'A') && (ch <= 'Z')) ? (ch - 'A' + 'a') : ch;
+    }
+
+    static component_kind classify_component(std::wstring_view component) noexcept
+    {
+        if ((component == L".") || (component == L".."))
+        {
+            return component_kind::unsupported;
+        }
+
+        auto result = component_kind::exact;
+        for (auto ch : component)
+        {
+            if ((ch == L':') || (ch == L'*') || (ch == L'?') || (ch == L'<') || (ch == L'>') || (ch == L'"') || (ch == L'|'))
+            {
+                // Streams and wildcards
+                return component_kind::unsupported;
+            }
+            else if ((ch == L'~') || (static_cast<std::uint32_t>(ch) > 0x7F))
+            {
+                result = component_kind::inexact;
+            }
+        }
+
+        if ((component.back() == L'.') || (component.back() == L' '))
+        {
+            // Win32 strips these
+            result = component_kind::inexact;
+        }
+
+        return result;
+    }
+
+    // Invokes 'func' with each UTF-16 code unit of 'str' (wchar_t is UTF-32 on some platforms)
+    template <typename Func>
+    static void for_each_utf16(std::wstring_view str, Func&& func)
+    {
+        for (auto ch : str)
+        {
+            auto value = static_cast<std::uint32_t>(ch);
+            if (value > 0xFFFF)
+            {
+                value -= 0x10000;
+                func(static_cast<std::uint16_t>(0xD800 + (value >> 10)));
+                func(static_cast<std::uint16_t>(0xDC00 + (value & 0x3FF)));
+            }
+            else
+            {
+                func(static_cast<std::uint16_t>(value));
+            }
+        }
+    }
+
+    static bool utf16_equal(std::wstring_view str, const std::uint16_t* data, std::size_t length) noexcept
+    {
+        std::size_t pos = 0;
+        bool equal = true;
+        for_each_utf16(str, [&](std::uint16_t unit)
+        {
+            equal = equal && (pos < length) && (data[pos] == unit);
+            ++pos;
+        });
+        return equal && (pos == length);
+    }
+
+    // Three way comparison of a (folded) name in the index against a query component
+    static int compare(const std::uint16_t* name, std::size_t nameLength, std::wstring_view component) noexcept
+    {
+        std::size_t pos = 0;
+        int result = 0;
+        for_each_utf16(component, [&](std::uint16_t unit)
+        {
+            if (result != 0)
+            {
+                return;
+            }
+
+            if (pos == nameLength)
+            {
+                result = -1;
+                return;
+            }
+
+            auto lhs = name[pos++];
+            auto rhs = fold(unit);
+            result = (lhs < rhs) ? -1 : (lhs > rhs) ? 1 : 0;
+        });
+
+        if ((result == 0) && (pos < nameLength))
+        {
+            result = 1;
+        }
+        return result;
+    }
+
+    std::uint32_t find_child(const index_entry& parent, std::wstring_view component) const noexcept
+    {
+        auto first = parent.first_child;
+        auto last = parent.first_child + parent.child_count;
+        while (first < last)
+        {
+            auto mid = first + (last - first) / 2;
+            auto& entry = m_entries[mid];
+            auto cmp = compare(m_names + entry.name_offset, entry.name_length, component);
+            if (cmp == 0)
+            {
+                return mid;
+            }
+            else if (cmp < 0)
+            {
+                first = mid + 1;
+            }
+            else
+            {
+                last = mid;
+            }
+        }
+
+        return no_entry;
+    }
+};
+
+// Accumulates entries (in any order) and produces the serialized form that package_file_index::open consumes
+class package_file_index_builder
+{
+public:
+    package_file_index_builder()
+    {
+        m_nodes.emplace_back();
+        m_nodes[0].attributes = package_file_index::attribute_directory;
+    }
+
+    // 'relativePath' is relative to the package root, using either separator. Missing parent directories are added
+    // implicitly
+    void add(std::wstring_view relativePath, std::uint32_t attributes, std::uint64_t size)
+    {
+        std::size_t current = 0;
+        std::size_t pos = 0;
+        while (pos < relativePath.length())
+        {
+            if (package_file_index::is_separator(relativePath[pos]))
+            {
+                ++pos;
+                continue;
+            }
+
+            auto end = pos;
+            while ((end < relativePath.length()) && !package_file_index::is_separator(relativePath[end]))
+            {
+                ++end;
+            }
+
+            std::u16string name;
+            package_file_index::for_each_utf16(relativePath.substr(pos, end - pos), [&](std::uint16_t unit)
+            {
+                name.push_back(static_cast<char16_t>(package_file_index::fold(unit)));
+            });
+            pos = end;
+
+            auto itr = m_nodes[current].children.find(name);
+            if (itr == m_nodes[current].children.end())
+            {
+                auto index = m_nodes.size();
+                m_nodes[current].children.emplace(std::move(name), index);
+                m_nodes.emplace_back();
+                m_nodes.back().attributes = package_file_index::attribute_directory;
+                current = index;
+            }
+            else
+            {
+                current = itr->second;
+            }
+        }
+
+        m_nodes[current].attributes = attributes;
+        m_nodes[current].size = size;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_nodes.size();
+    }
+
+    std::vector<std::uint8_t> serialize(std::wstring_view key) const
+    {
+        using index = package_file_index;
+
+        std::vector<std::uint16_t> keyData;
+        index::for_each_utf16(key, [&](std::uint16_t unit) { keyData.push_back(unit); });
+
+        // Breadth first, so that the children of each directory are contiguous (std::map already keeps them sorted)
+        std::vector<index::index_entry> entries;
+        std::vector<std::uint16_t> names;
+        std::vector<std::pair<std::size_t, const std::u16string*>> order;
+        order.reserve(m_nodes.size());
+        order.emplace_back(0, nullptr);
+        entries.reserve(m_nodes.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            auto& node = m_nodes[order[i].first];
+            index::index_entry entry = {};
+            entry.size = node.size;
+            entry.attributes = node.attributes;
+            entry.name_offset = static_cast<std::uint32_t>(names.size());
+            if (auto name = order[i].second)
+            {
+                entry.name_length = static_cast<std::uint16_t>(name->length());
+                names.insert(names.end(), name->begin(), name->end());
+            }
+
+            entry.first_child = static_cast<std::uint32_t>(order.size());
+            entry.child_count = static_cast<std::uint32_t>(node.children.size());
+            for (auto& [name, child] : node.children)
+            {
+                order.emplace_back(child, &name);
+            }
+
+            entries.push_back(entry);
+        }
+
+        index::index_header header = {};
+        header.magic = index::index_magic;
+        header.version = index::index_version;
+        header.entry_count = static_cast<std::uint32_t>(entries.size());
+        header.key_length = static_cast<std::uint32_t>(keyData.size());
+        header.names_length = static_cast<std::uint32_t>(names.size());
+
+        auto entriesOffset = index::align(sizeof(header) + keyData.size() * sizeof(std::uint16_t));
+        auto namesOffset = entriesOffset + entries.size() * sizeof(index::index_entry);
+        header.total_size = namesOffset + names.size() * sizeof(std::uint16_t);
+
+        std::vector<std::uint8_t> result(static_cast<std::size_t>(header.total_size));
+        std::memcpy(result.data(), &header, sizeof(header));
+        std::memcpy(result.data() + sizeof(header), keyData.data(), keyData.size() * sizeof(std::uint16_t));
+        std::memcpy(result.data() + entriesOffset, entries.data(), entries.size() * sizeof(index::index_entry));
+        std::memcpy(result.data() + namesOffset, names.data(), names.size() * sizeof(std::uint16_t));
+        return result;
+    }
+
+private:
+    struct node
+    {
+        std::uint32_t attributes = 0;
+        std::uint64_t size = 0;
+        std::map<std::u16string, std::size_t> children;
+    };
+
+    std::vector<node> m_nodes;
+};
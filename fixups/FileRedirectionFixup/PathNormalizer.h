@@ -0,0 +1,217 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The textual half of NormalizePath: URL decoding, "file:" prefix stripping and "::{GUID}"/"blob:" detection. This
+// used to be a chain of std::string copies (UrlDecode, then six StripAtStart calls, each of which took and returned
+// its string by value) on every intercepted call. It is now a single pass over the input into a buffer that lives on
+// the caller's stack and only touches the heap for paths that don't fit in it.
+//
+// Only the text is looked at here. Widening ANSI input, classifying the path type and calling GetFullPathName are left
+// to NormalizePath in PathRedirection.cpp.
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// A null-terminated character buffer with inline storage for InlineCapacity characters (not counting the null
+// terminator). The default is MAX_PATH, which covers just about every path that an application will hand us
+template <typename CharT, std::size_t InlineCapacity = 260>
+class path_buffer
+{
+public:
+    path_buffer() noexcept
+    {
+        m_inline[0] = 0;
+    }
+
+    path_buffer(const path_buffer&) = delete;
+    path_buffer& operator=(const path_buffer&) = delete;
+
+    CharT* data() noexcept
+    {
+        return m_data;
+    }
+
+    const CharT* c_str() const noexcept
+    {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    std::basic_string_view<CharT> view() const noexcept
+    {
+        return { m_data, m_size };
+    }
+
+    void clear() noexcept
+    {
+        m_size = 0;
+        m_data[0] = 0;
+    }
+
+    void push_back(CharT ch)
+    {
+        if (m_size == m_capacity)
+        {
+            reserve(m_capacity * 2);
+        }
+
+        m_data[m_size++] = ch;
+        m_data[m_size] = 0;
+    }
+
+    // Ensures room for 'capacity' characters plus a null terminator, preserving the current contents
+    void reserve(std::size_t capacity)
+    {
+        if (capacity <= m_capacity)
+        {
+            return;
+        }
+
+        auto heap = std::make_unique<CharT[]>(capacity + 1);
+        std::memcpy(heap.get(), m_data, (m_size + 1) * sizeof(CharT));
+        m_heap = std::move(heap);
+        m_data = m_heap.get();
+        m_capacity = capacity;
+    }
+
+    // For APIs that write directly into the buffer (e.g. MultiByteToWideChar). The caller must have reserved enough
+    // room beforehand
+    void set_size(std::size_t size) noexcept
+    {
+        m_size = size;
+        m_data[m_size] = 0;
+    }
+
+private:
+    CharT m_inline[InlineCapacity + 1];
+    std::unique_ptr<CharT[]> m_heap;
+    CharT* m_data = m_inline;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = InlineCapacity;
+};
+
+enum class path_input_kind
+{
+    path,               // Something that should continue on to path type classification and GetFullPathName
+    colon_colon_guid,   // E.g. "::{20D04FE0-3AEA-1069-A2D8-08002B30309D}"; a shell namespace item, not a file
+    blob,               // "blob:<hex string>"; seen with encrypted data, not a real file either
+};
+
+template <typename CharT>
+struct preprocessed_path
+{
+    path_input_kind kind = path_input_kind::path;
+
+    // Points inside of the buffer passed to preprocess_path and is null terminated. For 'path' this has any "file:"
+    // prefix stripped; for the other kinds it is the whole decoded input
+    std::basic_string_view<CharT> path;
+};
+
+namespace details
+{
+    template <typename CharT>
+    constexpr int hex_value(CharT ch) noexcept
+    {
+        return ((ch >= '0') && (ch <= '9')) ? (ch - '0') :
+            ((ch >= 'a') && (ch <= 'f')) ? (ch - 'a' + 10) :
+            ((ch >= 'A') && (ch <= 'F')) ? (ch - 'A' + 10) :
+            -1;
+    }
+
+    template <typename CharT>
+    constexpr bool starts_with(std::basic_string_view<CharT> str, std::string_view prefix) noexcept
+    {
+        if (str.length() < prefix.length())
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < prefix.length(); ++i)
+        {
+            if (str[i] != static_cast<CharT>(prefix[i]))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+// Decodes 'path' into 'buffer' and classifies it. URL escapes are "%XX" with exactly two hex digits; a '%' that isn't
+// followed by two hex digits is kept as is
+template <typename CharT, std::size_t InlineCapacity>
+preprocessed_path<CharT> preprocess_path(const CharT* path, path_buffer<CharT, InlineCapacity>& buffer)
+{
+    preprocessed_path<CharT> result;
+    buffer.clear();
+    if (!path)
+    {
+        return result;
+    }
+
+    for (auto itr = path; *itr; ++itr)
+    {
+        if (*itr == '%')
+        {
+            // NOTE: Short-circuiting ensures that we never read past the null terminator
+            auto high = details::hex_value(itr[1]);
+            auto low = (high >= 0) ? details::hex_value(itr[2]) : -1;
+            if (low >= 0)
+            {
+                buffer.push_back(static_cast<CharT>((high << 4) | low));
+                itr += 2;
+                continue;
+            }
+        }
+
+        buffer.push_back(*itr);
+    }
+
+    // The GUID check is made against the raw input, which is what it was always made against. A shell namespace path
+    // is "::{" followed by at least a 36 character GUID and a closing brace
+    constexpr std::size_t min_colon_colon_guid_length = 40;
+    std::basic_string_view<CharT> input = buffer.view();
+    if ((path[0] == ':') && (path[1] == ':') && (path[2] == '{') &&
+        (std::char_traits<CharT>::length(path) >= min_colon_colon_guid_length))
+    {
+        result.kind = path_input_kind::colon_colon_guid;
+        result.path = input;
+        return result;
+    }
+
+    if (details::starts_with(input, "blob:") || details::starts_with(input, "BLOB:"))
+    {
+        result.kind = path_input_kind::blob;
+        result.path = input;
+        return result;
+    }
+
+    // NOTE: These are applied in sequence (so more than one may be stripped), same as they always have been
+    constexpr std::string_view file_prefixes[] = { "file:\\\\", "file://", "FILE:\\\\", "FILE://", "\\\\file\\", "\\\\FILE\\" };
+    for (auto prefix : file_prefixes)
+    {
+        if (details::starts_with(input, prefix))
+        {
+            input.remove_prefix(prefix.length());
+        }
+    }
+
+    result.path = input;
+    return result;
+}
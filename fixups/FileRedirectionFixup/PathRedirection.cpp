@@ -7,12 +7,17 @@
 #include <vector>
 
 #include <known_folders.h>
+#include <vfs_folder_map.h>
 #include <objbase.h>
 #include <psf_framework.h>
 #include <utilities.h>
 
 #include "FunctionImplementations.h"
+#include "KnownDirectorySet.h"
+#include "PathNormalizer.h"
 #include "PathRedirection.h"
+#include "RedirectCache.h"
+#include "RedirectionRuleMatcher.h"
 #include "psf_tracelogging.h"
 #include "RemovePII.h"
 
@@ -27,12 +32,10 @@ std::filesystem::path g_finalPackageRootPath;
 
 DWORD g_FileIntceptInstance = 0;
 
-struct vfs_folder_mapping
-{
-    std::filesystem::path path;
-    std::filesystem::path package_vfs_relative_path; // E.g. "Windows"
-};
-std::vector<vfs_folder_mapping> g_vfsFolderMappings;
+psf::vfs_folder_map g_vfsFolderMap;
+
+// Only packages installed under WindowsApps are immutable; a loose layout registered for development can change under us
+bool g_packageFileIndexEnabled = false;
 
 void InitializePaths()
 {
@@ -53,62 +56,19 @@ void InitializePaths()
 	auto finalPackageRootPath = std::wstring(::PSFQueryFinalPackageRootPath());
 	g_finalPackageRootPath = psf::remove_trailing_path_separators(finalPackageRootPath);
     
-    // Ensure that the redirected root path exists
-    g_redirectRootPath = psf::known_folder(FOLDERID_LocalAppData) / std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\VFS)";
+    // Ensure that the redirected root path exists. This also resolves the known folder table that is used to classify
+    // paths on every intercepted call, so that the SHGetKnownFolderPath calls happen here rather than on first use
+    std::filesystem::path packagesPath = psf::known_folders().get(psf::known_root::local_app_data_packages).path;
+    g_redirectRootPath = packagesPath / psf::current_package_family_name() / LR"(LocalCache\Local\VFS)";
     std::filesystem::create_directories(g_redirectRootPath);
 
-    g_writablePackageRootPath = psf::known_folder(FOLDERID_LocalAppData) /std::filesystem::path(L"Packages") / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
+    g_writablePackageRootPath = packagesPath / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
     std::filesystem::create_directories(g_writablePackageRootPath);
 
-    // Folder IDs and their desktop bridge packaged VFS location equivalents. Taken from:
-    // https://docs.microsoft.com/en-us/windows/uwp/porting/desktop-to-uwp-behind-the-scenes
-    //      System Location                 Redirected Location (Under [PackageRoot]\VFS)   Valid on architectures
-    //      FOLDERID_SystemX86              SystemX86                                       x86, amd64
-    //      FOLDERID_System                 SystemX64                                       amd64
-    //      FOLDERID_ProgramFilesX86        ProgramFilesX86                                 x86, amd6
-    //      FOLDERID_ProgramFilesX64        ProgramFilesX64                                 amd64
-    //      FOLDERID_ProgramFilesCommonX86  ProgramFilesCommonX86                           x86, amd64
-    //      FOLDERID_ProgramFilesCommonX64  ProgramFilesCommonX64                           amd64
-    //      FOLDERID_Windows                Windows                                         x86, amd64
-    //      FOLDERID_ProgramData            Common AppData                                  x86, amd64
-    //      FOLDERID_System\catroot         AppVSystem32Catroot                             x86, amd64
-    //      FOLDERID_System\catroot2        AppVSystem32Catroot2                            x86, amd64
-    //      FOLDERID_System\drivers\etc     AppVSystem32DriversEtc                          x86, amd64
-    //      FOLDERID_System\driverstore     AppVSystem32Driverstore                         x86, amd64
-    //      FOLDERID_System\logfiles        AppVSystem32Logfiles                            x86, amd64
-    //      FOLDERID_System\spool           AppVSystem32Spool                               x86, amd64
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_SystemX86),                   LR"(SystemX86)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesX86),             LR"(ProgramFilesX86)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesCommonX86),       LR"(ProgramFilesCommonX86)"sv });
-#if !_M_IX86
-    // FUTURE: We may want to consider the possibility of a 32-bit application trying to reference "%windir%\sysnative\"
-    //         in which case we'll have to get smarter about how we resolve paths
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System), LR"(SystemX64)"sv });
-    // FOLDERID_ProgramFilesX64* not supported for 32-bit applications
-    // FUTURE: We may want to consider the possibility of a 32-bit process trying to access this path anyway. E.g. a
-    //         32-bit child process of a 64-bit process that set the current directory
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesX64), LR"(ProgramFilesX64)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramFilesCommonX64), LR"(ProgramFilesCommonX64)"sv });
-#endif
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_Windows),                      LR"(Windows)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_ProgramData),                  LR"(Common AppData)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System),                       LR"(System)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(catroot)"sv,     LR"(AppVSystem32Catroot)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(catroot2)"sv,    LR"(AppVSystem32Catroot2)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(drivers\etc)"sv, LR"(AppVSystem32DriversEtc)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(driverstore)"sv, LR"(AppVSystem32Driverstore)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(logfiles)"sv,    LR"(AppVSystem32Logfiles)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_System) / LR"(spool)"sv,       LR"(AppVSystem32Spool)"sv });
-    
-    // These are additional folders that may appear in MSIX packages and need help
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_LocalAppData),                 LR"(Local AppData)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_RoamingAppData),               LR"(AppData)"sv });
-
-    //These are additional folders seen from App-V packages converted into MSIX (still looking for an official App-V list)
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_Fonts),                        LR"(Fonts)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_PublicDesktop),                LR"(Common Desktop)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_CommonPrograms),               LR"(Common Programs)"sv });
-    g_vfsFolderMappings.push_back(vfs_folder_mapping{ psf::known_folder(FOLDERID_LocalAppDataLow),              LR"(LOCALAPPDATALOW)"sv });
+    // Known folders and their package VFS equivalents, in both directions (see vfs_folder_map.h for the list)
+    g_vfsFolderMap = psf::vfs_folder_map(g_packageRootPath, psf::default_vfs_folder_mappings());
+
+    g_packageFileIndexEnabled = g_packageRootPath.native().find(LR"(\windowsapps\)") != std::wstring::npos;
 }
 
 std::filesystem::path path_from_known_folder_string(std::wstring_view str)
@@ -181,320 +141,152 @@ std::filesystem::path path_from_known_folder_string(std::wstring_view str)
 struct path_redirection_spec
 {
     std::filesystem::path base_path;
-    std::wregex pattern;
     std::filesystem::path redirect_targetbase;
     bool isExclusion;
     bool isReadOnly;
 };
 
+// g_redirectionSpecs[i] holds the settings for the rule at index i of g_redirectionMatcher
 std::vector<path_redirection_spec> g_redirectionSpecs;
+redirection_rule_matcher g_redirectionMatcher;
 
-
-
-
-void Log(const char* fmt, ...)
+// ShouldRedirect decisions, keyed by normalized path. Each entry holds one result per redirect_flags combination since
+// the flags change both the outcome (check_file_presence) and the side effects that have already been performed
+// (ensure_directory_structure, copy_file).
+struct redirect_cache_entry
 {
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-        std::string str;
-        str.resize(256);
-        std::size_t count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
-        assert(count >= 0);
-        va_end(args);
+    static constexpr std::size_t flag_combinations = 16;
+    static_assert(static_cast<std::size_t>(redirect_flags::ensure_directory_structure | redirect_flags::copy_file | redirect_flags::check_file_presence | redirect_flags::read_only) < flag_combinations);
 
-        if (count > str.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            str.resize(count);
-
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vsnprintf(str.data(), str.size() + 1, fmt, args2);
-            assert(count >= 0);
-            va_end(args2);
-        }
+    std::uint16_t valid = 0;
+    path_redirect_info results[flag_combinations];
+};
 
-        str.resize(count);
-#if _DEBUG
-        ::OutputDebugStringA(str.c_str());
-#endif
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in Log()");
-        ::OutputDebugStringA(fmt);
-    }
-}
+bool g_redirectCacheEnabled = true;
+concurrent_path_cache<redirect_cache_entry> g_redirectCache;
 
-void Log(const wchar_t* fmt, ...)  
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
+// Parent directories of redirected paths that GenerateRedirectedPath has already created or found to exist. Shares the
+// "redirectCache" setting since it makes the same assumption: only this process removes things from the redirected
+// location
+known_directory_set g_knownDirectories;
 
-        std::wstring wstr;
-        wstr.resize(256);
-        std::size_t count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
-        va_end(args);
+// When set, opens that only read a file are served from the package until something opens it for write
+bool g_copyOnWriteEnabled = false;
 
-        if (count > wstr.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            wstr.resize(count);
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args2);
-            va_end(args2);
-        }
-        wstr.resize(count);
-#if _DEBUG
-        ::OutputDebugStringW(wstr.c_str());
-#endif
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in wide Log()");
-        ::OutputDebugStringW(fmt);
-    }
-}
+// See PrivateProfileCache.cpp
+extern bool g_privateProfileCacheEnabled;
 
-void LogString(const char* name, const char* value)
-{
-    Log("%s=%s\n", name, value);
-}
 
-void LogString(const char* name, const wchar_t* value)
-{
-    Log(L"%s=%ls\n", name, value);
-}
 
-void LogString(const wchar_t* name, const char* value)
-{
-    if ((value != NULL && value[1] != 0x0))
-    {
-        Log(L"%ls=%s\n", name, value);
-    }
-    else
-    {
-        Log(L"%ls=%ls", name, (wchar_t*)value);
-    }
-}
 
-void LogString(const wchar_t* name, const wchar_t* value)
+// The known folder table is resolved once (see InitializePaths), so each of these is a single walk of the input path
+bool IsUnderUserAppDataLocal(_In_ const wchar_t* fileName)
 {
-    if ((value != NULL && ((char*)value)[1] == 0x0))
-    {
-        Log(L"%ls=%ls\n", name, value);
-    }
-    else
-    {
-        Log(L"%ls=%s", name, (char*)value);
-    }
+    return psf::known_folders().classify(fileName).is_local_app_data();
 }
-
-void LogString(DWORD inst, const char* name, const char* value)
+bool IsUnderUserAppDataLocal(_In_ const char* fileName)
 {
-    Log("[%d] %s=%s\n", inst, name, value);
+    return psf::known_folders().classify(fileName).is_local_app_data();
 }
 
-void LogString(DWORD inst, const char* name, const wchar_t* value)
+bool IsUnderUserAppDataLocalPackages(_In_ const wchar_t* fileName)
 {
-    Log(L"[%d]%s=%ls\n", inst, name, value);
+    return psf::known_folders().classify(fileName).root == psf::known_root::local_app_data_packages;
 }
 
-void LogString(DWORD inst, const wchar_t* name, const char* value)
+bool IsUnderUserAppDataLocalPackages(_In_ const char* fileName)
 {
-    if ((value != NULL && value[1] != 0x0))
-    {
-        Log(L"[%d]%ls=%s\n", inst, name, value);
-    }
-    else
-    {
-        Log(L"[%d]%ls=%ls", inst, name, (wchar_t*)value);
-    }
+    return psf::known_folders().classify(fileName).root == psf::known_root::local_app_data_packages;
 }
 
-void LogString(DWORD inst, const wchar_t* name, const wchar_t* value)
+bool IsUnderUserAppDataRoaming(_In_ const wchar_t* fileName)
 {
-    if ((value != NULL && ((char*)value)[1] == 0x0))
-    {
-        Log(L"[%d]%ls=%ls\n", inst, name, value);
-    }
-    else
-    {
-        Log(L"[%d]%ls=%s", inst, name, (char*)value);
-    }
+    return psf::known_folders().classify(fileName).root == psf::known_root::roaming_app_data;
 }
 
-template <typename CharT>
-bool IsUnderUserAppDataLocalImpl(_In_ const CharT* fileName)
-{
-    if (fileName == NULL)
-    {
-        return false;
-    }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-  
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData));
-    }
-
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData));
-    }
-
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_LocalAppData));
-}
-bool IsUnderUserAppDataLocal(_In_ const wchar_t* fileName)
-{
-    return IsUnderUserAppDataLocalImpl(fileName);
-}
-bool IsUnderUserAppDataLocal(_In_ const char* fileName)
+bool IsUnderUserAppDataRoaming(_In_ const char* fileName)
 {
-    return IsUnderUserAppDataLocalImpl(fileName);
+    return psf::known_folders().classify(fileName).root == psf::known_root::roaming_app_data;
 }
 
-
 template <typename CharT>
-bool IsUnderUserAppDataLocalPackagesImpl(_In_ const CharT* fileName)
+std::filesystem::path GetPackageVFSPathImpl(const CharT* fileName, const psf::known_root_match& knownRoot)
 {
-    if (fileName == NULL)
+    if ((fileName == NULL) || (knownRoot.root == psf::known_root::none))
     {
-        return false;
+        return L"";
     }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
 
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
-    }
+    // NOTE: LocalAppData\Packages is intentionally treated as LocalAppData here, same as it always has been
+    auto result = g_packageVfsRootPath / (knownRoot.is_local_app_data() ? L"Local AppData" : L"AppData");
 
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
+    // The remainder of the path (if any) starts with a separator
+    auto remainder = fileName + knownRoot.length;
+    if (remainder[0] != '\0')
     {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
+        result /= widen(remainder + 1, CP_ACP);
     }
-
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_LocalAppData) / L"Packages");
+    return result;
 }
 
-bool IsUnderUserAppDataLocalPackages(_In_ const wchar_t* fileName)
+std::filesystem::path GetPackageVFSPath(const wchar_t* fileName)
 {
-    return IsUnderUserAppDataLocalPackagesImpl(fileName);
+    return GetPackageVFSPathImpl(fileName, psf::known_folders().classify(fileName));
 }
 
-bool IsUnderUserAppDataLocalPackages(_In_ const char* fileName)
+std::filesystem::path GetPackageVFSPath(const char* fileName)
 {
-    return IsUnderUserAppDataLocalPackagesImpl(fileName);
+    return GetPackageVFSPathImpl(fileName, psf::known_folders().classify(fileName));
 }
 
-
-template <typename CharT>
-bool IsUnderUserAppDataRoamingImpl(_In_ const CharT* fileName)
+std::filesystem::path GetPackageVFSPath(const wchar_t* fileName, const psf::known_root_match& knownRoot)
 {
-    if (fileName == NULL)
-    {
-        return false;
-    }
-    constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-    constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-
-    if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_RoamingAppData));
-    }
-
-    else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-    {
-        return path_relative_to(fileName + 4, psf::known_folder(FOLDERID_RoamingAppData));
-    }
-
-    return path_relative_to(fileName, psf::known_folder(FOLDERID_RoamingAppData));
+    return GetPackageVFSPathImpl(fileName, knownRoot);
 }
 
-bool IsUnderUserAppDataRoaming(_In_ const wchar_t* fileName)
+std::filesystem::path GetPackageVFSPath(const char* fileName, const psf::known_root_match& knownRoot)
 {
-    return IsUnderUserAppDataRoamingImpl(fileName);
+    return GetPackageVFSPathImpl(fileName, knownRoot);
 }
 
-bool IsUnderUserAppDataRoaming(_In_ const char* fileName)
+void InitializeConfiguration()
 {
-    return IsUnderUserAppDataRoamingImpl(fileName);
-}
+    std::wstringstream traceDataStream;
 
-template <typename CharT>
-std::filesystem::path GetPackageVFSPathImpl(const CharT* fileName)
-{
-    if (fileName != NULL)
+    if (auto rootConfig = ::PSFQueryCurrentDllConfig())
     {
-        constexpr wchar_t root_local_device_prefix[] = LR"(\\?\)";
-        constexpr wchar_t root_local_device_prefix_dot[] = LR"(\\.\)";
-
-        if (IsUnderUserAppDataLocal(fileName))
+        auto& rootObject = rootConfig->as_object();
+        traceDataStream << " config:\n";
+        if (auto redirectCacheValue = rootObject.try_get("redirectCache"))
         {
-            auto lad = psf::known_folder(FOLDERID_LocalAppData);
-            std::filesystem::path foo;
-            if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
-            {
-                foo = fileName + 4;
-            }
-
-            else if (std::equal(root_local_device_prefix_dot, root_local_device_prefix_dot + 4, fileName))
-            {
-                foo = fileName + 4;
-            }
-
-            else
-            {
-                foo = fileName;
-            }
-            auto testLad = g_packageVfsRootPath / L"Local AppData" / foo.wstring().substr(wcslen(lad.c_str()) + 1).c_str();
-            return testLad;
+            g_redirectCacheEnabled = redirectCacheValue->as_boolean().get();
+            traceDataStream << " redirectCache:" << (g_redirectCacheEnabled ? L"true" : L"false") << " ;";
         }
-        else if (IsUnderUserAppDataRoaming(fileName))
+        if (auto logLevelValue = rootObject.try_get("logLevel"))
         {
-            auto rad = psf::known_folder(FOLDERID_RoamingAppData);
-            std::filesystem::path foo;
-            if (std::equal(root_local_device_prefix, root_local_device_prefix + 4, fileName))
+            auto logLevel = logLevelValue->as_string().wstring();
+            psf::log_level level;
+            if (psf::parse_log_level(logLevel, level))
             {
-                foo = fileName + 4;
+                psf::set_log_level(level);
             }
-            else
-            {
-                foo = fileName;
-            }
-            auto testRad = g_packageVfsRootPath / L"AppData" / foo.wstring().substr(wcslen(rad.c_str()) + 1).c_str();
-            return testRad;
+            traceDataStream << " logLevel:" << logLevel << " ;";
+        }
+        if (auto copyOnWriteValue = rootObject.try_get("copyOnWrite"))
+        {
+            g_copyOnWriteEnabled = copyOnWriteValue->as_boolean().get();
+            traceDataStream << " copyOnWrite:" << (g_copyOnWriteEnabled ? L"true" : L"false") << " ;";
+        }
+        if (auto privateProfileCacheValue = rootObject.try_get("privateProfileCache"))
+        {
+            g_privateProfileCacheEnabled = privateProfileCacheValue->as_boolean().get();
+            traceDataStream << " privateProfileCache:" << (g_privateProfileCacheEnabled ? L"true" : L"false") << " ;";
+        }
+        if (auto packageFileIndexValue = rootObject.try_get("packageFileIndex"))
+        {
+            g_packageFileIndexEnabled = packageFileIndexValue->as_boolean().get();
+            traceDataStream << " packageFileIndex:" << (g_packageFileIndexEnabled ? L"true" : L"false") << " ;";
         }
-    }
-    return L"";
-}
-
-std::filesystem::path GetPackageVFSPath(const wchar_t* fileName)
-{
-    return GetPackageVFSPathImpl(fileName);
-}
-
-std::filesystem::path GetPackageVFSPath(const char* fileName)
-{
-    return GetPackageVFSPathImpl(fileName);
-}
-
-void InitializeConfiguration()
-{
-    std::wstringstream traceDataStream;
-
-    if (auto rootConfig = ::PSFQueryCurrentDllConfig())
-    {
-        auto& rootObject = rootConfig->as_object();
-        traceDataStream << " config:\n";
         if (auto pathsValue = rootObject.try_get("redirectedPaths"))
         {
             traceDataStream << " redirectedPaths:\n";
@@ -529,9 +321,9 @@ void InitializeConfiguration()
                         traceDataStream << pattern.as_string().wide() << " ;";                      
                         if (!traceOnly)
                         {
+                          g_redirectionMatcher.add(path.native(), patternString);
                           g_redirectionSpecs.emplace_back();
                           g_redirectionSpecs.back().base_path = path;
-                          g_redirectionSpecs.back().pattern.assign(patternString.data(), patternString.length());
                           g_redirectionSpecs.back().redirect_targetbase = redirectTargetBaseValue;
                           g_redirectionSpecs.back().isExclusion = IsExclusionValue;
                           g_redirectionSpecs.back().isReadOnly = IsReadOnlyValue;
@@ -574,7 +366,6 @@ void InitializeConfiguration()
 
         psf::TraceLogFixupConfig("FileRedirectionFixup", traceDataStream.str().c_str());
     }
-
 }
 
 template <typename CharT>
@@ -593,212 +384,71 @@ bool path_relative_to(const char* path, const std::filesystem::path& basePath)
     return path_relative_toImpl(path, basePath);
 }
 
-bool IsColonColonGuid(const char *path)
+// Converts an ANSI path to UTF-16 into 'buffer' without going through the heap unless the path is unusually long. ANSI
+// paths are interpreted in the active code page, same as the *A file APIs do
+template <std::size_t InlineCapacity>
+void WidenPath(std::string_view path, path_buffer<wchar_t, InlineCapacity>& buffer)
 {
-    if (strlen(path) > 39)
+    buffer.clear();
+    if (path.empty())
     {
-        if (path[0] == ':' &&
-            path[1] == ':' &&
-            path[2] == '{')
-        {
-            return true;
-        }
+        // MultiByteToWideChar fails when given a length of zero
+        return;
     }
-    return false;
-}
 
-bool IsColonColonGuid(const wchar_t *path)
-{
-    if (wcslen(path) > 39)
+    // UTF-16 never needs more code units than the input has bytes
+    buffer.reserve(path.length());
+    auto size = ::MultiByteToWideChar(
+        CP_ACP,
+        MB_ERR_INVALID_CHARS,
+        path.data(), static_cast<int>(path.length()),
+        buffer.data(), static_cast<int>(buffer.capacity()));
+    if (!size)
     {
-        if (path[0] == L':' &&
-            path[1] == L':' &&
-            path[2] == L'{'   )
-        {
-            return true;
-        }
+        throw_last_error();
     }
-    return false;
-}
 
-bool IsBlobColon(const std::string path)
-{
-    size_t found = path.find("blob:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    found = path.find("BLOB:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    return false;
-}
-
-bool IsBlobColon(const std::wstring path)
-{
-    size_t found = path.find(L"blob:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    found = path.find(L"BLOB:", 0);
-    if (found == 0)
-    {
-        return true;
-    }
-    return false;
-}
-
-// Method to decode a string that includes %xx replacement characters commonly found in URLs with the
-// native equivalent (std::string forrm).
-// Example input: C:\Program%20Files\Vendor%20Name
-std::string UrlDecode(std::string str) 
-{
-    std::string ret;
-    char ch;
-    size_t i,  len = str.length();
-    unsigned int ii;
-
-    for (i = 0; i < len; i++) 
-    {
-        if (str[i] != '%') 
-        {
-            ret += str[i];
-        }
-        else 
-        {            
-            if (sscanf_s(str.substr(i + 1, 4).c_str(), "%x", &ii) == 1)
-            {
-                ch = static_cast<char>(ii);
-                ret += ch;
-                if (ii <= 255)
-                {
-                    i = i + 2;
-                }
-                else
-                {
-                    i = i + 4;
-                }
-            }
-            else
-            {
-                ret += str[i];
-            }
-        }
-    }
-    return ret;
+    buffer.set_size(size);
 }
 
-// Method to decode a string that includes %xx replacement characters commonly found in URLs with the
-// native equivalent (std::wstring forrm).
-// Example input: C:\Program%20Files\Vendor%20Name
-std::wstring UrlDecode(std::wstring str) 
-{
-    std::wstring ret;
-    char ch;
-    size_t i,  len = str.length();
-    unsigned int ii;
-
-    for (i = 0; i < len; i++) 
-    {
-        if (str[i] != L'%') 
-        {
-            ret += str[i];
-        }
-        else 
-        {
-            if (swscanf_s(str.substr(i + 1, 4).c_str(), L"%x", &ii) == 1)
-            {
-                ch = static_cast<char>(ii);
-                ret += ch;
-                if (ii <= 255)
-                {
-                    i = i + 2;
-                }
-                else
-                {
-                    i = i + 4;
-                }
-            }
-            else
-            {
-                ret += str[i];
-            }
-        }
-    }
-    return ret;
-}
-
-// Method to remove certain URI prefixes (std::string form)
-std::string StripAtStart(std::string old_string, const char* toStrip)
-{
-    size_t found = old_string.find(toStrip, 0);
-    if (found == 0)
-    {
-        return old_string.substr(strlen(toStrip));
-    }
-    return old_string;
-}
-
-std::string StripFileColonSlash(std::string old_string)
-{
-    std::string sRet = old_string;
-    sRet = StripAtStart(sRet, "file:\\\\");
-    sRet = StripAtStart(sRet, "file://");
-    sRet = StripAtStart(sRet, "FILE:\\\\");
-    sRet = StripAtStart(sRet, "FILE://");
-    sRet = StripAtStart(sRet, "\\\\file\\");
-    sRet = StripAtStart(sRet, "\\\\FILE\\");
-
-    return sRet;
-}
-
-// Method to remove certain URI prefixes (std::wstring form)
-
-std::wstring StripAtStartW(std::wstring old_string, const wchar_t* toStrip)
-{
-    size_t found = old_string.find(toStrip, 0);
-    if (found == 0)
-    {
-        return old_string.substr(wcslen(toStrip));
-    }
-    return old_string;
-}
-
-std::wstring StripFileColonSlash(std::wstring old_string)
-{
-    std::wstring sRet = old_string;
-    sRet = StripAtStartW(sRet, L"file:\\\\");
-    sRet = StripAtStartW(sRet, L"file://");
-    sRet = StripAtStartW(sRet, L"FILE:\\\\");
-    sRet = StripAtStartW(sRet, L"FILE://");
-    sRet = StripAtStartW(sRet, L"\\\\file\\");
-    sRet = StripAtStartW(sRet, L"\\\\FILE\\");
-
-    return sRet;
-}
-
-template <typename CharT>
-normalized_path NormalizePathImpl(const CharT* path)
+// 'path' must be null terminated
+normalized_path NormalizePathImpl(std::wstring_view path)
 {
     normalized_path result;
 
-    result.path_type = psf::path_type(path);
+    result.path_type = psf::path_type(path.data());
     if (result.path_type == psf::dos_path_type::root_local_device)
     {
         // Root-local device paths are a direct escape into the object manager, so don't normalize them
-        result.full_path = widen(path);
+        result.full_path = path;
     }
     else if (result.path_type == psf::dos_path_type::local_device)
     {
         // these are a direct escape, but for devices.
-        result.full_path = widen(path); // widen(path + 4);
+        result.full_path = path;
     }
     else if (result.path_type != psf::dos_path_type::unknown)
     {
-        result.full_path = widen(psf::full_path(path));
+        // Have GetFullPathName write directly into the result. Nearly every path fits in MAX_PATH on the first try, so
+        // this is the only allocation that a typical call makes
+        result.full_path.resize(std::max<std::size_t>(path.length(), MAX_PATH));
+        auto len = psf::get_full_path_name(path.data(), static_cast<DWORD>(result.full_path.length() + 1), result.full_path.data());
+        if (len > result.full_path.length())
+        {
+            // Too small; 'len' is the required size, including the null terminator
+            result.full_path.resize(len - 1);
+            len = psf::get_full_path_name(path.data(), len, result.full_path.data());
+        }
+
+        if (!len || (len > result.full_path.length()))
+        {
+            // We don't expect to ever see this, but in the event that we do, treat it the same as any other path type
+            // that we don't handle below
+            assert(false);
+            len = 0;
+        }
+
+        result.full_path.resize(len);
         result.path_type = psf::path_type(result.full_path.c_str());
     }
     else // unknown
@@ -827,7 +477,7 @@ normalized_path NormalizePathImpl(const CharT* path)
     else
     {
         // GetFullPathName did something odd...
-        LogString(L"\t\tFRF Error: Path type not supported", path);
+        LogString(L"\t\tFRF Error: Path type not supported", path.data());
         Log(L"\t\tFRF Error: Path type: 0x%x", result.path_type);
 
         assert(false);
@@ -837,32 +487,47 @@ normalized_path NormalizePathImpl(const CharT* path)
     return result;
 }
 
+// Handles the results of preprocess_path that aren't file system paths
+normalized_path NormalizeNonPath(path_input_kind kind, std::wstring_view path)
+{
+    if (kind == path_input_kind::colon_colon_guid)
+    {
+        Log(L"Guid: avoidance");
+    }
+    else
+    {
+        // blob:hexstring has been seen, believed to be associated with writing encrypted data. Just pass it through as
+        // it is not a real file.
+        Log(L"Blob: avoidance");
+    }
+
+    normalized_path npath;
+    npath.full_path = path;
+    return npath;
+}
+
 normalized_path NormalizePath(const char* path)
 {
     if (path != NULL && path[0] != 0)
     {
-        std::string new_string = UrlDecode(path);       // replaces things like %3a with :
-        if (IsColonColonGuid(path))
+        // URL decoding (e.g. "%3a" to ':') and "file:\\" stripping happen in the input encoding, same as they always
+        // have, and only then is the result widened
+        path_buffer<char> decoded;
+        auto input = preprocess_path(path, decoded);
+
+        path_buffer<wchar_t> wide;
+        WidenPath(input.path, wide);
+        if (input.kind != path_input_kind::path)
         {
-            Log(L"Guid: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_string);
-            return npath;
+            return NormalizeNonPath(input.kind, wide.view());
         }
-        if (IsBlobColon(new_string))  // blog:hexstring has been seen, believed to be associated with writing encrypted data,  Just pass it through as it is not a real file.
-        {
-            Log(L"Blob: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_string);
-            return npath;
-        }      
-        new_string = StripFileColonSlash(new_string);        // removes "file:\\" from start of path if present
-        return NormalizePathImpl(new_string.c_str());
+
+        return NormalizePathImpl(wide.view());
     }
     else
     {
         //return NormalizePathImpl(L".");
-        return NormalizePathImpl(std::filesystem::current_path().c_str());
+        return NormalizePathImpl(std::filesystem::current_path().native());
     }
 }
 
@@ -870,29 +535,19 @@ normalized_path NormalizePath(const wchar_t* path)
 {
     if (path != NULL && path[0] != 0)
     {
-        std::wstring new_wstring = UrlDecode(path);   // replaces things like %3a with :
-        if (IsColonColonGuid(path))
+        path_buffer<wchar_t> decoded;
+        auto input = preprocess_path(path, decoded);
+        if (input.kind != path_input_kind::path)
         {
-            Log(L"Guid: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_wstring);
-            return npath;
+            return NormalizeNonPath(input.kind, input.path);
         }
-        if (IsBlobColon(new_wstring))  // blog:hexstring has been seen, believed to be associated with writing encrypted data,  Just pass it through as it is not a real file.
-        {
-            Log(L"Blob: avoidance");
-            normalized_path npath;
-            npath.full_path = widen(new_wstring);
-            return npath;
-        }        
 
-        new_wstring = StripFileColonSlash(new_wstring);     // removes "file:\\" from start of path if present
-        return NormalizePathImpl(new_wstring.c_str());
+        return NormalizePathImpl(input.path);
     }
     else
     {
         //return NormalizePathImpl(L".");
-        return NormalizePathImpl(std::filesystem::current_path().c_str());
+        return NormalizePathImpl(std::filesystem::current_path().native());
     }
 }
 
@@ -902,36 +557,17 @@ normalized_path NormalizePath(const wchar_t* path)
 // then modifies that path to its virtualized equivalent (e.g. "C:\Windows\System32\foo.txt")
 normalized_path DeVirtualizePath(normalized_path path)
 {
-    if (path.drive_absolute_path && path_relative_to(path.drive_absolute_path, g_packageVfsRootPath))
+    if (path.drive_absolute_path)
     {
-        auto packageRelativePath = path.drive_absolute_path + g_packageVfsRootPath.native().length();
-        if (psf::is_path_separator(packageRelativePath[0]))
+        // NOTE: Paths directly under VFS that aren't one of the known tokens (or a directory/file named something like
+        //       "VFSx") report as 'package' or 'none' and are left alone
+        auto match = g_vfsFolderMap.find(path.drive_absolute_path);
+        if (match.kind == psf::vfs_folder_map::match_kind::package_vfs)
         {
-            ++packageRelativePath;
-            for (auto& mapping : g_vfsFolderMappings)
-            {
-                if (path_relative_to(packageRelativePath, mapping.package_vfs_relative_path))
-                {
-                    auto vfsRelativePath = packageRelativePath + mapping.package_vfs_relative_path.native().length();
-                    if (psf::is_path_separator(vfsRelativePath[0]))
-                    {
-                        ++vfsRelativePath;
-                    }
-                    else if (vfsRelativePath[0])
-                    {
-                        // E.g. AppVSystem32Catroot2, but matched with AppVSystem32Catroot. This is not the match we are
-                        // looking for
-                        continue;
-                    }
-
-                    // NOTE: We should have already validated that mapping.path is drive-absolute
-                    path.full_path = (mapping.path / vfsRelativePath).native();
-                    path.drive_absolute_path = path.full_path.data();
-                    break;
-                }
-            }
+            // NOTE: We should have already validated that mapping.path is drive-absolute
+            path.full_path = g_vfsFolderMap.devirtualize(match).native();
+            path.drive_absolute_path = path.full_path.data();
         }
-        // Otherwise a directory/file named something like "VFSx" for some non-path separator/null terminator 'x'
     }
 
     return path;
@@ -945,55 +581,30 @@ normalized_path VirtualizePath(normalized_path path, DWORD impl)
     Log(L"[%d]\t\tVirtualizePath: Input drive_absolute_path %ls", impl, path.drive_absolute_path);
     Log(L"[%d]\t\tVirtualizePath: Input full_path %ls", impl, path.full_path.c_str());
 
-    if (path.drive_absolute_path != NULL && path_relative_to(path.drive_absolute_path, g_packageRootPath))
+    if (path.drive_absolute_path == NULL)
     {
-        Log(L"[%d]\t\tVirtualizePath: output same as input, is in package",impl);
+        // file is not on system drive
+        Log(L"[%d]\t\tVirtualizePath: output same as input, not on system drive.", impl);
         return path;
     }
-    
-    if (path.drive_absolute_path != NULL)
+
+    auto match = g_vfsFolderMap.find(path.drive_absolute_path);
+    if ((match.kind == psf::vfs_folder_map::match_kind::package) || (match.kind == psf::vfs_folder_map::match_kind::package_vfs))
     {
-        for (std::vector<vfs_folder_mapping>::reverse_iterator iter = g_vfsFolderMappings.rbegin(); iter != g_vfsFolderMappings.rend(); ++iter)
-        {
-            auto& mapping = *iter;
-            if (path_relative_to(path.drive_absolute_path, mapping.path))
-            {
-                LogString(impl, L"\t\t\t mapping entry match on path", mapping.path.wstring().c_str());
-                LogString(impl, L"\t\t\t package_vfs_relative_path", mapping.package_vfs_relative_path.native().c_str());
-                Log(L"[%d]\t\t\t rel length =%d, %d", impl, mapping.path.native().length(), mapping.package_vfs_relative_path.native().length());
-                auto vfsRelativePath = path.drive_absolute_path + mapping.path.native().length();
-                if (psf::is_path_separator(vfsRelativePath[0]))
-                {
-                    ++vfsRelativePath;
-                }
-                LogString(impl, L"\t\t\t VfsRelativePath", vfsRelativePath);
-                path.full_path = (g_packageVfsRootPath / mapping.package_vfs_relative_path / vfsRelativePath).native();
-                path.drive_absolute_path = path.full_path.data();
-                return path;
-            }
-            else if (path_relative_to(path.full_path.c_str(), mapping.path))
-            {
-                LogString(impl, L"\t\t\t mapping entry match on path", mapping.path.wstring().c_str());
-                LogString(impl, L"\t\t\t package_vfs_relative_path", mapping.package_vfs_relative_path.native().c_str());
-                Log(L"[%d]\t\t\t rel length =%d, %d", impl, mapping.path.native().length(), mapping.package_vfs_relative_path.native().length());
-                auto vfsRelativePath = path.full_path.c_str() + mapping.path.native().length();
-                if (psf::is_path_separator(vfsRelativePath[0]))
-                {
-                    ++vfsRelativePath;
-                }
-                LogString(impl, L"\t\t\t vfsRelativePath", vfsRelativePath);
-                path.full_path = (g_packageVfsRootPath / mapping.package_vfs_relative_path / vfsRelativePath).native();
-                path.drive_absolute_path = path.full_path.data();
-                return path;
-            }
-        }
+        Log(L"[%d]\t\tVirtualizePath: output same as input, is in package",impl);
+        return path;
     }
-    else
+
+    if (match.kind == psf::vfs_folder_map::match_kind::native)
     {
-        // file is not on system drive
-        Log(L"[%d]\t\tVirtualizePath: output same as input, not on system drive.", impl);
+        LogString(impl, L"\t\t\t mapping entry match on path", match.mapping->path.wstring().c_str());
+        LogString(impl, L"\t\t\t package_vfs_relative_path", match.mapping->package_vfs_relative_path.native().c_str());
+        LogString(impl, L"\t\t\t VfsRelativePath", match.relative_path);
+        path.full_path = g_vfsFolderMap.virtualize(match).native();
+        path.drive_absolute_path = path.full_path.data();
         return path;
     }
+
     Log(L"[%d]\t\tVirtualizePath: output same as input, no match.",impl);
     return path;
 }
@@ -1002,14 +613,24 @@ std::wstring GenerateRedirectedPath(std::wstring_view relativePath, bool ensureD
 {
     if (ensureDirectoryStructure)
     {
-        for (std::size_t pos = 0; pos < relativePath.length(); )
+        auto createDirectory = [&](const wchar_t* directory)
         {
-            LogString(inst,L"\t\tGenerateRedirectedPath: Create dir", result.c_str());
-            [[maybe_unused]] auto dirResult = impl::CreateDirectory(result.c_str(), nullptr);
-#if _DEBUG
+            LogString(inst,L"\t\tGenerateRedirectedPath: Create dir", directory);
+            auto dirResult = impl::CreateDirectory(directory, nullptr);
             auto err = ::GetLastError();
             assert(dirResult || (err == ERROR_ALREADY_EXISTS));
-#endif
+            return dirResult || (err == ERROR_ALREADY_EXISTS);
+        };
+
+        if (g_redirectCacheEnabled)
+        {
+            return g_knownDirectories.ensure_parent_directories(relativePath, std::move(result), createDirectory,
+                [](const wchar_t* directory) { return impl::PathExists(directory); });
+        }
+
+        for (std::size_t pos = 0; pos < relativePath.length(); )
+        {
+            createDirectory(result.c_str());
             auto nextPos = relativePath.find_first_of(LR"(\/)", pos + 1);
             if (nextPos == relativePath.length())
             {
@@ -1189,14 +810,29 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
         return result;
     }
     LogString(inst, L"\tFRF Should: for path", widen(path).c_str());
-    
-    size_t found = (widen(path)).find(L"WritablePackageRoot", 0);
-    if (found != std::wstring::npos)
+
+    // Searched as given, so that nothing is converted or allocated ahead of the cache lookup below
+    bool alreadyRedirected;
+    if constexpr (std::is_same_v<CharT, char>)
+    {
+        alreadyRedirected = std::string_view(path).find("WritablePackageRoot") != std::string_view::npos;
+    }
+    else
+    {
+        alreadyRedirected = std::wstring_view(path).find(L"WritablePackageRoot") != std::wstring_view::npos;
+    }
+    if (alreadyRedirected)
     {
         LogString(inst, L"Prevent redundant redirection.", widen(path).c_str());
         return result;
     }
 
+    if (!g_copyOnWriteEnabled)
+    {
+        // Same as copy_on_read then; don't spend a separate cache slot on it
+        flags &= ~redirect_flags::read_only;
+    }
+
     bool c_presense = flag_set(flags, redirect_flags::check_file_presence);
     bool c_copy = flag_set(flags, redirect_flags::copy_file);
     bool c_ensure = flag_set(flags, redirect_flags::ensure_directory_structure);
@@ -1220,6 +856,46 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     }
 
     LogString(inst, L"\t\tFRF Normalized", normalizedPath.drive_absolute_path);
+
+    const auto cacheSlot = static_cast<std::size_t>(flags);
+    if (g_redirectCacheEnabled)
+    {
+        auto found = g_redirectCache.find(normalizedPath.full_path, [&](const redirect_cache_entry& entry)
+        {
+            if ((entry.valid & (1u << cacheSlot)) == 0)
+            {
+                return false;
+            }
+
+            result = entry.results[cacheSlot];
+            return true;
+        });
+        if (found)
+        {
+            LogString(inst, L"\tFRF Should: cached result", result.should_redirect ? result.redirect_path.c_str() : L"(no redirect)");
+            return result;
+        }
+    }
+
+    // Decisions that depend on the (absence of) files, or on side effects that failed, must not be remembered. Note
+    // that normalizedPath gets devirtualized below, so hold on to the key that lookups are made with
+    bool cacheable = true;
+    const std::wstring cacheKey = g_redirectCacheEnabled ? normalizedPath.full_path : std::wstring{};
+    auto remember = [&]()
+    {
+        if (g_redirectCacheEnabled && cacheable)
+        {
+            g_redirectCache.update(cacheKey, [&](redirect_cache_entry& entry)
+            {
+                entry.results[cacheSlot] = result;
+                entry.valid |= static_cast<std::uint16_t>(1u << cacheSlot);
+            });
+        }
+    };
+
+    // vfspath starts from the same normalized path; no need to normalize the input a second time
+    auto vfspath = normalizedPath;
+
     // To be consistent in where we redirect files, we need to map VFS paths to their non-package-relative equivalent
     normalizedPath = DeVirtualizePath(std::move(normalizedPath));
 
@@ -1231,94 +907,46 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
 	
 	// Basically, what goes into RedirectedPath here also needs to go into 
 	// FindFirstFileFixup.cpp
-    auto vfspath = NormalizePath(path);
     vfspath = VirtualizePath(std::move(vfspath),inst);
     if (vfspath.drive_absolute_path != NULL)
     {
         LogString(inst, L"\t\tFRF Virtualized", vfspath.drive_absolute_path);
     }
 
-    // Figure out if this is something we need to redirect
-    for (auto& redirectSpec : g_redirectionSpecs)
+    // Figure out if this is something we need to redirect. The first rule (in configuration order) whose base path and
+    // pattern both match decides the outcome
+    auto match = g_redirectionMatcher.match(vfspath.drive_absolute_path);
+    if (match.pattern_failures)
     {
-        //LogString(inst, L"\t\tFRF Check against: base", redirectSpec.base_path.c_str());
-        if (path_relative_to(vfspath.drive_absolute_path, redirectSpec.base_path))
-        {
-            LogString(inst, L"\t\tFRF In ball park of base", redirectSpec.base_path.c_str());
-            auto relativePath = vfspath.drive_absolute_path + redirectSpec.base_path.native().length();
-            if (psf::is_path_separator(relativePath[0]))
-            {
-                ++relativePath;
-            }
-            else if (relativePath[0])
-            {
-                // Otherwise, just a substring match (e.g. we're trying to match against 'foo' but input was 'foobar')
-                continue;
-            }
-            // Otherwise exact match. Assume an implicit directory separator at the end (e.g. for matches to satisfy the
-            // first call to CreateDirectory
-            LogString(inst, L"\t\t\tFRF relativePath",relativePath);
-            try
-            {
-                if (std::regex_match(relativePath, redirectSpec.pattern))
-                {
-                    if (redirectSpec.isExclusion)
-                    {
-                        // The impact on isExclusion is that redirection is not needed.
-                        result.should_redirect = false;
-                        LogString(inst, L"\t\tFRF CASE:Exclusion for path", path);
-                    }
-                    else
-                    {
-                        result.should_redirect = true;
-                        result.shouldReadonly = (redirectSpec.isReadOnly == true);
+        psf::TraceLogExceptions("FileRedirectionFixupException", "Regex Failure. Likely a bad pattern was supplied");
+        Log(L"[%d]\tFRF: Regex failure. Likely a bad pattern was supplied.", inst);
+    }
 
-                        // Check if file exists as VFS path in the package
-                        if (impl::PathExists(vfspath.drive_absolute_path))
-                        {
-                            Log(L"[%d]\t\t\tFRF CASE:match, existing in package.", inst);
-                            destinationTargetBase = redirectSpec.redirect_targetbase;
-                            result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase, inst);
-                        }
-                        else
-                        {
-                            Log(L"[%d]\t\t\tFRF CASE:match, not existing in package.", inst);
-                            // If the folder above it exists, we might want to redirect anyway?
-                            std::filesystem::path abs = vfspath.drive_absolute_path;
-                            if (impl::PathExists(abs.parent_path().c_str()))
-                            {
-                                Log(L"[%d]\t\t\tFRF SUBCASE: parent folder is in package.", inst);
-                                destinationTargetBase = redirectSpec.redirect_targetbase;
-                                //result.redirect_path = RedirectedPath(normalizedPath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase);
-                                result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase, inst);
-                            }
-                            else
-                            {
-                                Log(L"[%d]\t\t\tFRF SUBCASE: parent folder is also not in package, but since relative should redirect.", inst);
-                                //result.should_redirect = false;
-                                destinationTargetBase = redirectSpec.redirect_targetbase;
-                                result.redirect_path = RedirectedPath(vfspath, flag_set(flags, redirect_flags::ensure_directory_structure), destinationTargetBase, inst);
-                            }
-                        }
-                        if (result.should_redirect)
-                            LogString(inst, L"\t\tFRF CASE:match on redirect_path", result.redirect_path.c_str());
-                    }
-                    break;
-                }
-                else
-                {
-                    LogString(inst, L"\t\tFRF no match on parse relativePath", relativePath);
-                }
-            }
-            catch (...)
-            {
-                psf::TraceLogExceptions("FileRedirectionFixupException", "Regex Failure. Likely a bad pattern was supplied");
-                Log(L"[%d]\tFRF: Regex failure. Likely a bad pattern was supplied.", inst);
-            }
+    if (match.index != redirection_rule_matcher::npos)
+    {
+        auto& redirectSpec = g_redirectionSpecs[match.index];
+        LogString(inst, L"\t\tFRF In ball park of base", redirectSpec.base_path.c_str());
+        LogString(inst, L"\t\t\tFRF relativePath", match.relative_path);
+        if (redirectSpec.isExclusion)
+        {
+            // The impact on isExclusion is that redirection is not needed.
+            result.should_redirect = false;
+            LogString(inst, L"\t\tFRF CASE:Exclusion for path", path);
         }
         else
         {
-            LogString(inst, L"\t\tFRF Not in ball park of base", redirectSpec.base_path.c_str());
+            result.should_redirect = true;
+            result.shouldReadonly = (redirectSpec.isReadOnly == true);
+            destinationTargetBase = redirectSpec.redirect_targetbase;
+
+            // Whether or not the file (or its parent folder) exists in the package, the redirected location is the
+            // same, so there's no need to probe the package here
+            Log(L"[%d]\t\t\tFRF CASE:match.", inst);
+            // Read only opens may not need the redirected location at all, so hold off on creating it until we know
+            result.redirect_path = RedirectedPath(vfspath,
+                flag_set(flags, redirect_flags::ensure_directory_structure) && !flag_set(flags, redirect_flags::read_only),
+                destinationTargetBase, inst);
+            LogString(inst, L"\t\tFRF CASE:match on redirect_path", result.redirect_path.c_str());
         }
     }
 
@@ -1328,6 +956,7 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     if (!result.should_redirect)
     {
         LogString(inst, L"\tFRF no redirect rule for path", path);
+        remember();
         return result;
     }
 
@@ -1336,8 +965,8 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     if (flag_set(flags, redirect_flags::check_file_presence))
     {
         if (!impl::PathExists(result.redirect_path.c_str()) &&
-            !impl::PathExists(vfspath.drive_absolute_path) &&
-            !impl::PathExists(normalizedPath.drive_absolute_path))
+            !IndexedPathExists(vfspath.drive_absolute_path) &&
+            !IndexedPathExists(normalizedPath.drive_absolute_path))
         {
             result.should_redirect = false;
             result.redirect_path.clear();
@@ -1349,6 +978,26 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
 
     Log(L"[%d]\t\tFRF post check 3",inst);
 
+    if (flag_set(flags, redirect_flags::read_only) && !impl::PathExists(result.redirect_path.c_str()))
+    {
+        // Copy-on-write: nothing has written to this file yet, so it can be read where it is. The copy is made by the
+        // first open for write. Not remembered, since that copy would make this decision stale
+        const wchar_t* source = IndexedPathExists(vfspath.drive_absolute_path) ? vfspath.drive_absolute_path :
+            IndexedPathExists(normalizedPath.drive_absolute_path) ? normalizedPath.drive_absolute_path : nullptr;
+        if (source)
+        {
+            result.redirect_path = source;
+            LogString(inst, L"\tFRF Should: Read only, using source", source);
+            return result;
+        }
+
+        if (flag_set(flags, redirect_flags::ensure_directory_structure))
+        {
+            // Nothing to read in place, so this is the same as copy_on_read after all
+            result.redirect_path = RedirectedPath(vfspath, true, destinationTargetBase, inst);
+        }
+    }
+
     if (flag_set(flags, redirect_flags::copy_file))
     {
         Log(L"[%d]\t\tFRF copy_file flag is set",inst);
@@ -1360,13 +1009,13 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
         else
         {
             std::filesystem::path CopySource = normalizedPath.drive_absolute_path;
-            if (impl::PathExists(vfspath.drive_absolute_path))
+            if (IndexedPathExists(vfspath.drive_absolute_path))
             {
                 CopySource = vfspath.drive_absolute_path;
             }
 
 
-            auto attr = impl::GetFileAttributes(CopySource.c_str()); //normalizedPath.drive_absolute_path);
+            auto attr = IndexedGetFileAttributes(CopySource.c_str()); //normalizedPath.drive_absolute_path);
             Log(L"[%d]\t\tFRF source %ls attributes=0x%x", inst, CopySource.c_str(), attr);
             if (attr != INVALID_FILE_ATTRIBUTES)
             {
@@ -1388,6 +1037,7 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
                     else
                     {
                         auto err = ::GetLastError();
+                        cacheable = (err == ERROR_FILE_EXISTS);
                         Log("[%d]\t\tFRF CopyFile Fail=0x%x", inst, err);
                         LogString(inst, L"\t\tFRF CopyFile Fail From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CopyFile Fail To", result.redirect_path.c_str());
@@ -1422,6 +1072,7 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
                     }
                     else
                     {
+                        cacheable = (::GetLastError() == ERROR_ALREADY_EXISTS);
                         Log("[%d]\t\tFRF CreateDir Fail=0x%x", inst, ::GetLastError());
                         LogString(inst, L"\t\tFRF CreateDir Fail From", CopySource.c_str());
                         LogString(inst, L"\t\tFRF CreateDir Fail To", result.redirect_path.c_str());
@@ -1441,15 +1092,121 @@ static path_redirect_info ShouldRedirectImpl(const CharT* path, redirect_flags f
     }
     LogString(inst, L"\tFRF Should: Redirect to result", result.redirect_path.c_str());
 
+    remember();
+    return result;
+}
+
+template <typename CharT>
+static path_redirect_info ShouldRedirectAndFlush(const CharT* path, redirect_flags flags, DWORD inst)
+{
+    auto result = ShouldRedirectImpl(path, flags, inst);
+    if (result.should_redirect)
+    {
+        FlushPrivateProfileCache(result.redirect_path);
+    }
     return result;
 }
 
 path_redirect_info ShouldRedirect(const char* path, redirect_flags flags, DWORD inst)
 {
-    return ShouldRedirectImpl(path, flags, inst);
+    return ShouldRedirectAndFlush(path, flags, inst);
 }
 
 path_redirect_info ShouldRedirect(const wchar_t* path, redirect_flags flags, DWORD inst)
+{
+    return ShouldRedirectAndFlush(path, flags, inst);
+}
+
+path_redirect_info ShouldRedirectPrivateProfile(const char* path, redirect_flags flags, DWORD inst)
 {
     return ShouldRedirectImpl(path, flags, inst);
 }
+
+path_redirect_info ShouldRedirectPrivateProfile(const wchar_t* path, redirect_flags flags, DWORD inst)
+{
+    return ShouldRedirectImpl(path, flags, inst);
+}
+
+// Redirected paths are "\\?\" paths, but the fixups may be handed the same location as a relative or plain DOS path
+// (e.g. by an app that works under LocalAppData\Packages directly). Both are compared as full paths without the prefix
+static const wchar_t* WithoutDevicePrefix(const wchar_t* path) noexcept
+{
+    auto type = psf::path_type(path);
+    return ((type == psf::dos_path_type::root_local_device) || (type == psf::dos_path_type::local_device)) ? path + 4 : path;
+}
+
+static std::filesystem::path ComparablePath(const std::filesystem::path& path)
+{
+    // Device paths are already absolute and aren't expanded any further
+    auto withoutPrefix = WithoutDevicePrefix(path.c_str());
+    if (withoutPrefix != path.c_str())
+    {
+        return psf::remove_trailing_path_separators(withoutPrefix);
+    }
+    return psf::remove_trailing_path_separators(psf::full_path(path.c_str()));
+}
+
+void InvalidateRedirectCache(const std::filesystem::path& redirectPath)
+{
+    if (!g_redirectCacheEnabled || redirectPath.empty())
+    {
+        return;
+    }
+
+    // Drop every cached decision whose redirect target is the changed path, or lies beneath it
+    auto changedPath = ComparablePath(redirectPath);
+    auto& changed = changedPath.native();
+    g_redirectCache.erase_if([&](const std::wstring&, redirect_cache_entry& entry)
+    {
+        for (std::size_t slot = 0; slot < redirect_cache_entry::flag_combinations; ++slot)
+        {
+            if ((entry.valid & (1u << slot)) == 0)
+            {
+                continue;
+            }
+
+            auto cachedPath = WithoutDevicePrefix(entry.results[slot].redirect_path.c_str());
+            if (path_relative_to(cachedPath, changedPath))
+            {
+                auto remainder = cachedPath[changed.length()];
+                if ((remainder == L'\0') || psf::is_path_separator(remainder))
+                {
+                    entry.valid &= static_cast<std::uint16_t>(~(1u << slot));
+                }
+            }
+        }
+
+        return entry.valid == 0;
+    });
+}
+
+void InvalidateKnownDirectories(const std::filesystem::path& directoryPath)
+{
+    if (g_redirectCacheEnabled && !directoryPath.empty())
+    {
+        g_knownDirectories.invalidate(ComparablePath(directoryPath).native());
+    }
+}
+
+path_cache_statistics RedirectCacheStatistics()
+{
+    return g_redirectCache.statistics();
+}
+
+void LogFixupStatistics()
+{
+    if (g_redirectCacheEnabled)
+    {
+        auto stats = RedirectCacheStatistics();
+        PSF_LOG_INFO(L"FRF redirect cache: hits=%llu misses=%llu insertions=%llu evictions=%llu invalidations=%llu\n",
+            stats.hits, stats.misses, stats.insertions, stats.evictions, stats.invalidations);
+
+        auto dirStats = g_knownDirectories.statistics();
+        PSF_LOG_INFO(L"FRF known directories: CreateDirectory calls=%llu skipped=%llu stale=%llu insertions=%llu evictions=%llu invalidations=%llu\n",
+            dirStats.create_calls, dirStats.skipped_creates, dirStats.stale_directories, dirStats.cache.insertions,
+            dirStats.cache.evictions, dirStats.cache.invalidations);
+    }
+
+    LogPackageFileIndexStatistics();
+    LogPrivateProfileCacheStatistics();
+}
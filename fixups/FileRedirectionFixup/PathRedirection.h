@@ -6,6 +6,10 @@
 
 #include <filesystem>
 #include <dos_paths.h>
+#include <known_folders.h>
+#include <psf_logging.h>
+
+#include "RedirectCache.h"
 
 enum class redirect_flags
 {
@@ -14,7 +18,12 @@ enum class redirect_flags
     copy_file = 0x0002,
     check_file_presence = 0x0004,
 
+    // The caller only reads. When copy-on-write is enabled and there is no redirected copy yet, the result points at the
+    // package (or native) file itself rather than at a fresh copy of it
+    read_only = 0x0008,
+
     copy_on_read = ensure_directory_structure | copy_file,
+    open_for_read = copy_on_read | read_only,
 };
 DEFINE_ENUM_FLAG_OPERATORS(redirect_flags);
 
@@ -34,8 +43,108 @@ struct path_redirect_info
 path_redirect_info ShouldRedirect(const char* path, redirect_flags flags, DWORD inst = 0);
 path_redirect_info ShouldRedirect(const wchar_t* path, redirect_flags flags, DWORD inst = 0);
 
+// Same as ShouldRedirect, for the GetPrivateProfile*/WritePrivateProfile* fixups. ShouldRedirect writes back buffered
+// WritePrivateProfile* changes to the path it returns, so that other fixups see the file as written; these don't, so
+// that a run of profile calls keeps using the cached file
+path_redirect_info ShouldRedirectPrivateProfile(const char* path, redirect_flags flags, DWORD inst = 0);
+path_redirect_info ShouldRedirectPrivateProfile(const wchar_t* path, redirect_flags flags, DWORD inst = 0);
+
+// ShouldRedirect decisions are cached per normalized path and redirect_flags value (unless disabled with the
+// "redirectCache" config setting). Decisions that depend on a file being absent are never cached, so creating files or
+// directories can't make a cached decision stale, but removing them can. Fixups that delete, move or replace something
+// in the redirected location must call this with the redirected path that they changed so that decisions for that
+// path, or anything beneath it, are recomputed on next use.
+void InvalidateRedirectCache(const std::filesystem::path& redirectPath);
+path_cache_statistics RedirectCacheStatistics();
+
+// Directories created for ensure_directory_structure are remembered so that later redirections beneath them don't need
+// to create them again. Fixups that remove or move a directory must call this with the path that they removed so that
+// it, and anything beneath it, are created again when next needed. The path may be redirected or not, relative or full.
+void InvalidateKnownDirectories(const std::filesystem::path& directoryPath);
+
+// The package install directory is immutable, so (unless disabled with the "packageFileIndex" config setting) its
+// contents are indexed once per package version and existence/attribute checks against package paths are answered from
+// that index. These are drop-in replacements for impl::GetFileAttributes and impl::PathExists; paths outside of the
+// package, and anything the index can't answer definitively, still go to the file system. The index is loaded, or its
+// build is queued, on the first lookup.
+DWORD IndexedGetFileAttributes(const wchar_t* path);
+bool IndexedPathExists(const wchar_t* path);
+void LogPackageFileIndexStatistics();
+
+// Redirected INI files are parsed once and (unless disabled with the "privateProfileCache" config setting) the
+// GetPrivateProfile*/WritePrivateProfile* fixups are served from memory. Each returns false if the cache can't serve the
+// call, in which case the caller forwards it to the OS with the redirected path, same as without the cache. Writes are
+// buffered; FlushPrivateProfileCache writes back the changes to one file (returning false, with the last error set, if
+// that fails), or to all of them. ShutdownPrivateProfileCache writes back everything when the fixup is unloaded.
+template <typename CharT>
+bool CachedGetPrivateProfileString(const std::filesystem::path& path, const CharT* appName, const CharT* keyName,
+    const CharT* defaultString, CharT* string, DWORD stringLength, DWORD& result);
+template <typename CharT>
+bool CachedGetPrivateProfileInt(const std::filesystem::path& path, const CharT* sectionName, const CharT* keyName, INT defaultValue, UINT& result);
+template <typename CharT>
+bool CachedGetPrivateProfileSection(const std::filesystem::path& path, const CharT* appName, CharT* string, DWORD stringLength, DWORD& result);
+template <typename CharT>
+bool CachedGetPrivateProfileSectionNames(const std::filesystem::path& path, CharT* string, DWORD stringLength, DWORD& result);
+template <typename CharT>
+bool CachedGetPrivateProfileStruct(const std::filesystem::path& path, const CharT* sectionName, const CharT* keyName,
+    LPVOID structArea, UINT structSize, BOOL& result);
+template <typename CharT>
+bool CachedWritePrivateProfileString(const std::filesystem::path& path, const CharT* appName, const CharT* keyName, const CharT* string, BOOL& result);
+template <typename CharT>
+bool CachedWritePrivateProfileSection(const std::filesystem::path& path, const CharT* appName, const CharT* string, BOOL& result);
+template <typename CharT>
+bool CachedWritePrivateProfileStruct(const std::filesystem::path& path, const CharT* appName, const CharT* keyName,
+    const void* structData, UINT structSize, BOOL& result);
+bool FlushPrivateProfileCache(const std::filesystem::path& path);
+void FlushPrivateProfileCache() noexcept;
+void ShutdownPrivateProfileCache() noexcept;
+void LogPrivateProfileCacheStatistics();
+
 struct normalized_path
 {
+    normalized_path() = default;
+
+    // drive_absolute_path points inside of full_path, so copies and moves need to re-point it at their own string
+    normalized_path(const normalized_path& other) :
+        full_path(other.full_path),
+        path_type(other.path_type),
+        drive_absolute_path(rebase(other.drive_absolute_offset()))
+    {
+    }
+
+    normalized_path(normalized_path&& other) noexcept :
+        path_type(other.path_type)
+    {
+        auto offset = other.drive_absolute_offset();
+        full_path = std::move(other.full_path);
+        drive_absolute_path = rebase(offset);
+        other.drive_absolute_path = nullptr;
+    }
+
+    normalized_path& operator=(const normalized_path& other)
+    {
+        if (this != &other)
+        {
+            full_path = other.full_path;
+            path_type = other.path_type;
+            drive_absolute_path = rebase(other.drive_absolute_offset());
+        }
+        return *this;
+    }
+
+    normalized_path& operator=(normalized_path&& other) noexcept
+    {
+        if (this != &other)
+        {
+            auto offset = other.drive_absolute_offset();
+            full_path = std::move(other.full_path);
+            path_type = other.path_type;
+            drive_absolute_path = rebase(offset);
+            other.drive_absolute_path = nullptr;
+        }
+        return *this;
+    }
+
     // The full_path could either be:
     //      1.  A drive-absolute path. E.g. "C:\foo\bar.txt"
     //      2.  A local device path. E.g. "\\.\C:\foo\bar.txt" or "\\.\COM1"
@@ -44,11 +153,24 @@ struct normalized_path
     // or empty if there was a failure
     std::wstring full_path;
 
-    psf::dos_path_type path_type;
+    psf::dos_path_type path_type = psf::dos_path_type::unknown;
 
     // A pointer inside of full_path if the path explicitly uses a drive symbolic link at the root, otherwise nullptr.
     // Note that this isn't perfect; e.g. we don't handle scenarios such as "\\localhost\C$\foo\bar.txt"
     wchar_t* drive_absolute_path = nullptr;
+
+private:
+    static constexpr std::size_t no_offset = static_cast<std::size_t>(-1);
+
+    std::size_t drive_absolute_offset() const noexcept
+    {
+        return drive_absolute_path ? static_cast<std::size_t>(drive_absolute_path - full_path.data()) : no_offset;
+    }
+
+    wchar_t* rebase(std::size_t offset) noexcept
+    {
+        return (offset == no_offset) ? nullptr : full_path.data() + offset;
+    }
 };
 
 normalized_path NormalizePath(const char* path);
@@ -86,17 +208,83 @@ bool IsUnderUserAppDataRoaming(_In_ const char* fileName);
 std::filesystem::path GetPackageVFSPath(const wchar_t* fileName);
 std::filesystem::path GetPackageVFSPath(const char* fileName);
 
+// Same as above, for callers that have already classified the path with psf::known_folders().classify
+std::filesystem::path GetPackageVFSPath(const wchar_t* fileName, const psf::known_root_match& knownRoot);
+std::filesystem::path GetPackageVFSPath(const char* fileName, const psf::known_root_match& knownRoot);
+
+
+
+
+// Log sites go through psf_logging.h. LogString is a macro, like Log, so that a disabled site is just the level check
+// and its arguments (often a converted copy of a path) are never evaluated
+inline void LogNameValue(const char* name, const char* value)
+{
+    psf::log_message("%s=%s\n", name, value);
+}
 
+inline void LogNameValue(const char* name, const wchar_t* value)
+{
+    psf::log_message(L"%s=%ls\n", name, value);
+}
+
+inline void LogNameValue(const wchar_t* name, const char* value)
+{
+    if ((value != NULL && value[1] != 0x0))
+    {
+        psf::log_message(L"%ls=%s\n", name, value);
+    }
+    else
+    {
+        psf::log_message(L"%ls=%ls", name, (wchar_t*)value);
+    }
+}
+
+inline void LogNameValue(const wchar_t* name, const wchar_t* value)
+{
+    if ((value != NULL && ((char*)value)[1] == 0x0))
+    {
+        psf::log_message(L"%ls=%ls\n", name, value);
+    }
+    else
+    {
+        psf::log_message(L"%ls=%s", name, (char*)value);
+    }
+}
+
+inline void LogNameValue(DWORD inst, const char* name, const char* value)
+{
+    psf::log_message("[%d] %s=%s\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const char* name, const wchar_t* value)
+{
+    psf::log_message(L"[%d]%s=%ls\n", inst, name, value);
+}
+
+inline void LogNameValue(DWORD inst, const wchar_t* name, const char* value)
+{
+    if ((value != NULL && value[1] != 0x0))
+    {
+        psf::log_message(L"[%d]%ls=%s\n", inst, name, value);
+    }
+    else
+    {
+        psf::log_message(L"[%d]%ls=%ls", inst, name, (wchar_t*)value);
+    }
+}
+
+inline void LogNameValue(DWORD inst, const wchar_t* name, const wchar_t* value)
+{
+    if ((value != NULL && ((char*)value)[1] == 0x0))
+    {
+        psf::log_message(L"[%d]%ls=%ls\n", inst, name, value);
+    }
+    else
+    {
+        psf::log_message(L"[%d]%ls=%s", inst, name, (char*)value);
+    }
+}
 
+#define LogString(...) PSF_LOG_CALL(::psf::log_level::verbose, LogNameValue, __VA_ARGS__)
 
-void Log(const char* fmt, ...);
-void Log(const wchar_t* fmt, ...);
-void LogString(const char* name, const char* value);
-void LogString(const char* name, const wchar_t* value);
-void LogString(const wchar_t* name, const char* value);
-void LogString(const wchar_t* name, const wchar_t* value);
-void LogString(DWORD inst, const char* name, const char* value);
-void LogString(DWORD inst, const char* name, const wchar_t* value);
-void LogString(DWORD inst, const wchar_t* name, const char* value);
-void LogString(DWORD inst, const wchar_t* name, const wchar_t* value);
 extern DWORD g_FileIntceptInstance;
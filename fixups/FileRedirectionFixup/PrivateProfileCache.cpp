@@ -0,0 +1,728 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Serves the GetPrivateProfile*/WritePrivateProfile* fixups from a parsed copy of each redirected INI file (see
+// IniFile.h). Every read still checks that the file on disk is the one that was parsed, which costs an open and a
+// GetFileInformationByHandle rather than the open, read and parse that the OS does for every key. Writes update the
+// parsed copy and are written back a short while later, so that a burst of writes costs one write of the file. The file
+// is written to a temporary name and then swapped in, so other readers never see a partial file.
+//
+// Buffered writes are written back before ShouldRedirect hands the path to any other fixup (e.g. CreateFile), before a
+// child process is created, when the app asks for it with WritePrivateProfileString(NULL, NULL, NULL, file), and when
+// the fixup is unloaded. Until then, other processes see the previous content. If writing a file back fails, its changes
+// are kept and retried, and further writes to it are written through so that the failure reaches the app.
+
+#include <atomic>
+#include <iterator>
+#include <mutex>
+
+#include <psf_framework.h>
+#include <utilities.h>
+
+#include "FunctionImplementations.h"
+#include "IniFile.h"
+#include "PathRedirection.h"
+
+bool g_privateProfileCacheEnabled = true;
+
+ini_file_cache g_iniFiles;
+std::atomic<std::size_t> g_dirtyIniFiles{ 0 };
+
+std::atomic<std::uint64_t> g_iniCacheHits{ 0 };
+std::atomic<std::uint64_t> g_iniCacheLoads{ 0 };
+std::atomic<std::uint64_t> g_iniCacheWrites{ 0 };
+std::atomic<std::uint64_t> g_iniCacheFlushes{ 0 };
+
+// INI files are small. Anything bigger than this is left to the OS
+constexpr DWORD max_cached_ini_size = 4 * 1024 * 1024;
+
+// How long after the first buffered write the file gets written back, and how long to wait before trying again if that
+// fails (e.g. because another process has the file open without sharing)
+constexpr LONGLONG private_profile_flush_delay_ms = 250;
+constexpr LONGLONG private_profile_retry_delay_ms = 2000;
+
+static PTP_TIMER g_flushTimer = nullptr;
+static std::once_flag g_flushTimerOnce;
+static std::atomic<bool> g_flushTimerClosing{ false };
+
+static bool QueryIniFileStamp(HANDLE file, ini_file_stamp& stamp, DWORD* attributes = nullptr)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!::GetFileInformationByHandle(file, &info) || ((info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0))
+    {
+        return false;
+    }
+
+    stamp.volume_serial = info.dwVolumeSerialNumber;
+    stamp.file_index = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    stamp.last_write_time = (static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+    stamp.size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    if (attributes)
+    {
+        *attributes = info.dwFileAttributes;
+    }
+    return true;
+}
+
+// Returns false, with the last error set, if the file can't be opened
+static bool QueryIniFileStamp(const std::wstring& path, ini_file_stamp& stamp, DWORD* attributes = nullptr)
+{
+    auto file = impl::CreateFile(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    auto result = QueryIniFileStamp(file, stamp, attributes);
+    auto error = result ? ERROR_SUCCESS : ERROR_ACCESS_DENIED;
+    ::CloseHandle(file);
+    ::SetLastError(error);
+    return result;
+}
+
+// Parses the file into 'file.document'. Returns false for anything that should be left to the OS
+static bool LoadIniFile(ini_file& file)
+{
+    auto handle = impl::CreateFile(file.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    // The stamp comes from before the read, so a change made while reading is noticed on next use
+    ini_file_stamp stamp;
+    std::string data;
+    bool result = QueryIniFileStamp(handle, stamp) && (stamp.size <= max_cached_ini_size);
+    if (result)
+    {
+        data.resize(static_cast<std::size_t>(stamp.size));
+        DWORD bytesRead = 0;
+        result = ::ReadFile(handle, data.data(), static_cast<DWORD>(data.size()), &bytesRead, nullptr) != FALSE;
+        data.resize(bytesRead);
+    }
+    ::CloseHandle(handle);
+    if (!result)
+    {
+        return false;
+    }
+
+    auto encoding = detect_ini_encoding(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    if (encoding == ini_text_encoding::unsupported)
+    {
+        return false;
+    }
+
+    if (encoding == ini_text_encoding::utf16)
+    {
+        file.document.parse(std::wstring_view(reinterpret_cast<const wchar_t*>(data.data() + 2), (data.size() - 2) / sizeof(wchar_t)));
+    }
+    else
+    {
+        std::wstring text(data.size(), L'\0');
+        auto length = data.empty() ? 0 : ::MultiByteToWideChar(CP_ACP, 0, data.data(), static_cast<int>(data.size()), text.data(), static_cast<int>(text.size()));
+        text.resize(length);
+        file.document.parse(text);
+    }
+
+    file.encoding = encoding;
+    file.stamp = stamp;
+    file.loaded = true;
+    ++g_iniCacheLoads;
+    return true;
+}
+
+// Requires the file's lock to be held exclusively. Returns false, with the last error set, if the changes could not be
+// written; they are kept, and the file is written through from then on until a write succeeds
+static bool FlushIniFile(ini_file& file)
+{
+    if (!file.dirty)
+    {
+        return true;
+    }
+
+    ++g_iniCacheFlushes;
+
+    auto text = file.document.serialize();
+    std::string data;
+    if (file.encoding == ini_text_encoding::utf16)
+    {
+        data = "\xFF\xFE";
+        data.append(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(wchar_t));
+    }
+    else
+    {
+        data = narrow(text, CP_ACP);
+    }
+
+    auto tempPath = file.path + L"." + std::to_wstring(::GetCurrentProcessId()) + L".tmp";
+    auto handle = impl::CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    bool written = handle != INVALID_HANDLE_VALUE;
+    if (written)
+    {
+        DWORD bytesWritten = 0;
+        written = ::WriteFile(handle, data.data(), static_cast<DWORD>(data.size()), &bytesWritten, nullptr) && (bytesWritten == data.size());
+        ::CloseHandle(handle);
+
+        // ReplaceFile keeps the attributes and security of the file being replaced, but needs there to be one
+        written = written &&
+            (impl::ReplaceFile(file.path.c_str(), tempPath.c_str(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr) ||
+             impl::MoveFileEx(tempPath.c_str(), file.path.c_str(), MOVEFILE_REPLACE_EXISTING));
+        if (!written)
+        {
+            auto error = ::GetLastError();
+            impl::DeleteFile(tempPath.c_str());
+            ::SetLastError(error);
+        }
+    }
+
+    if (!written)
+    {
+        auto error = ::GetLastError();
+        PSF_LOG_ERROR(L"FRF unable to write %ls (%d); its changes are kept and writes to it are written through\n", file.path.c_str(), error);
+        file.write_through = true;
+        ::SetLastError(error);
+        return false;
+    }
+
+    file.dirty = false;
+    file.write_through = false;
+    --g_dirtyIniFiles;
+
+    // What was just written is what the document holds, so it can keep being used as long as nobody else changes it
+    file.loaded = QueryIniFileStamp(file.path, file.stamp);
+    return true;
+}
+
+static void SetFlushTimer(LONGLONG delayMs)
+{
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = static_cast<ULONGLONG>(-(delayMs * 10000));
+    FILETIME fileDueTime = { dueTime.LowPart, dueTime.HighPart };
+    ::SetThreadpoolTimer(g_flushTimer, &fileDueTime, 0, 0);
+}
+
+// Returns false if a dirty file could not be written back, or (when 'wait' is false) was skipped because it was in use
+static bool FlushIniFiles(bool wait)
+{
+    if (g_dirtyIniFiles.load() == 0)
+    {
+        return true;
+    }
+
+    bool result = true;
+    g_iniFiles.for_each([&](ini_file& file)
+    {
+        std::unique_lock<std::shared_mutex> lock(file.mutex, std::defer_lock);
+        if (wait)
+        {
+            lock.lock();
+        }
+        else if (!lock.try_lock())
+        {
+            result = false;
+            return;
+        }
+
+        result = FlushIniFile(file) && result;
+    });
+    return result;
+}
+
+static void CALLBACK FlushTimerCallback(PTP_CALLBACK_INSTANCE, PVOID, PTP_TIMER) noexcept try
+{
+    if (!FlushIniFiles(true) && !g_flushTimerClosing.load())
+    {
+        SetFlushTimer(private_profile_retry_delay_ms);
+    }
+}
+catch (...)
+{
+}
+
+// Called when a file goes from clean to dirty, so a steady stream of writes can't keep pushing the flush back. Returns
+// false, with the last error set, if the file had to be written immediately and that failed
+static bool ScheduleFlush(ini_file& file)
+{
+    std::call_once(g_flushTimerOnce, []
+    {
+        g_flushTimer = ::CreateThreadpoolTimer(FlushTimerCallback, nullptr, nullptr);
+    });
+
+    if (!g_flushTimer)
+    {
+        return FlushIniFile(file);
+    }
+
+    SetFlushTimer(private_profile_flush_delay_ms);
+    return true;
+}
+
+// Invokes 'func' with the document for 'path'. Returns false if the cache can't serve the read, in which case the
+// caller forwards the call to the OS
+template <typename Func>
+static bool ReadIniFile(const std::filesystem::path& path, Func&& func)
+{
+    if (!g_privateProfileCacheEnabled)
+    {
+        return false;
+    }
+
+    auto file = g_iniFiles.get(path.native());
+    {
+        std::shared_lock<std::shared_mutex> lock(file->mutex);
+        if (file->dirty)
+        {
+            ++g_iniCacheHits;
+            func(file->document);
+            return true;
+        }
+    }
+
+    // A missing file is left to the OS, which reports it
+    ini_file_stamp stamp;
+    if (!QueryIniFileStamp(file->path, stamp))
+    {
+        return false;
+    }
+
+    {
+        std::shared_lock<std::shared_mutex> lock(file->mutex);
+        if (file->dirty || (file->loaded && (file->stamp == stamp)))
+        {
+            ++g_iniCacheHits;
+            func(file->document);
+            return true;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(file->mutex);
+    if (!file->dirty && (!file->loaded || (file->stamp != stamp)))
+    {
+        file->loaded = false;
+        if (!LoadIniFile(*file))
+        {
+            return false;
+        }
+    }
+
+    func(file->document);
+    return true;
+}
+
+// Applies 'update' to the document for 'path'; it returns true if it changed the document. Returns false if the cache
+// can't serve the write, in which case the caller forwards the call to the OS. 'result' is set to FALSE, with the last
+// error set, if the change was written through and that failed; the change is then undone
+template <typename Func>
+static bool WriteIniFile(const std::filesystem::path& path, Func&& update, BOOL& result)
+{
+    if (!g_privateProfileCacheEnabled)
+    {
+        return false;
+    }
+
+    auto file = g_iniFiles.get(path.native());
+    std::unique_lock<std::shared_mutex> lock(file->mutex);
+    if (!file->dirty)
+    {
+        ini_file_stamp stamp;
+        DWORD attributes;
+        if (QueryIniFileStamp(file->path, stamp, &attributes))
+        {
+            // Let the OS fail writes to read-only files
+            if ((attributes & FILE_ATTRIBUTE_READONLY) != 0)
+            {
+                return false;
+            }
+
+            if (!file->loaded || (file->stamp != stamp))
+            {
+                file->loaded = false;
+                if (!LoadIniFile(*file))
+                {
+                    return false;
+                }
+            }
+        }
+        else if (::GetLastError() == ERROR_FILE_NOT_FOUND)
+        {
+            // The OS creates a missing file as ANSI. A missing directory is left to the OS to report
+            file->document = ini_document{};
+            file->encoding = ini_text_encoding::ansi;
+            file->stamp = ini_file_stamp{};
+            file->loaded = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    ++g_iniCacheWrites;
+    auto previous = file->write_through ? file->document : ini_document{};
+    result = TRUE;
+    if (!update(file->document))
+    {
+        return true;
+    }
+
+    auto wasDirty = file->dirty;
+    if (!wasDirty)
+    {
+        file->dirty = true;
+        ++g_dirtyIniFiles;
+    }
+
+    if (file->write_through ? FlushIniFile(*file) : (wasDirty || ScheduleFlush(*file)))
+    {
+        return true;
+    }
+
+    // Undo the change, keeping any that were already waiting to be written back. If there were none, the file on disk
+    // is what the document held before
+    auto error = ::GetLastError();
+    if (!wasDirty)
+    {
+        file->dirty = false;
+        file->loaded = false;
+        --g_dirtyIniFiles;
+    }
+    else
+    {
+        file->document = std::move(previous);
+    }
+    ::SetLastError(error);
+    result = FALSE;
+    return true;
+}
+
+// Arguments from the ANSI functions are in the ANSI code page
+static wide_argument_string_with_buffer ProfileArgument(const char* str)
+{
+    return str ? wide_argument_string_with_buffer{ widen(str, CP_ACP) } : wide_argument_string_with_buffer{};
+}
+
+static wide_argument_string ProfileArgument(const wchar_t* str) noexcept
+{
+    return wide_argument_string{ str };
+}
+
+// A list of strings, each followed by a null character, that ends with an extra null character. The result keeps the
+// null characters that separate the strings, but not the extra one
+template <typename CharT>
+static std::wstring ProfileListArgument(const CharT* list)
+{
+    std::size_t length = 0;
+    if (list)
+    {
+        while (list[length] || list[length + 1])
+        {
+            ++length;
+        }
+        if (length)
+        {
+            ++length;
+        }
+    }
+
+    if constexpr (psf::is_ansi<CharT>)
+    {
+        return widen(std::string_view(list ? list : "", length), CP_ACP);
+    }
+    else
+    {
+        return std::wstring(list ? list : L"", length);
+    }
+}
+
+template <typename CharT>
+static DWORD CopyProfileResult(const std::wstring& text, bool isList, CharT* buffer, DWORD size)
+{
+    if constexpr (psf::is_ansi<CharT>)
+    {
+        auto ansiText = narrow(text, CP_ACP);
+        return copy_profile_result<char>(ansiText, isList, buffer, size);
+    }
+    else
+    {
+        return copy_profile_result<wchar_t>(text, isList, buffer, size);
+    }
+}
+
+template <typename CharT>
+bool CachedGetPrivateProfileString(const std::filesystem::path& path, const CharT* appName, const CharT* keyName,
+    const CharT* defaultString, CharT* string, DWORD stringLength, DWORD& result)
+{
+    auto section = ProfileArgument(appName);
+    auto key = ProfileArgument(keyName);
+    auto defaultValue = ProfileArgument(defaultString);
+    ini_document::query_result value;
+    if (!ReadIniFile(path, [&](const ini_document& document) { value = document.query_string(section.c_str(), key.c_str(), defaultValue.c_str()); }))
+    {
+        return false;
+    }
+
+    result = CopyProfileResult(value.text, value.is_list, string, stringLength);
+    ::SetLastError(value.found ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND);
+    return true;
+}
+
+template <typename CharT>
+bool CachedGetPrivateProfileInt(const std::filesystem::path& path, const CharT* sectionName, const CharT* keyName, INT defaultValue, UINT& result)
+{
+    auto section = ProfileArgument(sectionName);
+    auto key = ProfileArgument(keyName);
+    ini_document::query_result value;
+    if (!ReadIniFile(path, [&](const ini_document& document) { value = document.query_string(section.c_str(), key.c_str(), L""); }))
+    {
+        return false;
+    }
+
+    // The OS reads the value into a buffer of 30 characters first
+    wchar_t buffer[30];
+    if (copy_profile_result<wchar_t>(value.text, value.is_list, buffer, static_cast<std::uint32_t>(std::size(buffer))) == 0)
+    {
+        result = static_cast<UINT>(defaultValue);
+    }
+    else
+    {
+        result = parse_profile_int(buffer);
+    }
+    return true;
+}
+
+template <typename CharT>
+bool CachedGetPrivateProfileSection(const std::filesystem::path& path, const CharT* appName, CharT* string, DWORD stringLength, DWORD& result)
+{
+    if (!appName)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    auto section = ProfileArgument(appName);
+    std::wstring lines;
+    if (!ReadIniFile(path, [&](const ini_document& document) { lines = document.section_lines(section.c_str()); }))
+    {
+        return false;
+    }
+
+    result = CopyProfileResult(lines, true, string, stringLength);
+    return true;
+}
+
+template <typename CharT>
+bool CachedGetPrivateProfileSectionNames(const std::filesystem::path& path, CharT* string, DWORD stringLength, DWORD& result)
+{
+    std::wstring names;
+    if (!ReadIniFile(path, [&](const ini_document& document) { names = document.section_names(); }))
+    {
+        return false;
+    }
+
+    result = CopyProfileResult(names, true, string, stringLength);
+    return true;
+}
+
+template <typename CharT>
+bool CachedGetPrivateProfileStruct(const std::filesystem::path& path, const CharT* sectionName, const CharT* keyName,
+    LPVOID structArea, UINT structSize, BOOL& result)
+{
+    if (!sectionName || !keyName || !structArea)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    auto section = ProfileArgument(sectionName);
+    auto key = ProfileArgument(keyName);
+    profile_struct_status status = profile_struct_status::not_found;
+    if (!ReadIniFile(path, [&](const ini_document& document) { status = decode_profile_struct(document.value(section.c_str(), key.c_str()), structArea, structSize); }))
+    {
+        return false;
+    }
+
+    result = status == profile_struct_status::success;
+    switch (status)
+    {
+    case profile_struct_status::not_found: ::SetLastError(ERROR_FILE_NOT_FOUND); break;
+    case profile_struct_status::bad_length: ::SetLastError(ERROR_BAD_LENGTH); break;
+    case profile_struct_status::bad_checksum: ::SetLastError(ERROR_INVALID_DATA); break;
+    default: ::SetLastError(ERROR_SUCCESS); break;
+    }
+    return true;
+}
+
+template <typename CharT>
+bool CachedWritePrivateProfileString(const std::filesystem::path& path, const CharT* appName, const CharT* keyName, const CharT* string, BOOL& result)
+{
+    // All NULL asks for the file to be written back; a NULL section is an error. Both are left to the OS, unless writing
+    // back this cache's changes fails
+    if (!appName)
+    {
+        if (!FlushPrivateProfileCache(path))
+        {
+            result = FALSE;
+            return true;
+        }
+        return false;
+    }
+
+    auto section = ProfileArgument(appName);
+    auto key = ProfileArgument(keyName);
+    auto value = ProfileArgument(string);
+    auto handled = WriteIniFile(path, [&](ini_document& document)
+    {
+        if (!key.c_str())
+        {
+            return document.remove_section(section.c_str());
+        }
+        else if (!value.c_str())
+        {
+            return document.remove_key(section.c_str(), key.c_str());
+        }
+        return document.set_value(section.c_str(), key.c_str(), value.c_str());
+    }, result);
+
+    if (!handled)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    return true;
+}
+
+template <typename CharT>
+bool CachedWritePrivateProfileSection(const std::filesystem::path& path, const CharT* appName, const CharT* string, BOOL& result)
+{
+    if (!appName)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    auto section = ProfileArgument(appName);
+    auto lines = ProfileListArgument(string);
+    auto handled = WriteIniFile(path, [&](ini_document& document)
+    {
+        return string ? document.replace_section(section.c_str(), lines) : document.remove_section(section.c_str());
+    }, result);
+
+    if (!handled)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    return true;
+}
+
+template <typename CharT>
+bool CachedWritePrivateProfileStruct(const std::filesystem::path& path, const CharT* appName, const CharT* keyName,
+    const void* structData, UINT structSize, BOOL& result)
+{
+    if (!appName || !keyName)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    auto section = ProfileArgument(appName);
+    auto key = ProfileArgument(keyName);
+    auto value = structData ? encode_profile_struct(structData, structSize) : std::wstring{};
+    auto handled = WriteIniFile(path, [&](ini_document& document)
+    {
+        return structData ? document.set_value(section.c_str(), key.c_str(), value) : document.remove_key(section.c_str(), key.c_str());
+    }, result);
+
+    if (!handled)
+    {
+        FlushPrivateProfileCache(path);
+        return false;
+    }
+
+    return true;
+}
+
+template bool CachedGetPrivateProfileString(const std::filesystem::path&, const char*, const char*, const char*, char*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileString(const std::filesystem::path&, const wchar_t*, const wchar_t*, const wchar_t*, wchar_t*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileInt(const std::filesystem::path&, const char*, const char*, INT, UINT&);
+template bool CachedGetPrivateProfileInt(const std::filesystem::path&, const wchar_t*, const wchar_t*, INT, UINT&);
+template bool CachedGetPrivateProfileSection(const std::filesystem::path&, const char*, char*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileSection(const std::filesystem::path&, const wchar_t*, wchar_t*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileSectionNames(const std::filesystem::path&, char*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileSectionNames(const std::filesystem::path&, wchar_t*, DWORD, DWORD&);
+template bool CachedGetPrivateProfileStruct(const std::filesystem::path&, const char*, const char*, LPVOID, UINT, BOOL&);
+template bool CachedGetPrivateProfileStruct(const std::filesystem::path&, const wchar_t*, const wchar_t*, LPVOID, UINT, BOOL&);
+template bool CachedWritePrivateProfileString(const std::filesystem::path&, const char*, const char*, const char*, BOOL&);
+template bool CachedWritePrivateProfileString(const std::filesystem::path&, const wchar_t*, const wchar_t*, const wchar_t*, BOOL&);
+template bool CachedWritePrivateProfileSection(const std::filesystem::path&, const char*, const char*, BOOL&);
+template bool CachedWritePrivateProfileSection(const std::filesystem::path&, const wchar_t*, const wchar_t*, BOOL&);
+template bool CachedWritePrivateProfileStruct(const std::filesystem::path&, const char*, const char*, const void*, UINT, BOOL&);
+template bool CachedWritePrivateProfileStruct(const std::filesystem::path&, const wchar_t*, const wchar_t*, const void*, UINT, BOOL&);
+
+bool FlushPrivateProfileCache(const std::filesystem::path& path)
+{
+    if (g_dirtyIniFiles.load(std::memory_order_relaxed) == 0)
+    {
+        return true;
+    }
+
+    if (auto file = g_iniFiles.find(path.native()))
+    {
+        std::unique_lock<std::shared_mutex> lock(file->mutex);
+        return FlushIniFile(*file);
+    }
+    return true;
+}
+
+void FlushPrivateProfileCache() noexcept try
+{
+    FlushIniFiles(true);
+}
+catch (...)
+{
+}
+
+void ShutdownPrivateProfileCache() noexcept try
+{
+    // When the process is exiting, every other thread has already been terminated, including any that were in the middle
+    // of using a file or running the timer; waiting for them would never finish. Otherwise (e.g. the PsfRuntime is being
+    // unloaded) they are waited for, so that no change is skipped and the timer can't fire once the dll is gone
+    static const auto dllShutdownInProgress = reinterpret_cast<BOOLEAN(NTAPI*)()>(
+        ::GetProcAddress(::GetModuleHandleW(L"ntdll.dll"), "RtlDllShutdownInProgress"));
+    auto processExiting = dllShutdownInProgress && dllShutdownInProgress();
+
+    if (g_flushTimer)
+    {
+        g_flushTimerClosing = true;
+        ::SetThreadpoolTimer(g_flushTimer, nullptr, 0, 0);
+        if (!processExiting)
+        {
+            ::WaitForThreadpoolTimerCallbacks(g_flushTimer, TRUE);
+            ::CloseThreadpoolTimer(g_flushTimer);
+            g_flushTimer = nullptr;
+        }
+    }
+
+    if (!FlushIniFiles(!processExiting))
+    {
+        PSF_LOG_ERROR(L"FRF unable to write back every changed INI file at shutdown\n");
+    }
+}
+catch (...)
+{
+}
+
+void LogPrivateProfileCacheStatistics()
+{
+    if (g_privateProfileCacheEnabled)
+    {
+        PSF_LOG_INFO(L"FRF private profile cache: hits=%llu loads=%llu writes=%llu flushes=%llu\n",
+            g_iniCacheHits.load(), g_iniCacheLoads.load(), g_iniCacheWrites.load(), g_iniCacheFlushes.load());
+    }
+}
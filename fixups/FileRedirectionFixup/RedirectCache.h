@@ -0,0 +1,148 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// A bounded, thread-safe map from a (normalized) path string to some value. The map is split into a fixed number of
+// shards, each with its own reader/writer lock, so that concurrent lookups from different threads rarely contend. When
+// a shard is full, an arbitrary entry in it is evicted to make room; the cache only ever holds values that can be
+// recomputed, so the choice of victim only affects the hit rate.
+//
+// Keys are compared exactly. Callers must hand in paths that are already normalized and folded, and must invalidate an
+// entry themselves when the file system changes beneath it (see InvalidateRedirectCache in PathRedirection.cpp).
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+struct path_cache_statistics
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t insertions = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t invalidations = 0;
+};
+
+template <typename ValueT>
+class concurrent_path_cache
+{
+public:
+    explicit concurrent_path_cache(std::size_t capacity = 4096) noexcept :
+        m_shardCapacity((capacity + shard_count - 1) / shard_count)
+    {
+    }
+
+    // Invokes 'func' with the cached value for 'key', if present, while holding a shared lock. 'func' returns true if
+    // the value satisfied the caller's request, which is what gets counted as a hit
+    template <typename Func>
+    bool find(const std::wstring& key, Func&& func) const
+    {
+        auto& shard = shard_for(key);
+        bool found = false;
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            if (auto itr = shard.entries.find(key); itr != shard.entries.end())
+            {
+                found = func(itr->second);
+            }
+        }
+
+        ++(found ? m_hits : m_misses);
+        return found;
+    }
+
+    // Invokes 'func' with a mutable reference to the value for 'key', default constructing it first if necessary
+    template <typename Func>
+    void update(const std::wstring& key, Func&& func)
+    {
+        auto& shard = shard_for(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto itr = shard.entries.find(key);
+        if (itr == shard.entries.end())
+        {
+            if (shard.entries.size() >= m_shardCapacity)
+            {
+                shard.entries.erase(shard.entries.begin());
+                ++m_evictions;
+            }
+
+            itr = shard.entries.emplace(key, ValueT{}).first;
+            ++m_insertions;
+        }
+
+        func(itr->second);
+    }
+
+    // Invokes 'pred' on every entry, one shard at a time, letting it modify the value. Entries for which 'pred' returns
+    // true are removed. Returns the number of removed entries
+    template <typename Pred>
+    std::size_t erase_if(Pred&& pred)
+    {
+        std::size_t count = 0;
+        for (auto& shard : m_shards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            for (auto itr = shard.entries.begin(); itr != shard.entries.end(); )
+            {
+                if (pred(itr->first, itr->second))
+                {
+                    itr = shard.entries.erase(itr);
+                    ++count;
+                }
+                else
+                {
+                    ++itr;
+                }
+            }
+        }
+
+        m_invalidations += count;
+        return count;
+    }
+
+    void clear()
+    {
+        erase_if([](const std::wstring&, ValueT&) { return true; });
+    }
+
+    path_cache_statistics statistics() const noexcept
+    {
+        path_cache_statistics result;
+        result.hits = m_hits.load(std::memory_order_relaxed);
+        result.misses = m_misses.load(std::memory_order_relaxed);
+        result.insertions = m_insertions.load(std::memory_order_relaxed);
+        result.evictions = m_evictions.load(std::memory_order_relaxed);
+        result.invalidations = m_invalidations.load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    static constexpr std::size_t shard_count = 16;
+
+    struct shard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::wstring, ValueT> entries;
+    };
+
+    shard& shard_for(const std::wstring& key) const noexcept
+    {
+        return m_shards[std::hash<std::wstring>{}(key) % shard_count];
+    }
+
+    const std::size_t m_shardCapacity;
+    mutable std::array<shard, shard_count> m_shards;
+
+    mutable std::atomic<std::uint64_t> m_hits{ 0 };
+    mutable std::atomic<std::uint64_t> m_misses{ 0 };
+    std::atomic<std::uint64_t> m_insertions{ 0 };
+    std::atomic<std::uint64_t> m_evictions{ 0 };
+    std::atomic<std::uint64_t> m_invalidations{ 0 };
+};
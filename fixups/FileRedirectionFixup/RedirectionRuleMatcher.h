@@ -0,0 +1,427 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Compiled form of the FileRedirectionFixup "redirectedPaths" rules. Every intercepted file API asks whether a path
+// matches some rule, so rather than walking every rule and running std::regex_match for each one, the rules are
+// compiled once at configuration time into:
+//      1.  A case-insensitive trie over the rule base paths, so that a single walk of the input path yields every rule
+//          whose base path is a prefix of it (on a path separator boundary), and
+//      2.  A compiled program per pattern. The overwhelmingly common pattern shapes (".*", ".*\.ini", "foo\.txt",
+//          "logs\\.*") are lowered to a literal/wildcard program that is matched without std::regex. Anything else
+//          falls back to a std::wregex, which is still only constructed once.
+// Matching keeps the semantics of the original linear scan: the first rule, in configuration order, whose base path
+// and pattern both match wins, regardless of whether it is an exclusion rule.
+//
+// The matcher only compares strings. Normalizing the input path (to the drive absolute form that base paths are given
+// in) and acting on the rule that matched (redirect or exclude) are left to PathRedirection.cpp.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <limits>
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class redirection_rule_matcher
+{
+public:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    struct match_result
+    {
+        // Index of the matching rule, in the order that rules were added, or npos if no rule matched
+        std::size_t index = npos;
+
+        // Pointer inside of the input path to the portion of the path that the pattern was matched against
+        const wchar_t* relative_path = nullptr;
+
+        // Number of pattern evaluations that threw (e.g. std::regex_error::error_complexity). Such rules are treated
+        // as non-matching, same as the original implementation did
+        std::size_t pattern_failures = 0;
+    };
+
+    // Adds a rule. Rules are evaluated in the order that they are added. Throws std::regex_error if the pattern is not
+    // a valid ECMAScript regular expression
+    std::size_t add(std::wstring_view basePath, std::wstring_view pattern)
+    {
+        auto index = m_patterns.size();
+        m_patterns.push_back(compile(pattern));
+
+        std::uint32_t node = 0;
+        for (auto ch : basePath)
+        {
+            node = add_child(node, fold(ch));
+        }
+        m_nodes[node].rules.push_back(index);
+
+        return index;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_patterns.size();
+    }
+
+    bool empty() const noexcept
+    {
+        return m_patterns.empty();
+    }
+
+    // Finds the first rule whose base path is a prefix of 'path' and whose pattern matches the remainder of the path
+    match_result match(const wchar_t* path) const
+    {
+        match_result result;
+        if (!path || m_patterns.empty())
+        {
+            return result;
+        }
+
+        // Collect every rule whose base path terminates on a separator boundary along the input path. Most paths
+        // only ever reach a handful of candidates, so keep them on the stack where possible
+        struct candidate
+        {
+            std::size_t index;
+            std::size_t base_length;
+        };
+        constexpr std::size_t inline_candidates = 32;
+        candidate inlineBuffer[inline_candidates];
+        std::vector<candidate> overflow;
+        std::size_t count = 0;
+        auto addCandidate = [&](std::size_t index, std::size_t length)
+        {
+            if (count < inline_candidates)
+            {
+                inlineBuffer[count] = candidate{ index, length };
+            }
+            else
+            {
+                if (overflow.empty())
+                {
+                    overflow.assign(inlineBuffer, inlineBuffer + inline_candidates);
+                }
+                overflow.push_back(candidate{ index, length });
+            }
+            ++count;
+        };
+
+        std::uint32_t node = 0;
+        for (std::size_t pos = 0; ; ++pos)
+        {
+            auto ch = path[pos];
+            if (!m_nodes[node].rules.empty() && ((ch == L'\0') || is_separator(ch)))
+            {
+                for (auto index : m_nodes[node].rules)
+                {
+                    addCandidate(index, pos);
+                }
+            }
+
+            if (ch == L'\0')
+            {
+                break;
+            }
+
+            node = child(node, fold(ch));
+            if (node == no_node)
+            {
+                break;
+            }
+        }
+
+        if (count == 0)
+        {
+            return result;
+        }
+
+        candidate* candidates = (count <= inline_candidates) ? inlineBuffer : overflow.data();
+        std::sort(candidates, candidates + count, [](const candidate& lhs, const candidate& rhs)
+        {
+            return lhs.index < rhs.index;
+        });
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            // If the base path matched exactly, assume an implicit directory separator at the end (e.g. for matches
+            // to satisfy the first call to CreateDirectory)
+            auto relativePath = path + candidates[i].base_length;
+            if (is_separator(relativePath[0]))
+            {
+                ++relativePath;
+            }
+
+            try
+            {
+                if (m_patterns[candidates[i].index].matches(relativePath))
+                {
+                    result.index = candidates[i].index;
+                    result.relative_path = relativePath;
+                    return result;
+                }
+            }
+            catch (...)
+            {
+                ++result.pattern_failures;
+            }
+        }
+
+        return result;
+    }
+
+    // Exposed so that callers (and tests) can tell whether a pattern avoided the std::regex fallback
+    bool is_compiled(std::size_t index) const noexcept
+    {
+        return !m_patterns[index].regex;
+    }
+
+private:
+    static constexpr std::uint32_t no_node = std::numeric_limits<std::uint32_t>::max();
+
+    enum class op : std::uint8_t
+    {
+        literal,    // Matches 'ch' exactly
+        any_one,    // '.'
+        any_run,    // '.*'
+    };
+
+    struct instruction
+    {
+        op code;
+        wchar_t ch;
+    };
+
+    struct compiled_pattern
+    {
+        std::vector<instruction> program;
+        std::unique_ptr<std::wregex> regex;
+
+        bool matches(const wchar_t* str) const
+        {
+            if (regex)
+            {
+                return std::regex_match(str, *regex);
+            }
+
+            return match_program(program.data(), program.data() + program.size(), str);
+        }
+    };
+
+    struct trie_node
+    {
+        // Children are kept sorted by (folded) character; fan-out is small in practice, so a binary search over a
+        // contiguous array beats a hash map here
+        std::vector<std::pair<wchar_t, std::uint32_t>> children;
+        std::vector<std::size_t> rules;
+    };
+
+    std::vector<trie_node> m_nodes = std::vector<trie_node>(1);
+    std::vector<compiled_pattern> m_patterns;
+
+    static constexpr bool is_separator(wchar_t ch) noexcept
+    {
+        return (ch == L'\\') || (ch == L'/');
+    }
+
+    static wchar_t fold(wchar_t ch) noexcept
+    {
+        // Same equivalence as psf::path_compare: case-insensitive, and all separators are equal
+        return is_separator(ch) ? L'\\' : static_cast<wchar_t>(std::towlower(ch));
+    }
+
+    static constexpr bool is_line_terminator(wchar_t ch) noexcept
+    {
+        // ECMAScript '.' does not match these
+        return (ch == L'\n') || (ch == L'\r') || (ch == 0x2028) || (ch == 0x2029);
+    }
+
+    std::uint32_t child(std::uint32_t node, wchar_t ch) const noexcept
+    {
+        auto& children = m_nodes[node].children;
+        auto itr = std::lower_bound(children.begin(), children.end(), ch, [](const auto& entry, wchar_t value)
+        {
+            return entry.first < value;
+        });
+        return ((itr != children.end()) && (itr->first == ch)) ? itr->second : no_node;
+    }
+
+    std::uint32_t add_child(std::uint32_t node, wchar_t ch)
+    {
+        auto& children = m_nodes[node].children;
+        auto itr = std::lower_bound(children.begin(), children.end(), ch, [](const auto& entry, wchar_t value)
+        {
+            return entry.first < value;
+        });
+        if ((itr != children.end()) && (itr->first == ch))
+        {
+            return itr->second;
+        }
+
+        auto index = static_cast<std::uint32_t>(m_nodes.size());
+        children.insert(itr, std::make_pair(ch, index));
+        m_nodes.emplace_back();
+        return index;
+    }
+
+    // Lowers a regular expression to a literal/wildcard program if it only uses constructs that we know how to
+    // evaluate directly. Returns false if the caller needs to fall back to std::wregex
+    static bool try_lower(std::wstring_view pattern, std::vector<instruction>& program)
+    {
+        constexpr std::wstring_view metacharacters = LR"([](){}|?*+^$)";
+        auto isQuantifier = [&](std::size_t pos)
+        {
+            return (pos < pattern.length()) &&
+                ((pattern[pos] == L'*') || (pattern[pos] == L'+') || (pattern[pos] == L'?') || (pattern[pos] == L'{'));
+        };
+
+        std::size_t pos = 0;
+        if (!pattern.empty() && (pattern[0] == L'^'))
+        {
+            // regex_match is always anchored, so this is redundant
+            ++pos;
+        }
+
+        auto end = pattern.length();
+        if ((end > pos) && (pattern[end - 1] == L'$') && ((end < 2) || (pattern[end - 2] != L'\\')))
+        {
+            --end;
+        }
+
+        while (pos < end)
+        {
+            auto ch = pattern[pos];
+            if (ch == L'.')
+            {
+                if ((pos + 1 < end) && (pattern[pos + 1] == L'*'))
+                {
+                    if (isQuantifier(pos + 2))
+                    {
+                        // E.g. lazy/possessive forms; not worth special casing
+                        return false;
+                    }
+
+                    if (program.empty() || (program.back().code != op::any_run))
+                    {
+                        program.push_back(instruction{ op::any_run, 0 });
+                    }
+                    pos += 2;
+                }
+                else if ((pos + 1 < end) && (pattern[pos + 1] == L'+'))
+                {
+                    if (isQuantifier(pos + 2))
+                    {
+                        return false;
+                    }
+
+                    program.push_back(instruction{ op::any_one, 0 });
+                    program.push_back(instruction{ op::any_run, 0 });
+                    pos += 2;
+                }
+                else if (isQuantifier(pos + 1))
+                {
+                    return false;
+                }
+                else
+                {
+                    program.push_back(instruction{ op::any_one, 0 });
+                    ++pos;
+                }
+            }
+            else if (ch == L'\\')
+            {
+                // Only identity escapes of punctuation (e.g. "\.", "\\") are plain literals; character classes like
+                // "\d" or assertions like "\b" need the real regex engine
+                if (pos + 1 >= end)
+                {
+                    return false;
+                }
+
+                auto escaped = pattern[pos + 1];
+                if (std::iswalnum(escaped) || (escaped == L'_') || is_line_terminator(escaped) || isQuantifier(pos + 2))
+                {
+                    return false;
+                }
+
+                program.push_back(instruction{ op::literal, escaped });
+                pos += 2;
+            }
+            else if ((metacharacters.find(ch) != std::wstring_view::npos) || is_line_terminator(ch) || isQuantifier(pos + 1))
+            {
+                return false;
+            }
+            else
+            {
+                program.push_back(instruction{ op::literal, ch });
+                ++pos;
+            }
+        }
+
+        return true;
+    }
+
+    static compiled_pattern compile(std::wstring_view pattern)
+    {
+        compiled_pattern result;
+        if (!try_lower(pattern, result.program))
+        {
+            result.program.clear();
+            result.regex = std::make_unique<std::wregex>(pattern.data(), pattern.length());
+        }
+
+        return result;
+    }
+
+    static bool match_program(const instruction* begin, const instruction* end, const wchar_t* str) noexcept
+    {
+        // Standard wildcard matching with single-point backtracking to the most recent '.*'. Since no instruction can
+        // consume a line terminator, this is exact for the subset of ECMAScript that try_lower accepts
+        const instruction* backtrackInstruction = nullptr;
+        const wchar_t* backtrackStr = nullptr;
+
+        auto itr = begin;
+        while (*str)
+        {
+            if (is_line_terminator(*str))
+            {
+                return false;
+            }
+
+            if (itr != end)
+            {
+                if (itr->code == op::any_run)
+                {
+                    backtrackInstruction = ++itr;
+                    backtrackStr = str;
+                    continue;
+                }
+
+                if ((itr->code == op::any_one) || (itr->ch == *str))
+                {
+                    ++itr;
+                    ++str;
+                    continue;
+                }
+            }
+
+            if (!backtrackInstruction)
+            {
+                return false;
+            }
+
+            // Let the most recent '.*' consume one more character and try again
+            itr = backtrackInstruction;
+            str = ++backtrackStr;
+        }
+
+        while ((itr != end) && (itr->code == op::any_run))
+        {
+            ++itr;
+        }
+
+        return itr == end;
+    }
+};
@@ -31,13 +31,25 @@ BOOL __stdcall RemoveDirectoryFixup(_In_ const CharT* pathName) noexcept
                     }
                     else
                     {
-                        return impl::RemoveDirectory(redirectPath.c_str());
+                        auto result = impl::RemoveDirectory(redirectPath.c_str());
+                        InvalidateRedirectCache(redirectPath);
+                        InvalidateKnownDirectories(redirectPath);
+                        return result;
                     }
                 }
             }
             else
             {
                 Log(L"[%d]Under LocalAppData\\Packages, don't redirect", RemoveDirectoryInstance);
+
+                // The redirected location is itself under LocalAppData\Packages, so this may remove one of its folders
+                auto result = impl::RemoveDirectory(pathName);
+                if (result)
+                {
+                    InvalidateRedirectCache(widen_argument(pathName).c_str());
+                    InvalidateKnownDirectories(widen_argument(pathName).c_str());
+                }
+                return result;
             }
         }
     }
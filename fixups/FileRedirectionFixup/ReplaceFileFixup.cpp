@@ -34,13 +34,15 @@ BOOL __stdcall ReplaceFileFixup(
             auto [redirectBackup, backupRedirectPath, shouldReadonlyDest] = ShouldRedirect(backupFileName, redirect_flags::ensure_directory_structure);
             if (redirectTarget || redirectSource || redirectBackup)
             {
-                return impl::ReplaceFile(
+                auto result = impl::ReplaceFile(
                     redirectTarget ? targetRedirectPath.c_str() : widen_argument(replacedFileName).c_str(),
                     redirectSource ? sourceRedirectPath.c_str() : widen_argument(replacementFileName).c_str(),
                     redirectBackup ? backupRedirectPath.c_str() : widen_argument(backupFileName).c_str(),
                     replaceFlags,
                     exclude,
                     reserved);
+                InvalidateRedirectCache(sourceRedirectPath);
+                return result;
             }
         }
     }
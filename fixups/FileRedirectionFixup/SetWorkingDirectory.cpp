@@ -21,7 +21,7 @@ BOOL __stdcall SetCurrentDirectoryFixup(_In_ const CharT* filePath) noexcept
             {
                 normalized_path normalized = NormalizePath(filePath);
                 normalized_path virtualized = VirtualizePath(normalized, SetWorkingDirectoryInstance);
-                if (impl::PathExists(virtualized.full_path.c_str()))
+                if (IndexedPathExists(virtualized.full_path.c_str()))
                 {
                     return impl::SetCurrentDirectory(virtualized.full_path.c_str());
                 }
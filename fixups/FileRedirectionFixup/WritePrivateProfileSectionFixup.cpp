@@ -24,9 +24,15 @@ BOOL __stdcall WritePrivateProfileSectionFixup(
                 LogString(WritePrivateProfileSectionInstance,L"WritePrivateProfileSectionFixup for fileName", fileName);
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        BOOL cachedResult;
+                        if (CachedWritePrivateProfileSection(redirectPath, appName, string, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             return impl::WritePrivateProfileSectionW(widen_argument(appName).c_str(),
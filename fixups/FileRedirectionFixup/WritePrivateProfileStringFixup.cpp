@@ -25,9 +25,15 @@ BOOL __stdcall WritePrivateProfileStringFixup(
                 LogString(WritePrivateProfileStringInstance,L"WritePrivateProfileStringFixup for fileName", fileName);
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        BOOL cachedResult;
+                        if (CachedWritePrivateProfileString(redirectPath, appName, keyName, string, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             return impl::WritePrivateProfileStringW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
@@ -26,9 +26,15 @@ BOOL __stdcall WritePrivateProfileStructFixup(
                 LogString(WritePrivateProfileStructInstance,L"WritePrivateProfileStructFixup for fileName", fileName);
                 if (!IsUnderUserAppDataLocalPackages(fileName))
                 {
-                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirect(fileName, redirect_flags::copy_on_read);
+                    auto [shouldRedirect, redirectPath, shouldReadonly] = ShouldRedirectPrivateProfile(fileName, redirect_flags::copy_on_read);
                     if (shouldRedirect)
                     {
+                        BOOL cachedResult;
+                        if (CachedWritePrivateProfileStruct(redirectPath, appName, keyName, structData, uSizeStruct, cachedResult))
+                        {
+                            return cachedResult;
+                        }
+
                         if constexpr (psf::is_ansi<CharT>)
                         {
                             return impl::WritePrivateProfileStructW(widen_argument(appName).c_str(), widen_argument(keyName).c_str(),
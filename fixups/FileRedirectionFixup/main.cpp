@@ -14,6 +14,8 @@ TRACELOGGING_DEFINE_PROVIDER(
 
 void InitializePaths();
 void InitializeConfiguration();
+void LogFixupStatistics();
+void ShutdownPrivateProfileCache() noexcept;
 
 extern "C" {
 
@@ -31,6 +33,8 @@ catch (...)
 
 int __stdcall PSFUninitialize() noexcept try
 {
+    ShutdownPrivateProfileCache();
+    LogFixupStatistics();
     psf::detach_all();
     return ERROR_SUCCESS;
 }
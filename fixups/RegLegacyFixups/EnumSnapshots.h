@@ -0,0 +1,123 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Snapshots of the subkeys and values of open key handles that deletion markers apply to, so that enumerating a key by
+// index does not have to enumerate (and check against the deletion markers) every entry before the one asked for. A
+// snapshot holds the indexes, in the underlying enumeration, of the entries that are not hidden, along with the counts
+// and lengths that RegQueryInfoKey reports for them.
+//
+// A snapshot is only used while the key still has the path, entry count and last write time that it had when the
+// snapshot was taken, so entries added, deleted or renamed through any handle cause a new one to be taken. Snapshots
+// are forgotten when their handle is closed through RegCloseKey.
+//
+// NOTE: matches() is all that stands between a caller and a stale snapshot, so the entry count and last write time
+// passed to find() must be what RegQueryInfoKey reports for the key at the time of the call, never values kept from an
+// earlier one. Indexes in a snapshot only mean something to the underlying RegEnumKeyEx/RegEnumValue of that key
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class registry_enum_kind
+{
+    subkeys = 0,
+    values = 1,
+};
+
+struct registry_enum_snapshot
+{
+    // What the key looked like when the snapshot was taken. Name lengths differ between the ANSI and wide functions,
+    // so a snapshot is only used by the kind of function that took it
+    std::string path;
+    bool ansi = false;
+    std::uint32_t raw_count = 0;
+    std::uint64_t last_write_time = 0;
+
+    // The indexes, in the underlying enumeration, of the entries that are not hidden, in order
+    std::vector<std::uint32_t> visible;
+
+    // In characters, not counting the terminating null, as RegQueryInfoKey reports them
+    std::uint32_t max_name_length = 0;
+
+    // In bytes; values only
+    std::uint32_t max_data_length = 0;
+
+    bool matches(const std::string& keyPath, bool isAnsi, std::uint32_t rawCount, std::uint64_t lastWriteTime) const noexcept
+    {
+        return (ansi == isAnsi) && (raw_count == rawCount) && (last_write_time == lastWriteTime) && (path == keyPath);
+    }
+};
+
+class registry_enum_snapshots
+{
+public:
+    using key_type = const void*;
+
+    // Returns the snapshot of 'key' if there is one and the key has not changed since it was taken
+    std::shared_ptr<const registry_enum_snapshot> find(key_type key, registry_enum_kind kind, const std::string& path,
+        bool ansi, std::uint32_t rawCount, std::uint64_t lastWriteTime)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        if (auto itr = m_entries.find(key); itr != m_entries.end())
+        {
+            auto& snapshot = itr->second[static_cast<int>(kind)];
+            if (snapshot && snapshot->matches(path, ansi, rawCount, lastWriteTime))
+            {
+                ++m_hits;
+                return snapshot;
+            }
+        }
+        return nullptr;
+    }
+
+    // Replaces any earlier snapshot of the same kind for 'key'
+    void store(key_type key, registry_enum_kind kind, std::shared_ptr<const registry_enum_snapshot> snapshot)
+    {
+        ++m_taken;
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        m_entries[key][static_cast<int>(kind)] = std::move(snapshot);
+    }
+
+    // Called for every key that is closed, most of which never had a snapshot
+    void remove(key_type key)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            if (m_entries.find(key) == m_entries.end())
+            {
+                return;
+            }
+        }
+
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        m_entries.erase(key);
+    }
+
+    std::uint64_t hits() const noexcept
+    {
+        return m_hits;
+    }
+
+    std::uint64_t taken() const noexcept
+    {
+        return m_taken;
+    }
+
+private:
+    using entry = std::array<std::shared_ptr<const registry_enum_snapshot>, 2>;
+
+    std::shared_mutex m_mutex;
+    std::unordered_map<key_type, entry> m_entries;
+
+    std::atomic<std::uint64_t> m_hits{ 0 };
+    std::atomic<std::uint64_t> m_taken{ 0 };
+};
@@ -11,6 +11,7 @@
 
 #include <reentrancy_guard.h>
 #include <psf_framework.h>
+#include <psf_logging.h>
 
 #include <cassert>
 //#include <ntstatus.h>
@@ -237,8 +238,28 @@ inline std::wstring InterpretStringW(const wchar_t* value)
 }
 
 
-void Log(const char* fmt, ...);
-void LogString(const char* name, const char* value);
-void LogString(const char* name, const wchar_t* value);
+// Log sites go through psf_logging.h. LogString is a macro, like Log, so that a disabled site is just the level check
+// and its arguments (often a converted copy of a path) are never evaluated
+inline void LogNameValue(const char* name, const char* value)
+{
+    psf::log_message("%s=%s\n", name, value);
+}
+
+inline void LogNameValue(const char* name, const wchar_t* value)
+{
+    psf::log_message("%s=%ls\n", name, value);
+}
+
+inline void LogNameValue(const wchar_t* name, const char* value)
+{
+    psf::log_message("%ls=%s\n", name, value);
+}
+
+inline void LogNameValue(const wchar_t* name, const wchar_t* value)
+{
+    psf::log_message(L"%ls=%ls\n", name, value);
+}
+
+#define LogString(...) PSF_LOG_CALL(::psf::log_level::verbose, LogNameValue, __VA_ARGS__)
 
 
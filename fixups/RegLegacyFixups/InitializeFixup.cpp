@@ -5,6 +5,7 @@
 //-------------------------------------------------------------------------------------------------------
 #include "pch.h"
 
+#include <chrono>
 #include <regex>
 #include <vector>
 
@@ -29,99 +30,18 @@ using namespace winrt::Windows::System::Profile;
 
 std::vector<Reg_Remediation_Spec>  g_regRemediationSpecs;
 
-#if _DEBUG 
-void Log(const char* fmt, ...)
-{
-   
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-        std::string str;
-        str.resize(256);
-        std::size_t count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
-        assert(count >= 0);
-        va_end(args);
-
-        if (count > str.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            str.resize(count);
-
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vsnprintf(str.data(), str.size() + 1, fmt, args2);
-            assert(count >= 0);
-            va_end(args2);
-        }
+size_t CreateRedirectedKeys(const Redirect_Registry& redirect);
+bool RedirectMarkerMatches(const Redirect_Registry& redirect);
+bool EnableRegistryLatencyHistograms();
 
-        str.resize(count);
-        ::OutputDebugStringA(str.c_str());
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in Log()");
-        ::OutputDebugStringA(fmt);
-    }
-}
-#else
-void Log(const char* , ...)
+// Time spent on Redirect records while the fixup initializes, by Redirect_Materialize_Types
+struct RedirectStartupCost
 {
-}
-#endif
-#if _DEBUG
-void Log(const wchar_t* fmt, ...)
-{
-    try
-    {
-        va_list args;
-        va_start(args, fmt);
-
-        std::wstring wstr;
-        wstr.resize(256);
-        std::size_t count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
-        va_end(args);
-
-        if (count > wstr.size())
-        {
-            count = 1024;       // vswprintf actually returns a negative number, let's just go with something big enough for our long strings; it is resized shortly.
-            wstr.resize(count);
-            va_list args2;
-            va_start(args2, fmt);
-            count = std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args2);
-            va_end(args2);
-        }
-        wstr.resize(count);
-        ::OutputDebugStringW(wstr.c_str());
-    }
-    catch (...)
-    {
-        ::OutputDebugStringA("Exception in wide Log()");
-        ::OutputDebugStringW(fmt);
-    }
-}
-#else
-void Log(const wchar_t* , ...)
-{
-}
-#endif
-
-void LogString(const char* name, const char* value)
-{
-    Log("%s=%s\n", name, value);
-}
-void LogString(const char* name, const wchar_t* value)
-{
-    Log("%s=%ls\n", name, value);
-}
-void LogString(const wchar_t* name, const char* value)
-{
-    Log("%ls=%s\n", name, value);
-}
-void LogString(const wchar_t* name, const wchar_t* value)
-{
-    Log(L"%ls=%ls\n", name, value);
-}
+    size_t records = 0;
+    size_t keys = 0;
+    std::chrono::microseconds elapsed{ 0 };
+};
+RedirectStartupCost g_redirectStartupCosts[3];
 
 struct EntryToCreate 
 {
@@ -130,9 +50,10 @@ struct EntryToCreate
 };
 
 
-Redirect_Registry CreateRegistryRedirectEntries(std::wstring_view dependency_name, const std::vector<EntryToCreate>& entries)
+Redirect_Registry CreateRegistryRedirectEntries(std::wstring_view dependency_name, const std::vector<EntryToCreate>& entries, Redirect_Materialize_Types materialize)
 {
     Redirect_Registry redirect;
+    redirect.materialize = materialize;
 
     if (!ApiInformation::IsPropertyPresent(L"Windows.ApplicationModel.Package", L"EffectivePath"))
     {
@@ -176,41 +97,79 @@ Redirect_Registry CreateRegistryRedirectEntries(std::wstring_view dependency_nam
     std::wstring dependency_version = std::to_wstring(version.Major) + L"." + std::to_wstring(version.Minor) + L"." + std::to_wstring(version.Build) + L"." + std::to_wstring(version.Revision);
     Log("Dependency path: %LS, version: %LS\n", dependency_path.c_str(), dependency_version.c_str());
 
+    size_t value_count = 0;
     for (const auto& reg_entry : entries)
     {
-        HKEY res;
-        std::wstring reg_path = std::regex_replace(reg_entry.path, dependency_version_regex, dependency_version);
-
-        LSTATUS st = ::RegCreateKeyExW(HKEY_CURRENT_USER, reg_path.c_str(), 0, NULL, REG_OPTION_VOLATILE, KEY_ALL_ACCESS, NULL, &res, NULL);
-        if (st != ERROR_SUCCESS)
-        {
-            Log("Create key %LS failed\n", reg_entry.path.c_str());
-            psf::TraceLogExceptions("RegLegacyFixup", "Creating key failed");
-            return redirect;
-        }
-
-        redirect.redirectedHivePaths.insert(narrow(reg_path));
-        redirect.orderedRedirectedKeys.push_back(reg_path);
+        Redirect_Entry entry;
+        entry.path = std::regex_replace(reg_entry.path, dependency_version_regex, dependency_version);
 
         for (const auto& it : reg_entry.values)
         {
             std::wstring value_data = std::regex_replace(it.second, dependency_path_regex, dependency_path);
             value_data = std::regex_replace(value_data, dependency_version_regex, dependency_version);
+            entry.values.emplace_back(it.first, std::move(value_data));
+        }
 
-            st = ::RegSetValueExW(res, it.first.c_str(), 0, REG_SZ, reinterpret_cast<const BYTE*>(value_data.c_str()),
-                (DWORD)(value_data.size() + 1 /* for null termination char */) * sizeof(wchar_t));
+        value_count += entry.values.size();
+        redirect.entries.push_back(std::move(entry));
+    }
 
-            if (st != ERROR_SUCCESS)
-            {
-                Log("set value %s failed\n", it.first.c_str());
-                psf::TraceLogExceptions("RegLegacyFixup", "Setting value for a key failed");
-            }
+    // Everything needed to create the keys is known, so OnDemand and Persistent records can leave it until the app
+    // touches one of them. For a Persistent record, reading its marker is all that happens here: whether the keys that
+    // an earlier run of the same versions created are still in place is checked when the app first touches one
+    auto start = std::chrono::steady_clock::now();
+    const char* outcome = "deferred";
+    if (materialize == Redirect_Materialize_Type_Startup)
+    {
+        // As before, only the keys that were created before one failed are redirected
+        redirect.entries.resize(CreateRedirectedKeys(redirect));
+        std::call_once(redirect.materialization->once, [&] { redirect.materialization->created = true; });
+        outcome = "created";
+    }
+    else if (materialize == Redirect_Materialize_Type_Persistent)
+    {
+        redirect.markerName = dependency.Id().FamilyName();
+        redirect.markerData = std::wstring(pkg.Id().FullName()) + L";" + std::wstring(dependency.Id().FullName());
+        redirect.markerMatched = RedirectMarkerMatches(redirect);
+        if (redirect.markerMatched)
+        {
+            outcome = "marker matched";
         }
     }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    auto& cost = g_redirectStartupCosts[materialize];
+    ++cost.records;
+    cost.keys += redirect.entries.size();
+    cost.elapsed += elapsed;
+    Log("RegLegacyFixups redirected keys: %zu keys, %zu values, %s in %lld us\n",
+        redirect.entries.size(), value_count, outcome, static_cast<long long>(elapsed.count()));
+
+    for (const auto& entry : redirect.entries)
+    {
+        redirect.redirectedHivePaths.insert(narrow(entry.path));
+        redirect.orderedRedirectedKeys.push_back(entry.path);
+    }
 
     return redirect;
 }
 
+Reg_Key_Pattern CompileRegistryPattern(std::wstring_view pattern)
+{
+    Reg_Key_Pattern result;
+    result.pattern = pattern;
+    try
+    {
+        result.regex = std::wregex(result.pattern, std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        result.valid = true;
+    }
+    catch (...)
+    {
+        Log(L"RegLegacyFixups: Bad Regex pattern ignored: %Ls\n", result.pattern.c_str());
+        psf::TraceLogExceptions("RegLegacyFixupException", "Bad Regex pattern ignored in RegLegacyFixups.");
+    }
+    return result;
+}
+
 void CleanupFixups()
 {
     Log("RegLegacyFixups CleanupFixups()\n");
@@ -220,7 +179,10 @@ void CleanupFixups()
     {
         for (auto& record : specItem.remediationRecords)
         {
-            if (record.remeditaionType != Reg_Remediation_Type_Redirect)
+            // Persistent keys are kept for the next run, and OnDemand ones may never have been created
+            if ((record.remeditaionType != Reg_Remediation_Type_Redirect) ||
+                (record.redirectRegistry.materialize == Redirect_Materialize_Type_Persistent) ||
+                !record.redirectRegistry.materialization->created)
             {
                 continue;
             }
@@ -251,6 +213,22 @@ void InitializeConfiguration()
             Log("RegLegacyFixups process config\n");
             const psf::json_array& rootConfigArray = rootConfig->as_array();
 
+            // The histograms are for the whole process, so they are on if any spec asks for them
+            bool latencyHistograms = false;
+            for (auto& spec : rootConfigArray)
+            {
+                if (auto latencyValue = spec.as_object().try_get("latencyHistograms"))
+                {
+                    latencyHistograms = latencyHistograms || latencyValue->as_boolean().get();
+                }
+            }
+            traceDataStream << " latencyHistograms: " << (latencyHistograms ? "true" : "false") << " ;";
+            Log("RegLegacyFixups: latencyHistograms %s\n", latencyHistograms ? "true" : "false");
+            if (latencyHistograms && !EnableRegistryLatencyHistograms())
+            {
+                Log("RegLegacyFixups: latencyHistograms ignored, this build has no timers\n");
+            }
+
             for (auto& spec : rootConfigArray)
             {
                 Log("RegLegacyFixups: process spec\n");
@@ -301,7 +279,7 @@ void InitializeConfiguration()
                                 auto patternString = pattern.as_string().wstring();
                                 traceDataStream << patternString << " ;";
                                 Log(L"Pattern:      %Ls\n", patternString.data());
-                                recordItem.modifyKeyAccess.patterns.push_back(patternString.data());
+                                recordItem.modifyKeyAccess.patterns.push_back(CompileRegistryPattern(patternString));
 
                             }
                             Log("RegLegacyFixups:      have patterns\n");
@@ -366,7 +344,7 @@ void InitializeConfiguration()
                                 auto patternString = pattern.as_string().wstring();
                                 traceDataStream << patternString << " ;";
                                 Log(L"Pattern:        %Ls\n", patternString.data());
-                                recordItem.fakeDeleteKey.patterns.push_back(patternString.data());
+                                recordItem.fakeDeleteKey.patterns.push_back(CompileRegistryPattern(patternString));
                             }
                             Log("RegLegacyFixups:      have patterns\n");
 
@@ -382,6 +360,22 @@ void InitializeConfiguration()
 
                             traceDataStream << " dependency: " << dependency << ";";
 
+                            auto materialize = Redirect_Materialize_Type_Startup;
+                            if (auto materializeValue = regItemObject.try_get("materialize"))
+                            {
+                                auto materializeType = materializeValue->as_string().wstring();
+                                traceDataStream << " materialize: " << materializeType << ";";
+                                Log(L"Materialize: %.*Ls\n", static_cast<int>(materializeType.length()), materializeType.data());
+                                if (materializeType.compare(L"OnDemand") == 0)
+                                {
+                                    materialize = Redirect_Materialize_Type_OnDemand;
+                                }
+                                else if (materializeType.compare(L"Persistent") == 0)
+                                {
+                                    materialize = Redirect_Materialize_Type_Persistent;
+                                }
+                            }
+
                             std::vector<EntryToCreate>entriesTtoCreate;
 
                             for (auto& entry : data)
@@ -406,7 +400,7 @@ void InitializeConfiguration()
                                 entriesTtoCreate.push_back(toCreate);
                             }
 
-                            recordItem.redirectRegistry = CreateRegistryRedirectEntries(dependency, entriesTtoCreate);
+                            recordItem.redirectRegistry = CreateRegistryRedirectEntries(dependency, entriesTtoCreate, materialize);
                             specItem.remediationRecords.push_back(recordItem);
                         }
                         // Look for DeletionMarker remediation
@@ -438,7 +432,7 @@ void InitializeConfiguration()
                             auto keyString = regItemObject.get("key").as_string().wstring();
                             traceDataStream << keyString << " ;";
                             Log(L"key:        %Ls\n", keyString.data());
-                            recordItem.deletionMarker.key = keyString.data();
+                            recordItem.deletionMarker.key = CompileRegistryPattern(keyString);
                             
                             Log("RegLegacyFixups: \t have key\n");
 
@@ -453,7 +447,7 @@ void InitializeConfiguration()
                                     auto valueString = value.as_string().wstring();
                                     traceDataStream << valueString << " ;";
                                     Log(L"Value: \t %Ls\n", valueString.data());
-                                    recordItem.deletionMarker.values.push_back(valueString.data());
+                                    recordItem.deletionMarker.values.push_back(CompileRegistryPattern(valueString));
                                 }
 
                                 Log("RegLegacyFixups: \t have value\n");
@@ -469,11 +463,22 @@ void InitializeConfiguration()
                         {
                     specItem.remeditaionType = Reg_Remediation_Type_Unknown;
                         }
-                        g_regRemediationSpecs.push_back(specItem);
                     }
                 }
+                g_regRemediationSpecs.push_back(specItem);
             }
             psf::TraceLogFixupConfig("RegLegacyFixup", traceDataStream.str().c_str());
+
+            const char* modeNames[] = { "Startup", "OnDemand", "Persistent" };
+            for (int mode = 0; mode < 3; ++mode)
+            {
+                auto& cost = g_redirectStartupCosts[mode];
+                if (cost.records)
+                {
+                    PSF_LOG_INFO("RegLegacyFixups %s Redirect records at startup: %zu records, %zu keys, %lld us\n",
+                        modeNames[mode], cost.records, cost.keys, static_cast<long long>(cost.elapsed.count()));
+                }
+            }
         }
         else
         {
@@ -0,0 +1,141 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The normalized path (as ReplaceRegistrySyntax would return it) of each open key handle that the registry fixups know
+// about, so that working out which key a call is about is a hash lookup rather than two NtQueryKey calls and an
+// allocation each time.
+//
+// Handles are tracked when they are opened or created through the fixups and forgotten when they are closed. The path
+// of a tracked handle is resolved the first time that it is needed, since many handles are only ever used by the call
+// that opened them. Handles that are not tracked (opened before the fixups were attached, or by some other API) are
+// resolved on every call, as before: nothing would ever remove their entries, and the handle value could later be
+// reused for a different key. Roots (the predefined HKEYs) are never removed.
+//
+// NOTE: A kept path is never checked against the key again, so remove() must be called before a tracked handle is
+// closed. RegistryFixups.cpp does this in its RegCloseKey detour, under both the handle value the app holds and that
+// value without the tag bits advapi32 sets on some keys. A key closed some other way (CloseHandle, NtClose) keeps its
+// entry until a key opened through the fixups reuses the value and track() resets it; were the value reused by a key
+// opened through some other API first, that key would be matched against the old path
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+class key_path_cache
+{
+public:
+    using key_type = const void*;
+
+    struct statistics
+    {
+        std::uint64_t hits;
+        std::uint64_t resolves;
+        std::uint64_t untracked;
+        std::uint64_t tracked;
+    };
+
+    void add_root(key_type key, std::string path)
+    {
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        auto& entry = m_entries[key];
+        entry.path = std::move(path);
+        entry.resolved = true;
+        entry.root = true;
+    }
+
+    // Called once 'key' has been opened or created. Any path that was kept for an earlier handle with the same value
+    // is discarded
+    void track(key_type key)
+    {
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        auto& entry = m_entries[key];
+        if (!entry.root)
+        {
+            entry.path.clear();
+            entry.resolved = false;
+            entry.generation = ++m_generation;
+            ++m_tracked;
+        }
+    }
+
+    void remove(key_type key)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            if (auto itr = m_entries.find(key); (itr == m_entries.end()) || itr->second.root)
+            {
+                return;
+            }
+        }
+
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        if (auto itr = m_entries.find(key); (itr != m_entries.end()) && !itr->second.root)
+        {
+            m_entries.erase(itr);
+        }
+    }
+
+    // Returns the normalized path of 'key' if it is known. Otherwise, when 'key' is tracked, 'generation' is set so
+    // that its path can be kept with store() once it has been resolved; it is zero when the path can't be kept
+    std::optional<std::string> find(key_type key, std::uint64_t& generation)
+    {
+        generation = 0;
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        if (auto itr = m_entries.find(key); itr != m_entries.end())
+        {
+            if (itr->second.resolved)
+            {
+                ++m_hits;
+                return itr->second.path;
+            }
+
+            ++m_resolves;
+            generation = itr->second.generation;
+            return std::nullopt;
+        }
+
+        ++m_untracked;
+        return std::nullopt;
+    }
+
+    void store(key_type key, std::uint64_t generation, std::string path)
+    {
+        // The handle may have been closed, and its value reused, while the path was being resolved
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        if (auto itr = m_entries.find(key); (itr != m_entries.end()) && (itr->second.generation == generation))
+        {
+            itr->second.path = std::move(path);
+            itr->second.resolved = true;
+        }
+    }
+
+    statistics stats() const noexcept
+    {
+        return { m_hits.load(), m_resolves.load(), m_untracked.load(), m_tracked.load() };
+    }
+
+private:
+    struct entry
+    {
+        std::string path;
+        std::uint64_t generation = 0;
+        bool resolved = false;
+        bool root = false;
+    };
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<key_type, entry> m_entries;
+    std::uint64_t m_generation = 0;
+
+    std::atomic<std::uint64_t> m_hits{ 0 };
+    std::atomic<std::uint64_t> m_resolves{ 0 };
+    std::atomic<std::uint64_t> m_untracked{ 0 };
+    std::atomic<std::uint64_t> m_tracked{ 0 };
+};
@@ -18,6 +18,7 @@
 #include <winternl.h>
 
 
+#include <psf_logging.h>
 #include <psf_utils.h>
 #include <sddl.h>
 
@@ -36,7 +37,6 @@ extern bool m_inhibitOutput;
 extern bool m_shouldLog;
 inline std::recursive_mutex g_outputMutex;
 
-extern void Log(const char* fmt, ...);
 
 enum class function_type
 {
@@ -4,6 +4,10 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 //-------------------------------------------------------------------------------------------------------
 #pragma once
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <string_view>
@@ -38,30 +42,78 @@ enum Modify_Key_Hive_Types
     Modify_Key_Hive_Type_HKLM = 2
 };
 
+// A pattern from the config, compiled once by InitializeConfiguration rather than on every registry call that checks
+// it. A pattern that does not compile is reported then, and kept with valid == false so that it never matches
+struct Reg_Key_Pattern
+{
+    std::wstring pattern;
+    std::wregex regex;
+    bool valid = false;
+};
+
 struct Modify_Key_Access
 {
     Modify_Key_Hive_Types hive;
-    std::vector<std::wstring> patterns;
+    std::vector<Reg_Key_Pattern> patterns;
     Modify_Key_Access_Types access;
 };
 
 struct Fake_Delete_Key
 {
     Modify_Key_Hive_Types hive;
-    std::vector<std::wstring> patterns;
+    std::vector<Reg_Key_Pattern> patterns;
 };
 
 struct Deletion_Marker
 {
     Modify_Key_Hive_Types hive;
-    std::wstring key;
-    std::vector<std::wstring> values;
+    Reg_Key_Pattern key;
+    std::vector<Reg_Key_Pattern> values;
+};
+
+// When the keys of a Redirect record are created under HKCU
+enum Redirect_Materialize_Types
+{
+    // While the fixup initializes, and deleted when it unloads
+    Redirect_Materialize_Type_Startup = 0,
+    // The first time the app touches one of them, and deleted when the fixup unloads
+    Redirect_Materialize_Type_OnDemand,
+    // As OnDemand, but kept, and only created again when the app or the dependency changes version
+    Redirect_Materialize_Type_Persistent
+};
+
+struct Redirect_Entry
+{
+    // With the meta-variables replaced
+    std::wstring path;
+    std::vector<std::pair<std::wstring, std::wstring>> values;
+};
+
+// Shared by the copies of a Redirect record
+struct Redirect_Materialization
+{
+    std::once_flag once;
+    bool created = false;
 };
 
 struct Redirect_Registry
 {
     std::unordered_set<std::string> redirectedHivePaths;
     std::vector<std::wstring> orderedRedirectedKeys;
+
+    Redirect_Materialize_Types materialize = Redirect_Materialize_Type_Startup;
+    std::vector<Redirect_Entry> entries;
+
+    // Persistent: the name of the marker value, and the data that it holds once the keys have been created for this
+    // version of the app and the dependency
+    std::wstring markerName;
+    std::wstring markerData;
+
+    // Persistent: whether the marker matched when the fixup initialized. The keys themselves are only checked the first
+    // time the app touches one of them (see MaterializeRedirect)
+    bool markerMatched = false;
+
+    std::shared_ptr<Redirect_Materialization> materialization = std::make_shared<Redirect_Materialization>();
 };
 
 struct Reg_Remediation_Record
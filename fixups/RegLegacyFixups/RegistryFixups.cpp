@@ -11,19 +11,31 @@
 #include "Framework.h"
 #include "Reg_Remediation_Spec.h"
 #include "Logging.h"
+#include "EnumSnapshots.h"
+#include "KeyPathCache.h"
+#include "RegistryLatency.h"
+#include "RegistryRules.h"
+#include <chrono>
 #include <regex>
 #include "psf_tracelogging.h"
 #include "pch.h"
 
 
-DWORD g_RegIntceptInstance = 0;
+// Numbers the calls in the log output, and only counts when there is any
+#if PSF_LOG_COMPILED_LEVEL > 0
+std::atomic<DWORD> g_RegIntceptInstance = 0;
 
+DWORD NextRegLocalInstance()
+{
+    return ++g_RegIntceptInstance;
+}
+#else
+DWORD NextRegLocalInstance()
+{
+    return 0;
+}
+#endif
 
-enum Action {
-    Continue,
-    ReturnTrue,
-    ReturnFalse
-};
 
 std::string ReplaceRegistrySyntax(std::string regPath)
 {
@@ -72,455 +84,388 @@ std::string ReplaceRegistrySyntax(std::string regPath)
     return returnPath;
 }
 
+key_path_cache g_keyPaths;
+registry_rules g_registryRules;
+registry_verdict_cache g_registryVerdicts;
+registry_enum_snapshots g_enumSnapshots;
+registry_latency g_registryLatency;
 
-REGSAM RegFixupSam(std::string keypath, REGSAM samDesired, DWORD RegLocalInstance)
+void InitializeRegistryFixups()
 {
-    REGSAM samModified = samDesired;
-    std::string keystring;
+    // The roots keep the paths that they have always normalized to. NtQueryKey rejects the predefined handles, so
+    // InterpretKeyPath names the first three and leaves HKEY_USERS and HKEY_CURRENT_CONFIG empty, and the patterns that
+    // apps have been configured with match their subkeys as such
+    for (auto root : { HKEY_LOCAL_MACHINE, HKEY_CURRENT_USER, HKEY_CLASSES_ROOT, HKEY_USERS, HKEY_CURRENT_CONFIG })
+    {
+        // A root that NtQueryKey can name is resolved on every call, as KnownKeyPath leaves \REGISTRY\USER
+        auto path = InterpretKeyPath(root);
+        if (path.empty() || (path[0] != '='))
+        {
+            g_keyPaths.add_root(root, ReplaceRegistrySyntax(path));
+        }
+    }
 
+    g_registryRules.compile(g_regRemediationSpecs);
+}
+
+// Returns false when the timers are not compiled in, and so there is nothing to enable
+bool EnableRegistryLatencyHistograms()
+{
+#if PSF_REGISTRY_LATENCY
+    g_registryLatency.enable();
+    return true;
+#else
+    return false;
+#endif
+}
 
-    Log("[%d] RegFixupSam: path=%s\n", RegLocalInstance, keypath.c_str());
-    for (auto& spec : g_regRemediationSpecs)
+// Written whatever the log level is, since the histograms were asked for by the configuration
+void LogRegistryLatencyHistograms()
+{
+    auto histograms = g_registryLatency.histograms();
+    for (size_t api = 0; api < registry_latency::api_count; ++api)
     {
-#ifdef _DEBUG
-        Log("[%d] RegFixupSam: spec\n", RegLocalInstance);
-#endif        
-        for (auto& specitem: spec.remediationRecords)
+        std::uint64_t calls = 0;
+        for (auto count : histograms[api])
         {
-#ifdef _DEBUG
-            Log("[%d] RegFixupSam: specitem.type=%d\n", RegLocalInstance, specitem.remeditaionType);
-#endif   
-            switch (specitem.remeditaionType)
+            calls += count;
+        }
+
+        if (calls == 0)
+        {
+            continue;
+        }
+
+        psf::log_message("RegLegacyFixups latency: %s calls=%llu\n", registry_api_names[api], calls);
+        for (size_t n = 0; n < registry_latency::bucket_count; ++n)
+        {
+            if (histograms[api][n] == 0)
             {
-            case Reg_Remediation_Type_ModifyKeyAccess:
-#ifdef _DEBUG
-                Log("[%d] RegFixupSam: is Check ModifyKeyAccess...\n", RegLocalInstance);
-#endif
-                switch (specitem.modifyKeyAccess.hive)
+                continue;
+            }
+
+            // The lower bound of the bucket
+            double from = static_cast<double>(std::uint64_t(1) << n);
+            const char* unit = "ns";
+            for (const char* larger : { "us", "ms", "s" })
+            {
+                if (from < 1000)
                 {
-                case Modify_Key_Hive_Type_HKCU:
-                    keystring = "HKEY_CURRENT_USER\\";
-                    if (keypath._Starts_with(keystring))
-                    {
-#ifdef _DEBUG
-                        Log("[%d] RegFixupSam: is HKCU key\n", RegLocalInstance);
-#endif
-                        for (auto& pattern : specitem.modifyKeyAccess.patterns)
-                        {
-#ifdef _DEBUG
-                            Log("[%d] RegFixupSam: Check %LS\n", RegLocalInstance, widen(keypath.substr(keystring.size())).c_str());
-                            Log("[%d] RegFixupSam: using %LS\n", RegLocalInstance, pattern.c_str());
-#endif
-                            try
-                            {
-                                if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                                {
+                    break;
+                }
+                from /= 1000;
+                unit = larger;
+            }
+            psf::log_message("\t>= %.3g%s: %llu\n", from, unit, histograms[api][n]);
+        }
+    }
+}
+
+void LogRegistryFixupStatistics()
+{
+    auto stats = g_keyPaths.stats();
+    PSF_LOG_INFO("RegLegacyFixups key paths: hits=%llu resolves=%llu untracked=%llu tracked=%llu\n",
+        stats.hits, stats.resolves, stats.untracked, stats.tracked);
+    PSF_LOG_INFO("RegLegacyFixups rule verdicts: hits=%llu evaluations=%llu\n",
+        g_registryVerdicts.hits(), g_registryVerdicts.evaluations());
+    PSF_LOG_INFO("RegLegacyFixups enumeration snapshots: hits=%llu taken=%llu\n",
+        g_enumSnapshots.hits(), g_enumSnapshots.taken());
+
+    if (g_registryLatency.enabled())
+    {
+        LogRegistryLatencyHistograms();
+    }
+}
+
+// Keeps track of a key opened or created through the fixups, so that its path only needs to be resolved once
+LSTATUS TrackKeyPath(LSTATUS result, PHKEY resultKey)
+{
+    if ((result == ERROR_SUCCESS) && resultKey)
+    {
+        g_keyPaths.track(*resultKey);
+    }
+    return result;
+}
+
+// Returns the normalized path of 'key' when it is known or can be kept. Otherwise 'keyPath' is set to what
+// InterpretKeyPath returned for it. The path is kept without a trailing separator, which is the same as
+// ReplaceRegistrySyntax(keyPath + "\\" + subKey) less the subkey, except for the root of HKEY_USERS:
+// ReplaceRegistrySyntax maps the SID that follows it to HKEY_CURRENT_USER, so the path of its subkeys depends on the subkey
+std::optional<std::string> KnownKeyPath(HKEY key, std::string& keyPath)
+{
+    std::uint64_t generation;
+    if (auto path = g_keyPaths.find(key, generation))
+    {
+        return path;
+    }
+
+    keyPath = InterpretKeyPath(key);
+    if (generation && (keyPath.size() > 1) && (keyPath[0] == '=') && (keyPath != "=\\REGISTRY\\USER"))
+    {
+        auto path = ReplaceRegistrySyntax(keyPath + "\\");
+        if (path.back() == '\\')
+        {
+            path.pop_back();
+        }
+        g_keyPaths.store(key, generation, path);
+        return path;
+    }
+    return std::nullopt;
+}
+
+// The normalized path of 'key', i.e. ReplaceRegistrySyntax(InterpretKeyPath(key))
+std::string NormalizedKeyPath(HKEY key)
+{
+    std::string keyPath;
+    if (auto path = KnownKeyPath(key, keyPath))
+    {
+        return std::move(*path);
+    }
+    return ReplaceRegistrySyntax(keyPath);
+}
+
+// The normalized path of 'subKey' under 'key', i.e. ReplaceRegistrySyntax(InterpretKeyPath(key) + "\\" + subKey)
+template <typename CharT>
+std::string NormalizedKeyPath(HKEY key, const CharT* subKey)
+{
+    std::string keyPath;
+    if (auto path = KnownKeyPath(key, keyPath))
+    {
+        return *path + "\\" + InterpretStringA(subKey);
+    }
+    return ReplaceRegistrySyntax(keyPath + "\\" + InterpretStringA(subKey));
+}
+
+// Splits a normalized key path into its hive and the rest of the path, which is what remediation patterns are matched
+// against. The rest of the path is widened once here, rather than once for every pattern that is checked
+Modify_Key_Hive_Types SplitRemediationKeyPath(const std::string& keypath, std::wstring& subkey)
+{
+    constexpr std::string_view hkcu = "HKEY_CURRENT_USER\\";
+    constexpr std::string_view hklm = "HKEY_LOCAL_MACHINE\\";
+    if (keypath.compare(0, hkcu.size(), hkcu) == 0)
+    {
+        subkey = widen(std::string_view(keypath).substr(hkcu.size()));
+        return Modify_Key_Hive_Type_HKCU;
+    }
+    else if (keypath.compare(0, hklm.size(), hklm) == 0)
+    {
+        subkey = widen(std::string_view(keypath).substr(hklm.size()));
+        return Modify_Key_Hive_Type_HKLM;
+    }
+    return Modify_Key_Hive_Type_Unknown;
+}
+
+// The hive of the key at the normalized path 'keypath' (and of its subkeys), as far as remediation records go
+Modify_Key_Hive_Types RemediationHive(std::string_view keypath)
+{
+    constexpr std::string_view hkcu = "HKEY_CURRENT_USER";
+    constexpr std::string_view hklm = "HKEY_LOCAL_MACHINE";
+    auto isUnder = [&](std::string_view hive)
+    {
+        return (keypath.compare(0, hive.size(), hive) == 0) && ((keypath.size() == hive.size()) || (keypath[hive.size()] == '\\'));
+    };
+
+    if (isUnder(hkcu))
+    {
+        return Modify_Key_Hive_Type_HKCU;
+    }
+    else if (isUnder(hklm))
+    {
+        return Modify_Key_Hive_Type_HKLM;
+    }
+    return Modify_Key_Hive_Type_Unknown;
+}
+
+// The verdict of the remediation rules for the key at the normalized path 'keypath'
+std::shared_ptr<const registry_verdict> RegistryVerdict(const std::string& keypath)
+{
+    return g_registryVerdicts.get(keypath, [&]
+    {
+        std::wstring subkey;
+        auto hive = SplitRemediationKeyPath(keypath, subkey);
+        return g_registryRules.evaluate(keypath, hive, subkey);
+    });
+}
+
+// The access that the first ModifyKeyAccess record that matches the key allows, for a request for 'samDesired'
+REGSAM RegFixupSam(const registry_verdict& verdict, REGSAM samDesired, DWORD RegLocalInstance)
+{
+    REGSAM samModified = samDesired;
+    UNREFERENCED_PARAMETER(RegLocalInstance);
+
+    switch (verdict.access_hive)
+    {
+    case Modify_Key_Hive_Type_HKCU:
 #ifdef _DEBUG
-                                    Log("[%d] RegFixupSam: is HKCU pattern match.\n", RegLocalInstance);
+        Log("[%d] RegFixupSam: is HKCU pattern match.\n", RegLocalInstance);
 #endif
-                                    switch (specitem.modifyKeyAccess.access)
-                                    {
-                                    case Modify_Key_Access_Type_Full2RW:
-                                        if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | KEY_CREATE_LINK);
+        switch (verdict.access)
+        {
+        case Modify_Key_Access_Type_Full2RW:
+            if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
 #endif
-                                        }
-                                        break;
-                                    case Modify_Key_Access_Type_Full2MaxAllowed:
-                                        if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = MAXIMUM_ALLOWED;
+            }
+            break;
+        case Modify_Key_Access_Type_Full2MaxAllowed:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                        }
-                                    case Modify_Key_Access_Type_Full2R:
-                                        if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_Full2R:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
 #endif
-                                        }
-                                    case Modify_Key_Access_Type_RW2R:
-                                        if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_RW2R:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
 #endif
-                                        }
-                                    case Modify_Key_Access_Type_RW2MaxAllowed:
-                                        if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
-                                        {
-                                            samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_RW2MaxAllowed:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                        }
-                                    default:
-                                        break;
-                                    }
-                                    return samModified;
-                                }
-                            }
-                            catch (...)
-                            {
-                                psf::TraceLogExceptions("RegLegacyFixupException", "Bad Regex pattern ignored in RegLegacyFixups. Hive: HKCU");
-                                Log("[%d] Bad Regex pattern ignored in RegLegacyFixups.\n", RegLocalInstance);
-                            }
-                        }
-                    }
-                    break;
-                case Modify_Key_Hive_Type_HKLM:
-                    keystring = "HKEY_LOCAL_MACHINE\\";
-                    if (keypath._Starts_with(keystring))
-                    {
-#ifdef _DEBUG
-                        Log("[%d] RegFixupSam: is HKLM key\n", RegLocalInstance);
-#endif
-                        for (auto& pattern : specitem.modifyKeyAccess.patterns)
-                        {
-                            try
-                            {
-                                if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                                {
+            }
+        default:
+            break;
+        }
+        break;
+    case Modify_Key_Hive_Type_HKLM:
 #ifdef _DEBUG
-                                    Log("[%d] RegFixupSam: HKLM pattern match.\n", RegLocalInstance);
+        Log("[%d] RegFixupSam: HKLM pattern match.\n", RegLocalInstance);
 #endif
-                                    switch (specitem.modifyKeyAccess.access)
-                                    {
-                                    case Modify_Key_Access_Type_Full2RW:
-                                        if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | KEY_CREATE_LINK);
+        switch (verdict.access)
+        {
+        case Modify_Key_Access_Type_Full2RW:
+            if ((samDesired & (KEY_ALL_ACCESS | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2RW\n", RegLocalInstance);
 #endif
-                                        }
-                                        break;
-                                    case Modify_Key_Access_Type_Full2R:
-                                        if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+            break;
+        case Modify_Key_Access_Type_Full2R:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2R\n", RegLocalInstance);
 #endif
-                                        }
-                                    case Modify_Key_Access_Type_Full2MaxAllowed:
-                                        if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
-                                        {
-                                            samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_Full2MaxAllowed:
+            if ((samDesired & (DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: Full2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                        }
-                                    case Modify_Key_Access_Type_RW2R:
-                                        if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
-                                        {
-                                            samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
+            }
+        case Modify_Key_Access_Type_RW2R:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE)) != 0)
+            {
+                samModified = samDesired & ~(DELETE | WRITE_DAC | WRITE_OWNER | KEY_SET_VALUE | KEY_CREATE_SUB_KEY | KEY_CREATE_LINK);
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2R\n", RegLocalInstance);
 #endif
-                                        }
-                                    case Modify_Key_Access_Type_RW2MaxAllowed:
-                                        if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
-                                        {
-                                            samModified = MAXIMUM_ALLOWED;
+            }
+        case Modify_Key_Access_Type_RW2MaxAllowed:
+            if ((samDesired & (KEY_CREATE_LINK | KEY_CREATE_SUB_KEY | KEY_SET_VALUE | WRITE_DAC | WRITE_OWNER)) != 0)
+            {
+                samModified = MAXIMUM_ALLOWED;
 #ifdef _DEBUG
-                                            Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
+                Log("[%d] RegFixupSam: RW2MaxAllowed\n", RegLocalInstance);
 #endif                                    
-                                        }
-                                    default:
-                                        break;
-                                    }
-                                    return samModified;
-                                }
-                            }
-                            catch (...)
-                            {
-                                psf::TraceLogExceptions("RegLegacyFixupException", "Bad Regex pattern ignored in RegLegacyFixups. Hive: HKLM");
-                                Log("[%d] Bad Regex pattern ignored in RegLegacyFixups.\n", RegLocalInstance);
-                            }
-                        }
-                    }
-                    break;
-                case Modify_Key_Hive_Type_Unknown:
-                default:
-                    break;
-                }
             }
+        default:
+            break;
         }
+        break;
+    default:
+        break;
     }
     return samModified;
 }
 
+void MaterializeRedirect(const Redirect_Registry& redirect);
+
 template <typename CharT>
-std::tuple<const char*, std::string> ReplaceRegistryQueryPath(_Inout_ PHKEY key, _In_opt_ const CharT* subKey)
+std::tuple<const char*, std::string, std::shared_ptr<const registry_verdict>> ReplaceRegistryQueryPath(_Inout_ PHKEY key, _In_opt_ const CharT* subKey)
 {
-    std::string keypath = InterpretKeyPath(*key) + "\\" + InterpretStringA(subKey);
-
-    std::string normalizedKeypath = ReplaceRegistrySyntax(keypath);
-    size_t subkeyOffset = normalizedKeypath.find_first_of('\\');
-    if (subkeyOffset != std::wstring_view::npos)
+    std::string normalizedKeypath = NormalizedKeyPath(*key, subKey);
+    auto verdict = RegistryVerdict(normalizedKeypath);
+    if (verdict->redirect)
     {
-        std::string requestedSubkey = normalizedKeypath.substr(subkeyOffset + 1);
-
-        for (auto& spec : g_regRemediationSpecs)
-        {
-            for (auto& specitem : spec.remediationRecords)
-            {
-                if (specitem.remeditaionType != Reg_Remediation_Type_Redirect)
-                {
-                    continue;
-                }
-
-                auto it = specitem.redirectRegistry.redirectedHivePaths.find(requestedSubkey);
-                if (it != specitem.redirectRegistry.redirectedHivePaths.end())
-                {
-                    // If application is trying to do something with registry path that is configured to be redirected,
-                    // we need to change the hive to HKCU since thats where the entries are created during 
-                    // InitializeConfiguration function. We could have created them in HKLM but that would require
-                    // admin privileges and would modify global registry. Redirecting to HKCU allows us to bypass
-                    // the priviledge requirement and also keep the changes local to per user per app.
-                    *key = HKEY_CURRENT_USER;
-                    return { it->c_str(), normalizedKeypath };
-                }
-            }
-        }
+        // If application is trying to do something with registry path that is configured to be redirected,
+        // we need to change the hive to HKCU since thats where the entries are created during 
+        // InitializeConfiguration function. We could have created them in HKLM but that would require
+        // admin privileges and would modify global registry. Redirecting to HKCU allows us to bypass
+        // the priviledge requirement and also keep the changes local to per user per app.
+        MaterializeRedirect(*verdict->redirect->record);
+        *key = HKEY_CURRENT_USER;
+        return { verdict->redirect->subkey.c_str(), normalizedKeypath, verdict };
     }
 
-    return { nullptr, normalizedKeypath };
+    return { nullptr, normalizedKeypath, verdict };
 }
 
 
 #ifdef _DEBUG
-bool RegFixupFakeDelete(std::string keypath,DWORD RegLocalInstance)
+bool RegFixupFakeDelete(const std::string& keypath, DWORD RegLocalInstance)
 #else
-bool RegFixupFakeDelete(std::string keypath)
+bool RegFixupFakeDelete(const std::string& keypath)
 #endif
 {
-    keypath = ReplaceRegistrySyntax(keypath);
 #ifdef _DEBUG
     Log("[%d] RegFixupFakeDelete: path=%s\n", RegLocalInstance, keypath.c_str());
 #endif
-    std::string keystring;
-    for (auto& spec : g_regRemediationSpecs)
-    {
-#ifdef _DEBUG
-        Log("[%d] RegFixupFakeDelete: spec\n", RegLocalInstance);
-#endif        
-        for (auto& specitem : spec.remediationRecords)
-        {
-#ifdef _DEBUG
-            Log("[%d] RegFixupFakeDelete: specitem.type=%d\n", RegLocalInstance, specitem.remeditaionType);
-#endif        
-            switch (specitem.fakeDeleteKey.hive)
-            {
-            case Modify_Key_Hive_Type_HKCU:
-                keystring = "HKEY_CURRENT_USER\\";
-                if (keypath._Starts_with(keystring))
-                {
-                    for (auto& pattern : specitem.fakeDeleteKey.patterns)
-                    {
-                        try
-                        {
-                            if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                            {
-#ifdef _DEBUG
-                                Log("[%d] RegFixupFakeDelete: match hkcu\n", RegLocalInstance);
-#endif                            
-                                return true;
-                            }
-                        }
-                        catch (...)
-                        {
-                            psf::TraceLogExceptions("RegLegacyFixupException", "RegFixupFakeDelete: Bad Regex pattern ignored in RegLegacyFixups. Hive: HKCU");
-#ifdef _DEBUG
-                            Log("[%d] Bad Regex pattern ignored in RegLegacyFixups.\n", RegLocalInstance);
-#endif
-                        }
-                    }
-                }
-                break;
-            case Modify_Key_Hive_Type_HKLM:
-                keystring = "HKEY_LOCAL_MACHINE\\";
-                if (keypath._Starts_with(keystring))
-                {
-                    for (auto& pattern : specitem.fakeDeleteKey.patterns)
-                    {
-                        try
-                        {
-                            if (std::regex_match(widen(keypath.substr(keystring.size())), std::wregex(pattern)))
-                            {
-#ifdef _DEBUG
-                                Log("[%d] RegFixupFakeDelete: match hklm\n", RegLocalInstance);
-#endif                            
-                                return true;
-                            }
-                        }
-                        catch (...)
-                        {
-                            psf::TraceLogExceptions("RegLegacyFixupException", "RegFixupFakeDelete: Bad Regex pattern ignored in RegLegacyFixups. Hive: HKLM");
-#ifdef _DEBUG
-                            Log("[%d] Bad Regex pattern ignored in RegLegacyFixups.\n", RegLocalInstance);
-#endif
-                        }
-                    }
-                }
-                break;
-            }
-        }
-    }
-    return false;
+    return RegistryVerdict(keypath)->fake_delete;
 }
 
 
-
 /// <summary>
-/// Helper method for RegFixupDeletionMarker
+/// Method to check if given keyValue is a deletion-marker, or with no keyValue, if the key is
 /// </summary>
+/// <param name="verdict"></param>
+/// <param name="keyValue"></param>
+/// <returns></returns>
 template <typename CharT>
-#ifdef _DEBUG
-Action RegFixupDeletionMarkerHelper(Reg_Remediation_Record &specitem, std::string keyPath, const CharT* keyValue, DWORD RegLocalInstance,  std::string keystring, const char* hive)
-#else
-Action RegFixupDeletionMarkerHelper(Reg_Remediation_Record& specitem, std::string keyPath, const CharT* keyValue, std::string keystring)
-#endif
+bool RegFixupDeletionMarker(const registry_verdict& verdict, const CharT* keyValue)
 {
-    if (keyPath._Starts_with(keystring))
+    if (keyValue == NULL)
     {
-#ifdef _DEBUG
-        Log("[%d] RegFixupDeletionMarker: is %s hive\n", RegLocalInstance, hive);
-#endif
-        try
-        {
-#ifdef _DEBUG
-            Log("[%d] RegFixupDeletionMarker: key: %LS\n", RegLocalInstance, specitem.deletionMarker.key.c_str());
-#endif
-            if (std::regex_match(widen(keyPath.substr(keystring.size())), std::wregex(specitem.deletionMarker.key)))
-            {
-#ifdef _DEBUG
-                Log("[%d] RegFixupDeletionMarker: is %s key match.\n", RegLocalInstance, hive);
-#endif
-                if (specitem.deletionMarker.values.empty())
-                {
-                    // Deletion Marker for Key Found
-#ifdef _DEBUG
-                    Log("[%d] RegFixupDeletionMarker: No Values\n", RegLocalInstance);
-#endif
-                    return ReturnTrue;
-                }
-                else if (keyValue == NULL)
-                {
-                    return ReturnFalse;
-                }
-                else
-                {
-                    // Check for Deletion Marker for Value
-                    for (auto& value : specitem.deletionMarker.values)
-                    {
-#ifdef _DEBUG
-                        Log("[%d] RegFixupDeletionMarker: value: %LS\n", RegLocalInstance, value.c_str());
-#endif
-                        if (std::regex_match(widen(keyValue), std::wregex(value)))
-                        {
-                            //Deletion Marker for Value Found
-#ifdef _DEBUG
-                            Log("[%d] RegFixupDeletionMarker: is %s key-value match.\n", RegLocalInstance, hive);
-                            Log("[%d] RegFixupDeletionMarker: Deletion-Marker true.\n", RegLocalInstance);
-#endif
-                            return ReturnTrue;
-                        }
-                    }
-                }
-            }
-        }
-        catch (...)
-        {
-            psf::TraceLogExceptions("RegLegacyFixupException", "Bad Regex pattern ignored in RegLegacyFixups.");
-#ifdef _DEBUG
-            Log("[%d] Bad Regex pattern ignored in RegLegacyFixups.\n", RegLocalInstance);
-#endif
-        }
+        return verdict.hidden();
     }
-    return Continue;
+    return !verdict.deletion_markers.empty() && verdict.value_hidden(widen(keyValue));
 }
 
-/// <summary>
-/// Method to check if given keyValue is a deletion-marker
-/// </summary>
-/// <param name="keypath"></param>
-/// <param name="keyValue"></param>
-/// <param name="RegLocalInstance"></param>
-/// <returns></returns>
-
 template <typename CharT>
 #ifdef _DEBUG
-bool RegFixupDeletionMarker(std::string keyPath, const CharT* keyValue, DWORD RegLocalInstance)
+bool RegFixupDeletionMarker(const std::string& keyPath, const CharT* keyValue, DWORD RegLocalInstance)
 #else
-bool RegFixupDeletionMarker(std::string keyPath, const CharT* keyValue)
+bool RegFixupDeletionMarker(const std::string& keyPath, const CharT* keyValue)
 #endif 
 {
-    std::string keystring;
 #ifdef _DEBUG
     Log("[%d] RegFixupDeletionMarker: keyPath=%s keyValue=%s \n", RegLocalInstance, keyPath.c_str(), keyValue);
 #endif  
-
-    for (auto& spec : g_regRemediationSpecs)
-    {
-#ifdef _DEBUG
-        Log("[%d] RegFixupDeletionMarker: spec\n", RegLocalInstance);
-#endif        
-        for (auto& specitem : spec.remediationRecords)
-        {
-#ifdef _DEBUG
-            Log("[%d] RegFixupDeletionMarker: specitem.type=%d\n", RegLocalInstance, specitem.remeditaionType);
-#endif   
-            Action result = Continue;
-            switch (specitem.remeditaionType)
-            {
-            case Reg_Remediation_Type_DeletionMarker:
-#ifdef _DEBUG
-                Log("[%d] RegFixupDeletionMarker: is Check DeletionMarker...\n", RegLocalInstance);
-#endif  
-                switch (specitem.deletionMarker.hive)
-                {  
-                case Modify_Key_Hive_Type_HKCU:
-                    keystring = "HKEY_CURRENT_USER\\";
-#ifdef _DEBUG
-                    result = RegFixupDeletionMarkerHelper(specitem, keyPath, keyValue, RegLocalInstance, keystring, "HKCU");
-#else
-                    result = RegFixupDeletionMarkerHelper(specitem, keyPath, keyValue, keystring);
-#endif
-                    break;
-                case Modify_Key_Hive_Type_HKLM:
-                    keystring = "HKEY_LOCAL_MACHINE\\";
-#ifdef _DEBUG
-                    result = RegFixupDeletionMarkerHelper(specitem, keyPath, keyValue, RegLocalInstance, keystring, "HKLM");
-#else
-                    result = RegFixupDeletionMarkerHelper(specitem, keyPath, keyValue, keystring);
-#endif
-                    break;
-                default:
-                    break;
-                }
-
-                if (result == ReturnTrue) {
-                    return true;
-                }
-                else if (result == ReturnFalse) {
-                    return false;
-                }
-
-            default:
-                break;
-            }
-        }
-    }
-    return false;
+    return RegFixupDeletionMarker(*RegistryVerdict(keyPath), keyValue);
 }
 
 
@@ -538,20 +483,17 @@ LSTATUS __stdcall RegCreateKeyExFixup(
     _Out_ PHKEY resultKey,
     _Out_opt_ LPDWORD disposition)
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegCreateKeyEx);
+    DWORD RegLocalInstance = NextRegLocalInstance();
 
     auto entry = LogFunctionEntry();
     Log("[%d] RegCreateKeyEx:\n", RegLocalInstance);
 
 
-    std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
-    std::string normalizedKeypath = ReplaceRegistrySyntax(keypath);
-    REGSAM samModified = RegFixupSam(normalizedKeypath, samDesired, RegLocalInstance);
+    std::string normalizedKeypath = NormalizedKeyPath(key, subKey);
+    REGSAM samModified = RegFixupSam(*RegistryVerdict(normalizedKeypath), samDesired, RegLocalInstance);
 
-    auto result = RegCreateKeyExImpl(key, subKey, reserved, classType, options, samModified, securityAttributes, resultKey, disposition);
-    QueryPerformanceCounter(&TickEnd);
+    auto result = TrackKeyPath(RegCreateKeyExImpl(key, subKey, reserved, classType, options, samModified, securityAttributes, resultKey, disposition), resultKey);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -602,24 +544,21 @@ LSTATUS __stdcall RegOpenKeyExFixup(
     _In_ REGSAM samDesired,
     _Out_ PHKEY resultKey)
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegOpenKeyEx);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
     Log("[%d] RegOpenKeyEx:\n", RegLocalInstance);
-    auto [updatedSubKey, registryPath] = ReplaceRegistryQueryPath(&key, subKey);
+    auto [updatedSubKey, registryPath, verdict] = ReplaceRegistryQueryPath(&key, subKey);
     if (updatedSubKey)
     {
-        return RegOpenKeyExImpl(key, updatedSubKey, options, samDesired, resultKey);
+        return TrackKeyPath(RegOpenKeyExImpl(key, updatedSubKey, options, samDesired, resultKey), resultKey);
     }
 
 #ifdef _DEBUG
     Log("[%d] RegOpenKeyEx: Path=%s", RegLocalInstance, registryPath.c_str());
-    if (RegFixupDeletionMarker<char>(registryPath, NULL, RegLocalInstance) == true)
-#else
-    if (RegFixupDeletionMarker<char>(registryPath, NULL) == true)
 #endif
+    if (RegFixupDeletionMarker<char>(*verdict, NULL) == true)
     {
 #ifdef _DEBUG
         Log("[%d] RegOpenKeyEx: Key Deletion Marker", RegLocalInstance);
@@ -628,10 +567,9 @@ LSTATUS __stdcall RegOpenKeyExFixup(
         return ERROR_FILE_NOT_FOUND;
     }
 
-    REGSAM samModified = RegFixupSam(registryPath, samDesired, RegLocalInstance);
+    REGSAM samModified = RegFixupSam(*verdict, samDesired, RegLocalInstance);
 
-    auto result = RegOpenKeyExImpl(key, subKey, options, samModified,  resultKey);
-    QueryPerformanceCounter(&TickEnd);
+    auto result = TrackKeyPath(RegOpenKeyExImpl(key, subKey, options, samModified,  resultKey), resultKey);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -679,27 +617,24 @@ LSTATUS __stdcall RegOpenKeyTransactedFixup(
 {
 
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegOpenKeyTransacted);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
 #if _DEBUG
     Log("[%d] RegOpenKeyTransacted:\n", RegLocalInstance);
 #endif
 
-    auto [updatedSubKey, registryPath] = ReplaceRegistryQueryPath(&key, subKey);
+    auto [updatedSubKey, registryPath, verdict] = ReplaceRegistryQueryPath(&key, subKey);
     if (updatedSubKey)
     {
-        return RegOpenKeyTransactedImpl(key, updatedSubKey, options, samDesired, resultKey, hTransaction, pExtendedParameter);
+        return TrackKeyPath(RegOpenKeyTransactedImpl(key, updatedSubKey, options, samDesired, resultKey, hTransaction, pExtendedParameter), resultKey);
     }
 
 #ifdef _DEBUG
     Log("[%d] RegOpenKeyTransacted: Path=%s", RegLocalInstance, registryPath.c_str());
-    if (RegFixupDeletionMarker<char>(registryPath,NULL, RegLocalInstance) == true)
-#else
-    if (RegFixupDeletionMarker<char>(registryPath, NULL) == true)
 #endif
+    if (RegFixupDeletionMarker<char>(*verdict, NULL) == true)
     {
 #ifdef _DEBUG
         Log("[%d] RegOpenKeyTransacted: Key Deletion Marker", RegLocalInstance);
@@ -708,10 +643,9 @@ LSTATUS __stdcall RegOpenKeyTransactedFixup(
         return ERROR_FILE_NOT_FOUND;
     }
 
-    REGSAM samModified = RegFixupSam(registryPath, samDesired, RegLocalInstance);
+    REGSAM samModified = RegFixupSam(*verdict, samDesired, RegLocalInstance);
 
-    auto result = RegOpenKeyTransactedImpl(key, subKey, options, samModified, resultKey, hTransaction, pExtendedParameter);
-    QueryPerformanceCounter(&TickEnd);
+    auto result = TrackKeyPath(RegOpenKeyTransactedImpl(key, subKey, options, samModified, resultKey, hTransaction, pExtendedParameter), resultKey);
 
 #if _DEBUG
     auto functionResult = from_win32(result);
@@ -745,6 +679,42 @@ LSTATUS __stdcall RegOpenKeyTransactedFixup(
 DECLARE_STRING_FIXUP(RegOpenKeyTransactedImpl, RegOpenKeyTransactedFixup);
 
 
+// HKEY_CLASSES_ROOT and the other predefined keys are small negative constants, which closing leaves open
+bool IsPredefinedKey(HKEY key) noexcept
+{
+    auto value = reinterpret_cast<std::intptr_t>(key);
+    return (value >= static_cast<std::int32_t>(0x80000000)) && (value < static_cast<std::int32_t>(0x80000100));
+}
+
+/// <summary>
+/// detour RegCloseKey
+/// to forget the path and enumeration snapshots of the key
+/// </summary>
+auto RegCloseKeyImpl = &::RegCloseKey;
+LSTATUS __stdcall RegCloseKeyFixup(_In_ HKEY key)
+{
+    // Before the handle is closed, after which its value could be reused for another key. advapi32 sets the low bits of
+    // some handles that it returns (e.g. HKEY_CLASSES_ROOT subkeys) and strips them again before closing, so forget the
+    // key under either value
+    if (!IsPredefinedKey(key))
+    {
+        auto untagged = reinterpret_cast<HKEY>(reinterpret_cast<std::uintptr_t>(key) & ~std::uintptr_t(3));
+        g_keyPaths.remove(key);
+        g_enumSnapshots.remove(key);
+        if (untagged != key)
+        {
+            g_keyPaths.remove(untagged);
+            g_enumSnapshots.remove(untagged);
+        }
+    }
+    return RegCloseKeyImpl(key);
+}
+DECLARE_FIXUP(RegCloseKeyImpl, RegCloseKeyFixup);
+
+
+
+template <typename CharT>
+std::shared_ptr<const registry_enum_snapshot> EnumSnapshot(HKEY key, registry_enum_kind kind);
 
 /// <summary>
 /// detour RegEnumKeyExA & RegEnumKeyExW
@@ -763,9 +733,8 @@ LSTATUS __stdcall RegEnumKeyExFixup(
     _Out_opt_ PFILETIME lpftLastWriteTime
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegEnumKeyEx);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
     auto response = ERROR_NO_MORE_ITEMS;
 
@@ -774,57 +743,30 @@ LSTATUS __stdcall RegEnumKeyExFixup(
 #ifdef _DEBUG
         Log("[%d] RegEnumKeyEx:\n", RegLocalInstance);
 #endif
-        DWORD Index = 0;
-        DWORD CountDeletionMarkerKeys = 0;
-
-        do
+        if (auto snapshot = EnumSnapshot<CharT>(hKey, registry_enum_kind::subkeys))
         {
-            CharT KeyName[INT16_MAX];
-            DWORD lpdKeyName = INT16_MAX;
-            response = RegEnumKeyExImpl(hKey, Index, KeyName, &lpdKeyName, nullptr, nullptr, nullptr, nullptr);
-
-            if (response == ERROR_SUCCESS)
+            // Indexes only count the subkeys that are not hidden by deletion markers
+            if (dwIndex >= snapshot->visible.size())
             {
-                //Get Registry Path from hkey
-                std::string keyPath = InterpretKeyPath(hKey) + "\\" + InterpretStringA(KeyName);
-                keyPath = ReplaceRegistrySyntax(keyPath);
-#ifdef _DEBUG
-                Log("[%d] RegEnumKeyEx: path=%s", RegLocalInstance, keyPath.c_str());
-                if (RegFixupDeletionMarker<char>(keyPath, NULL, RegLocalInstance) == true)
-#else
-                if (RegFixupDeletionMarker<char>(keyPath, NULL) == true)
-#endif
-                {
-#ifdef _DEBUG
-                    Log("[%d] RegEnumKeyEx:Deletion Marker Success\n", RegLocalInstance);
-#endif 
-                    CountDeletionMarkerKeys++;
-                }
-
-                if (Index - CountDeletionMarkerKeys == dwIndex)
-                {
-#ifdef _DEBUG
-                    Log("[%d] RegEnumKeyEx:Index Found\n", RegLocalInstance);
-#endif 
-                    return RegEnumKeyExImpl(hKey, Index, lpName, lpcchName, lpReserved, lpClass, lpcchClass, lpftLastWriteTime);
-                }
+                response = ERROR_NO_MORE_ITEMS;
             }
             else
             {
 #ifdef _DEBUG
-                Log("[%d] RegEnumKeyEx: function failure\n", RegLocalInstance);
-#endif 
-                return response;
+                Log("[%d] RegEnumKeyEx: index %d is %d in the snapshot\n", RegLocalInstance, dwIndex, snapshot->visible[dwIndex]);
+#endif
+                response = RegEnumKeyExImpl(hKey, snapshot->visible[dwIndex], lpName, lpcchName, lpReserved, lpClass, lpcchClass, lpftLastWriteTime);
             }
-
-            Index++;
-        } while (response == ERROR_SUCCESS);
+        }
+        else
+        {
+            response = RegEnumKeyExImpl(hKey, dwIndex, lpName, lpcchName, lpReserved, lpClass, lpcchClass, lpftLastWriteTime);
+        }
     }
     catch (...)
     {
         Log("[%d] RegEnumKeyEx logging failure.\n", RegLocalInstance);
     }
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegEnumKeyEx: returns %d\n", RegLocalInstance, response);
 #endif
@@ -851,9 +793,8 @@ LSTATUS __stdcall RegEnumValueFixup(
     _Inout_opt_ LPDWORD lpcbData
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegEnumValue);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
     auto response = ERROR_NO_MORE_ITEMS;
 
@@ -862,57 +803,30 @@ LSTATUS __stdcall RegEnumValueFixup(
 #ifdef _DEBUG
         Log("[%d] RegEnumValue:\n", RegLocalInstance);
 #endif
-        DWORD Index = 0;
-        DWORD CountDeletionMarkerValues = 0;
-        
-        do
+        if (auto snapshot = EnumSnapshot<CharT>(hKey, registry_enum_kind::values))
         {
-            CharT ValueName[INT16_MAX];
-            DWORD lpdValueName = INT16_MAX;
-            response = RegEnumValueImpl(hKey, Index, ValueName, &lpdValueName, nullptr, nullptr, nullptr, nullptr);
-            
-            if (response == ERROR_SUCCESS)
+            // Indexes only count the values that are not hidden by deletion markers
+            if (dwIndex >= snapshot->visible.size())
             {
-                //Get Registry Path from hkey
-                std::string keyPath = InterpretKeyPath(hKey);
-                keyPath = ReplaceRegistrySyntax(keyPath);
-#ifdef _DEBUG
-                Log("[%d] RegEnumValue: path=%s", RegLocalInstance, keyPath.c_str());
-                if (RegFixupDeletionMarker(keyPath, ValueName, RegLocalInstance) == true)
-#else
-                if (RegFixupDeletionMarker(keyPath, ValueName) == true)
-#endif
-                {
-#ifdef _DEBUG
-                    Log("[%d] RegEnumValue:Deletion Marker Success\n", RegLocalInstance);
-#endif 
-                    CountDeletionMarkerValues++;
-                }
-
-                if (Index - CountDeletionMarkerValues == dwIndex)
-                {
-#ifdef _DEBUG
-                    Log("[%d] RegEnumValue:Index Found\n", RegLocalInstance);
-#endif 
-                    return RegEnumValueImpl(hKey, Index, lpValueName, lpcchValueName, lpReserved, lpType, lpData, lpcbData);
-                }
+                response = ERROR_NO_MORE_ITEMS;
             }
             else
             {
 #ifdef _DEBUG
-                Log("[%d] RegEnumValue: function failure\n", RegLocalInstance);
-#endif 
-                return response;
+                Log("[%d] RegEnumValue: index %d is %d in the snapshot\n", RegLocalInstance, dwIndex, snapshot->visible[dwIndex]);
+#endif
+                response = RegEnumValueImpl(hKey, snapshot->visible[dwIndex], lpValueName, lpcchValueName, lpReserved, lpType, lpData, lpcbData);
             }
-            
-            Index++;
-        } while (response == ERROR_SUCCESS);
+        }
+        else
+        {
+            response = RegEnumValueImpl(hKey, dwIndex, lpValueName, lpcchValueName, lpReserved, lpType, lpData, lpcbData);
+        }
     }
     catch (...)
     {
         Log("[%d] RegEnumValue logging failure.\n", RegLocalInstance);
     }
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegEnumValue: returns %d\n", RegLocalInstance, response);
 #endif
@@ -926,6 +840,81 @@ DECLARE_STRING_FIXUP(RegEnumValueImpl, RegEnumValueFixup);
 /// for deletion marker fixup
 /// </summary>
 auto RegQueryInfoKeyImpl = psf::detoured_string_function(&::RegQueryInfoKeyA, &::RegQueryInfoKeyW);
+
+// Returns the snapshot of the subkeys or the values of 'key', taking it if there is none or the key has changed, when
+// deletion markers could hide some of them. Returns null when they can't, or when the key can't be enumerated, in
+// which case the key is used as it is
+template <typename CharT>
+std::shared_ptr<const registry_enum_snapshot> EnumSnapshot(HKEY key, registry_enum_kind kind)
+{
+    std::string keyPath = NormalizedKeyPath(key);
+    std::shared_ptr<const registry_verdict> verdict;
+    if (kind == registry_enum_kind::values)
+    {
+        verdict = RegistryVerdict(keyPath);
+        if (verdict->deletion_markers.empty())
+        {
+            return nullptr;
+        }
+    }
+    else if (!g_registryRules.has_deletion_markers(RemediationHive(keyPath)))
+    {
+        return nullptr;
+    }
+
+    DWORD subKeys = 0;
+    DWORD values = 0;
+    FILETIME lastWriteTime = {};
+    if (RegQueryInfoKeyImpl.invoke<wchar_t>(key, nullptr, nullptr, nullptr, &subKeys, nullptr, nullptr, &values, nullptr, nullptr, nullptr, &lastWriteTime) != ERROR_SUCCESS)
+    {
+        return nullptr;
+    }
+
+    DWORD rawCount = (kind == registry_enum_kind::values) ? values : subKeys;
+    std::uint64_t lastWrite = (static_cast<std::uint64_t>(lastWriteTime.dwHighDateTime) << 32) | lastWriteTime.dwLowDateTime;
+    if (auto snapshot = g_enumSnapshots.find(key, kind, keyPath, psf::is_ansi<CharT>, rawCount, lastWrite))
+    {
+        return snapshot;
+    }
+
+    auto snapshot = std::make_shared<registry_enum_snapshot>();
+    snapshot->path = keyPath;
+    snapshot->ansi = psf::is_ansi<CharT>;
+    snapshot->raw_count = rawCount;
+    snapshot->last_write_time = lastWrite;
+    snapshot->visible.reserve(rawCount);
+
+    for (DWORD index = 0; ; ++index)
+    {
+        CharT name[INT16_MAX];
+        DWORD nameLength = INT16_MAX;
+        DWORD dataSize = 0;
+        LSTATUS result = (kind == registry_enum_kind::values) ?
+            RegEnumValueImpl(key, index, name, &nameLength, nullptr, nullptr, nullptr, &dataSize) :
+            RegEnumKeyExImpl(key, index, name, &nameLength, nullptr, nullptr, nullptr, nullptr);
+        if (result == ERROR_NO_MORE_ITEMS)
+        {
+            break;
+        }
+        else if (result != ERROR_SUCCESS)
+        {
+            return nullptr;
+        }
+
+        bool hidden = (kind == registry_enum_kind::values) ?
+            RegFixupDeletionMarker(*verdict, name) :
+            RegistryVerdict(NormalizedKeyPath(key, name))->hidden();
+        if (!hidden)
+        {
+            snapshot->visible.push_back(index);
+            snapshot->max_name_length = (std::max)(snapshot->max_name_length, static_cast<std::uint32_t>(nameLength));
+            snapshot->max_data_length = (std::max)(snapshot->max_data_length, static_cast<std::uint32_t>(dataSize));
+        }
+    }
+
+    g_enumSnapshots.store(key, kind, snapshot);
+    return snapshot;
+}
 template <typename CharT>
 LSTATUS __stdcall RegQueryInfoKeyFixup(
     _In_ HKEY hKey,
@@ -942,147 +931,50 @@ LSTATUS __stdcall RegQueryInfoKeyFixup(
     _Out_opt_ PFILETIME lpftLastWriteTime
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
+    registry_call_timer timer(g_registryLatency, registry_api::RegQueryInfoKey);
     auto entry = LogFunctionEntry();
 
 #if _DEBUG
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    DWORD RegLocalInstance = NextRegLocalInstance();
     Log("[%d] RegQueryInfoKey:\n", RegLocalInstance);
 #endif
     auto result = RegQueryInfoKeyImpl(hKey, lpClass, lpcchClass, lpReserved, lpcSubKeys, lpcbMaxSubKeyLen, lpcbMaxClassLen, lpcValues, lpcbMaxValueNameLen, lpcbMaxValueLen, lpcbSecurityDescriptor, lpftLastWriteTime);
 
     if (result == ERROR_SUCCESS)
     {
-        // Modify lpcValues & lpcbMaxValueNameLen , lpcbMaxValueLen
-        // Since Deletion Markers for values may be present
+        // Deletion markers may hide some of the values and subkeys, which are then not counted
         try
         {
-            DWORD Index = 0;
-            DWORD CountValues = 0;
-            DWORD MaxValueNameLen = 0;
-            DWORD MaxDataLen = 0;
-            auto response = ERROR_SUCCESS;
-            
-            while (response == ERROR_SUCCESS)
+            if (auto snapshot = EnumSnapshot<CharT>(hKey, registry_enum_kind::values))
             {
-                CharT ValueName[INT16_MAX];
-                DWORD dValueName = INT16_MAX;
-                LPBYTE lpData = new BYTE[INT16_MAX];
-                DWORD dData = INT16_MAX;
-
-                if constexpr (psf::is_ansi<CharT>)
-                {
-                    response = RegEnumValueA(hKey, Index, ValueName, &dValueName, NULL, NULL, lpData, &dData);
-                }
-                else
-                {
-                    response = RegEnumValueW(hKey, Index, ValueName, &dValueName, NULL, NULL, lpData, &dData);
-                }
-
-                if (response == ERROR_SUCCESS)
-                {
-                    CountValues++;
-
-                    MaxValueNameLen = max(MaxValueNameLen, dValueName);
-
-                    //Remove size of null character from dData
-                    if constexpr (psf::is_ansi<CharT>)
-                    {
-                        dData = dData - sizeof(CHAR);
-                    }
-                    else
-                    {
-                        dData = dData - sizeof(WCHAR);
-                    }
-
-                    MaxDataLen = max(MaxDataLen, dData);
-                }
-                else if (response == ERROR_NO_MORE_ITEMS)
-                {
-                    // Update lpcValues, lpcbMaxValueNameLen, lpcbMaxValueLen
-                    if (lpcValues != nullptr)
-                        *lpcValues = CountValues;
-                    if (lpcbMaxValueNameLen != nullptr)
-                        *lpcbMaxValueNameLen = MaxValueNameLen;
-                    if (lpcbMaxValueLen != nullptr)
-                        *lpcbMaxValueLen = MaxDataLen;
+                if (lpcValues != nullptr)
+                    *lpcValues = static_cast<DWORD>(snapshot->visible.size());
+                if (lpcbMaxValueNameLen != nullptr)
+                    *lpcbMaxValueNameLen = snapshot->max_name_length;
+                if (lpcbMaxValueLen != nullptr)
+                    *lpcbMaxValueLen = snapshot->max_data_length;
 #if _DEBUG
-                    Log("[%d] RegQueryInfoKey: lpcValues=  %d, lpcbMaxValueNameLen= %d, lpcbMaxValueLen= %d\n", RegLocalInstance, CountValues, dValueName, dData);
+                Log("[%d] RegQueryInfoKey: lpcValues=  %d, lpcbMaxValueNameLen= %d, lpcbMaxValueLen= %d\n", RegLocalInstance,
+                    static_cast<DWORD>(snapshot->visible.size()), snapshot->max_name_length, snapshot->max_data_length);
 #endif
-                    break;
-                }
-                else
-                {
-#if _DEBUG
-                    Log("[%d] RegQueryInfoKey logging fixup failure.\n", RegLocalInstance);
-#endif
-                    return response;
-                }
-                Index++;
             }
-        }
-        catch (...)
-        {
-#if _DEBUG
-            Log("[%d] RegQueryInfoKey logging failure in RegEnumValue.\n", RegLocalInstance);
-#endif
-        }
-
-        // Modify lpcSubKeys, lpcbMaxSubKeyLen
-        // Since Deletion Markers for values may be present
-        try
-        {
-            DWORD Index = 0;
-            DWORD CountSubKeys = 0;
-            DWORD MaxSubKeyLen = 0;
-            auto response = ERROR_SUCCESS;
 
-            while (response == ERROR_SUCCESS)
+            if (auto snapshot = EnumSnapshot<CharT>(hKey, registry_enum_kind::subkeys))
             {
-                CharT SubKey[INT16_MAX];
-                DWORD NameLen = INT16_MAX;
-
-                if constexpr (psf::is_ansi<CharT>)
-                {
-                    response = RegEnumKeyExA(hKey, Index, SubKey, &NameLen, NULL, NULL, NULL, NULL);
-                }
-                else
-                {
-                    response = RegEnumKeyExW(hKey, Index, SubKey, &NameLen, NULL, NULL, NULL, NULL);
-                }
-
-                if (response == ERROR_SUCCESS)
-                {
-                    CountSubKeys++;
-                    MaxSubKeyLen = max(MaxSubKeyLen, NameLen);
-                }
-                else if (response == ERROR_NO_MORE_ITEMS)
-                {
-                    // Update lpcSubKeys & lpcbMaxSubKeyLen
-                    if (lpcSubKeys != nullptr)
-                        *lpcSubKeys = CountSubKeys;
-                    if (lpcbMaxSubKeyLen != nullptr)
-                        *lpcbMaxSubKeyLen = MaxSubKeyLen;
-#if _DEBUG
-                    Log("[%d] RegQueryInfoKey: lpcSubKeys=  %d, lpcbMaxSubKeyLen= %d\n", RegLocalInstance, CountSubKeys, MaxSubKeyLen);
-#endif
-                    break;
-                }
-                else
-                {
+                if (lpcSubKeys != nullptr)
+                    *lpcSubKeys = static_cast<DWORD>(snapshot->visible.size());
+                if (lpcbMaxSubKeyLen != nullptr)
+                    *lpcbMaxSubKeyLen = snapshot->max_name_length;
 #if _DEBUG
-                    Log("[%d] RegQueryInfoKey logging fixup failure.\n", RegLocalInstance);
+                Log("[%d] RegQueryInfoKey: lpcSubKeys=  %d, lpcbMaxSubKeyLen= %d\n", RegLocalInstance,
+                    static_cast<DWORD>(snapshot->visible.size()), snapshot->max_name_length);
 #endif
-                    return response;
-                }
-                Index++;
             }
         }
         catch (...)
         {
 #if _DEBUG
-            Log("[%d] RegQueryInfoKey logging failure in RegEnumKeyEx.\n", RegLocalInstance);
+            Log("[%d] RegQueryInfoKey logging failure.\n", RegLocalInstance);
 #endif
         }
     }
@@ -1093,7 +985,6 @@ LSTATUS __stdcall RegQueryInfoKeyFixup(
 #endif
     }
 
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegQueryInfoKey: returns %d\n", RegLocalInstance, result);
 #endif
@@ -1124,9 +1015,8 @@ LSTATUS __stdcall  RegGetValueFixup(
     _Inout_opt_ LPDWORD pcbData
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegGetValue);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
     auto result = ERROR_SUCCESS;
 
@@ -1137,7 +1027,7 @@ LSTATUS __stdcall  RegGetValueFixup(
 #endif
 
         // If subkey is in redirected path, use it to get Registry Value
-        auto [updatedSubKey, keypath] = ReplaceRegistryQueryPath(&key, SubKey);
+        auto [updatedSubKey, keypath, verdict] = ReplaceRegistryQueryPath(&key, SubKey);
         if (updatedSubKey)
         {
             if constexpr (psf::is_ansi<CharT>) 
@@ -1153,10 +1043,8 @@ LSTATUS __stdcall  RegGetValueFixup(
 
 #ifdef _DEBUG
         Log("[%d] RegGetValue: path=%s", RegLocalInstance, keypath.c_str());
-        bool isDeletionMarker = RegFixupDeletionMarker(keypath, Value, RegLocalInstance);
-#else
-        bool isDeletionMarker = RegFixupDeletionMarker(keypath, Value);
 #endif
+        bool isDeletionMarker = RegFixupDeletionMarker(*verdict, Value);
         if (isDeletionMarker == true)
         {
 #ifdef _DEBUG
@@ -1175,7 +1063,6 @@ LSTATUS __stdcall  RegGetValueFixup(
         Log("[%d] RegGetValue logging failure.\n", RegLocalInstance);
     }
 
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegGetValue: returns %d\n", RegLocalInstance, result);
 #endif
@@ -1198,9 +1085,8 @@ LSTATUS __stdcall RegQueryMultipleValuesFixup(
     _Inout_opt_ LPDWORD ldwTotsize
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegQueryMultipleValues);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
     auto result = ERROR_SUCCESS;
 
@@ -1210,23 +1096,21 @@ LSTATUS __stdcall RegQueryMultipleValuesFixup(
         Log("[%d] RegQueryMultipleValues:\n", RegLocalInstance);
 #endif
         //Get Registry Path from hkey
-        std::string keypath = InterpretKeyPath(key);
-        keypath = ReplaceRegistrySyntax(keypath);
+        std::string keypath = NormalizedKeyPath(key);
 
 #ifdef _DEBUG
         Log("[%d] RegQueryMultipleValues: path=%s", RegLocalInstance, keypath.c_str());
 #endif
         bool isDeletionMarker = false;
+        auto verdict = RegistryVerdict(keypath);
 
         for (DWORD itr = 0; itr < num_vals; itr++)
         {
             CharT* value = val_list[itr].ve_valuename;
 #ifdef _DEBUG
             Log("[%d] RegQueryMultipleValues: value=%s", RegLocalInstance, value);
-            if (RegFixupDeletionMarker(keypath, value, RegLocalInstance) == true)
-#else
-            if (RegFixupDeletionMarker(keypath, value) == true)
 #endif
+            if (RegFixupDeletionMarker(*verdict, value) == true)
             {
                 isDeletionMarker = true;
                 break;
@@ -1251,7 +1135,6 @@ LSTATUS __stdcall RegQueryMultipleValuesFixup(
         Log("[%d] RegQueryMultipleValues logging failure.\n", RegLocalInstance);
     }
 
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegQueryMultipleValues: returns %d\n", RegLocalInstance, result);
 #endif
@@ -1276,9 +1159,8 @@ LSTATUS __stdcall RegQueryValueExFixup(
     _When_(lpData == NULL, _Out_opt_) _When_(lpData != NULL, _Inout_opt_) LPDWORD lpcbData
 )
 {
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegQueryValueEx);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
     auto result = ERROR_SUCCESS;
 
@@ -1288,8 +1170,7 @@ LSTATUS __stdcall RegQueryValueExFixup(
         Log("[%d] RegQueryValueEx:\n", RegLocalInstance);
 #endif
         //Get Registry Path from hkey
-        std::string keypath = InterpretKeyPath(key);
-        keypath = ReplaceRegistrySyntax(keypath);
+        std::string keypath = NormalizedKeyPath(key);
 
 #ifdef _DEBUG
         Log("[%d] RegQueryValueEx: path=%s", RegLocalInstance, keypath.c_str());
@@ -1315,7 +1196,6 @@ LSTATUS __stdcall RegQueryValueExFixup(
         Log("[%d] RegQueryValueEx logging failure.\n", RegLocalInstance);
     }
 
-    QueryPerformanceCounter(&TickEnd);
 #if _DEBUG
     Log("[%d] RegQueryValueEx: returns %d\n", RegLocalInstance, result);
 #endif
@@ -1335,15 +1215,13 @@ LSTATUS __stdcall RegDeleteKeyFixup(
     _In_ const CharT* subKey)
 {
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegDeleteKey);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
 
     auto result = RegDeleteKeyImpl(key, subKey);
     auto functionResult = from_win32(result);
-    QueryPerformanceCounter(&TickEnd);
 
     if (functionResult != from_win32(0))
     {
@@ -1354,7 +1232,7 @@ LSTATUS __stdcall RegDeleteKeyFixup(
 #if _DEBUG
                 Log("[%d] RegDeleteKey:\n", RegLocalInstance);
 #endif
-                std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
+                std::string keypath = NormalizedKeyPath(key, subKey);
 
 #ifdef _DEBUG
                 Log("[%d] RegDeleteKey: Path=%s", RegLocalInstance, keypath.c_str());
@@ -1393,15 +1271,13 @@ LSTATUS __stdcall RegDeleteKeyExFixup(
     DWORD Reserved)
 {
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegDeleteKeyEx);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
 
     auto result = RegDeleteKeyExImpl(key, subKey, viewDesired, Reserved);
     auto functionResult = from_win32(result);
-    QueryPerformanceCounter(&TickEnd);
 
     if (functionResult != from_win32(0))
     {
@@ -1412,7 +1288,7 @@ LSTATUS __stdcall RegDeleteKeyExFixup(
 #if _DEBUG
                 Log("[%d] RegDeleteKeyEx:\n", RegLocalInstance);
 #endif
-                std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
+                std::string keypath = NormalizedKeyPath(key, subKey);
 #ifdef _DEBUG
                 Log("[%d] RegDeleteKeyEx: Path=%s", RegLocalInstance, keypath.c_str());
                 if (RegFixupFakeDelete(keypath, RegLocalInstance) == true)
@@ -1451,15 +1327,13 @@ LSTATUS __stdcall RegDeleteKeyTransactedFixup(
     PVOID  pExtendedParameter)
 {
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegDeleteKeyTransacted);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
 
     auto result = RegDeleteKeyTransactedImpl(key, subKey, viewDesired, Reserved, hTransaction, pExtendedParameter);
     auto functionResult = from_win32(result);
-    QueryPerformanceCounter(&TickEnd);
 
     if (functionResult != from_win32(0))
     {
@@ -1470,7 +1344,7 @@ LSTATUS __stdcall RegDeleteKeyTransactedFixup(
 #if _DEBUG
                 Log("[%d] RegDeleteKeyTransacted:\n", RegLocalInstance);
 #endif
-                std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subKey);
+                std::string keypath = NormalizedKeyPath(key, subKey);
 #ifdef _DEBUG
                 Log("[%d] RegDeleteKeyTransacted: Path=%s", RegLocalInstance, keypath.c_str());
                 if (RegFixupFakeDelete(keypath, RegLocalInstance) == true)
@@ -1506,15 +1380,13 @@ LSTATUS __stdcall RegDeleteValueFixup(
     _In_ const CharT* subValueName)
 {
 
-    LARGE_INTEGER TickStart, TickEnd;
-    QueryPerformanceCounter(&TickStart);
-    DWORD RegLocalInstance = ++g_RegIntceptInstance;
+    registry_call_timer timer(g_registryLatency, registry_api::RegDeleteValue);
+    DWORD RegLocalInstance = NextRegLocalInstance();
     auto entry = LogFunctionEntry();
 
 
     auto result = RegDeleteValueImpl(key, subValueName);
     auto functionResult = from_win32(result);
-    QueryPerformanceCounter(&TickEnd);
 
     if (functionResult != from_win32(0))
     {
@@ -1525,7 +1397,7 @@ LSTATUS __stdcall RegDeleteValueFixup(
 #if _DEBUG
                 Log("[%d] RegDeleteValue:\n", RegLocalInstance);
 #endif
-                std::string keypath = InterpretKeyPath(key) + "\\" + InterpretStringA(subValueName);
+                std::string keypath = NormalizedKeyPath(key, subValueName);
 #ifdef _DEBUG
                 Log("[%d] RegDeleteValue: Path=%s", RegLocalInstance, keypath.c_str());
                 if (RegFixupFakeDelete(keypath, RegLocalInstance) == true)
@@ -1553,3 +1425,219 @@ LSTATUS __stdcall RegDeleteValueFixup(
 }
 DECLARE_STRING_FIXUP(RegDeleteValueImpl, RegDeleteValueFixup);
 
+
+
+// Where Persistent Redirect records note, by dependency, the versions of the app and the dependency that their keys were
+// last created for (in the value named by the dependency's family name), and which keys those were (in the REG_MULTI_SZ
+// value of the same name with redirectMarkerKeysSuffix appended)
+constexpr wchar_t redirectMarkerKey[] = LR"(Software\PSF\RegLegacyFixups\Redirect)";
+constexpr wchar_t redirectMarkerKeysSuffix[] = L".Keys";
+
+// Creates the keys of a Redirect record under HKCU, in order, and returns how many were created: the rest are not
+// attempted once one fails. 'complete' is set to whether every key and value was written
+size_t CreateRedirectedKeys(const Redirect_Registry& redirect, bool& complete)
+{
+    complete = true;
+    DWORD options = (redirect.materialize == Redirect_Materialize_Type_Persistent) ? REG_OPTION_NON_VOLATILE : REG_OPTION_VOLATILE;
+    size_t created = 0;
+    for (auto& entry : redirect.entries)
+    {
+        HKEY res;
+        LSTATUS st = RegCreateKeyExImpl(HKEY_CURRENT_USER, entry.path.c_str(), 0, nullptr, options, KEY_ALL_ACCESS, nullptr, &res, nullptr);
+        if (st != ERROR_SUCCESS)
+        {
+            Log("Create key %LS failed\n", entry.path.c_str());
+            psf::TraceLogExceptions("RegLegacyFixup", "Creating key failed");
+            break;
+        }
+
+        for (auto& [name, data] : entry.values)
+        {
+            st = ::RegSetValueExW(res, name.c_str(), 0, REG_SZ, reinterpret_cast<const BYTE*>(data.c_str()),
+                (DWORD)(data.size() + 1 /* for null termination char */) * sizeof(wchar_t));
+            if (st != ERROR_SUCCESS)
+            {
+                Log("set value %LS failed\n", name.c_str());
+                psf::TraceLogExceptions("RegLegacyFixup", "Setting value for a key failed");
+                complete = false;
+            }
+        }
+
+        RegCloseKeyImpl(res);
+        ++created;
+    }
+
+    complete = complete && (created == redirect.entries.size());
+    return created;
+}
+
+size_t CreateRedirectedKeys(const Redirect_Registry& redirect)
+{
+    bool complete;
+    return CreateRedirectedKeys(redirect, complete);
+}
+
+// Reads a REG_SZ or REG_MULTI_SZ value under HKCU. Returns false if it can't be read
+bool ReadRedirectString(const wchar_t* keyPath, const wchar_t* valueName, DWORD flags, std::wstring& data)
+{
+    DWORD size = 0;
+    if (RegGetValueImpl(HKEY_CURRENT_USER, keyPath, valueName, flags, nullptr, nullptr, &size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+
+    data.assign(size / sizeof(wchar_t) + 1, L'\0');
+    size = static_cast<DWORD>(data.size() * sizeof(wchar_t));
+    if (RegGetValueImpl(HKEY_CURRENT_USER, keyPath, valueName, flags, nullptr, data.data(), &size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+
+    data.resize(size / sizeof(wchar_t));
+    return true;
+}
+
+// Whether the keys and values that the record would create are all in place, e.g. that nothing deleted them since the
+// marker was written
+bool RedirectedKeysExist(const Redirect_Registry& redirect)
+{
+    for (auto& entry : redirect.entries)
+    {
+        HKEY res;
+        if (RegOpenKeyExImpl(HKEY_CURRENT_USER, entry.path.c_str(), 0, KEY_QUERY_VALUE, &res) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+        RegCloseKeyImpl(res);
+
+        for (auto& [name, data] : entry.values)
+        {
+            std::wstring existing;
+            if (!ReadRedirectString(entry.path.c_str(), name.c_str(), RRF_RT_REG_SZ, existing) ||
+                (existing.c_str() != data))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether the keys were last created for these versions of the app and the dependency. A single value read, since it
+// runs at every launch; MaterializeRedirect checks the keys themselves
+bool RedirectMarkerMatches(const Redirect_Registry& redirect)
+{
+    std::wstring data;
+    return ReadRedirectString(redirectMarkerKey, redirect.markerName.c_str(), RRF_RT_REG_SZ, data) &&
+        (data.c_str() == redirect.markerData);
+}
+
+// Deletes the keys that were created for an earlier version of the app or the dependency, as recorded along with its
+// marker. Keys that the current version will create are deleted as well, so that values no longer configured go with
+// them; they are created again right after
+void DeletePreviousRedirectedKeys(const Redirect_Registry& redirect)
+{
+    std::wstring keys;
+    auto keysName = redirect.markerName + redirectMarkerKeysSuffix;
+    if (!ReadRedirectString(redirectMarkerKey, keysName.c_str(), RRF_RT_REG_MULTI_SZ, keys))
+    {
+        return;
+    }
+
+    // Deeper keys were created later, so they are deleted first
+    std::vector<std::wstring> paths;
+    for (auto path = keys.c_str(); *path; path += wcslen(path) + 1)
+    {
+        paths.emplace_back(path);
+    }
+    for (auto itr = paths.rbegin(); itr != paths.rend(); ++itr)
+    {
+        auto st = ::RegDeleteTreeW(HKEY_CURRENT_USER, itr->c_str());
+        if ((st != ERROR_SUCCESS) && (st != ERROR_FILE_NOT_FOUND))
+        {
+            Log("Delete key %LS failed\n", itr->c_str());
+        }
+    }
+
+    // Until the new keys are all created, there is no marker to trust
+    HKEY res;
+    if (RegOpenKeyExImpl(HKEY_CURRENT_USER, redirectMarkerKey, 0, KEY_SET_VALUE, &res) == ERROR_SUCCESS)
+    {
+        RegDeleteValueImpl(res, redirect.markerName.c_str());
+        RegDeleteValueImpl(res, keysName.c_str());
+        RegCloseKeyImpl(res);
+    }
+}
+
+void WriteRedirectMarker(const Redirect_Registry& redirect)
+{
+    HKEY res;
+    if (RegCreateKeyExImpl(HKEY_CURRENT_USER, redirectMarkerKey, 0, nullptr, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE, nullptr, &res, nullptr) != ERROR_SUCCESS)
+    {
+        Log("Create key %LS failed\n", redirectMarkerKey);
+        return;
+    }
+
+    // The list of keys goes first: a marker is only ever written along with the keys that a later version must delete
+    std::wstring keys;
+    for (auto& entry : redirect.entries)
+    {
+        keys += entry.path;
+        keys += L'\0';
+    }
+    keys += L'\0';
+    auto keysName = redirect.markerName + redirectMarkerKeysSuffix;
+    LSTATUS st = ::RegSetValueExW(res, keysName.c_str(), 0, REG_MULTI_SZ, reinterpret_cast<const BYTE*>(keys.c_str()),
+        (DWORD)keys.size() * sizeof(wchar_t));
+    if (st == ERROR_SUCCESS)
+    {
+        st = ::RegSetValueExW(res, redirect.markerName.c_str(), 0, REG_SZ, reinterpret_cast<const BYTE*>(redirect.markerData.c_str()),
+            (DWORD)(redirect.markerData.size() + 1) * sizeof(wchar_t));
+    }
+    if (st != ERROR_SUCCESS)
+    {
+        Log("set value %LS failed\n", redirect.markerName.c_str());
+    }
+    RegCloseKeyImpl(res);
+}
+
+// Creates the keys of a Redirect record the first time that the app touches one of them, unless that was already done
+// when the fixup initialized (or, for a Persistent record, by an earlier run of the same versions)
+void MaterializeRedirect(const Redirect_Registry& redirect)
+{
+    std::call_once(redirect.materialization->once, [&]
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (redirect.markerMatched)
+        {
+            // The marker alone doesn't prove that the keys are still there: something may have deleted them since
+            if (RedirectedKeysExist(redirect))
+            {
+                redirect.materialization->created = true;
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                Log("RegLegacyFixups verified %zu redirected keys on demand in %lld us\n", redirect.entries.size(),
+                    static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+                return;
+            }
+            Log("RegLegacyFixups redirected keys for %LS are missing; they will be created again\n",
+                redirect.markerName.c_str());
+        }
+
+        if (redirect.materialize == Redirect_Materialize_Type_Persistent)
+        {
+            DeletePreviousRedirectedKeys(redirect);
+        }
+
+        bool complete;
+        auto created = CreateRedirectedKeys(redirect, complete);
+        redirect.materialization->created = true;
+        if ((redirect.materialize == Redirect_Materialize_Type_Persistent) && complete)
+        {
+            WriteRedirectMarker(redirect);
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        Log("RegLegacyFixups created %zu of %zu redirected keys on demand in %lld us\n",
+            created, redirect.entries.size(), static_cast<long long>(elapsed.count()));
+    });
+}
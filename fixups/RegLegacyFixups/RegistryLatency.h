@@ -0,0 +1,242 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Opt-in latency histograms for the registry fixups. Each fixup times itself with a registry_call_timer, which does
+// nothing but check a flag unless the histograms were enabled by the configuration. Each thread counts into its own
+// block of counters, so timed calls never write to memory that another thread writes to. When a thread exits, its
+// counts are added to those of the threads that exited before it and its block is freed.
+//
+// Calls are counted by the power of two of their duration in nanoseconds: bucket 'n' holds the calls that took from
+// 2^n up to (but not including) 2^(n+1) nanoseconds, except that the first and last buckets hold everything below and
+// above them.
+//
+// The timers are only compiled into debug builds, as the log output is; elsewhere "latencyHistograms" is ignored.
+// Define PSF_REGISTRY_LATENCY to 1 on the compiler command line to time a release build, or to 0 to remove the timers
+// from a debug one.
+//
+// NOTE: A thread's block is given back by a thread_local destructor, which the CRT runs on DLL_THREAD_DETACH, so the
+// registry_latency must outlive every thread that records into it (RegistryFixups.cpp has one, for the process)
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef PSF_REGISTRY_LATENCY
+#if _DEBUG
+#define PSF_REGISTRY_LATENCY 1
+#else
+#define PSF_REGISTRY_LATENCY 0
+#endif
+#endif
+
+enum class registry_api : std::size_t
+{
+    RegCreateKeyEx,
+    RegOpenKeyEx,
+    RegOpenKeyTransacted,
+    RegEnumKeyEx,
+    RegEnumValue,
+    RegQueryInfoKey,
+    RegGetValue,
+    RegQueryMultipleValues,
+    RegQueryValueEx,
+    RegDeleteKey,
+    RegDeleteKeyEx,
+    RegDeleteKeyTransacted,
+    RegDeleteValue,
+
+    count
+};
+
+constexpr const char* registry_api_names[] =
+{
+    "RegCreateKeyEx",
+    "RegOpenKeyEx",
+    "RegOpenKeyTransacted",
+    "RegEnumKeyEx",
+    "RegEnumValue",
+    "RegQueryInfoKey",
+    "RegGetValue",
+    "RegQueryMultipleValues",
+    "RegQueryValueEx",
+    "RegDeleteKey",
+    "RegDeleteKeyEx",
+    "RegDeleteKeyTransacted",
+    "RegDeleteValue",
+};
+static_assert(std::size(registry_api_names) == static_cast<std::size_t>(registry_api::count));
+
+class registry_latency
+{
+public:
+    static constexpr std::size_t api_count = static_cast<std::size_t>(registry_api::count);
+    static constexpr std::size_t bucket_count = 32;
+
+    using histogram = std::array<std::uint64_t, bucket_count>;
+
+    void enable() noexcept
+    {
+        m_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const noexcept
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void record(registry_api api, std::chrono::nanoseconds elapsed)
+    {
+        auto& counter = thread_block().counters[static_cast<std::size_t>(api)][bucket(elapsed)];
+
+        // Only this thread writes to its block, so there is no need for a locked increment; the counter is atomic so
+        // that it can be read while it is being written
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // The counts of every thread, by API
+    std::array<histogram, api_count> histograms() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto result = m_exited;
+        for (auto& block : m_blocks)
+        {
+            for (std::size_t api = 0; api < api_count; ++api)
+            {
+                for (std::size_t n = 0; n < bucket_count; ++n)
+                {
+                    result[api][n] += block->counters[api][n].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        return result;
+    }
+
+    static std::size_t bucket(std::chrono::nanoseconds elapsed) noexcept
+    {
+        auto ns = static_cast<std::uint64_t>((elapsed.count() > 0) ? elapsed.count() : 0);
+        std::size_t result = 0;
+        while ((ns >>= 1) != 0)
+        {
+            ++result;
+        }
+        return (result < bucket_count) ? result : (bucket_count - 1);
+    }
+
+private:
+    struct block
+    {
+        std::atomic<std::uint64_t> counters[api_count][bucket_count] = {};
+    };
+
+    struct thread_block_owner
+    {
+        registry_latency* owner = nullptr;
+        block* value = nullptr;
+
+        ~thread_block_owner()
+        {
+            if (owner)
+            {
+                owner->release(value);
+            }
+        }
+    };
+
+    block& thread_block()
+    {
+        thread_local thread_block_owner cached;
+        if (cached.owner != this)
+        {
+            // Any block that the thread had from another registry_latency is left for that one to free
+            auto newBlock = std::make_unique<block>();
+            cached.value = newBlock.get();
+            cached.owner = this;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_blocks.push_back(std::move(newBlock));
+        }
+        return *cached.value;
+    }
+
+    // Called on the thread that 'value' belongs to, as it exits, so nothing else can be writing to it
+    void release(block* value) noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto itr = m_blocks.begin(); itr != m_blocks.end(); ++itr)
+        {
+            if (itr->get() == value)
+            {
+                for (std::size_t api = 0; api < api_count; ++api)
+                {
+                    for (std::size_t n = 0; n < bucket_count; ++n)
+                    {
+                        m_exited[api][n] += value->counters[api][n].load(std::memory_order_relaxed);
+                    }
+                }
+                m_blocks.erase(itr);
+                break;
+            }
+        }
+    }
+
+    std::atomic<bool> m_enabled{ false };
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<block>> m_blocks;
+
+    // The counts of the threads that have exited
+    std::array<histogram, api_count> m_exited = {};
+};
+
+// Times the scope that it is declared in when the histograms are enabled
+class registry_call_timer
+{
+public:
+#if PSF_REGISTRY_LATENCY
+    registry_call_timer(registry_latency& latency, registry_api api) noexcept :
+        m_latency(latency.enabled() ? &latency : nullptr),
+        m_api(api)
+    {
+        if (m_latency)
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~registry_call_timer()
+    {
+        if (m_latency)
+        {
+            try
+            {
+                m_latency->record(m_api, std::chrono::steady_clock::now() - m_start);
+            }
+            catch (...)
+            {
+                // The call is not counted
+            }
+        }
+    }
+#else
+    registry_call_timer(registry_latency&, registry_api) noexcept
+    {
+    }
+#endif
+
+    registry_call_timer(const registry_call_timer&) = delete;
+    registry_call_timer& operator=(const registry_call_timer&) = delete;
+
+#if PSF_REGISTRY_LATENCY
+private:
+    registry_latency* m_latency;
+    registry_api m_api;
+    std::chrono::steady_clock::time_point m_start;
+#endif
+};
@@ -0,0 +1,393 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The remediation records of g_regRemediationSpecs, gathered by hive so that a key is only checked against the rules
+// that can apply to it, and evaluated together: one evaluation returns everything that the fixups need to know about a
+// key (where it is redirected to, whether it is hidden by a deletion marker, whether deleting it is faked and how the
+// access requested for it is changed). Verdicts are kept by normalized key path, so that each key is only evaluated
+// once however many calls are made about it.
+//
+// Records are checked in the order in which they appear in the config, and the first that matches wins, as when each
+// check walked the records itself.
+//
+// Nothing here reads or writes the registry: the caller normalizes the key path (see NormalizedKeyPath) and creates the
+// keys of a Redirect record when a verdict first refers to them (see MaterializeRedirect).
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Reg_Remediation_Spec.h"
+
+inline bool match_registry_pattern(const Reg_Key_Pattern& pattern, const std::wstring& str) noexcept
+{
+    try
+    {
+        return pattern.valid && std::regex_match(str, pattern.regex);
+    }
+    catch (...)
+    {
+        // E.g. std::regex_constants::error_complexity; the pattern is treated as not matching
+        return false;
+    }
+}
+
+// The keys named by Redirect records, by path component, so that the deepest redirected ancestor of a key is found in a
+// single walk down its path. Registry key names are case insensitive, so components are compared with ASCII letters
+// folded to upper case; any other characters (e.g. the UTF-8 bytes of accented letters) must match exactly
+struct registry_redirect
+{
+    // The HKCU subkey that the key is redirected to
+    std::string subkey;
+
+    // The record that names the key or its ancestor, whose keys may not have been created yet
+    const Redirect_Registry* record;
+};
+
+class registry_redirect_trie
+{
+public:
+    // The first key inserted with a given path (in any case) wins. NOTE: 'key' and 'record' must outlive the trie
+    void insert(const std::string& key, const Redirect_Registry* record)
+    {
+        auto node = &m_root;
+        for_each_component(key, [&](std::string_view component, std::size_t)
+        {
+            auto& child = node->children[fold(component)];
+            if (!child)
+            {
+                child = std::make_unique<trie_node>();
+            }
+            node = child.get();
+            return true;
+        });
+
+        if ((node != &m_root) && !node->key)
+        {
+            node->key = &key;
+            node->record = record;
+        }
+    }
+
+    // Returns where 'subkey' is redirected to: the deepest redirected key that is 'subkey' or one of its ancestors,
+    // spelled as it was configured, followed by the rest of 'subkey' as the app spelled it
+    std::optional<registry_redirect> find(std::string_view subkey) const
+    {
+        const trie_node* match = nullptr;
+        std::size_t matchedLength = 0;
+
+        auto node = &m_root;
+        std::string folded;
+        for_each_component(subkey, [&](std::string_view component, std::size_t end)
+        {
+            fold(component, folded);
+            auto itr = node->children.find(folded);
+            if (itr == node->children.end())
+            {
+                return false;
+            }
+
+            node = itr->second.get();
+            if (node->key)
+            {
+                match = node;
+                matchedLength = end;
+            }
+            return true;
+        });
+
+        if (!match)
+        {
+            return std::nullopt;
+        }
+
+        registry_redirect result{ {}, match->record };
+        result.subkey.reserve(match->key->length() + (subkey.length() - matchedLength));
+        result.subkey.append(*match->key);
+        result.subkey.append(subkey.substr(matchedLength));
+        return result;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_root.children.empty();
+    }
+
+private:
+    struct trie_node
+    {
+        std::unordered_map<std::string, std::unique_ptr<trie_node>> children;
+        const std::string* key = nullptr;
+        const Redirect_Registry* record = nullptr;
+    };
+
+    // Calls 'func(component, end)' for each backslash separated component of 'path', where 'end' is the offset just
+    // past the component, until 'func' returns false
+    template <typename Func>
+    static void for_each_component(std::string_view path, Func&& func)
+    {
+        std::size_t begin = 0;
+        while (begin < path.length())
+        {
+            auto end = path.find('\\', begin);
+            if (end == std::string_view::npos)
+            {
+                end = path.length();
+            }
+
+            if (!func(path.substr(begin, end - begin), end))
+            {
+                return;
+            }
+            begin = end + 1;
+        }
+    }
+
+    static void fold(std::string_view component, std::string& result)
+    {
+        result.assign(component);
+        for (auto& ch : result)
+        {
+            if ((ch >= 'a') && (ch <= 'z'))
+            {
+                ch = static_cast<char>(ch - 'a' + 'A');
+            }
+        }
+    }
+
+    static std::string fold(std::string_view component)
+    {
+        std::string result;
+        fold(component, result);
+        return result;
+    }
+
+    trie_node m_root;
+};
+
+struct registry_verdict
+{
+    // Set if the key or one of its ancestors is named by a Redirect record
+    std::optional<registry_redirect> redirect;
+
+    // The first ModifyKeyAccess record whose patterns match the key
+    Modify_Key_Hive_Types access_hive = Modify_Key_Hive_Type_Unknown;
+    Modify_Key_Access_Types access = Modify_Key_Access_Type_Unknown;
+
+    bool fake_delete = false;
+
+    // The values of the DeletionMarker records that match the key, in order, up to and including the first that has no
+    // values. That one marks the key itself, and with it every value in it
+    std::vector<const std::vector<Reg_Key_Pattern>*> deletion_markers;
+
+    bool hidden() const noexcept
+    {
+        return !deletion_markers.empty() && deletion_markers.front()->empty();
+    }
+
+    bool value_hidden(const std::wstring& valueName) const noexcept
+    {
+        for (auto values : deletion_markers)
+        {
+            if (values->empty())
+            {
+                return true;
+            }
+
+            for (auto& value : *values)
+            {
+                if (match_registry_pattern(value, valueName))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+};
+
+class registry_rules
+{
+public:
+    // NOTE: The records must outlive the rules, which refer to them
+    void compile(const std::vector<Reg_Remediation_Spec>& specs)
+    {
+        for (auto& spec : specs)
+        {
+            for (auto& record : spec.remediationRecords)
+            {
+                switch (record.remeditaionType)
+                {
+                case Reg_Remediation_Type_ModifyKeyAccess:
+                    hive_rules(record.modifyKeyAccess.hive).modify_key_access.push_back(&record.modifyKeyAccess);
+                    break;
+                case Reg_Remediation_Type_FakeDelete:
+                    hive_rules(record.fakeDeleteKey.hive).fake_delete.push_back(&record.fakeDeleteKey);
+                    break;
+                case Reg_Remediation_Type_DeletionMarker:
+                    hive_rules(record.deletionMarker.hive).deletion_markers.push_back(&record.deletionMarker);
+                    break;
+                case Reg_Remediation_Type_Redirect:
+                    for (auto& path : record.redirectRegistry.redirectedHivePaths)
+                    {
+                        // The first record that names a key wins
+                        m_redirects.insert(path, &record.redirectRegistry);
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    // 'keypath' is the normalized path of the key, and 'subkey' the part of it that follows 'hive', widened
+    registry_verdict evaluate(std::string_view keypath, Modify_Key_Hive_Types hive, const std::wstring& subkey) const
+    {
+        registry_verdict result;
+
+        // Redirected keys are named without their hive
+        if (auto offset = keypath.find('\\'); (offset != std::string_view::npos) && !m_redirects.empty())
+        {
+            result.redirect = m_redirects.find(keypath.substr(offset + 1));
+        }
+
+        if ((hive != Modify_Key_Hive_Type_HKCU) && (hive != Modify_Key_Hive_Type_HKLM))
+        {
+            return result;
+        }
+
+        auto& rules = m_hives[hive];
+        for (auto rule : rules.modify_key_access)
+        {
+            if (match_any(rule->patterns, subkey))
+            {
+                result.access_hive = hive;
+                result.access = rule->access;
+                break;
+            }
+        }
+
+        for (auto rule : rules.fake_delete)
+        {
+            if (match_any(rule->patterns, subkey))
+            {
+                result.fake_delete = true;
+                break;
+            }
+        }
+
+        for (auto rule : rules.deletion_markers)
+        {
+            if (match_registry_pattern(rule->key, subkey))
+            {
+                result.deletion_markers.push_back(&rule->values);
+                if (rule->values.empty())
+                {
+                    break;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    // Whether any DeletionMarker record could hide a key, or the values of a key, in 'hive'
+    bool has_deletion_markers(Modify_Key_Hive_Types hive) const noexcept
+    {
+        return ((hive == Modify_Key_Hive_Type_HKCU) || (hive == Modify_Key_Hive_Type_HKLM)) && !m_hives[hive].deletion_markers.empty();
+    }
+
+private:
+    struct rules_for_hive
+    {
+        std::vector<const Modify_Key_Access*> modify_key_access;
+        std::vector<const Fake_Delete_Key*> fake_delete;
+        std::vector<const Deletion_Marker*> deletion_markers;
+    };
+
+    rules_for_hive& hive_rules(Modify_Key_Hive_Types hive)
+    {
+        // Records for any other hive never match, as before
+        return ((hive == Modify_Key_Hive_Type_HKCU) || (hive == Modify_Key_Hive_Type_HKLM)) ? m_hives[hive] : m_unused;
+    }
+
+    static bool match_any(const std::vector<Reg_Key_Pattern>& patterns, const std::wstring& str) noexcept
+    {
+        for (auto& pattern : patterns)
+        {
+            if (match_registry_pattern(pattern, str))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    rules_for_hive m_hives[3];
+    rules_for_hive m_unused;
+    registry_redirect_trie m_redirects;
+};
+
+// Verdicts by normalized key path. Enumerating a large key looks up every subkey once, so when the cache is full it is
+// simply emptied rather than tracking which verdicts were used last
+class registry_verdict_cache
+{
+public:
+    explicit registry_verdict_cache(std::size_t capacity = 4096) noexcept :
+        m_capacity(capacity)
+    {
+    }
+
+    // 'evaluate' (registry_verdict()) is called without holding the lock when 'keypath' has no verdict yet
+    template <typename EvaluateFunc>
+    std::shared_ptr<const registry_verdict> get(const std::string& keypath, EvaluateFunc&& evaluate)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            if (auto itr = m_verdicts.find(keypath); itr != m_verdicts.end())
+            {
+                ++m_hits;
+                return itr->second;
+            }
+        }
+
+        ++m_evaluations;
+        auto verdict = std::make_shared<const registry_verdict>(evaluate());
+
+        std::lock_guard<std::shared_mutex> lock(m_mutex);
+        if (m_verdicts.size() >= m_capacity)
+        {
+            m_verdicts.clear();
+        }
+        return m_verdicts.emplace(keypath, std::move(verdict)).first->second;
+    }
+
+    std::uint64_t hits() const noexcept
+    {
+        return m_hits;
+    }
+
+    std::uint64_t evaluations() const noexcept
+    {
+        return m_evaluations;
+    }
+
+private:
+    const std::size_t m_capacity;
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const registry_verdict>> m_verdicts;
+
+    std::atomic<std::uint64_t> m_hits{ 0 };
+    std::atomic<std::uint64_t> m_evaluations{ 0 };
+};
@@ -6,6 +6,7 @@
 #include "pch.h"
 
 #include <psf_framework.h>
+#include <psf_logging.h>
 #include "psf_tracelogging.h"
 
 TRACELOGGING_DEFINE_PROVIDER(
@@ -19,14 +20,16 @@ bool m_inhibitOutput = false;
 bool m_shouldLog = true;
 
 void InitializeConfiguration();
+void InitializeRegistryFixups();
 void CleanupFixups();
-void Log(const char* fmt, ...);
+void LogRegistryFixupStatistics();
 
 extern "C" {
 
 int __stdcall PSFInitialize() noexcept try
 {
     InitializeConfiguration();
+    InitializeRegistryFixups();
     psf::attach_all();
     return ERROR_SUCCESS;
 }
@@ -39,6 +42,7 @@ catch (...)
 int __stdcall PSFUninitialize() noexcept try
 {
     CleanupFixups();
+    LogRegistryFixupStatistics();
     psf::detach_all();
     return ERROR_SUCCESS;
 }
@@ -83,7 +87,7 @@ catch (...)
     {
         psf::TraceLogExceptions("RegLegacyFixupException", "RegLegacyFixups attach ERROR");
         TraceLoggingUnregister(g_Log_ETW_ComponentProvider);
-        Log("RegLegacyFixups attach ERROR\n");
+        PSF_LOG_ERROR("RegLegacyFixups attach ERROR\n");
         ::SetLastError(win32_from_caught_exception());
         return FALSE;
     }
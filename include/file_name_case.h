@@ -0,0 +1,55 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Case folding for file names. NTFS compares names by upper casing each UTF-16 code unit with its upcase table, which
+// covers non-ASCII letters; towupper/towlower only do that in some locales (in the default "C" locale they fold ASCII
+// alone), so "É.txt" and "é.txt" would be different names to a set built on them and the same file to the file system.
+// On Windows, non-ASCII code units are upper cased with the invariant locale, which matches the file system's table for
+// the letters that applications actually use. Elsewhere (i.e. in the unit tests) the CRT's towupper stands in for it.
+//
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cwctype>
+#endif
+
+namespace psf
+{
+    inline wchar_t fold_file_name_char(wchar_t ch) noexcept
+    {
+        if (ch < 0x80)
+        {
+            return ((ch >= L'a') && (ch <= L'z')) ? static_cast<wchar_t>(ch - L'a' + L'A') : ch;
+        }
+
+#ifdef _WIN32
+        // Surrogates are left alone, the same as the file system's table does
+        wchar_t result;
+        if ((ch < 0xD800 || ch > 0xDFFF) &&
+            (::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, &ch, 1, &result, 1, nullptr, nullptr, 0) == 1))
+        {
+            return result;
+        }
+        return ch;
+#else
+        return static_cast<wchar_t>(std::towupper(ch));
+#endif
+    }
+
+    inline std::wstring fold_file_name(std::wstring_view name)
+    {
+        std::wstring result(name);
+        for (auto& ch : result)
+        {
+            ch = fold_file_name_char(ch);
+        }
+        return result;
+    }
+}
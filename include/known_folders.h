@@ -4,6 +4,7 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <algorithm>
 #include <cwctype>
 #include <filesystem>
 
@@ -13,6 +14,7 @@
 #include <KnownFolders.h>
 
 #include "dos_paths.h"
+#include "path_trie.h"
 
 namespace psf
 {
@@ -55,4 +57,101 @@ namespace psf
 
         return remove_trailing_path_separators(path);
     }
+
+    // The user profile roots that fixups need to classify paths against on (nearly) every intercepted call
+    enum class known_root
+    {
+        none,
+        local_app_data,             // FOLDERID_LocalAppData
+        local_app_data_packages,    // FOLDERID_LocalAppData\Packages
+        roaming_app_data,           // FOLDERID_RoamingAppData
+    };
+
+    struct known_root_match
+    {
+        known_root root = known_root::none;
+
+        // Number of characters at the start of the input that make up the root, including any "\\?\" or "\\.\" prefix.
+        // The remainder of the input, if any, starts with a path separator
+        std::size_t length = 0;
+
+        // True for local_app_data_packages too, since that is under local_app_data
+        bool is_local_app_data() const noexcept
+        {
+            return (root == known_root::local_app_data) || (root == known_root::local_app_data_packages);
+        }
+    };
+
+    // Snapshot of the known folder paths, resolved once. psf::known_folder calls SHGetKnownFolderPath and allocates a
+    // new path each time, which is far too expensive to do per intercepted call
+    class known_folder_table
+    {
+    public:
+        struct entry
+        {
+            std::wstring path;          // As returned by psf::known_folder
+            std::wstring lower_path;    // Lowercased, for callers that need to do their own comparisons
+        };
+
+        known_folder_table()
+        {
+            add(known_root::local_app_data, known_folder(FOLDERID_LocalAppData));
+            add(known_root::local_app_data_packages, known_folder(FOLDERID_LocalAppData) / L"Packages");
+            add(known_root::roaming_app_data, known_folder(FOLDERID_RoamingAppData));
+        }
+
+        const entry& get(known_root root) const noexcept
+        {
+            assert(root != known_root::none);
+            return m_entries[static_cast<std::size_t>(root)];
+        }
+
+        // Determines which known root, if any, the path is under in a single pass over the string. The deepest root
+        // wins, so paths under LocalAppData\Packages report local_app_data_packages rather than local_app_data
+        template <typename CharT>
+        known_root_match classify(const CharT* path) const noexcept
+        {
+            known_root_match result;
+            if (!path)
+            {
+                return result;
+            }
+
+            // Root-local device and local device paths are compared without their prefix
+            std::size_t prefixLength = 0;
+            if (auto type = path_type(path); (type == dos_path_type::root_local_device) || (type == dos_path_type::local_device))
+            {
+                prefixLength = 4;
+            }
+
+            if (auto match = m_roots.longest_match(path + prefixLength))
+            {
+                result.root = *match.value;
+                result.length = prefixLength + match.length;
+            }
+
+            return result;
+        }
+
+    private:
+        void add(known_root root, const std::filesystem::path& path)
+        {
+            auto& target = m_entries[static_cast<std::size_t>(root)];
+            target.path = path.wstring();
+            target.lower_path = target.path;
+            std::transform(target.lower_path.begin(), target.lower_path.end(), target.lower_path.begin(), [](wchar_t ch) { return static_cast<wchar_t>(std::towlower(ch)); });
+            m_roots.insert(target.path, root);
+        }
+
+        entry m_entries[static_cast<std::size_t>(known_root::roaming_app_data) + 1];
+        path_trie<known_root> m_roots;
+    };
+
+    // Process-wide (well, module-wide) snapshot, resolved on first use. Fixups should touch this during initialization
+    // so that the SHGetKnownFolderPath calls happen up front
+    inline const known_folder_table& known_folders()
+    {
+        static const known_folder_table table;
+        return table;
+    }
 }
@@ -0,0 +1,263 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// A case-insensitive radix tree keyed by path. Lookups walk the input path once and report the deepest inserted path
+// that the input is "under" - that is, the inserted path is a prefix of the input and either ends in a path separator
+// or is followed by a separator (or the end of the input) in the input. This is the same test as psf::path_compare
+// combined with the "AppVSystem32Catroot vs. AppVSystem32Catroot2" boundary check that is done throughout PSF, so
+// "C:\Windows\System32\catroot" matches "c:/windows/system32/CATROOT\foo" but not "C:\Windows\System32\catroot2".
+//
+// Paths are compared as strings, in whatever form they were inserted, so the input must be spelled the same way (e.g.
+// drive absolute, without a "\\?\" prefix). known_folders.h strips such prefixes itself; vfs_folder_map.h leaves
+// that to its callers.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cwctype>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace psf
+{
+    template <typename ValueT>
+    class path_trie
+    {
+    public:
+        static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+        struct match
+        {
+            const ValueT* value = nullptr;
+
+            // Number of characters of the input that the matched key consumed (excluding any separator that follows)
+            std::size_t length = 0;
+
+            explicit operator bool() const noexcept
+            {
+                return value != nullptr;
+            }
+        };
+
+        // Inserts 'key', or replaces the value if 'key' (compared case-insensitively) is already present
+        void insert(std::wstring_view key, ValueT value)
+        {
+            std::wstring folded(key.length(), L'\0');
+            std::transform(key.begin(), key.end(), folded.begin(), [](wchar_t ch) { return fold(ch); });
+
+            std::uint32_t node = 0;
+            std::size_t pos = 0;
+            while (pos < folded.length())
+            {
+                auto itr = find_child(node, folded[pos]);
+                if (itr == m_nodes[node].children.end())
+                {
+                    auto leaf = new_node(folded.substr(pos));
+                    insert_child(node, leaf);
+                    node = leaf;
+                    break;
+                }
+
+                auto slot = itr - m_nodes[node].children.begin();
+                auto childIndex = *itr;
+                const auto labelLength = m_nodes[childIndex].label.length();
+                std::size_t common = 0;
+                while ((common < labelLength) && (pos + common < folded.length()) &&
+                    (m_nodes[childIndex].label[common] == folded[pos + common]))
+                {
+                    ++common;
+                }
+
+                if (common < labelLength)
+                {
+                    // Split the edge into node -> split -> child. The split node starts with the same character as the
+                    // child did, so the parent's children stay sorted
+                    auto split = new_node(m_nodes[childIndex].label.substr(0, common));
+                    m_nodes[node].children[slot] = split;
+                    m_nodes[childIndex].label.erase(0, common);
+                    insert_child(split, childIndex);
+                    childIndex = split;
+                }
+
+                node = childIndex;
+                pos += common;
+            }
+
+            auto& target = m_nodes[node];
+            if (target.value == npos)
+            {
+                target.value = m_values.size();
+                m_values.push_back(std::move(value));
+            }
+            else
+            {
+                m_values[target.value] = std::move(value);
+            }
+            target.ends_with_separator = !folded.empty() && (folded.back() == L'\\');
+        }
+
+        bool empty() const noexcept
+        {
+            return m_values.empty();
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_values.size();
+        }
+
+        // Returns the deepest key that 'path' is under. 'path' is read up to 'length' characters or the first null
+        // character, whichever comes first
+        template <typename CharT>
+        match longest_match(const CharT* path, std::size_t length = npos) const noexcept
+        {
+            match result;
+            for_each_match(path, length, [&](const ValueT& value, std::size_t matchLength)
+            {
+                result.value = &value;
+                result.length = matchLength;
+            });
+            return result;
+        }
+
+        template <typename CharT>
+        match longest_match(std::basic_string_view<CharT> path) const noexcept
+        {
+            return longest_match(path.data(), path.length());
+        }
+
+        // Invokes 'func(value, length)' for every key that 'path' is under, from shallowest to deepest
+        template <typename CharT, typename Func>
+        void for_each_match(const CharT* path, std::size_t length, Func&& func) const
+        {
+            if (!path)
+            {
+                return;
+            }
+
+            auto at = [&](std::size_t pos) -> wchar_t
+            {
+                return (pos < length) ? to_wide(path[pos]) : L'\0';
+            };
+
+            std::uint32_t node = 0;
+            std::size_t pos = 0;
+            while (true)
+            {
+                auto& current = m_nodes[node];
+                if (current.value != npos)
+                {
+                    auto next = at(pos);
+                    if (current.ends_with_separator || (next == L'\0') || is_separator(next))
+                    {
+                        func(m_values[current.value], pos);
+                    }
+                }
+
+                auto ch = at(pos);
+                if (ch == L'\0')
+                {
+                    return;
+                }
+
+                auto itr = find_child(node, fold(ch));
+                if (itr == current.children.end())
+                {
+                    return;
+                }
+
+                auto& label = m_nodes[*itr].label;
+                for (std::size_t i = 1; i < label.length(); ++i)
+                {
+                    auto labelCh = at(pos + i);
+                    if ((labelCh == L'\0') || (fold(labelCh) != label[i]))
+                    {
+                        return;
+                    }
+                }
+
+                pos += label.length();
+                node = *itr;
+            }
+        }
+
+        // Invokes 'func(value)' for every value, in insertion order
+        template <typename Func>
+        void for_each(Func&& func) const
+        {
+            for (auto& value : m_values)
+            {
+                func(value);
+            }
+        }
+
+    private:
+        struct node
+        {
+            std::wstring label;
+            std::vector<std::uint32_t> children; // Sorted by the first character of the child's label
+            std::size_t value = npos;
+            bool ends_with_separator = false;
+        };
+
+        std::vector<node> m_nodes = std::vector<node>(1);
+        std::vector<ValueT> m_values;
+
+        static constexpr bool is_separator(wchar_t ch) noexcept
+        {
+            return (ch == L'\\') || (ch == L'/');
+        }
+
+        template <typename CharT>
+        static constexpr wchar_t to_wide(CharT ch) noexcept
+        {
+            return static_cast<wchar_t>(static_cast<std::make_unsigned_t<CharT>>(ch));
+        }
+
+        static wchar_t fold(wchar_t ch) noexcept
+        {
+            return is_separator(ch) ? L'\\' : static_cast<wchar_t>(std::towlower(ch));
+        }
+
+        std::uint32_t new_node(std::wstring label)
+        {
+            auto index = static_cast<std::uint32_t>(m_nodes.size());
+            m_nodes.emplace_back();
+            m_nodes.back().label = std::move(label);
+            return index;
+        }
+
+        std::vector<std::uint32_t>::const_iterator find_child(std::uint32_t parent, wchar_t ch) const noexcept
+        {
+            auto& children = m_nodes[parent].children;
+            auto itr = std::lower_bound(children.begin(), children.end(), ch, [&](std::uint32_t child, wchar_t value)
+            {
+                return m_nodes[child].label[0] < value;
+            });
+            return ((itr != children.end()) && (m_nodes[*itr].label[0] == ch)) ? itr : children.end();
+        }
+
+        std::vector<std::uint32_t>::iterator find_child(std::uint32_t parent, wchar_t ch) noexcept
+        {
+            auto constItr = static_cast<const path_trie*>(this)->find_child(parent, ch);
+            auto& children = m_nodes[parent].children;
+            return children.begin() + (constItr - children.cbegin());
+        }
+
+        void insert_child(std::uint32_t parent, std::uint32_t child)
+        {
+            auto ch = m_nodes[child].label[0];
+            auto& children = m_nodes[parent].children;
+            auto itr = std::lower_bound(children.begin(), children.end(), ch, [&](std::uint32_t existing, wchar_t value)
+            {
+                return m_nodes[existing].label[0] < value;
+            });
+            children.insert(itr, child);
+        }
+    };
+}
@@ -0,0 +1,172 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Level-gated debug output for fixups. Log sites are written as
+//      Log("format", args...);                                     // psf::log_level::verbose
+//      PSF_LOG(psf::log_level::warning, "format", args...);
+// and expand to a check of the level ahead of everything else, so a disabled site costs a single branch: the arguments
+// are not evaluated and nothing is formatted. Levels above PSF_LOG_COMPILED_LEVEL are removed at compile time. It
+// defaults to verbose in debug builds and to none in release builds, which is where the output used to be discarded
+// anyway; define it on the compiler command line to get output from a release build. Below that, the level can be
+// lowered at runtime with psf::set_log_level (e.g. from a fixup's "logLevel" configuration).
+//
+// Since this defines a macro named 'Log', only fixups include it; PsfRuntime and PsfLauncher have their own loggers.
+#pragma once
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cwchar>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <windows.h>
+
+#ifndef PSF_LOG_COMPILED_LEVEL
+#if _DEBUG
+#define PSF_LOG_COMPILED_LEVEL 4
+#else
+#define PSF_LOG_COMPILED_LEVEL 0
+#endif
+#endif
+
+namespace psf
+{
+    enum class log_level : int
+    {
+        none = 0,
+        error = 1,
+        warning = 2,
+        info = 3,
+        verbose = 4,
+    };
+
+    namespace details
+    {
+        inline std::atomic<int> runtime_log_level{ PSF_LOG_COMPILED_LEVEL };
+    }
+
+    inline bool log_enabled(log_level level) noexcept
+    {
+        return (static_cast<int>(level) <= PSF_LOG_COMPILED_LEVEL) &&
+            (static_cast<int>(level) <= details::runtime_log_level.load(std::memory_order_relaxed));
+    }
+
+    inline void set_log_level(log_level level) noexcept
+    {
+        details::runtime_log_level.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    // Accepts the names of the log_level values. Returns false, leaving 'level' unchanged, for anything else
+    inline bool parse_log_level(std::wstring_view text, log_level& level) noexcept
+    {
+        constexpr std::pair<std::wstring_view, log_level> names[] =
+        {
+            { L"none", log_level::none },
+            { L"error", log_level::error },
+            { L"warning", log_level::warning },
+            { L"info", log_level::info },
+            { L"verbose", log_level::verbose },
+        };
+
+        for (auto& [name, value] : names)
+        {
+            if ((text.length() == name.length()) && (::_wcsnicmp(text.data(), name.data(), name.length()) == 0))
+            {
+                level = value;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    namespace details
+    {
+        // Most messages fit on the stack; longer ones are formatted a second time into a buffer of the exact size
+        constexpr std::size_t log_buffer_size = 512;
+    }
+
+    inline void log_message(const char* fmt, ...) noexcept
+    {
+        char buffer[details::log_buffer_size];
+        va_list args;
+        va_start(args, fmt);
+        auto count = std::vsnprintf(buffer, std::size(buffer), fmt, args);
+        va_end(args);
+
+        if (count < 0)
+        {
+            ::OutputDebugStringA(fmt);
+        }
+        else if (static_cast<std::size_t>(count) < std::size(buffer))
+        {
+            ::OutputDebugStringA(buffer);
+        }
+        else try
+        {
+            std::string str(static_cast<std::size_t>(count), '\0');
+            va_start(args, fmt);
+            std::vsnprintf(str.data(), str.size() + 1, fmt, args);
+            va_end(args);
+            ::OutputDebugStringA(str.c_str());
+        }
+        catch (...)
+        {
+            ::OutputDebugStringA("Exception in Log()");
+            ::OutputDebugStringA(fmt);
+        }
+    }
+
+    inline void log_message(const wchar_t* fmt, ...) noexcept
+    {
+        wchar_t buffer[details::log_buffer_size];
+        va_list args;
+        va_start(args, fmt);
+        auto count = std::vswprintf(buffer, std::size(buffer), fmt, args);
+        va_end(args);
+
+        if (count >= 0)
+        {
+            ::OutputDebugStringW(buffer);
+            return;
+        }
+
+        // Unlike vsnprintf, vswprintf doesn't report the length it needed when the buffer is too small
+        va_start(args, fmt);
+        count = ::_vscwprintf(fmt, args);
+        va_end(args);
+
+        if (count < 0)
+        {
+            ::OutputDebugStringW(fmt);
+        }
+        else try
+        {
+            std::wstring str(static_cast<std::size_t>(count), L'\0');
+            va_start(args, fmt);
+            std::vswprintf(str.data(), str.size() + 1, fmt, args);
+            va_end(args);
+            ::OutputDebugStringW(str.c_str());
+        }
+        catch (...)
+        {
+            ::OutputDebugStringA("Exception in wide Log()");
+            ::OutputDebugStringW(fmt);
+        }
+    }
+}
+
+#define PSF_LOG(level, ...) (::psf::log_enabled(level) ? ::psf::log_message(__VA_ARGS__) : (void)0)
+#define PSF_LOG_ERROR(...) PSF_LOG(::psf::log_level::error, __VA_ARGS__)
+#define PSF_LOG_WARNING(...) PSF_LOG(::psf::log_level::warning, __VA_ARGS__)
+#define PSF_LOG_INFO(...) PSF_LOG(::psf::log_level::info, __VA_ARGS__)
+#define Log(...) PSF_LOG(::psf::log_level::verbose, __VA_ARGS__)
+
+// For a fixup's own logging helpers (e.g. LogString): 'func' is only called, and its arguments only evaluated, when
+// 'level' is enabled. The helper itself calls psf::log_message directly
+#define PSF_LOG_CALL(level, func, ...) (::psf::log_enabled(level) ? func(__VA_ARGS__) : (void)0)
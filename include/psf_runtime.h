@@ -38,6 +38,12 @@ PSFAPI const wchar_t* __stdcall PSFQueryApplicationId() noexcept;
 PSFAPI const wchar_t* __stdcall PSFQueryPackageRootPath() noexcept;
 PSFAPI const wchar_t* __stdcall PSFQueryFinalPackageRootPath() noexcept;
 
+// Full paths of the files named 'fileName' (a file name only, compared without regard to case) anywhere in the
+// package, shallowest first, as a null terminated array. The package is enumerated on the first call and the result is
+// saved, so later launches of the same package version don't enumerate it again
+// NOTE: Returns null if an error occurred
+PSFAPI const wchar_t* const* __stdcall PSFFindPackageFiles(_In_ const wchar_t* fileName) noexcept;
+
 PSFAPI const psf::json_value* __stdcall PSFQueryConfigRoot() noexcept;
 
 PSFAPI const psf::json_object* __stdcall PSFQueryAppLaunchConfig(_In_ const wchar_t* applicationId, bool verbose) noexcept;
@@ -0,0 +1,193 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// The mapping between native known folder paths (e.g. "C:\Windows\System32") and their package VFS equivalents (e.g.
+// "[PackageRoot]\VFS\SystemX64"). Both directions are kept in a single path_trie, along with the package root itself,
+// so that one walk over a drive-absolute path tells us which of the three, if any, the path is under. Because the
+// deepest match wins and matches must end on a path separator boundary, "C:\Windows\System32\catroot2\foo" maps to
+// AppVSystem32Catroot2 rather than to AppVSystem32Catroot, System or Windows, independent of the mapping order.
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+#include "dos_paths.h"
+#include "known_folders.h"
+#include "path_trie.h"
+
+namespace psf
+{
+    struct vfs_folder_mapping
+    {
+        std::filesystem::path path;                         // Drive-absolute native path. E.g. "C:\Windows"
+        std::filesystem::path package_vfs_relative_path;    // E.g. "Windows"
+    };
+
+    class vfs_folder_map
+    {
+    public:
+        enum class match_kind
+        {
+            none,
+            package,        // Under the package root, but not under a known VFS folder
+            package_vfs,    // Under [PackageRoot]\VFS\<token>
+            native,         // Under a native folder that has a VFS equivalent
+        };
+
+        struct match
+        {
+            match_kind kind = match_kind::none;
+
+            // The mapping that matched, for package_vfs and native matches
+            const vfs_folder_mapping* mapping = nullptr;
+
+            // Points inside of the input, just past the matched folder and the separator that follows it (if any)
+            const wchar_t* relative_path = nullptr;
+        };
+
+        vfs_folder_map() = default;
+
+        // 'packageRootPath' and the mapping paths must be drive-absolute and have no trailing separator. When more than
+        // one mapping has the same native path, the last one wins when virtualizing
+        vfs_folder_map(std::filesystem::path packageRootPath, std::vector<vfs_folder_mapping> mappings) :
+            m_packageRootPath(std::move(packageRootPath)),
+            m_packageVfsRootPath(m_packageRootPath / L"VFS"),
+            m_mappings(std::move(mappings))
+        {
+            m_folders.insert(m_packageRootPath.wstring(), entry{ match_kind::package, 0 });
+            for (std::size_t i = 0; i < m_mappings.size(); ++i)
+            {
+                m_folders.insert(m_mappings[i].path.wstring(), entry{ match_kind::native, i });
+                m_folders.insert((m_packageVfsRootPath / m_mappings[i].package_vfs_relative_path).wstring(), entry{ match_kind::package_vfs, i });
+            }
+        }
+
+        const std::filesystem::path& package_root_path() const noexcept
+        {
+            return m_packageRootPath;
+        }
+
+        const std::filesystem::path& package_vfs_root_path() const noexcept
+        {
+            return m_packageVfsRootPath;
+        }
+
+        const std::vector<vfs_folder_mapping>& mappings() const noexcept
+        {
+            return m_mappings;
+        }
+
+        // Finds the deepest folder that the drive-absolute 'path' is under
+        match find(const wchar_t* path) const noexcept
+        {
+            match result;
+            auto found = m_folders.longest_match(path);
+            if (!found)
+            {
+                return result;
+            }
+
+            result.kind = found.value->kind;
+            if (result.kind != match_kind::package)
+            {
+                result.mapping = &m_mappings[found.value->mapping];
+            }
+
+            result.relative_path = path + found.length;
+            if (is_path_separator(result.relative_path[0]))
+            {
+                ++result.relative_path;
+            }
+
+            return result;
+        }
+
+        // E.g. "C:\Windows\System32\foo.txt" -> "[PackageRoot]\VFS\SystemX64\foo.txt". 'nativeMatch' must be a native
+        // match
+        std::filesystem::path virtualize(const match& nativeMatch) const
+        {
+            assert(nativeMatch.kind == match_kind::native);
+            return m_packageVfsRootPath / nativeMatch.mapping->package_vfs_relative_path / nativeMatch.relative_path;
+        }
+
+        // E.g. "[PackageRoot]\VFS\SystemX64\foo.txt" -> "C:\Windows\System32\foo.txt". 'packageVfsMatch' must be a
+        // package_vfs match
+        std::filesystem::path devirtualize(const match& packageVfsMatch) const
+        {
+            assert(packageVfsMatch.kind == match_kind::package_vfs);
+            return packageVfsMatch.mapping->path / packageVfsMatch.relative_path;
+        }
+
+    private:
+        struct entry
+        {
+            match_kind kind;
+            std::size_t mapping;
+        };
+
+        std::filesystem::path m_packageRootPath;
+        std::filesystem::path m_packageVfsRootPath;
+        std::vector<vfs_folder_mapping> m_mappings;
+        path_trie<entry> m_folders;
+    };
+
+    // Folder IDs and their desktop bridge packaged VFS location equivalents. Taken from:
+    // https://docs.microsoft.com/en-us/windows/uwp/porting/desktop-to-uwp-behind-the-scenes
+    //      System Location                 Redirected Location (Under [PackageRoot]\VFS)   Valid on architectures
+    //      FOLDERID_SystemX86              SystemX86                                       x86, amd64
+    //      FOLDERID_System                 SystemX64                                       amd64
+    //      FOLDERID_ProgramFilesX86        ProgramFilesX86                                 x86, amd6
+    //      FOLDERID_ProgramFilesX64        ProgramFilesX64                                 amd64
+    //      FOLDERID_ProgramFilesCommonX86  ProgramFilesCommonX86                           x86, amd64
+    //      FOLDERID_ProgramFilesCommonX64  ProgramFilesCommonX64                           amd64
+    //      FOLDERID_Windows                Windows                                         x86, amd64
+    //      FOLDERID_ProgramData            Common AppData                                  x86, amd64
+    //      FOLDERID_System\catroot         AppVSystem32Catroot                             x86, amd64
+    //      FOLDERID_System\catroot2        AppVSystem32Catroot2                            x86, amd64
+    //      FOLDERID_System\drivers\etc     AppVSystem32DriversEtc                          x86, amd64
+    //      FOLDERID_System\driverstore     AppVSystem32Driverstore                         x86, amd64
+    //      FOLDERID_System\logfiles        AppVSystem32Logfiles                            x86, amd64
+    //      FOLDERID_System\spool           AppVSystem32Spool                               x86, amd64
+    inline std::vector<vfs_folder_mapping> default_vfs_folder_mappings()
+    {
+        using namespace std::literals;
+
+        std::vector<vfs_folder_mapping> result;
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_SystemX86),                   LR"(SystemX86)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_ProgramFilesX86),             LR"(ProgramFilesX86)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_ProgramFilesCommonX86),       LR"(ProgramFilesCommonX86)"sv });
+#if !_M_IX86
+        // FUTURE: We may want to consider the possibility of a 32-bit application trying to reference "%windir%\sysnative\"
+        //         in which case we'll have to get smarter about how we resolve paths
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System), LR"(SystemX64)"sv });
+        // FOLDERID_ProgramFilesX64* not supported for 32-bit applications
+        // FUTURE: We may want to consider the possibility of a 32-bit process trying to access this path anyway. E.g. a
+        //         32-bit child process of a 64-bit process that set the current directory
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_ProgramFilesX64), LR"(ProgramFilesX64)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_ProgramFilesCommonX64), LR"(ProgramFilesCommonX64)"sv });
+#endif
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_Windows),                      LR"(Windows)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_ProgramData),                  LR"(Common AppData)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System),                       LR"(System)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(catroot)"sv,     LR"(AppVSystem32Catroot)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(catroot2)"sv,    LR"(AppVSystem32Catroot2)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(drivers\etc)"sv, LR"(AppVSystem32DriversEtc)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(driverstore)"sv, LR"(AppVSystem32Driverstore)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(logfiles)"sv,    LR"(AppVSystem32Logfiles)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_System) / LR"(spool)"sv,       LR"(AppVSystem32Spool)"sv });
+
+        // These are additional folders that may appear in MSIX packages and need help
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_LocalAppData),                 LR"(Local AppData)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_RoamingAppData),               LR"(AppData)"sv });
+
+        //These are additional folders seen from App-V packages converted into MSIX (still looking for an official App-V list)
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_Fonts),                        LR"(Fonts)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_PublicDesktop),                LR"(Common Desktop)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_CommonPrograms),               LR"(Common Programs)"sv });
+        result.push_back(vfs_folder_mapping{ known_folder(FOLDERID_LocalAppDataLow),              LR"(LOCALAPPDATALOW)"sv });
+        return result;
+    }
+}
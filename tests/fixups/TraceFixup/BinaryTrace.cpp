@@ -0,0 +1,271 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cwchar>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+#include <psapi.h>
+
+#include <psf_utils.h>
+#include <utilities.h>
+
+#include "Config.h"
+
+using namespace std::literals;
+
+// NOTE: The rings and the writer are intentionally never freed. The writer thread is detached rather than joined on
+//       DLL_PROCESS_DETACH (see trace_writer::stop), so they must outlive it. This fixup is never unloaded before the
+//       process exits
+static trace_ring_set* g_traceRings = nullptr;
+static trace_writer* g_traceWriter = nullptr;
+static HANDLE g_traceFile = INVALID_HANDLE_VALUE;
+
+// Only used by the writer
+static std::vector<std::uint8_t> g_traceBuffer;
+static std::map<std::uint64_t, std::uint64_t> g_traceModules; // Base address -> end address
+constexpr std::size_t trace_buffer_flush_size = 1024 * 1024;
+
+struct thread_trace_state
+{
+    std::shared_ptr<trace_ring> ring;
+
+    // Output of Log while the thread holds an output_lock
+    std::string text;
+
+    ~thread_trace_state()
+    {
+        if (ring)
+        {
+            ring->retire();
+        }
+    }
+};
+static thread_local thread_trace_state t_traceState;
+
+static trace_ring* CurrentThreadTraceRing() noexcept
+{
+    if (!g_traceRings)
+    {
+        return nullptr;
+    }
+
+    auto& state = t_traceState;
+    if (!state.ring)
+    {
+        try
+        {
+            state.ring = g_traceRings->create();
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+
+    return state.ring.get();
+}
+
+static void FlushTraceBuffer()
+{
+    if (!g_traceBuffer.empty())
+    {
+        DWORD bytesWritten;
+        ::WriteFile(g_traceFile, g_traceBuffer.data(), static_cast<DWORD>(g_traceBuffer.size()), &bytesWritten, nullptr);
+        g_traceBuffer.clear();
+    }
+}
+
+// Calling modules are resolved here rather than by the traced call. The first time an address in a module is seen, a
+// module record is written ahead of the record that refers to it
+static void TraceCallingModule(std::uint64_t caller)
+{
+    if (!caller)
+    {
+        return;
+    }
+
+    auto next = g_traceModules.upper_bound(caller);
+    if ((next != g_traceModules.begin()) && (caller < std::prev(next)->second))
+    {
+        return;
+    }
+
+    HMODULE moduleHandle;
+    MODULEINFO moduleInfo;
+    if (!::GetModuleHandleExW(
+            GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+            reinterpret_cast<const wchar_t*>(static_cast<std::uintptr_t>(caller)),
+            &moduleHandle) ||
+        !::GetModuleInformation(::GetCurrentProcess(), moduleHandle, &moduleInfo, sizeof(moduleInfo)))
+    {
+        // E.g. the module has since been unloaded; TraceDecoder falls back to the address
+        return;
+    }
+
+    std::uint64_t base = reinterpret_cast<std::uintptr_t>(moduleInfo.lpBaseOfDll);
+    g_traceModules.emplace(base, base + moduleInfo.SizeOfImage);
+
+    trace_record_header header = {};
+    header.kind = trace_record_kind::module;
+    auto path = psf::get_module_path(moduleHandle);
+    append_trace_record(g_traceBuffer, header, { base, moduleInfo.SizeOfImage }, { path.c_str() });
+}
+
+static void OutputTraceRecord(const std::uint8_t* record, std::size_t size)
+{
+    try
+    {
+        trace_record_header header;
+        std::memcpy(&header, record, sizeof(header));
+        TraceCallingModule(header.caller);
+
+        g_traceBuffer.insert(g_traceBuffer.end(), record, record + size);
+        if (g_traceBuffer.size() >= trace_buffer_flush_size)
+        {
+            FlushTraceBuffer();
+        }
+    }
+    catch (...)
+    {
+        // Unable to log should not crash an app
+    }
+}
+
+bool StartBinaryTrace(const wchar_t* path, std::size_t bufferSize)
+{
+    g_traceFile = ::CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (g_traceFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    trace_file_header header = {};
+    header.magic = trace_file_header::file_magic;
+    header.version = trace_file_header::file_version;
+    header.frequency = frequency.QuadPart;
+    header.process_id = ::GetCurrentProcessId();
+
+    DWORD bytesWritten;
+    ::WriteFile(g_traceFile, &header, sizeof(header), &bytesWritten, nullptr);
+
+    g_traceRings = new trace_ring_set(bufferSize);
+    g_traceWriter = new trace_writer(*g_traceRings, &OutputTraceRecord, &FlushTraceBuffer, 10ms);
+    return true;
+}
+
+void StopBinaryTrace() noexcept try
+{
+    if (g_traceWriter)
+    {
+        // The file is left to be closed with the process; if the final drain timed out, the writer may still use it
+        g_traceWriter->stop(false);
+    }
+}
+catch (...)
+{
+    ::OutputDebugStringW(L"Unable to stop binary trace");
+}
+
+void WriteBinaryTrace(
+    trace_record_kind kind,
+    function_result functionResult,
+    std::uint64_t result,
+    LARGE_INTEGER TickStart,
+    LARGE_INTEGER TickEnd,
+    const void* caller,
+    std::initializer_list<std::uint64_t> args,
+    std::initializer_list<trace_string> strings) noexcept
+{
+    auto lastError = ::GetLastError();
+    if (auto ring = CurrentThreadTraceRing())
+    {
+        trace_record_header header = {};
+        header.kind = kind;
+        header.function_result = static_cast<std::uint8_t>(functionResult);
+        header.thread_id = ::GetCurrentThreadId();
+        header.last_error = lastError;
+        header.start = TickStart.QuadPart;
+        header.end = TickEnd.QuadPart;
+        header.result = result;
+        header.caller = trace_calling_module ? reinterpret_cast<std::uintptr_t>(caller) : 0;
+        ring->write(header, args, strings);
+    }
+    ::SetLastError(lastError);
+}
+
+void AppendBinaryTraceText(const char* fmt, va_list args) noexcept try
+{
+    auto& text = t_traceState.text;
+    auto offset = text.size();
+    text.resize(offset + 256);
+
+    va_list args2;
+    va_copy(args2, args);
+    auto count = std::vsnprintf(text.data() + offset, 256 + 1, fmt, args);
+    if (count > 256)
+    {
+        text.resize(offset + count);
+        std::vsnprintf(text.data() + offset, count + 1, fmt, args2);
+    }
+    va_end(args2);
+
+    text.resize(offset + ((count > 0) ? count : 0));
+}
+catch (...)
+{
+    ::OutputDebugStringA("Exception in binary Log()");
+}
+
+void AppendBinaryTraceText(const wchar_t* fmt, va_list args) noexcept try
+{
+    // Text records are narrow, as is the output of traceMethod "eventlog"
+    va_list args2;
+    va_copy(args2, args);
+    auto count = ::_vscwprintf(fmt, args2);
+    va_end(args2);
+
+    if (count > 0)
+    {
+        std::wstring wstr(count, L'\0');
+        std::vswprintf(wstr.data(), wstr.size() + 1, fmt, args);
+        t_traceState.text += narrow(wstr);
+    }
+}
+catch (...)
+{
+    ::OutputDebugStringA("Exception in wide binary Log()");
+}
+
+void CommitBinaryTraceText() noexcept
+{
+    auto& text = t_traceState.text;
+    if (text.empty())
+    {
+        return;
+    }
+
+    auto lastError = ::GetLastError();
+    if (auto ring = CurrentThreadTraceRing())
+    {
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+
+        trace_record_header header = {};
+        header.kind = trace_record_kind::text;
+        header.thread_id = ::GetCurrentThreadId();
+        header.start = now.QuadPart;
+        header.end = now.QuadPart;
+        ring->write(header, {}, { std::string_view(text) });
+    }
+    text.clear();
+    ::SetLastError(lastError);
+}
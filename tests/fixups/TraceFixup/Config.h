@@ -4,15 +4,21 @@
 //-------------------------------------------------------------------------------------------------------
 #pragma once
 
+#include <cstdarg>
+#include <initializer_list>
+
 #include <ntstatus.h>
 #include <windows.h>
 #include <winternl.h>
 
+#include "TraceRecords.h"
+
 enum class trace_method
 {
     printf,
     output_debug_string,
     eventlog,
+    binary,
 };
 
 enum class function_result
@@ -189,6 +195,22 @@ extern void Log_ETW_PostMsgA(const char *);
 extern void Log_ETW_PostMsgW(const wchar_t *);
 extern void Log_ETW_PostMsgOperationA(const char *operation, const char *inputs, const char *result, const char *outputs, const char *caller, LARGE_INTEGER TickStart, LARGE_INTEGER TickEnd );
 
+// trace_method::binary (see TraceRecords.h)
+bool StartBinaryTrace(const wchar_t* path, std::size_t bufferSize);
+void StopBinaryTrace() noexcept;
+void WriteBinaryTrace(
+    trace_record_kind kind,
+    function_result functionResult,
+    std::uint64_t result,
+    LARGE_INTEGER TickStart,
+    LARGE_INTEGER TickEnd,
+    const void* caller,
+    std::initializer_list<std::uint64_t> args,
+    std::initializer_list<trace_string> strings) noexcept;
+void AppendBinaryTraceText(const char* fmt, va_list args) noexcept;
+void AppendBinaryTraceText(const wchar_t* fmt, va_list args) noexcept;
+void CommitBinaryTraceText() noexcept;
+
 struct result_configuration
 {
     bool should_log;
@@ -34,7 +34,13 @@ HANDLE __stdcall CreateFileFixup(
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::create_file, functionResult, reinterpret_cast<std::uintptr_t>(result), TickStart, TickEnd, _ReturnAddress(),
+                { desiredAccess, shareMode, creationDisposition, flagsAndAttributes },
+                { fileName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -118,7 +124,21 @@ HANDLE __stdcall CreateFile2Fixup(
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::create_file2, functionResult, reinterpret_cast<std::uintptr_t>(result), TickStart, TickEnd, _ReturnAddress(),
+                {
+                    desiredAccess,
+                    shareMode,
+                    creationDisposition,
+                    createExParams != nullptr,
+                    createExParams ? createExParams->dwFileAttributes : 0,
+                    createExParams ? createExParams->dwFileFlags : 0,
+                    createExParams ? createExParams->dwSecurityQosFlags : 0
+                },
+                { fileName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -942,7 +962,14 @@ HANDLE __stdcall FindFirstFileExFixup(
     auto functionResult = from_win32_bool(result != INVALID_HANDLE_VALUE);
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto findData = reinterpret_cast<win32_find_data_t<CharT>*>(findFileData);
+            WriteBinaryTrace(trace_record_kind::find_first_file_ex, functionResult, reinterpret_cast<std::uintptr_t>(result), TickStart, TickEnd, _ReturnAddress(),
+                { static_cast<std::uint64_t>(infoLevelId), static_cast<std::uint64_t>(searchOp), additionalFlags },
+                { fileName, (result != INVALID_HANDLE_VALUE) ? findData->cFileName : nullptr });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1032,7 +1059,13 @@ BOOL __stdcall FindNextFileFixup(_In_ HANDLE findFile, _Out_ win32_find_data_t<C
     auto functionResult = from_win32_bool(result || (::GetLastError() == ERROR_NO_MORE_FILES));
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::find_next_file, functionResult, result, TickStart, TickEnd, _ReturnAddress(),
+                { reinterpret_cast<std::uintptr_t>(findFile) },
+                { result ? findFileData->cFileName : nullptr });
+        }
+        else if (output_method == trace_method::eventlog)
         {
 
             std::string inputs = "";
@@ -1521,7 +1554,13 @@ DWORD __stdcall GetFileAttributesFixup(_In_ const CharT* fileName)
     auto functionResult = from_win32_bool(result != INVALID_FILE_ATTRIBUTES);
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::get_file_attributes, functionResult, result, TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { fileName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1666,7 +1705,14 @@ BOOL __stdcall GetFileAttributesExFixup(
     auto functionResult = from_win32_bool(result);
     if (auto lock = acquire_output_lock(function_type::filesystem, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto data = reinterpret_cast<WIN32_FILE_ATTRIBUTE_DATA*>(fileInformation);
+            WriteBinaryTrace(trace_record_kind::get_file_attributes_ex, functionResult, result, TickStart, TickEnd, _ReturnAddress(),
+                { static_cast<std::uint64_t>(infoLevelId), result ? data->dwFileAttributes : 0 },
+                { fileName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
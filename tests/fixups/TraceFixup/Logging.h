@@ -49,10 +49,27 @@
 // Since consumers typically call 'Log' multiple times, make sure that we synchronize that output
 inline std::recursive_mutex g_outputMutex;
 
+// trace_method::binary takes no lock; output is instead buffered by the calling thread while it holds an output_lock and
+// written as a single record when the lock is released. This is also what keeps calls made while processing output from
+// causing more output
+inline thread_local bool g_processingOutputOnThread = false;
+
 // Logs output using a printf-like format
 inline void Log(const char* fmt, ...)
 {
-    if (output_method == trace_method::printf)
+    if (output_method == trace_method::binary)
+    {
+        va_list args;
+        va_start(args, fmt);
+        AppendBinaryTraceText(fmt, args);
+        va_end(args);
+
+        if (!g_processingOutputOnThread)
+        {
+            CommitBinaryTraceText();
+        }
+    }
+    else if (output_method == trace_method::printf)
     {
         va_list args;
         va_start(args, fmt);
@@ -90,7 +107,19 @@ inline void Log(const char* fmt, ...)
 
 inline void Log(const wchar_t* fmt, ...)
 {
-    if (output_method == trace_method::printf)
+    if (output_method == trace_method::binary)
+    {
+        va_list args;
+        va_start(args, fmt);
+        AppendBinaryTraceText(fmt, args);
+        va_end(args);
+
+        if (!g_processingOutputOnThread)
+        {
+            CommitBinaryTraceText();
+        }
+    }
+    else if (output_method == trace_method::printf)
     {
         va_list args;
         va_start(args, fmt);
@@ -644,10 +673,18 @@ struct output_lock
     // to acquire the lock" check
     static inline bool processing_output = false;
 
-    output_lock(function_type type, function_result result)
+    output_lock(function_type type, function_result result) :
+        m_binary(output_method == trace_method::binary)
     {
-        g_outputMutex.lock();
-        m_inhibitOutput = std::exchange(processing_output, true);
+        if (m_binary)
+        {
+            m_inhibitOutput = std::exchange(g_processingOutputOnThread, true);
+        }
+        else
+        {
+            g_outputMutex.lock();
+            m_inhibitOutput = std::exchange(processing_output, true);
+        }
 
         auto [shouldLog, shouldBreak] = configured_result(type, result);
         m_shouldLog = !m_inhibitOutput && shouldLog;
@@ -659,8 +696,25 @@ struct output_lock
 
     ~output_lock()
     {
-        processing_output = m_inhibitOutput;
-        g_outputMutex.unlock();
+        if (m_binary)
+        {
+            g_processingOutputOnThread = m_inhibitOutput;
+            if (!m_inhibitOutput)
+            {
+                CommitBinaryTraceText();
+            }
+        }
+        else
+        {
+            processing_output = m_inhibitOutput;
+            g_outputMutex.unlock();
+        }
+    }
+
+    // Whether the calling thread is in the middle of producing output, in which case function calls must not be traced
+    static bool processing() noexcept
+    {
+        return (output_method == trace_method::binary) ? g_processingOutputOnThread : processing_output;
     }
 
     explicit operator bool() const noexcept
@@ -670,6 +724,7 @@ struct output_lock
 
 private:
 
+    bool m_binary;
     bool m_inhibitOutput;
     bool m_shouldLog;
 };
@@ -689,8 +744,8 @@ struct function_entry_tracker
     {
         if (trace_function_entry)
         {
-            std::lock_guard<std::recursive_mutex> lock(g_outputMutex);
-            if (!output_lock::processing_output)
+            auto lock = lock_output();
+            if (!output_lock::processing())
             {
                 if (++function_call_depth == 1)
                 {
@@ -716,8 +771,8 @@ struct function_entry_tracker
     {
         if (trace_function_entry)
         {
-            std::lock_guard<std::recursive_mutex> lock(g_outputMutex);
-            if (!output_lock::processing_output)
+            auto lock = lock_output();
+            if (!output_lock::processing())
             {
                 if (--function_call_depth == 0)
                 {
@@ -726,6 +781,17 @@ struct function_entry_tracker
             }
         }
     }
+
+private:
+
+    static std::unique_lock<std::recursive_mutex> lock_output()
+    {
+        if (output_method == trace_method::binary)
+        {
+            return {};
+        }
+        return std::unique_lock<std::recursive_mutex>(g_outputMutex);
+    }
 };
 #define LogFunctionEntry() function_entry_tracker{ __FUNCTION__ }
 
@@ -72,6 +72,37 @@ std::string InterpretKeyPath(HKEY key, const char* msg = "Key")
     return sret;
 }
 
+// For traceMethod "binary" (see TraceRecords.h). Returns an empty string if NtQueryKey can't name the key, e.g. when it
+// is a predefined key, in which case LogKeyPath logs nothing either
+std::wstring TraceKeyPath(HKEY key)
+{
+    ULONG size;
+    if (auto status = impl::NtQueryKey(key, winternl::KeyNameInformation, nullptr, 0, &size);
+        (status == STATUS_BUFFER_TOO_SMALL) || (status == STATUS_BUFFER_OVERFLOW))
+    {
+        try
+        {
+            auto buffer = std::make_unique<std::uint8_t[]>(size);
+            if (NT_SUCCESS(impl::NtQueryKey(key, winternl::KeyNameInformation, buffer.get(), size, &size)))
+            {
+                auto info = reinterpret_cast<winternl::PKEY_NAME_INFORMATION>(buffer.get());
+                return std::wstring(info->Name, info->NameLength / 2);
+            }
+        }
+        catch (...)
+        {
+        }
+    }
+    return {};
+}
+
+// A string that the function wrote along with its length, as LogCountedString logs it
+template <typename CharT>
+trace_string TraceCountedString(const CharT* value, std::size_t length)
+{
+    return value ? trace_string(std::basic_string_view<CharT>(value, length)) : trace_string(value);
+}
+
 auto RegCreateKeyImpl = psf::detoured_string_function(&::RegCreateKeyA, &::RegCreateKeyW);
 template <typename CharT>
 LSTATUS __stdcall RegCreateKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey, _Out_ PHKEY resultKey)
@@ -85,7 +116,13 @@ LSTATUS __stdcall RegCreateKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey,
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_create_key, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -167,7 +204,14 @@ LSTATUS __stdcall RegCreateKeyExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto hasDisposition = !function_failed(functionResult) && disposition;
+            WriteBinaryTrace(trace_record_kind::reg_create_key_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { options, samDesired, hasDisposition, hasDisposition ? *disposition : 0 },
+                { TraceKeyPath(key).c_str(), subKey, classType });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -255,7 +299,13 @@ LSTATUS __stdcall RegOpenKeyFixup(_In_ HKEY key, _In_opt_ const CharT* subKey, _
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_open_key, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -336,7 +386,13 @@ LSTATUS __stdcall RegOpenKeyExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_open_key_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { options, samDesired },
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = ""; 
             std::string outputs = "";
@@ -428,7 +484,20 @@ LSTATUS __stdcall RegGetValueFixup(
 
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto hasType = !function_failed(functionResult) && type;
+            auto hasData = hasType && data && dataSize;
+            WriteBinaryTrace(trace_record_kind::reg_get_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { flags, !psf::is_ansi<CharT>, hasType, hasType ? *type : 0 },
+                {
+                    TraceKeyPath(key).c_str(),
+                    subKey,
+                    value,
+                    trace_string::binary(hasData ? data : nullptr, hasData ? *dataSize : 0)
+                });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -519,7 +588,18 @@ LSTATUS __stdcall RegQueryValueFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto hasData = !function_failed(functionResult) && data && dataSize;
+            WriteBinaryTrace(trace_record_kind::reg_query_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { !psf::is_ansi<CharT> },
+                {
+                    TraceKeyPath(key).c_str(),
+                    subKey,
+                    trace_string::binary(hasData ? data : nullptr, hasData ? static_cast<std::size_t>(*dataSize) : 0)
+                });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -600,7 +680,19 @@ LSTATUS __stdcall RegQueryValueExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto hasType = !function_failed(functionResult) && type;
+            auto hasData = hasType && data && dataSize;
+            WriteBinaryTrace(trace_record_kind::reg_query_value_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { !psf::is_ansi<CharT>, hasType, hasType ? *type : 0 },
+                {
+                    TraceKeyPath(key).c_str(),
+                    valueName,
+                    trace_string::binary(hasData ? data : nullptr, hasData ? *dataSize : 0)
+                });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -686,7 +778,13 @@ LSTATUS __stdcall RegSetKeyValueFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_set_key_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { !psf::is_ansi<CharT>, type },
+                { TraceKeyPath(key).c_str(), subKey, valueName, trace_string::binary(data, dataSize) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -769,7 +867,13 @@ LSTATUS __stdcall RegSetValueFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_set_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { type },
+                { TraceKeyPath(key).c_str(), subKey, data });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -849,7 +953,13 @@ LSTATUS __stdcall RegSetValueExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_set_value_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { !psf::is_ansi<CharT>, type },
+                { TraceKeyPath(key).c_str(), valueName, trace_string::binary(data, dataSize) });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -923,7 +1033,13 @@ LSTATUS __stdcall RegDeleteKeyFixup(_In_ HKEY key, _In_ const CharT* subKey)
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_delete_key, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -996,7 +1112,13 @@ LSTATUS __stdcall RegDeleteKeyExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_delete_key_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { samDesired },
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1067,7 +1189,13 @@ LSTATUS __stdcall RegDeleteKeyValueFixup(_In_ HKEY key, _In_opt_ const CharT* su
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_delete_key_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), subKey, valueName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1139,7 +1267,13 @@ LSTATUS __stdcall RegDeleteValueFixup(_In_ HKEY key, _In_opt_ const CharT* value
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_delete_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), valueName });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1208,7 +1342,13 @@ LSTATUS __stdcall RegDeleteTreeFixup(_In_ HKEY key, _In_opt_ const CharT* subKey
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_delete_tree, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(key).c_str(), subKey });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1277,7 +1417,13 @@ LSTATUS __stdcall RegCopyTreeFixup(_In_ HKEY keySrc, _In_opt_ const CharT* subKe
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            WriteBinaryTrace(trace_record_kind::reg_copy_tree, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                {},
+                { TraceKeyPath(keySrc).c_str(), subKey, TraceKeyPath(keyDest).c_str() });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1353,7 +1499,14 @@ LSTATUS __stdcall RegEnumKeyFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto succeeded = !function_failed(functionResult);
+            WriteBinaryTrace(trace_record_kind::reg_enum_key, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { index },
+                { TraceKeyPath(key).c_str(), succeeded ? name : nullptr });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1438,7 +1591,19 @@ LSTATUS __stdcall RegEnumKeyExFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto succeeded = !function_failed(functionResult);
+            auto hasClassName = succeeded && className && classNameLength;
+            WriteBinaryTrace(trace_record_kind::reg_enum_key_ex, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { index },
+                {
+                    TraceKeyPath(key).c_str(),
+                    TraceCountedString<CharT>(succeeded ? name : nullptr, succeeded ? *nameLength : 0),
+                    TraceCountedString<CharT>(hasClassName ? className : nullptr, hasClassName ? *classNameLength : 0)
+                });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -1526,7 +1691,20 @@ LSTATUS __stdcall RegEnumValueFixup(
     auto functionResult = from_win32(result);
     if (auto lock = acquire_output_lock(function_type::registry, functionResult))
     {
-        if (output_method == trace_method::eventlog)
+        if (output_method == trace_method::binary)
+        {
+            auto succeeded = !function_failed(functionResult);
+            auto hasType = succeeded && type;
+            auto hasData = hasType && data && dataSize;
+            WriteBinaryTrace(trace_record_kind::reg_enum_value, functionResult, static_cast<DWORD>(result), TickStart, TickEnd, _ReturnAddress(),
+                { index, !psf::is_ansi<CharT>, hasType, hasType ? *type : 0 },
+                {
+                    TraceKeyPath(key).c_str(),
+                    TraceCountedString<CharT>(succeeded ? valueName : nullptr, succeeded ? *valueNameLength : 0),
+                    trace_string::binary(hasData ? data : nullptr, hasData ? *dataSize : 0)
+                });
+        }
+        else if (output_method == trace_method::eventlog)
         {
             std::string inputs = "";
             std::string outputs = "";
@@ -0,0 +1,164 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Measures how many traced calls per second each thread can make with traceMethod "binary", compared to the text path
+// it replaces: a process wide lock, held while each line of output is formatted. The traced call is CreateFile shaped
+// (four flag arguments and a path), and in both cases the output only goes to memory, so the numbers are an upper
+// bound of what tracing itself costs rather than of what the output device can take. So that every call counts, the
+// binary producers wait for the writer when their ring is full where the fixup would drop the record instead.
+//
+// NOTE: Only the binary side runs the fixup's own code (TraceRecords.h). The text side is a stand-in for the fixup's
+// text output, a recursive lock held around a vsnprintf of each line, so it must be kept in step with that by hand
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../TraceRecords.h"
+
+using namespace std::literals;
+
+namespace
+{
+    struct benchmark_result
+    {
+        double calls_per_second_per_thread;
+    };
+
+    constexpr wchar_t benchmark_path[] = LR"(C:\Program Files\WindowsApps\Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe\VFS\ProgramFilesX64\App\settings.ini)";
+
+    template <typename CallFunc>
+    std::uint64_t run_threads(unsigned threadCount, std::chrono::milliseconds duration, CallFunc&& call)
+    {
+        std::atomic<bool> stop{ false };
+        std::atomic<std::uint64_t> calls{ 0 };
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back([&, i]
+            {
+                auto state = call.thread_start(i);
+                std::uint64_t count = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    call(state, count++);
+                }
+                call.thread_end(state);
+                calls += count;
+            });
+        }
+
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        return calls;
+    }
+
+    benchmark_result benchmark_binary(unsigned threadCount, std::chrono::milliseconds duration)
+    {
+        trace_ring_set rings(1024 * 1024);
+        std::uint64_t bytes = 0;
+        trace_writer writer(rings, [&](const std::uint8_t*, std::size_t size) { bytes += size; }, [] {}, 1ms);
+
+        struct binary_call
+        {
+            trace_ring_set& rings;
+
+            std::shared_ptr<trace_ring> thread_start(unsigned)
+            {
+                return rings.create();
+            }
+
+            void thread_end(std::shared_ptr<trace_ring>& ring)
+            {
+                ring->retire();
+            }
+
+            void operator()(std::shared_ptr<trace_ring>& ring, std::uint64_t count)
+            {
+                trace_record_header header = {};
+                header.kind = trace_record_kind::create_file;
+                header.start = count;
+                header.end = count + 1;
+                header.result = count;
+                while (!ring->write(header, { 0x80000000, 1, 3, 0x80 }, { benchmark_path }))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        };
+
+        auto calls = run_threads(threadCount, duration, binary_call{ rings });
+        writer.stop(true);
+
+        return { calls / std::chrono::duration<double>(duration).count() / threadCount };
+    }
+
+    // Formats a line the way Log does
+    void format_line(std::uint64_t& bytes, const char* fmt, ...)
+    {
+        std::string str(256, '\0');
+        va_list args;
+        va_start(args, fmt);
+        auto count = std::vsnprintf(str.data(), str.size() + 1, fmt, args);
+        va_end(args);
+        str.resize(count);
+        bytes += str.size();
+    }
+
+    benchmark_result benchmark_text(unsigned threadCount, std::chrono::milliseconds duration)
+    {
+        struct text_call
+        {
+            std::recursive_mutex outputMutex;
+            std::uint64_t bytes = 0;
+
+            int thread_start(unsigned)
+            {
+                return 0;
+            }
+
+            void thread_end(int)
+            {
+            }
+
+            void operator()(int, std::uint64_t)
+            {
+                std::lock_guard<std::recursive_mutex> lock(outputMutex);
+                format_line(bytes, "CreateFile:\n");
+                format_line(bytes, "\t%s=%ls\n", "Path", benchmark_path);
+                format_line(bytes, "\t%s=%s\n", "Access", "GENERIC_READ");
+                format_line(bytes, "\t%s=%s\n", "Share", "FILE_SHARE_READ");
+                format_line(bytes, "\t%s=%s\n", "Disposition", "OPEN_EXISTING");
+                format_line(bytes, "\t%s=%s\n", "Flags and Attributes", "FILE_ATTRIBUTE_NORMAL");
+                format_line(bytes, "\t%s=%s\n", "Result", "Success");
+                format_line(bytes, "\tCalling Module=%ls\n", LR"(C:\Program Files\WindowsApps\Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe\App.exe)");
+            }
+        };
+
+        text_call call;
+        auto calls = run_threads(threadCount, duration, call);
+        return { calls / std::chrono::duration<double>(duration).count() / threadCount };
+    }
+}
+
+void RunBenchmark(unsigned threadCount, std::chrono::milliseconds duration)
+{
+    std::printf("Traced CreateFile calls per second per thread, %u thread(s):\n", threadCount);
+
+    auto text = benchmark_text(threadCount, duration);
+    std::printf("\ttext (lock + format): %12.0f\n", text.calls_per_second_per_thread);
+
+    auto binary = benchmark_binary(threadCount, duration);
+    std::printf("\tbinary:               %12.0f\n", binary.calls_per_second_per_thread);
+}
@@ -0,0 +1,511 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Renders a trace file written by TraceFixup's traceMethod "binary" as the text that traceMethod "printf" would have
+// written, using the same Log* helpers:
+//      TraceDecoder <trace file>
+// Or measures the traced calls per second per thread that binary tracing sustains, against the text path:
+//      TraceDecoder -benchmark [threads] [seconds]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+#include <psf_utils.h>
+#include <utilities.h>
+
+#include "../Config.h"
+#include "../Logging.h"
+
+trace_method output_method = trace_method::printf;
+bool wait_for_debugger = false;
+bool trace_function_entry = false;
+bool trace_calling_module = true;
+bool ignore_dll_load = true;
+
+void RunBenchmark(unsigned threadCount, std::chrono::milliseconds duration);
+
+// Module records, by base address
+struct trace_module
+{
+    std::uint64_t end;
+    std::wstring path;
+};
+static std::map<std::uint64_t, trace_module> g_modules;
+
+static void LogRecordCallingModule(const trace_record_view& record)
+{
+    auto caller = record.header.caller;
+    if (!caller)
+    {
+        return;
+    }
+
+    auto next = g_modules.upper_bound(caller);
+    if ((next != g_modules.begin()) && (caller < std::prev(next)->second.end))
+    {
+        Log("\tCalling Module=%ls\n", std::prev(next)->second.path.c_str());
+    }
+    else
+    {
+        Log("\tCalling Module=0x%llX\n", caller);
+    }
+}
+
+// Log*'s string arguments must be null terminated
+static std::wstring RecordString(const trace_record_view& record, std::size_t index)
+{
+    auto& str = record.strings[index];
+    if (str.encoding == trace_string_encoding::narrow)
+    {
+        return widen(std::string_view(reinterpret_cast<const char*>(str.data), str.bytes));
+    }
+    return std::wstring(record.wide_string(index));
+}
+
+static void LogRecordString(const char* name, const trace_record_view& record, std::size_t index)
+{
+    if (index < record.strings.size())
+    {
+        LogString(name, RecordString(record, index).c_str());
+    }
+}
+
+// As the fixups only log some strings when they were given
+static void LogRecordOptionalString(const char* name, const trace_record_view& record, std::size_t index)
+{
+    if (!record.null_string(index))
+    {
+        LogRecordString(name, record, index);
+    }
+}
+
+// As LogKeyPath in RegistryFixup.cpp, which logs nothing for a key that NtQueryKey can't name
+static void LogRecordKeyPath(const trace_record_view& record, std::size_t index, const char* msg = "Key")
+{
+    if ((index < record.strings.size()) && record.strings[index].bytes)
+    {
+        LogRecordString(msg, record, index);
+    }
+}
+
+// A string that the fixup logged with LogCountedString, narrow or wide as the function returned it
+static void LogRecordCountedString(const char* name, const trace_record_view& record, std::size_t index)
+{
+    if (record.null_string(index))
+    {
+        return;
+    }
+
+    if (record.strings[index].encoding == trace_string_encoding::wide)
+    {
+        auto value = record.wide_string(index);
+        LogCountedString(name, value.data(), value.length());
+    }
+    else
+    {
+        auto value = record.narrow_string(index);
+        LogCountedString(name, value.data(), value.length());
+    }
+}
+
+// Registry value data, which may have been cut short at trace_value_data_limit bytes. It's copied with zeros after it so
+// that LogRegValue finds the terminators it looks for, and never reads beyond the data
+static void LogRecordValue(const trace_record_view& record, std::size_t index, DWORD type, bool wide)
+{
+    if (record.null_string(index))
+    {
+        return;
+    }
+
+    auto& str = record.strings[index];
+    std::vector<std::uint8_t> data(str.data, str.data + str.bytes);
+    data.resize(str.bytes + 2 * sizeof(std::uint64_t), 0);
+    if (wide)
+    {
+        LogRegValue<wchar_t>(type, data.data(), str.bytes);
+    }
+    else
+    {
+        LogRegValue<char>(type, data.data(), str.bytes);
+    }
+}
+
+static void LogRecordResult(const trace_record_view& record)
+{
+    auto functionResult = static_cast<function_result>(record.header.function_result);
+    LogFunctionResult(functionResult);
+    if (function_failed(functionResult))
+    {
+        LogWin32Error(record.header.last_error, "Last Error");
+    }
+}
+
+// The registry functions return their error rather than setting the last error
+static void LogRegistryRecordResult(const trace_record_view& record)
+{
+    auto functionResult = static_cast<function_result>(record.header.function_result);
+    LogFunctionResult(functionResult);
+    if (function_failed(functionResult))
+    {
+        LogWin32Error(static_cast<DWORD>(record.header.result));
+    }
+}
+
+// Mirrors the text output of the corresponding functions in FileSystemFixup.cpp and RegistryFixup.cpp
+static void LogRecord(const trace_record_view& record)
+{
+    auto functionResult = static_cast<function_result>(record.header.function_result);
+    switch (record.header.kind)
+    {
+    case trace_record_kind::text:
+        Log("%.*s", static_cast<int>(record.narrow_string(0).length()), record.narrow_string(0).data());
+        return;
+
+    case trace_record_kind::module:
+        g_modules[record.arg(0)] = trace_module{ record.arg(0) + record.arg(1), RecordString(record, 0) };
+        return;
+
+    case trace_record_kind::create_file:
+        Log("CreateFile:\n");
+        LogRecordString("Path", record, 0);
+        LogGenericAccess(static_cast<DWORD>(record.arg(0)));
+        LogShareMode(static_cast<DWORD>(record.arg(1)));
+        LogCreationDisposition(static_cast<DWORD>(record.arg(2)));
+        LogFileFlagsAndAttributes(static_cast<DWORD>(record.arg(3)));
+        LogRecordResult(record);
+        break;
+
+    case trace_record_kind::create_file2:
+        Log("CreateFile2:\n");
+        LogRecordString("Path", record, 0);
+        LogGenericAccess(static_cast<DWORD>(record.arg(0)));
+        LogShareMode(static_cast<DWORD>(record.arg(1)));
+        LogCreationDisposition(static_cast<DWORD>(record.arg(2)));
+        if (record.arg(3))
+        {
+            LogFileAttributes(static_cast<DWORD>(record.arg(4)));
+            LogFileFlags(static_cast<DWORD>(record.arg(5)));
+            LogSQOS(static_cast<DWORD>(record.arg(6)));
+        }
+        LogRecordResult(record);
+        break;
+
+    case trace_record_kind::get_file_attributes:
+        Log("GetFileAttributes:\n");
+        LogRecordString("Path", record, 0);
+        LogRecordResult(record);
+        if (!function_failed(functionResult))
+        {
+            LogFileAttributes(static_cast<DWORD>(record.header.result));
+        }
+        break;
+
+    case trace_record_kind::get_file_attributes_ex:
+        Log("GetFileAttributesEx:\n");
+        LogRecordString("Path", record, 0);
+        LogInfoLevelId(static_cast<GET_FILEEX_INFO_LEVELS>(record.arg(0)));
+        LogRecordResult(record);
+        if (!function_failed(functionResult))
+        {
+            LogFileAttributes(static_cast<DWORD>(record.arg(1)));
+        }
+        break;
+
+    case trace_record_kind::find_first_file_ex:
+        Log("FindFirstFileEx:\n");
+        LogRecordString("Search Path", record, 0);
+        LogInfoLevelId(static_cast<FINDEX_INFO_LEVELS>(record.arg(0)));
+        LogSearchOp(static_cast<FINDEX_SEARCH_OPS>(record.arg(1)));
+        LogFindFirstFileExFlags(static_cast<DWORD>(record.arg(2)));
+        LogRecordResult(record);
+        if (!function_failed(functionResult) && (record.header.result != reinterpret_cast<std::uintptr_t>(INVALID_HANDLE_VALUE)))
+        {
+            Log("\tHandle=%p\n", reinterpret_cast<HANDLE>(static_cast<std::uintptr_t>(record.header.result)));
+            LogRecordString("First File", record, 1);
+        }
+        break;
+
+    case trace_record_kind::find_next_file:
+        Log("FindNextFile:\n");
+        Log("\tHandle=%p\n", reinterpret_cast<HANDLE>(static_cast<std::uintptr_t>(record.arg(0))));
+        LogRecordResult(record);
+        if (!function_failed(functionResult) && record.header.result)
+        {
+            LogRecordString("Next File", record, 0);
+        }
+        break;
+
+    case trace_record_kind::reg_create_key:
+        Log("RegCreateKey:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_create_key_ex:
+        Log("RegCreateKeyEx:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordString("Sub Key", record, 1);
+        LogRecordOptionalString("Class", record, 2);
+        LogRegKeyFlags(static_cast<DWORD>(record.arg(0)));
+        LogRegKeyAccess(static_cast<REGSAM>(record.arg(1)));
+        LogRegistryRecordResult(record);
+        if (record.arg(2))
+        {
+            LogRegKeyDisposition(static_cast<DWORD>(record.arg(3)));
+        }
+        break;
+
+    case trace_record_kind::reg_open_key:
+        Log("RegOpenKey:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_open_key_ex:
+        Log("RegOpenKeyEx:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegKeyFlags(static_cast<DWORD>(record.arg(0)));
+        LogRegKeyAccess(static_cast<REGSAM>(record.arg(1)));
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_get_value:
+        Log("RegGetValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRecordOptionalString("Value", record, 2);
+        LogRegKeyQueryFlags(static_cast<DWORD>(record.arg(0)));
+        LogRegistryRecordResult(record);
+        if (record.arg(2))
+        {
+            LogRegKeyType(static_cast<DWORD>(record.arg(3)));
+            LogRecordValue(record, 3, static_cast<DWORD>(record.arg(3)), record.arg(1) != 0);
+        }
+        break;
+
+    case trace_record_kind::reg_query_value:
+        Log("RegQueryValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegistryRecordResult(record);
+        if (!record.null_string(2))
+        {
+            auto& str = record.strings[2];
+            if (record.arg(0))
+            {
+                std::wstring value(str.bytes / sizeof(wchar_t), L'\0');
+                std::memcpy(value.data(), str.data, value.length() * sizeof(wchar_t));
+                LogCountedString("Data", value.c_str(), value.length());
+            }
+            else
+            {
+                LogCountedString("Data", reinterpret_cast<const char*>(str.data), str.bytes);
+            }
+        }
+        break;
+
+    case trace_record_kind::reg_query_value_ex:
+        Log("RegQueryValueEx:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Value Name", record, 1);
+        LogRegistryRecordResult(record);
+        if (record.arg(1))
+        {
+            LogRegKeyType(static_cast<DWORD>(record.arg(2)));
+            LogRecordValue(record, 2, static_cast<DWORD>(record.arg(2)), record.arg(0) != 0);
+        }
+        break;
+
+    case trace_record_kind::reg_set_key_value:
+        Log("RegSetKeyValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRecordOptionalString("Value Name", record, 2);
+        LogRegKeyType(static_cast<DWORD>(record.arg(1)));
+        LogRecordValue(record, 3, static_cast<DWORD>(record.arg(1)), record.arg(0) != 0);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_set_value:
+        Log("RegSetValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegKeyType(static_cast<DWORD>(record.arg(0)));
+        LogRecordOptionalString("Data", record, 2);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_set_value_ex:
+        Log("RegSetValueEx:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Value Name", record, 1);
+        LogRegKeyType(static_cast<DWORD>(record.arg(1)));
+        LogRecordValue(record, 2, static_cast<DWORD>(record.arg(1)), record.arg(0) != 0);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_delete_key:
+        Log("RegDeleteKey:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordString("Sub Key", record, 1);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_delete_key_ex:
+        Log("RegDeleteKeyEx:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordString("Sub Key", record, 1);
+        LogRegKeyAccess(static_cast<REGSAM>(record.arg(0)));
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_delete_key_value:
+        Log("RegDeleteKeyValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRecordOptionalString("Value Name", record, 2);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_delete_value:
+        Log("RegDeleteValue:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Value Name", record, 1);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_delete_tree:
+        Log("RegDeleteTree:\n");
+        LogRecordKeyPath(record, 0);
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_copy_tree:
+        Log("RegCopyTree:\n");
+        LogRecordKeyPath(record, 0, "Source");
+        LogRecordOptionalString("Sub Key", record, 1);
+        LogRecordKeyPath(record, 2, "Dest");
+        LogRegistryRecordResult(record);
+        break;
+
+    case trace_record_kind::reg_enum_key:
+        Log("RegEnumKey:\n");
+        LogRecordKeyPath(record, 0);
+        Log("\tIndex=%d\n", static_cast<DWORD>(record.arg(0)));
+        LogRegistryRecordResult(record);
+        LogRecordOptionalString("Name", record, 1);
+        break;
+
+    case trace_record_kind::reg_enum_key_ex:
+        Log("RegEnumKeyEx:\n");
+        LogRecordKeyPath(record, 0);
+        Log("\tIndex=%d\n", static_cast<DWORD>(record.arg(0)));
+        LogRegistryRecordResult(record);
+        LogRecordCountedString("Name", record, 1);
+        LogRecordCountedString("Class", record, 2);
+        break;
+
+    case trace_record_kind::reg_enum_value:
+        Log("RegEnumValue:\n");
+        LogRecordKeyPath(record, 0);
+        Log("\tIndex=%d\n", static_cast<DWORD>(record.arg(0)));
+        LogRegistryRecordResult(record);
+        LogRecordCountedString("Value Name", record, 1);
+        if (record.arg(2))
+        {
+            LogRegKeyType(static_cast<DWORD>(record.arg(3)));
+            LogRecordValue(record, 2, static_cast<DWORD>(record.arg(3)), record.arg(1) != 0);
+        }
+        break;
+
+    default:
+        Log("Unknown trace record %u\n", static_cast<unsigned>(record.header.kind));
+        return;
+    }
+
+    LogRecordCallingModule(record);
+}
+
+static int DecodeTraceFile(const wchar_t* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::fwprintf(stderr, L"Unable to open %ls\n", path);
+        return 1;
+    }
+    std::vector<std::uint8_t> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    trace_file_reader reader(data.data(), data.size());
+    if (!reader.valid())
+    {
+        std::fwprintf(stderr, L"%ls is not a trace file\n", path);
+        return 1;
+    }
+
+    // Each thread's records are in order, but the writer interleaves threads a batch at a time. Calls are traced when
+    // they complete, so sort by that (keeping module records, which have no time, ahead of everything that uses them)
+    std::vector<trace_record_view> records;
+    for (trace_record_view record; reader.next(record); )
+    {
+        records.push_back(record);
+    }
+    std::stable_sort(records.begin(), records.end(), [](const trace_record_view& lhs, const trace_record_view& rhs)
+    {
+        return lhs.header.end < rhs.header.end;
+    });
+
+    for (auto& record : records)
+    {
+        LogRecord(record);
+    }
+    return 0;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    if ((argc >= 2) && (std::wcscmp(argv[1], L"-benchmark") == 0))
+    {
+        auto threadCount = (argc >= 3) ? static_cast<unsigned>(std::wcstoul(argv[2], nullptr, 10)) : 0;
+        auto seconds = (argc >= 4) ? std::wcstoul(argv[3], nullptr, 10) : 2;
+        if (threadCount)
+        {
+            RunBenchmark(threadCount, std::chrono::seconds(seconds));
+        }
+        else
+        {
+            for (unsigned count = 1; count <= 8; count *= 2)
+            {
+                RunBenchmark(count, std::chrono::seconds(seconds));
+            }
+        }
+        return 0;
+    }
+
+    if (argc != 2)
+    {
+        std::wprintf(L"Usage: TraceDecoder <trace file>\n");
+        std::wprintf(L"       TraceDecoder -benchmark [threads] [seconds]\n");
+        return 1;
+    }
+
+    return DecodeTraceFile(argv[1]);
+}
@@ -0,0 +1,660 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Binary tracing (traceMethod "binary"). Rather than formatting text under a process wide lock, each traced call
+// appends one compact record to a ring buffer owned by the calling thread, and a background writer drains the rings of
+// all threads into a file. TraceDecoder turns that file back into the same text the other trace methods produce.
+//
+// Every record is a multiple of 8 bytes long and laid out as:
+//      trace_record_header
+//      std::uint64_t args[header.arg_count]
+//      strings, each a trace_string_header followed by its contents, padded with zeros to a multiple of 8 bytes
+// A trace file is a trace_file_header followed by records.
+//
+// The writer (TraceFixup) and the reader (TraceDecoder) both include this header, so any change to the layout must bump
+// trace_file_header::file_version. Wide strings are stored as wchar_t, so a file can only be decoded on a platform where
+// wchar_t is UTF-16, as it is on Windows.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class trace_record_kind : std::uint16_t
+{
+    // Filler at the end of a ring buffer; never written to the file
+    padding,
+
+    // Output of Log, i.e. already formatted text. One narrow string
+    text,
+
+    // A module that a record's caller address belongs to. args: base address, size. One wide string: the module path
+    module,
+
+    // Calls that are traced field by field. args and strings are the function's, in order
+    create_file,
+    create_file2,
+    get_file_attributes,
+    get_file_attributes_ex,
+    find_first_file_ex,
+    find_next_file,
+
+    // Registry calls. The first string is the path of the key handle as NtQueryKey reports it (empty for a predefined
+    // key), looked up when the call is traced since the handle may be closed by the time the record is written. Then
+    // come the function's integer arguments and strings, and what it returned through pointers, recorded only when it
+    // succeeded. Value data is recorded as binary, up to trace_value_data_limit bytes, with an argument saying whether
+    // the function was the wide variant
+    reg_create_key,
+    reg_create_key_ex,
+    reg_open_key,
+    reg_open_key_ex,
+    reg_get_value,
+    reg_query_value,
+    reg_query_value_ex,
+    reg_set_key_value,
+    reg_set_value,
+    reg_set_value_ex,
+    reg_delete_key,
+    reg_delete_key_ex,
+    reg_delete_key_value,
+    reg_delete_value,
+    reg_delete_tree,
+    reg_copy_tree,
+    reg_enum_key,
+    reg_enum_key_ex,
+    reg_enum_value,
+};
+
+// Registry value data beyond this is not recorded, so that a large value doesn't take up a thread's whole ring
+constexpr std::size_t trace_value_data_limit = 4096;
+
+enum class trace_string_encoding : std::uint16_t
+{
+    narrow,
+    wide,   // wchar_t, i.e. UTF-16 on Windows
+    binary, // Raw bytes, e.g. registry value data
+};
+
+enum trace_string_flags : std::uint16_t
+{
+    trace_string_null = 0x1,    // The pointer was null; the string is empty
+};
+
+struct trace_record_header
+{
+    std::uint32_t size;             // Including this header
+    trace_record_kind kind;
+    std::uint8_t function_result;
+    std::uint8_t arg_count;
+    std::uint32_t thread_id;
+    std::uint32_t last_error;
+    std::uint64_t start;            // QueryPerformanceCounter ticks
+    std::uint64_t end;
+    std::uint64_t result;           // The function's return value
+    std::uint64_t caller;           // Return address into the calling module, or zero if not traced
+};
+static_assert(sizeof(trace_record_header) == 48);
+
+struct trace_string_header
+{
+    std::uint32_t bytes;
+    trace_string_encoding encoding;
+    std::uint16_t flags;            // trace_string_flags
+};
+static_assert(sizeof(trace_string_header) == 8);
+
+struct trace_file_header
+{
+    static constexpr std::uint32_t file_magic = 0x54465350; // "PSFT"
+    static constexpr std::uint32_t file_version = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t frequency;        // QueryPerformanceFrequency
+    std::uint32_t process_id;
+    std::uint32_t reserved;
+};
+static_assert(sizeof(trace_file_header) == 24);
+
+// A string argument of a record. Null pointers are recorded as empty strings, flagged trace_string_null
+struct trace_string
+{
+    trace_string(const char* value) noexcept :
+        data(value),
+        bytes(value ? static_cast<std::uint32_t>(std::strlen(value)) : 0),
+        encoding(trace_string_encoding::narrow),
+        null(value == nullptr)
+    {
+    }
+
+    trace_string(const wchar_t* value) noexcept :
+        data(value),
+        bytes(value ? static_cast<std::uint32_t>(std::wcslen(value) * sizeof(wchar_t)) : 0),
+        encoding(trace_string_encoding::wide),
+        null(value == nullptr)
+    {
+    }
+
+    trace_string(std::string_view value) noexcept :
+        data(value.data()),
+        bytes(static_cast<std::uint32_t>(value.length())),
+        encoding(trace_string_encoding::narrow),
+        null(value.data() == nullptr)
+    {
+    }
+
+    trace_string(std::wstring_view value) noexcept :
+        data(value.data()),
+        bytes(static_cast<std::uint32_t>(value.length() * sizeof(wchar_t))),
+        encoding(trace_string_encoding::wide),
+        null(value.data() == nullptr)
+    {
+    }
+
+    // Up to trace_value_data_limit bytes of 'value'
+    static trace_string binary(const void* value, std::size_t length) noexcept
+    {
+        auto bytes = value ? std::min(length, trace_value_data_limit) : 0;
+        trace_string result(std::string_view(static_cast<const char*>(value), bytes));
+        result.encoding = trace_string_encoding::binary;
+        return result;
+    }
+
+    const void* data;
+    std::uint32_t bytes;
+    trace_string_encoding encoding;
+    bool null;
+};
+
+inline constexpr std::size_t trace_align(std::size_t size) noexcept
+{
+    return (size + 7) & ~std::size_t(7);
+}
+
+inline std::size_t trace_record_size(std::size_t argCount, std::initializer_list<trace_string> strings) noexcept
+{
+    auto result = sizeof(trace_record_header) + argCount * sizeof(std::uint64_t);
+    for (auto& str : strings)
+    {
+        result += sizeof(trace_string_header) + trace_align(str.bytes);
+    }
+    return result;
+}
+
+// Writes a record of trace_record_size bytes to 'out', filling in the header's size and argument count
+inline void encode_trace_record(
+    std::uint8_t* out,
+    trace_record_header header,
+    std::initializer_list<std::uint64_t> args,
+    std::initializer_list<trace_string> strings) noexcept
+{
+    header.size = static_cast<std::uint32_t>(trace_record_size(args.size(), strings));
+    header.arg_count = static_cast<std::uint8_t>(args.size());
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    for (auto arg : args)
+    {
+        std::memcpy(out, &arg, sizeof(arg));
+        out += sizeof(arg);
+    }
+
+    for (auto& str : strings)
+    {
+        auto flags = static_cast<std::uint16_t>(str.null ? trace_string_null : 0);
+        trace_string_header stringHeader = { str.bytes, str.encoding, flags };
+        std::memcpy(out, &stringHeader, sizeof(stringHeader));
+        out += sizeof(stringHeader);
+
+        if (str.bytes)
+        {
+            std::memcpy(out, str.data, str.bytes);
+        }
+        std::memset(out + str.bytes, 0, trace_align(str.bytes) - str.bytes);
+        out += trace_align(str.bytes);
+    }
+}
+
+inline void append_trace_record(
+    std::vector<std::uint8_t>& buffer,
+    const trace_record_header& header,
+    std::initializer_list<std::uint64_t> args,
+    std::initializer_list<trace_string> strings)
+{
+    auto offset = buffer.size();
+    buffer.resize(offset + trace_record_size(args.size(), strings));
+    encode_trace_record(buffer.data() + offset, header, args, strings);
+}
+
+// Single producer/single consumer byte ring holding whole records. The owning thread writes without ever blocking; when
+// the consumer falls behind, records are dropped (and counted) rather than making the traced call wait
+class trace_ring
+{
+public:
+    // 'capacity' is rounded up to a power of two
+    explicit trace_ring(std::size_t capacity)
+    {
+        m_capacity = 4096;
+        while (m_capacity < capacity)
+        {
+            m_capacity *= 2;
+        }
+        m_buffer = std::make_unique<std::uint8_t[]>(m_capacity);
+    }
+
+    // Producer side. Returns false if the record did not fit
+    bool write(
+        const trace_record_header& header,
+        std::initializer_list<std::uint64_t> args,
+        std::initializer_list<trace_string> strings) noexcept
+    {
+        auto size = trace_record_size(args.size(), strings);
+        if ((size > m_capacity / 2) || (args.size() > 0xFF))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // Records never wrap; if one doesn't fit before the end of the buffer, the rest of the buffer becomes padding
+        auto position = m_head.load(std::memory_order_relaxed);
+        auto offset = static_cast<std::size_t>(position & (m_capacity - 1));
+        auto contiguous = m_capacity - offset;
+        auto needed = (size <= contiguous) ? size : contiguous + size;
+        if (position + needed - m_tail.load(std::memory_order_acquire) > m_capacity)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (size > contiguous)
+        {
+            trace_record_header padding = {};
+            padding.size = static_cast<std::uint32_t>(contiguous);
+            padding.kind = trace_record_kind::padding;
+            std::memcpy(m_buffer.get() + offset, &padding, sizeof(padding.size) + sizeof(padding.kind));
+            offset = 0;
+        }
+
+        encode_trace_record(m_buffer.get() + offset, header, args, strings);
+        m_head.store(position + needed, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; only one thread may drain a ring at a time. Invokes 'sink(const std::uint8_t* record, std::size_t
+    // size)' for every record written so far, in order, and returns the number of records
+    template <typename SinkT>
+    std::size_t drain(SinkT&& sink)
+    {
+        std::size_t count = 0;
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        auto head = m_head.load(std::memory_order_acquire);
+        while (tail != head)
+        {
+            auto record = m_buffer.get() + (tail & (m_capacity - 1));
+            std::uint32_t size;
+            trace_record_kind kind;
+            std::memcpy(&size, record, sizeof(size));
+            std::memcpy(&kind, record + sizeof(size), sizeof(kind));
+            if (kind != trace_record_kind::padding)
+            {
+                sink(static_cast<const std::uint8_t*>(record), static_cast<std::size_t>(size));
+                ++count;
+            }
+            tail += size;
+        }
+
+        m_tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    std::uint64_t dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Called by the owning thread on exit; the ring is released once it has been drained
+    void retire() noexcept
+    {
+        m_retired.store(true, std::memory_order_release);
+    }
+
+    bool retired() const noexcept
+    {
+        return m_retired.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<std::uint8_t[]> m_buffer;
+    std::size_t m_capacity;
+    std::atomic<bool> m_retired{ false };
+    std::atomic<std::uint64_t> m_dropped{ 0 };
+
+    // Keep the producer and consumer positions on separate cache lines
+    char m_padding0[64];
+    std::atomic<std::uint64_t> m_head{ 0 };
+    char m_padding1[64 - sizeof(std::uint64_t)];
+    std::atomic<std::uint64_t> m_tail{ 0 };
+    char m_padding2[64 - sizeof(std::uint64_t)];
+};
+
+// The rings of all threads that have traced anything
+class trace_ring_set
+{
+public:
+    explicit trace_ring_set(std::size_t ringCapacity) noexcept :
+        m_ringCapacity(ringCapacity)
+    {
+    }
+
+    // Called once per thread, on its first traced call
+    std::shared_ptr<trace_ring> create()
+    {
+        auto ring = std::make_shared<trace_ring>(m_ringCapacity);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rings.push_back(ring);
+        return ring;
+    }
+
+    // Drains every ring into 'sink' (see trace_ring::drain) and releases the rings of threads that have exited. Only one
+    // thread may drain at a time
+    template <typename SinkT>
+    std::size_t drain(SinkT&& sink)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_draining = m_rings;
+        }
+
+        std::size_t count = 0;
+        for (auto& ring : m_draining)
+        {
+            // Check before draining so that nothing can be written between the final drain and the release
+            auto retired = ring->retired();
+            count += ring->drain(sink);
+            if (retired)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_retiredDrops += ring->dropped();
+                m_rings.erase(std::find(m_rings.begin(), m_rings.end(), ring));
+            }
+        }
+
+        m_draining.clear();
+        return count;
+    }
+
+    // Records dropped because a ring was full
+    std::uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto result = m_retiredDrops;
+        for (auto& ring : m_rings)
+        {
+            result += ring->dropped();
+        }
+        return result;
+    }
+
+private:
+    std::size_t m_ringCapacity;
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<trace_ring>> m_rings;
+    std::vector<std::shared_ptr<trace_ring>> m_draining;
+    std::uint64_t m_retiredDrops = 0;
+};
+
+// Drains a trace_ring_set from a background thread every 'interval'. 'output' is invoked for each record and 'flush'
+// after each pass; both are only ever called by one thread at a time
+class trace_writer
+{
+public:
+    using output_function = std::function<void(const std::uint8_t* record, std::size_t size)>;
+    using flush_function = std::function<void()>;
+
+    trace_writer(trace_ring_set& rings, output_function output, flush_function flush, std::chrono::milliseconds interval) :
+        m_rings(rings),
+        m_output(std::move(output)),
+        m_flush(std::move(flush)),
+        m_interval(interval),
+        m_thread([this] { run(); })
+    {
+    }
+
+    ~trace_writer()
+    {
+        stop(true);
+    }
+
+    // Drains everything written so far
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(m_drainMutex);
+        drain_locked();
+    }
+
+    // Stops the background thread and drains whatever is left; nothing is output after this returns. When 'join' is
+    // false the thread isn't waited for, which is what DLL_PROCESS_DETACH needs: the thread can't exit while the loader
+    // lock is held, and if the process is exiting it is already gone - possibly while it held the drain lock, hence the
+    // bounded wait
+    void stop(bool join)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+
+        if (m_thread.joinable())
+        {
+            if (join)
+            {
+                m_thread.join();
+            }
+            else
+            {
+                m_thread.detach();
+            }
+        }
+
+        for (int attempt = 0; attempt < 50; ++attempt)
+        {
+            std::unique_lock<std::mutex> lock(m_drainMutex, std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                drain_locked();
+                m_stopped = true;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+private:
+    trace_ring_set& m_rings;
+    output_function m_output;
+    flush_function m_flush;
+    std::chrono::milliseconds m_interval;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+
+    std::mutex m_drainMutex;
+    bool m_stopped = false;
+
+    std::thread m_thread;
+
+    void run()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_wake.wait_for(lock, m_interval, [&] { return m_stopping; }))
+                {
+                    return;
+                }
+            }
+
+            drain();
+        }
+    }
+
+    void drain_locked()
+    {
+        if (m_stopped)
+        {
+            return;
+        }
+
+        m_rings.drain(m_output);
+        m_flush();
+    }
+};
+
+// A record read back from a trace file
+struct trace_record_view
+{
+    struct string_ref
+    {
+        trace_string_encoding encoding;
+        const std::uint8_t* data;
+        std::uint32_t bytes;
+        bool null;
+    };
+
+    trace_record_header header;
+    const std::uint8_t* args;
+    std::vector<string_ref> strings;
+
+    // Missing arguments read as zero and missing strings as empty, so that newer records can be read by older decoders
+    std::uint64_t arg(std::size_t index) const noexcept
+    {
+        std::uint64_t result = 0;
+        if (index < header.arg_count)
+        {
+            std::memcpy(&result, args + index * sizeof(result), sizeof(result));
+        }
+        return result;
+    }
+
+    // Whether the string was recorded from a null pointer, or is missing
+    bool null_string(std::size_t index) const noexcept
+    {
+        return (index >= strings.size()) || strings[index].null;
+    }
+
+    std::string_view narrow_string(std::size_t index) const noexcept
+    {
+        if ((index >= strings.size()) || (strings[index].encoding != trace_string_encoding::narrow))
+        {
+            return {};
+        }
+        return { reinterpret_cast<const char*>(strings[index].data), strings[index].bytes };
+    }
+
+    // NOTE: Strings are only suitably aligned for wchar_t if the file contents are
+    std::wstring_view wide_string(std::size_t index) const noexcept
+    {
+        if ((index >= strings.size()) || (strings[index].encoding != trace_string_encoding::wide))
+        {
+            return {};
+        }
+        return { reinterpret_cast<const wchar_t*>(strings[index].data), strings[index].bytes / sizeof(wchar_t) };
+    }
+};
+
+class trace_file_reader
+{
+public:
+    trace_file_reader(const void* data, std::size_t length) noexcept :
+        m_data(static_cast<const std::uint8_t*>(data)),
+        m_length(length)
+    {
+        if (m_length >= sizeof(m_header))
+        {
+            std::memcpy(&m_header, m_data, sizeof(m_header));
+            m_offset = sizeof(m_header);
+        }
+    }
+
+    bool valid() const noexcept
+    {
+        return (m_offset != 0) && (m_header.magic == trace_file_header::file_magic) &&
+            (m_header.version == trace_file_header::file_version);
+    }
+
+    const trace_file_header& header() const noexcept
+    {
+        return m_header;
+    }
+
+    // Returns false at the end of the data, or at the first malformed record (e.g. the last one, if the process was
+    // terminated while it was being written)
+    bool next(trace_record_view& record)
+    {
+        if (!valid() || (m_length - m_offset < sizeof(trace_record_header)))
+        {
+            return false;
+        }
+
+        auto data = m_data + m_offset;
+        std::memcpy(&record.header, data, sizeof(record.header));
+        auto size = record.header.size;
+        if ((size < sizeof(record.header)) || (size % 8 != 0) || (size > m_length - m_offset) ||
+            (sizeof(record.header) + record.header.arg_count * sizeof(std::uint64_t) > size))
+        {
+            return false;
+        }
+
+        record.args = data + sizeof(record.header);
+        record.strings.clear();
+        std::size_t offset = sizeof(record.header) + record.header.arg_count * sizeof(std::uint64_t);
+        while (offset < size)
+        {
+            trace_string_header stringHeader;
+            if (size - offset < sizeof(stringHeader))
+            {
+                return false;
+            }
+
+            std::memcpy(&stringHeader, data + offset, sizeof(stringHeader));
+            offset += sizeof(stringHeader);
+            if (trace_align(stringHeader.bytes) > size - offset)
+            {
+                return false;
+            }
+
+            auto null = (stringHeader.flags & trace_string_null) != 0;
+            record.strings.push_back({ stringHeader.encoding, data + offset, stringHeader.bytes, null });
+            offset += trace_align(stringHeader.bytes);
+        }
+
+        m_offset += size;
+        return true;
+    }
+
+private:
+    const std::uint8_t* m_data;
+    std::size_t m_length;
+    std::size_t m_offset = 0;
+    trace_file_header m_header = {};
+};
@@ -40,6 +40,10 @@ static trace_level g_defaultTraceLevel = trace_level::unexpected_failures;
 static const psf::json_object* g_breakLevels = nullptr;
 static trace_level g_defaultBreakLevel = trace_level::ignore;
 
+// trace_method::binary
+static std::wstring g_traceFile;
+static std::size_t g_traceBufferSize = 256 * 1024;
+
 char exe_path[2048] = {};
 
 
@@ -323,12 +327,28 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
                     output_method = trace_method::eventlog;
                     Log("config traceMethod is eventlog");
                 }
+                else if (methodStr == "binary"sv)
+                {
+                    output_method = trace_method::binary;
+                }
                 else {
                     // Otherwise, use the default (OutputDebugString)
                     Log("config traceMethod is default");
                 }
             }
 
+            if (auto traceFile = configObj.try_get("traceFile"))
+            {
+                traceDataStream << " traceFile:" << traceFile->as_string().wide() << " ;";
+                g_traceFile = traceFile->as_string().wstring();
+            }
+
+            if (auto bufferSize = configObj.try_get("traceBufferSize"))
+            {
+                g_traceBufferSize = static_cast<std::size_t>(bufferSize->as_number().get_unsigned());
+                traceDataStream << " traceBufferSize:" << g_traceBufferSize << " ;";
+            }
+
             if (auto levels = configObj.try_get("traceLevels"))
             {
                 g_traceLevels = &levels->as_object();
@@ -389,6 +409,23 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
             }
         }
 
+        if (output_method == trace_method::binary)
+        {
+            if (g_traceFile.empty())
+            {
+                wchar_t tempPath[MAX_PATH];
+                (DWORD)GetTempPathW(MAX_PATH, tempPath);
+                g_traceFile = tempPath;
+                g_traceFile += L"PSF_Trace_" + std::to_wstring(::GetCurrentProcessId()) + L".bin";
+            }
+
+            if (!StartBinaryTrace(g_traceFile.c_str(), g_traceBufferSize))
+            {
+                output_method = trace_method::output_debug_string;
+                Log("Unable to create trace file %ls (%d); using OutputDebugString instead\n", g_traceFile.c_str(), ::GetLastError());
+            }
+        }
+
         if (wait_for_debugger)
         {
             psf::wait_for_debugger();
@@ -396,6 +433,10 @@ BOOL __stdcall DllMain(HINSTANCE, DWORD reason, LPVOID) noexcept try
     }
     else if (reason == DLL_PROCESS_DETACH)
     {
+        if (output_method == trace_method::binary)
+        {
+            StopBinaryTrace();
+        }
         Log_ETW_UnRegister();
     }
 
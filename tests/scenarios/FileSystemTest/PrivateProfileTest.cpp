@@ -129,6 +129,59 @@ int PrivateProfileTests()
         }
         result = result ? result : testResult;
         test_end(testResult);
+
+        // Changes are written back to the file a little later. If that fails, the app has to hear about it, the same as
+        // it would if the OS wrote the file
+        test_begin("WritePrivateProfileString Write Back Failure Test");
+        testResult = [&]()
+        {
+            auto lockedFile = ::CreateFileW(otherFilePath.c_str(), GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (lockedFile == INVALID_HANDLE_VALUE)
+            {
+                return trace_last_error(L"Failed to open the INI file without sharing");
+            }
+
+            trace_message(L"Writing a key while the INI file is open without sharing\n");
+            auto written = WritePrivateProfileString(L"Section2", L"LockedItem", updatedValue.c_str(), otherFilePath.c_str());
+            auto flushed = WritePrivateProfileString(nullptr, nullptr, nullptr, otherFilePath.c_str());
+            auto flushError = ::GetLastError();
+            auto writtenThrough = WritePrivateProfileString(L"Section2", L"LockedItem2", updatedValue.c_str(), otherFilePath.c_str());
+            ::CloseHandle(lockedFile);
+
+            if (!written)
+            {
+                return trace_last_error(L"Failed to write the key");
+            }
+            if (flushed || writtenThrough)
+            {
+                trace_message(L"ERROR: Writing back to a file that is open without sharing succeeded\n", error_color);
+                return static_cast<int>(ERROR_ASSERTION_FAILURE);
+            }
+            trace_messages(L"Write back failed as expected with: ", info_color, error_message(static_cast<int>(flushError)), new_line);
+
+            auto len = GetPrivateProfileString(L"Section2", L"LockedItem2", badValue.c_str(), buffer, testLen, otherFilePath.c_str());
+            if ((len == 0) || (_wcsicmp(badValue.c_str(), buffer) != 0))
+            {
+                trace_message(L"ERROR: A write that failed is still visible\n", error_color);
+                return static_cast<int>(ERROR_ASSERTION_FAILURE);
+            }
+
+            trace_message(L"Writing the kept change back now that the file is closed\n");
+            if (!WritePrivateProfileString(nullptr, nullptr, nullptr, otherFilePath.c_str()))
+            {
+                return trace_last_error(L"Failed to write back the INI file after closing it");
+            }
+
+            auto contents = read_entire_file(otherFilePath.c_str());
+            if (contents.find("LockedItem=") == std::string::npos)
+            {
+                trace_message(L"ERROR: The change made while the file was locked was lost\n", error_color);
+                return static_cast<int>(ERROR_ASSERTION_FAILURE);
+            }
+            return static_cast<int>(ERROR_SUCCESS);
+        }();
+        result = result ? result : testResult;
+        test_end(testResult);
         free(buffer);
     }
     return result;
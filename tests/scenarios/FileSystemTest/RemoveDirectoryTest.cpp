@@ -96,5 +96,66 @@ int RemoveDirectoryTests()
     result = result ? result : testResult;
     test_end(testResult);
 
+    // The directories that a redirected file is written to are remembered so that they aren't created again for the
+    // next file. Removing them through their own path under LocalAppData\Packages (which isn't redirected, and isn't a
+    // "\\?\" path) must make them get created again
+    test_begin("Recreate Redirected Directory Removed Under LocalAppData\\Packages Test");
+    testResult = []()
+    {
+        clean_redirection_path();
+        trace_message(L"Writing a redirected file so that its parent directories get created\n");
+        if (!write_entire_file(L"Rèçřèáƭèð/Sub/file.txt", "Written before the directories were removed"))
+        {
+            return trace_last_error(L"Failed to create file");
+        }
+
+        auto writablePackageRoot = psf::known_folder(FOLDERID_LocalAppData) / L"Packages" / psf::current_package_family_name() / LR"(LocalCache\Local\Microsoft\WritablePackageRoot)";
+        std::filesystem::path subDirectory;
+        for (auto& entry : std::filesystem::recursive_directory_iterator(writablePackageRoot))
+        {
+            if (entry.is_directory() && (entry.path().filename() == L"Sub") && (entry.path().parent_path().filename() == L"Rèçřèáƭèð"))
+            {
+                subDirectory = entry.path();
+                break;
+            }
+        }
+        if (subDirectory.empty())
+        {
+            trace_message(L"ERROR: Could not find the redirected directory under the writable package root\n", error_color);
+            return ERROR_ASSERTION_FAILURE;
+        }
+
+        trace_message(L"Removing the redirected directories through their own path\n");
+        if (!::DeleteFileW((subDirectory / L"file.txt").c_str()))
+        {
+            return trace_last_error(L"Failed to delete the redirected file");
+        }
+        if (auto removeResult = DoRemoveDirectoryTest(subDirectory, true))
+        {
+            return removeResult;
+        }
+        if (auto removeResult = DoRemoveDirectoryTest(subDirectory.parent_path(), true))
+        {
+            return removeResult;
+        }
+
+        trace_message(L"Writing the file again, which needs the directories to be created again\n");
+        if (!write_entire_file(L"Rèçřèáƭèð/Sub/file.txt", "Written after the directories were removed"))
+        {
+            return trace_last_error(L"Failed to create file after removing its redirected directories");
+        }
+
+        auto contents = read_entire_file(L"Rèçřèáƭèð/Sub/file.txt");
+        if (contents != "Written after the directories were removed")
+        {
+            trace_messages(error_color, L"ERROR: Unexpected file contents: ", error_info_color, contents.c_str(), new_line);
+            return ERROR_ASSERTION_FAILURE;
+        }
+
+        return ERROR_SUCCESS;
+    }();
+    result = result ? result : testResult;
+    test_end(testResult);
+
     return result;
 }
@@ -0,0 +1,301 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for delta_block_map and delta_overlay (FileRedirectionFixup/DeltaOverlay.h), which assemble a redirected copy
+// of a package file from the original and a sparse delta of the blocks that were written, checked against a plain copy
+// that every operation is also applied to, and a benchmark of a few small writes to a large file against copying the
+// whole file first, as redirection does today.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/DeltaOverlay.h"
+#include "unit_test.h"
+
+// A file in memory, with the interface that delta_overlay expects of the base and the delta
+struct memory_file
+{
+    std::vector<std::uint8_t> data;
+
+    std::size_t read(std::uint64_t offset, void* buffer, std::size_t length)
+    {
+        if (offset >= data.size())
+        {
+            return 0;
+        }
+        length = static_cast<std::size_t>(std::min<std::uint64_t>(length, data.size() - offset));
+        std::memcpy(buffer, data.data() + offset, length);
+        return length;
+    }
+
+    void write(std::uint64_t offset, const void* buffer, std::size_t length)
+    {
+        if (offset + length > data.size())
+        {
+            data.resize(static_cast<std::size_t>(offset + length));
+        }
+        std::memcpy(data.data() + offset, buffer, length);
+    }
+};
+
+// A sparse file in memory, as the delta file is on disk: only the pages that were written take space
+struct sparse_file
+{
+    static constexpr std::size_t page_size = 64 * 1024;
+    std::unordered_map<std::uint64_t, std::vector<std::uint8_t>> pages;
+
+    std::size_t read(std::uint64_t offset, void* buffer, std::size_t length)
+    {
+        auto out = static_cast<std::uint8_t*>(buffer);
+        for (std::size_t done = 0; done < length; )
+        {
+            auto position = offset + done;
+            auto inPage = static_cast<std::size_t>(position % page_size);
+            auto chunk = std::min(page_size - inPage, length - done);
+            if (auto itr = pages.find(position / page_size); itr != pages.end())
+            {
+                std::memcpy(out + done, itr->second.data() + inPage, chunk);
+            }
+            else
+            {
+                std::memset(out + done, 0, chunk);
+            }
+            done += chunk;
+        }
+        return length;
+    }
+
+    void write(std::uint64_t offset, const void* buffer, std::size_t length)
+    {
+        auto in = static_cast<const std::uint8_t*>(buffer);
+        for (std::size_t done = 0; done < length; )
+        {
+            auto position = offset + done;
+            auto inPage = static_cast<std::size_t>(position % page_size);
+            auto chunk = std::min(page_size - inPage, length - done);
+            auto& page = pages[position / page_size];
+            page.resize(page_size);
+            std::memcpy(page.data() + inPage, in + done, chunk);
+            done += chunk;
+        }
+    }
+};
+
+static std::vector<std::uint8_t> random_bytes(std::mt19937& random, std::size_t length)
+{
+    std::vector<std::uint8_t> result(length);
+    for (auto& byte : result)
+    {
+        byte = static_cast<std::uint8_t>(random());
+    }
+    return result;
+}
+
+static std::vector<std::uint8_t> read_all(delta_overlay<memory_file, memory_file>& overlay)
+{
+    std::vector<std::uint8_t> result(static_cast<std::size_t>(overlay.size()));
+    UNIT_CHECK(overlay.read(0, result.data(), result.size()) == result.size());
+    return result;
+}
+
+int main()
+{
+    unit_test("Reads come from the package until a block is written", []
+    {
+        std::mt19937 random(1);
+        memory_file base{ random_bytes(random, 1000) };
+        memory_file delta;
+        delta_block_map map(base.data.size(), 42, 64);
+        delta_overlay<memory_file, memory_file> overlay(base, delta, map);
+
+        UNIT_CHECK(read_all(overlay) == base.data);
+        UNIT_CHECK(map.count() == 0);
+
+        // A partial write copies up just the block that it touches
+        const std::uint8_t bytes[] = { 1, 2, 3 };
+        overlay.write(130, bytes, sizeof(bytes));
+        UNIT_CHECK((map.count() == 1) && map.contains(2));
+        UNIT_CHECK(delta.data.size() == 192);
+
+        auto expected = base.data;
+        std::memcpy(expected.data() + 130, bytes, sizeof(bytes));
+        UNIT_CHECK(read_all(overlay) == expected);
+
+        std::uint8_t buffer[10];
+        UNIT_CHECK(overlay.read(995, buffer, sizeof(buffer)) == 5);
+        UNIT_CHECK(overlay.read(1000, buffer, sizeof(buffer)) == 0);
+    });
+
+    unit_test("Truncated package data reads as zeros when the file grows again", []
+    {
+        std::mt19937 random(2);
+        memory_file base{ random_bytes(random, 500) };
+        memory_file delta;
+        delta_block_map map(base.data.size(), 42, 64);
+        delta_overlay<memory_file, memory_file> overlay(base, delta, map);
+
+        const std::uint8_t bytes[] = { 9, 9 };
+        overlay.write(100, bytes, sizeof(bytes));
+        overlay.resize(90);
+        UNIT_CHECK((map.size() == 90) && (map.base_limit() == 90));
+        overlay.resize(300);
+
+        auto contents = read_all(overlay);
+        UNIT_CHECK(std::equal(contents.begin(), contents.begin() + 90, base.data.begin()));
+        UNIT_CHECK(std::all_of(contents.begin() + 90, contents.end(), [](std::uint8_t byte) { return byte == 0; }));
+
+        // Writing past the end leaves a gap of zeros
+        overlay.write(400, bytes, sizeof(bytes));
+        contents = read_all(overlay);
+        UNIT_CHECK((contents.size() == 402) && (contents[400] == 9) && (contents[350] == 0));
+    });
+
+    unit_test("Every operation agrees with a plain copy", []
+    {
+        std::mt19937 random(3);
+        for (int round = 0; round < 300; ++round)
+        {
+            std::uint32_t blockSize = 16u << (random() % 4);
+            memory_file base{ random_bytes(random, random() % 2000) };
+            memory_file delta;
+            delta_block_map map(base.data.size(), round, blockSize);
+            auto reference = base.data;
+
+            for (int op = 0; op < 200; ++op)
+            {
+                delta_overlay<memory_file, memory_file> overlay(base, delta, map);
+                auto offset = random() % 2500;
+                switch (random() % 4)
+                {
+                case 0:
+                {
+                    auto bytes = random_bytes(random, random() % 300);
+                    overlay.write(offset, bytes.data(), bytes.size());
+                    if (!bytes.empty())
+                    {
+                        reference.resize(std::max<std::size_t>(reference.size(), offset + bytes.size()));
+                        std::copy(bytes.begin(), bytes.end(), reference.begin() + offset);
+                    }
+                    break;
+                }
+                case 1:
+                    overlay.resize(offset);
+                    reference.resize(offset);
+                    break;
+                case 2:
+                {
+                    std::vector<std::uint8_t> buffer(random() % 400);
+                    auto length = overlay.read(offset, buffer.data(), buffer.size());
+                    auto expected = (offset < reference.size()) ? std::min(buffer.size(), reference.size() - offset) : 0;
+                    UNIT_CHECK(length == expected);
+                    UNIT_CHECK(std::equal(buffer.begin(), buffer.begin() + length, reference.begin() + std::min<std::size_t>(offset, reference.size())));
+                    break;
+                }
+                default:
+                {
+                    // The delta is reopened with the map as it was persisted
+                    delta_block_map reloaded;
+                    auto blob = map.serialize();
+                    UNIT_CHECK(reloaded.deserialize(blob.data(), blob.size(), round));
+                    map = reloaded;
+                    break;
+                }
+                }
+            }
+
+            delta_overlay<memory_file, memory_file> overlay(base, delta, map);
+            UNIT_CHECK(read_all(overlay) == reference);
+
+            memory_file flattened;
+            overlay.materialize(flattened, 100);
+            UNIT_CHECK(flattened.data == reference);
+        }
+    });
+
+    unit_test("A persisted map only reloads against the same package file", []
+    {
+        delta_block_map map(1 << 20, 7, 4096);
+        map.insert(3);
+        map.insert(200);
+        auto blob = map.serialize();
+
+        delta_block_map reloaded;
+        UNIT_CHECK(!reloaded.deserialize(blob.data(), blob.size(), 8));
+        UNIT_CHECK(!reloaded.deserialize(blob.data(), blob.size() - 1, 7));
+        UNIT_CHECK(!reloaded.deserialize(blob.data(), 10, 7));
+
+        auto corrupt = blob;
+        corrupt[8] = 3; // Block size no longer a power of two
+        UNIT_CHECK(!reloaded.deserialize(corrupt.data(), corrupt.size(), 7));
+
+        UNIT_CHECK(reloaded.deserialize(blob.data(), blob.size(), 7));
+        UNIT_CHECK(reloaded.contains(3) && reloaded.contains(200) && !reloaded.contains(4) && (reloaded.count() == 2));
+        UNIT_CHECK((reloaded.size() == (1 << 20)) && (reloaded.block_size() == 4096));
+    });
+
+    unit_test("Benchmark: 100 random 4KB writes to a 64MB package file", []
+    {
+        constexpr std::size_t fileSize = 64 * 1024 * 1024;
+        std::mt19937 random(4);
+        memory_file base{ random_bytes(random, fileSize) };
+        auto chunk = random_bytes(random, 4096);
+        std::vector<std::uint64_t> offsets;
+        for (int i = 0; i < 100; ++i)
+        {
+            offsets.push_back(random() % (fileSize - chunk.size()));
+        }
+
+        // Before: the whole file is copied out of the package on the first write
+        memory_file copy;
+        auto copyNs = unit_benchmark_ns(1, [&](std::size_t)
+        {
+            copy.data = base.data;
+            for (auto offset : offsets)
+            {
+                copy.write(offset, chunk.data(), chunk.size());
+            }
+        });
+
+        sparse_file delta;
+        delta_block_map map(fileSize, 1);
+        delta_overlay<memory_file, sparse_file> overlay(base, delta, map);
+        auto overlayNs = unit_benchmark_ns(1, [&](std::size_t)
+        {
+            for (auto offset : offsets)
+            {
+                overlay.write(offset, chunk.data(), chunk.size());
+            }
+        });
+
+        // Then reading the whole file back, 1MB at a time
+        std::vector<std::uint8_t> buffer(1024 * 1024);
+        auto copyReadNs = unit_benchmark_ns(fileSize / buffer.size(), [&](std::size_t i)
+        {
+            copy.read(i * buffer.size(), buffer.data(), buffer.size());
+        });
+        auto overlayReadNs = unit_benchmark_ns(fileSize / buffer.size(), [&](std::size_t i)
+        {
+            overlay.read(i * buffer.size(), buffer.data(), buffer.size());
+        });
+
+        memory_file flattened;
+        overlay.materialize(flattened);
+        UNIT_CHECK(flattened.data == copy.data);
+        auto megabytesPerSecond = [&](double ns) { return (buffer.size() / (1024.0 * 1024.0)) / (ns / 1e9); };
+        std::printf("    full copy: writes %.1f ms, %zu MB copied; reads %.0f MB/s\n", copyNs / 1e6,
+            copy.data.size() / (1024 * 1024), megabytesPerSecond(copyReadNs));
+        std::printf("    overlay:   writes %.1f ms, %llu blocks (%.1f MB) copied; reads %.0f MB/s\n", overlayNs / 1e6,
+            static_cast<unsigned long long>(map.count()), map.count() * map.block_size() / (1024.0 * 1024.0),
+            megabytesPerSecond(overlayReadNs));
+    });
+
+    return unit_test_result();
+}
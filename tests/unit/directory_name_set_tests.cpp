@@ -0,0 +1,120 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for directory_name_set (FileRedirectionFixup/DirectoryNameSet.h), which FindFirstFileFixup uses to merge the
+// redirected, package VFS and native enumerations, and a benchmark of merging a large directory with the set against
+// probing the redirected directory once per entry as FindNextFileFixup used to.
+//
+
+#include <clocale>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/DirectoryNameSet.h"
+#include "unit_test.h"
+
+int main()
+{
+    unit_test("Names are compared without regard to case", []
+    {
+        directory_name_set names;
+        UNIT_CHECK(names.insert(L"Config.ini"));
+        UNIT_CHECK(!names.insert(L"CONFIG.INI"));
+        UNIT_CHECK(names.contains(L"config.ini"));
+        UNIT_CHECK(!names.contains(L"config.in"));
+        UNIT_CHECK(!names.contains(L"config.ini2"));
+        UNIT_CHECK(names.size() == 1);
+    });
+
+    unit_test("Non-ASCII names are compared the way the file system compares them", []
+    {
+        // The CRT only folds non-ASCII letters in a Unicode locale; on Windows the fold doesn't depend on it
+        if (!std::setlocale(LC_CTYPE, "C.UTF-8"))
+        {
+            std::printf("    skipped; no C.UTF-8 locale\n");
+            return;
+        }
+
+        directory_name_set names;
+        UNIT_CHECK(names.insert(L"Été.txt"));
+        UNIT_CHECK(names.contains(L"éTÉ.TXT"));
+        UNIT_CHECK(!names.insert(L"été.txt"));
+        UNIT_CHECK(names.insert(L"ete.txt"));
+        std::setlocale(LC_CTYPE, "C");
+    });
+
+    unit_test("Growth keeps every name", []
+    {
+        directory_name_set names;
+        std::set<std::wstring> expected;
+        for (int i = 0; i < 50000; ++i)
+        {
+            auto name = L"File" + std::to_wstring(i * 7919 % 100003) + L".dat";
+            UNIT_CHECK(names.insert(name) == expected.insert(name).second);
+        }
+        UNIT_CHECK(names.size() == expected.size());
+        for (int i = 0; i < 100003; i += 13)
+        {
+            auto name = L"FILE" + std::to_wstring(i) + L".DAT";
+            UNIT_CHECK(names.contains(name) == (expected.count(L"File" + std::to_wstring(i) + L".dat") != 0));
+        }
+
+        names.clear();
+        UNIT_CHECK(names.empty() && !names.contains(L"File0.dat"));
+        UNIT_CHECK(names.insert(L"File0.dat"));
+    });
+
+    unit_test("Benchmark: merging a 10,000 entry directory", []
+    {
+        constexpr int fileCount = 10000;
+        auto root = std::filesystem::temp_directory_path() / "psf_directory_name_set_tests";
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "redirected");
+        std::vector<std::wstring> packageNames;
+        for (int i = 0; i < fileCount; ++i)
+        {
+            // Half of the package's files have a redirected copy
+            auto name = L"file" + std::to_wstring(i) + L".dat";
+            if (i % 2 == 0)
+            {
+                std::ofstream(root / "redirected" / name);
+            }
+            packageNames.push_back(std::move(name));
+        }
+
+        // Before: one probe of the redirected directory per package entry
+        std::size_t probeSkipped = 0;
+        auto probeNs = unit_benchmark_ns(packageNames.size(), [&](std::size_t i)
+        {
+            probeSkipped += std::filesystem::exists(root / "redirected" / packageNames[i]);
+        });
+
+        // After: the redirected directory's names are remembered as it is enumerated
+        std::size_t setSkipped = 0;
+        directory_name_set names;
+        auto setNs = unit_benchmark_ns(1, [&](std::size_t)
+        {
+            for (auto& entry : std::filesystem::directory_iterator(root / "redirected"))
+            {
+                names.insert(entry.path().filename().wstring());
+            }
+            for (auto& name : packageNames)
+            {
+                setSkipped += names.contains(name);
+            }
+        }) / packageNames.size();
+
+        UNIT_CHECK(probeSkipped == fileCount / 2);
+        UNIT_CHECK(setSkipped == probeSkipped);
+        std::printf("    probe per entry: %.0f entries/s\n", 1e9 / probeNs);
+        std::printf("    name set:        %.0f entries/s\n", 1e9 / setNs);
+        std::filesystem::remove_all(root);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,242 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for dll_discovery (DynamicLibraryFixup/dll_discovery.h), which chooses the package DLL for a module name once
+// the loader has failed to find it, from the DLLs that the package file index (PsfRuntime/package_file_locator.h) has
+// with that name, and a benchmark of the first such lookup in a process against the fixup walking the package itself.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../fixups/DynamicLibraryFixup/dll_discovery.h"
+#include "../../PsfRuntime/package_file_locator.h"
+#include "unit_test.h"
+
+static const std::wstring key = L"Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe";
+
+// The start of a DLL built for 'machine', as far as pe_machine looks
+static std::vector<std::uint8_t> pe_headers(std::uint16_t machine)
+{
+    std::vector<std::uint8_t> result(4096, 0);
+    result[0] = 'M';
+    result[1] = 'Z';
+    std::uint32_t ntHeaderOffset = 0x80;
+    std::memcpy(result.data() + 0x3C, &ntHeaderOffset, sizeof(ntHeaderOffset));
+    std::memcpy(result.data() + ntHeaderOffset, "PE\0\0", 4);
+    std::memcpy(result.data() + ntHeaderOffset + 4, &machine, sizeof(machine));
+    return result;
+}
+
+int main()
+{
+    // Relative path -> the machine type in its PE header
+    const std::map<std::wstring, std::uint16_t> dlls =
+    {
+        { L"App\\helper.dll", dll_discovery::machine_amd64 },
+        { L"VFS\\SystemX86\\shared.dll", dll_discovery::machine_i386 },
+        { L"VFS\\SystemX64\\shared.dll", dll_discovery::machine_amd64 },
+        { L"VFS\\ProgramFilesX64\\Contoso\\deep\\shared.dll", dll_discovery::machine_amd64 },
+        { L"VFS\\ProgramFilesX64\\Contoso\\plugin.dll", dll_discovery::machine_unknown },
+        { L"VFS\\ProgramFilesX64\\Contoso\\arm\\plugin.dll", dll_discovery::machine_arm64 },
+        { L"Lib\\Only32.DLL", dll_discovery::machine_i386 },
+    };
+
+    // As PSFFindPackageFiles finds them, along with the package's other files
+    package_file_locator_builder builder;
+    for (auto& [path, machine] : dlls)
+    {
+        builder.add(path);
+    }
+    builder.add(L"App\\helper.exe");
+    builder.add(L"App\\helper.dll.config");
+    auto data = builder.serialize(key);
+    package_file_locator locator;
+    UNIT_CHECK(locator.open(data.data(), data.size(), key));
+
+    std::vector<std::wstring> reads;
+    auto machineOf = [&](const std::wstring& relativePath)
+    {
+        reads.push_back(relativePath);
+        return dlls.at(relativePath);
+    };
+
+    auto find = [&](std::wstring_view name, std::uint16_t machine)
+    {
+        return dll_discovery::select(locator.find(dll_discovery::file_name(name)), machine, machineOf);
+    };
+
+    unit_test("Module names are looked up with or without .dll, whatever their case", [&]
+    {
+        UNIT_CHECK(dll_discovery::file_name(L"helper") == L"helper.dll");
+        UNIT_CHECK(dll_discovery::file_name(L"HELPER.DLL") == L"HELPER.DLL");
+        UNIT_CHECK(dll_discovery::file_name(L"helper.exe") == L"helper.exe.dll");
+        UNIT_CHECK(dll_discovery::file_name(L".dll") == L".dll.dll");
+
+        UNIT_CHECK(find(L"helper", dll_discovery::machine_amd64) == L"App\\helper.dll");
+        UNIT_CHECK(find(L"HELPER.DLL", dll_discovery::machine_amd64) == L"App\\helper.dll");
+        UNIT_CHECK(find(L"only32.dll", dll_discovery::machine_i386) == L"Lib\\Only32.DLL");
+        UNIT_CHECK(find(L"missing.dll", dll_discovery::machine_amd64).empty());
+        UNIT_CHECK(find(L"helper.exe", dll_discovery::machine_amd64).empty());
+    });
+
+    unit_test("Only DLLs with the name asked for have their headers read, until one is built for the process", [&]
+    {
+        constexpr auto amd64 = dll_discovery::machine_amd64;
+        constexpr auto i386 = dll_discovery::machine_i386;
+
+        // The VFS system folders come before the rest of the VFS, and shallower paths first
+        reads.clear();
+        UNIT_CHECK(find(L"shared", amd64) == L"VFS\\SystemX64\\shared.dll");
+        UNIT_CHECK((reads.size() == 1) && (reads[0] == L"VFS\\SystemX64\\shared.dll"));
+
+        reads.clear();
+        UNIT_CHECK(find(L"shared", i386) == L"VFS\\SystemX86\\shared.dll");
+        UNIT_CHECK(reads.size() == 2);
+
+        // Nothing for this machine, so every candidate is read, and there is no fallback
+        reads.clear();
+        UNIT_CHECK(find(L"only32", amd64).empty());
+        UNIT_CHECK((reads.size() == 1) && (reads[0] == L"Lib\\Only32.DLL"));
+
+        reads.clear();
+        UNIT_CHECK(find(L"nothing", amd64).empty());
+        UNIT_CHECK(reads.empty());
+    });
+
+    unit_test("A DLL whose machine can't be read is used when none is built for the process", [&]
+    {
+        UNIT_CHECK(find(L"plugin", dll_discovery::machine_arm64) == L"VFS\\ProgramFilesX64\\Contoso\\arm\\plugin.dll");
+        UNIT_CHECK(find(L"plugin", dll_discovery::machine_amd64) == L"VFS\\ProgramFilesX64\\Contoso\\plugin.dll");
+    });
+
+    unit_test("Candidates are ranked by where they are, whatever order they come in", []
+    {
+        UNIT_CHECK(dll_discovery::preference(L"helper.dll") == 0);
+        UNIT_CHECK(dll_discovery::preference(L"vfs/systemx64/helper.dll") == 1);
+        UNIT_CHECK(dll_discovery::preference(L"VFS\\ProgramFilesX64\\helper.dll") == 2);
+        UNIT_CHECK(dll_discovery::preference(L"VFSData\\helper.dll") == 0);
+
+        std::vector<std::wstring> order;
+        auto result = dll_discovery::select({ L"VFS\\ProgramFilesX64\\a.dll", L"VFS\\SystemX64\\a.dll", L"b\\c\\a.dll",
+            L"b\\a.dll" }, dll_discovery::machine_arm64, [&](const std::wstring& path)
+        {
+            order.push_back(path);
+            return dll_discovery::machine_amd64;
+        });
+        UNIT_CHECK(result.empty());
+        UNIT_CHECK((order == std::vector<std::wstring>{ L"b\\a.dll", L"b\\c\\a.dll", L"VFS\\SystemX64\\a.dll",
+            L"VFS\\ProgramFilesX64\\a.dll" }));
+    });
+
+    unit_test("Machine types come from the PE header", []
+    {
+        auto headers = pe_headers(dll_discovery::machine_arm64);
+        UNIT_CHECK(dll_discovery::pe_machine(headers.data(), headers.size()) == dll_discovery::machine_arm64);
+        UNIT_CHECK(dll_discovery::pe_machine(headers.data(), 0x85) == dll_discovery::machine_unknown);
+        UNIT_CHECK(dll_discovery::pe_machine(headers.data(), 0x3F) == dll_discovery::machine_unknown);
+
+        auto notPe = headers;
+        notPe[0x81] = 'X';
+        UNIT_CHECK(dll_discovery::pe_machine(notPe.data(), notPe.size()) == dll_discovery::machine_unknown);
+
+        auto farOffset = headers;
+        std::uint32_t offset = 0xFFFFFFF0;
+        std::memcpy(farOffset.data() + 0x3C, &offset, sizeof(offset));
+        UNIT_CHECK(dll_discovery::pe_machine(farOffset.data(), farOffset.size()) == dll_discovery::machine_unknown);
+    });
+
+    unit_test("Benchmark: the first failed load in a process, in a package of 2,000 DLLs in 100 folders", []
+    {
+        auto root = std::filesystem::temp_directory_path() / "psf_dll_discovery_bench";
+        std::filesystem::remove_all(root);
+        auto headers = pe_headers(dll_discovery::machine_amd64);
+        std::size_t fileCount = 0;
+        for (int dir = 0; dir < 100; ++dir)
+        {
+            auto folder = root / "VFS" / "ProgramFilesX64" / ("Dir" + std::to_string(dir));
+            std::filesystem::create_directories(folder);
+            for (int file = 0; file < 20; ++file)
+            {
+                std::ofstream(folder / ("lib" + std::to_string(dir * 20 + file) + ".dll"), std::ios::binary)
+                    .write(reinterpret_cast<const char*>(headers.data()), headers.size());
+                ++fileCount;
+            }
+        }
+
+        auto relative = [&](const std::filesystem::path& path)
+        {
+            auto result = path.lexically_relative(root).wstring();
+            for (auto& ch : result)
+            {
+                ch = (ch == L'/') ? L'\\' : ch;
+            }
+            return result;
+        };
+
+        auto readMachine = [&](const std::wstring& relativePath)
+        {
+            auto generic = relativePath;
+            for (auto& ch : generic)
+            {
+                ch = (ch == L'\\') ? L'/' : ch;
+            }
+            std::uint8_t buffer[4096];
+            std::ifstream file(root / generic, std::ios::binary);
+            file.read(reinterpret_cast<char*>(buffer), sizeof(buffer));
+            return dll_discovery::pe_machine(buffer, static_cast<std::size_t>(file.gcount()));
+        };
+
+        // Before: the fixup walked the package for DLLs the first time a load failed, in every process that had not
+        // saved its own index yet
+        std::wstring walkFound;
+        auto walkNs = unit_benchmark_ns(1, [&](std::size_t)
+        {
+            std::vector<std::wstring> candidates;
+            for (auto& entry : std::filesystem::recursive_directory_iterator(root))
+            {
+                if (entry.is_regular_file() && (entry.path().filename() == "lib1234.dll"))
+                {
+                    candidates.push_back(relative(entry.path()));
+                }
+            }
+            walkFound = dll_discovery::select(std::move(candidates), dll_discovery::machine_amd64, readMachine);
+        });
+
+        // The package file index is the one the PsfRuntime has already built or mapped to find config.json
+        package_file_locator_builder builder;
+        for (auto& entry : std::filesystem::recursive_directory_iterator(root))
+        {
+            if (entry.is_regular_file())
+            {
+                builder.add(relative(entry.path()));
+            }
+        }
+        auto data = builder.serialize(key);
+        package_file_locator locator;
+        UNIT_CHECK(locator.open(data.data(), data.size(), key));
+
+        std::wstring sharedFound;
+        auto sharedNs = unit_benchmark_ns(1, [&](std::size_t)
+        {
+            sharedFound = dll_discovery::select(locator.find(dll_discovery::file_name(L"lib1234")),
+                dll_discovery::machine_amd64, readMachine);
+        });
+
+        UNIT_CHECK(walkFound == L"VFS\\ProgramFilesX64\\Dir61\\lib1234.dll");
+        UNIT_CHECK(sharedFound == walkFound);
+        UNIT_CHECK(builder.size() == fileCount);
+        std::printf("    walking the package: %.2f ms\n", walkNs / 1e6);
+        std::printf("    package file index:  %.2f ms\n", sharedNs / 1e6);
+        std::filesystem::remove_all(root);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,206 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for ini_document and ini_file_cache (FileRedirectionFixup/IniFile.h), which serve GetPrivateProfile* and
+// WritePrivateProfile* calls for redirected INI files from memory, and a benchmark of reading every key of a file from
+// the parsed document against parsing the file again for each key, as the OS does.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "../../fixups/FileRedirectionFixup/IniFile.h"
+#include "unit_test.h"
+
+using namespace std::literals;
+
+static const wchar_t sample[] =
+    L"; Settings for the app\r\n"
+    L"[General]\r\n"
+    L"Name = Contoso  \r\n"
+    L"Quoted=\"  padded  \"\r\n"
+    L"NoValue\r\n"
+    L"name=second\r\n"
+    L"\r\n"
+    L"[ Window ]\n"
+    L"Left=0x20\n"
+    L"Top=-5\r"
+    L"[general]\r\n"
+    L"Ignored=1\r\n";
+
+int main()
+{
+    unit_test("Lookups follow GetPrivateProfileString", []
+    {
+        ini_document document;
+        document.parse(sample);
+
+        UNIT_CHECK(document.query_string(L"general", L"NAME", L"x").text == L"Contoso");
+        UNIT_CHECK(document.query_string(L"General", L"Quoted", L"").text == L"  padded  ");
+        UNIT_CHECK(document.query_string(L"General", L"Missing", L"default  ").text == L"default");
+        UNIT_CHECK(!document.query_string(L"General", L"Missing", L"").found);
+        UNIT_CHECK(!document.query_string(L"General", L"NoValue", L"").found);
+        UNIT_CHECK(document.query_string(L"WINDOW", L"Left", L"").text == L"0x20");
+        UNIT_CHECK(!document.query_string(L"General", L"Ignored", L"").found);
+
+        auto sections = document.query_string(nullptr, nullptr, L"");
+        UNIT_CHECK(sections.is_list && (sections.text == L"General\0Window\0general\0"s));
+        auto keys = document.query_string(L"General", nullptr, L"");
+        UNIT_CHECK(keys.is_list && (keys.text == L"Name\0Quoted\0name\0"s));
+        UNIT_CHECK(document.section_lines(L"window") == L"Left=0x20\0Top=-5\0"s);
+    });
+
+    unit_test("Unchanged lines are written back exactly as they were read", []
+    {
+        ini_document document;
+        document.parse(sample);
+        auto text = document.serialize();
+        UNIT_CHECK(text.find(L"; Settings for the app\r\n[General]\r\nName = Contoso  \r\n") == 0);
+        UNIT_CHECK(text.find(L"[ Window ]\r\nLeft=0x20\r\nTop=-5\r\n") != std::wstring::npos);
+
+        ini_document reparsed;
+        reparsed.parse(text);
+        UNIT_CHECK(reparsed.serialize() == text);
+    });
+
+    unit_test("Writes follow WritePrivateProfileString", []
+    {
+        ini_document document;
+        document.parse(sample);
+
+        UNIT_CHECK(!document.set_value(L"general", L"name", L"Contoso"));
+        UNIT_CHECK(document.set_value(L"general", L"name", L"  Fabrikam"));
+        UNIT_CHECK(document.query_string(L"General", L"Name", L"").text == L"Fabrikam");
+        UNIT_CHECK(document.set_value(L"General", L"Added", L"1"));
+        UNIT_CHECK(document.set_value(L"New", L"Key", L"Value"));
+
+        auto text = document.serialize();
+        UNIT_CHECK(text.find(L"Name=Fabrikam\r\n") != std::wstring::npos);
+        UNIT_CHECK(text.find(L"name=second\r\nAdded=1\r\n\r\n[ Window ]") != std::wstring::npos);
+        UNIT_CHECK(text.find(L"[New]\r\nKey=Value\r\n") != std::wstring::npos);
+
+        UNIT_CHECK(document.remove_key(L"GENERAL", L"quoted"));
+        UNIT_CHECK(!document.remove_key(L"GENERAL", L"quoted"));
+        UNIT_CHECK(document.remove_section(L"window"));
+        UNIT_CHECK(document.query_string(L"Window", L"Left", L"gone").text == L"gone");
+
+        UNIT_CHECK(document.replace_section(L"New", L"A=1\0 B = 2 \0; comment\0\0"sv));
+        UNIT_CHECK(!document.replace_section(L"New", L"A=1\0B=2\0\0"sv));
+        UNIT_CHECK(document.section_lines(L"New") == L"A=1\0B=2\0"s);
+    });
+
+    unit_test("Results are truncated into the caller's buffer as the OS truncates them", []
+    {
+        wchar_t buffer[8];
+        UNIT_CHECK(copy_profile_result(L"Contoso"sv, false, buffer, 8) == 7);
+        UNIT_CHECK(copy_profile_result(L"Contoso Ltd"sv, false, buffer, 8) == 7);
+        UNIT_CHECK(std::wcscmp(buffer, L"Contoso") == 0);
+
+        UNIT_CHECK(copy_profile_result(L"One\0Two\0"sv, true, buffer, 8) == 6);
+        UNIT_CHECK(std::wmemcmp(buffer, L"One\0Tw\0\0", 8) == 0);
+        UNIT_CHECK(copy_profile_result(L""sv, true, buffer, 8) == 0);
+        UNIT_CHECK((buffer[0] == 0) && (buffer[1] == 0));
+        UNIT_CHECK(copy_profile_result(L"One"sv, true, buffer, 1) == 0);
+        UNIT_CHECK(copy_profile_result<wchar_t>(L"One"sv, false, nullptr, 8) == 0);
+    });
+
+    unit_test("Integers and structs are parsed as the OS parses them", []
+    {
+        UNIT_CHECK(parse_profile_int(L"42") == 42);
+        UNIT_CHECK(parse_profile_int(L"  0x20") == 32);
+        UNIT_CHECK(parse_profile_int(L"0b101") == 5);
+        UNIT_CHECK(parse_profile_int(L"0o17") == 15);
+        UNIT_CHECK(parse_profile_int(L"-5") == static_cast<std::uint32_t>(-5));
+        UNIT_CHECK(parse_profile_int(L"12abc") == 12);
+        UNIT_CHECK(parse_profile_int(L"abc") == 0);
+
+        const std::uint8_t data[] = { 0x01, 0xAB, 0xFF };
+        auto encoded = encode_profile_struct(data, sizeof(data));
+        UNIT_CHECK(encoded == L"01ABFFAB");
+
+        std::uint8_t decoded[3] = {};
+        UNIT_CHECK(decode_profile_struct(&encoded, decoded, sizeof(decoded)) == profile_struct_status::success);
+        UNIT_CHECK(std::memcmp(decoded, data, sizeof(data)) == 0);
+        UNIT_CHECK(decode_profile_struct(nullptr, decoded, 3) == profile_struct_status::not_found);
+        UNIT_CHECK(decode_profile_struct(&encoded, decoded, 2) == profile_struct_status::bad_length);
+        auto corrupt = L"01ABFFAC"s;
+        UNIT_CHECK(decode_profile_struct(&corrupt, decoded, 3) == profile_struct_status::bad_checksum);
+    });
+
+    unit_test("Only ANSI and UTF-16 LE files are cached", []
+    {
+        const std::uint8_t utf16[] = { 0xFF, 0xFE, '[', 0 };
+        const std::uint8_t utf16be[] = { 0xFE, 0xFF, 0, '[' };
+        const std::uint8_t utf8[] = { 0xEF, 0xBB, 0xBF, '[' };
+        const std::uint8_t ansi[] = { '[', 'A', ']' };
+        UNIT_CHECK(detect_ini_encoding(utf16, sizeof(utf16)) == ini_text_encoding::utf16);
+        UNIT_CHECK(detect_ini_encoding(utf16be, sizeof(utf16be)) == ini_text_encoding::unsupported);
+        UNIT_CHECK(detect_ini_encoding(utf8, sizeof(utf8)) == ini_text_encoding::unsupported);
+        UNIT_CHECK(detect_ini_encoding(ansi, sizeof(ansi)) == ini_text_encoding::ansi);
+        UNIT_CHECK(detect_ini_encoding(ansi, 0) == ini_text_encoding::ansi);
+    });
+
+    unit_test("A full cache never drops a file with unwritten changes", []
+    {
+        ini_file_cache cache(2);
+        auto first = cache.get(LR"(C:\App\First.ini)");
+        first->dirty = true;
+        UNIT_CHECK(cache.get(LR"(c:\app\FIRST.INI)") == first);
+        cache.get(LR"(C:\App\Second.ini)");
+        cache.get(LR"(C:\App\Third.ini)");
+        UNIT_CHECK(cache.find(LR"(C:\App\First.ini)") == first);
+        UNIT_CHECK(!cache.find(LR"(C:\App\Second.ini)"));
+        UNIT_CHECK(cache.find(LR"(C:\App\Third.ini)"));
+
+        std::size_t count = 0;
+        cache.for_each([&](ini_file&) { ++count; });
+        UNIT_CHECK(count == 2);
+    });
+
+    unit_test("Benchmark: reading every key of a 500 key file", []
+    {
+        std::wstring text;
+        for (int section = 0; section < 10; ++section)
+        {
+            text += L"[Section" + std::to_wstring(section) + L"]\r\n";
+            for (int key = 0; key < 50; ++key)
+            {
+                text += L"Key" + std::to_wstring(key) + L"=Value " + std::to_wstring(section * 50 + key) + L"\r\n";
+            }
+        }
+
+        auto lookup = [](const ini_document& document, std::size_t i)
+        {
+            auto section = L"Section" + std::to_wstring(i / 50);
+            auto key = L"Key" + std::to_wstring(i % 50);
+            return document.query_string(section.c_str(), key.c_str(), L"").found;
+        };
+
+        // Before: the OS reads and parses the file again for each key
+        std::size_t reparseFound = 0;
+        auto reparseNs = unit_benchmark_ns(500, [&](std::size_t i)
+        {
+            ini_document document;
+            document.parse(text);
+            reparseFound += lookup(document, i);
+        });
+
+        ini_document document;
+        document.parse(text);
+        std::size_t cachedFound = 0;
+        auto cachedNs = unit_benchmark_ns(500 * 100, [&](std::size_t i)
+        {
+            cachedFound += lookup(document, i % 500);
+        });
+
+        UNIT_CHECK(reparseFound == 500);
+        UNIT_CHECK(cachedFound == 500 * 100);
+        std::printf("    parse per key: %.0f ns\n", reparseNs);
+        std::printf("    parsed once:   %.0f ns\n", cachedNs);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,116 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for known_directory_set (FileRedirectionFixup/KnownDirectorySet.h), which remembers the redirected directories
+// that ensure_directory_structure has already created. The file system is simulated with a set of (case folded)
+// directory names.
+//
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/KnownDirectorySet.h"
+#include "unit_test.h"
+
+struct simulated_directories
+{
+    std::set<std::wstring> existing;
+    std::vector<std::wstring> created;
+
+    bool create(const wchar_t* path)
+    {
+        created.push_back(path);
+        existing.insert(psf::fold_file_name(path));
+        return true;
+    }
+
+    bool exists(const wchar_t* path) const
+    {
+        return existing.count(psf::fold_file_name(path)) != 0;
+    }
+
+    void remove(const wchar_t* path)
+    {
+        existing.erase(psf::fold_file_name(path));
+    }
+
+    std::wstring ensure(known_directory_set& directories, std::wstring_view relativePath)
+    {
+        created.clear();
+        return directories.ensure_parent_directories(relativePath, LR"(\\?\C:\Root)",
+            [this](const wchar_t* path) { return create(path); },
+            [this](const wchar_t* path) { return exists(path); });
+    }
+};
+
+int main()
+{
+    unit_test("Only the missing directories are created", []
+    {
+        known_directory_set directories;
+        simulated_directories fs;
+        UNIT_CHECK(fs.ensure(directories, LR"(\A\B\file.txt)") == LR"(\\?\C:\Root\A\B\file.txt)");
+        UNIT_CHECK((fs.created == std::vector<std::wstring>{ LR"(\\?\C:\Root)", LR"(\\?\C:\Root\A)", LR"(\\?\C:\Root\A\B)" }));
+
+        fs.ensure(directories, LR"(\A\B\other.txt)");
+        UNIT_CHECK(fs.created.empty());
+
+        fs.ensure(directories, LR"(\a\b\C\file.txt)");
+        UNIT_CHECK((fs.created == std::vector<std::wstring>{ LR"(\\?\C:\Root\a\b\C)" }));
+    });
+
+    unit_test("A directory can be invalidated through a path without the device prefix", []
+    {
+        const wchar_t* forms[] = { LR"(\\?\C:\Root\A)", LR"(C:\Root\A)", LR"(c:/root/a/)", LR"(\\.\C:\ROOT\A)", LR"(\??\C:\Root\A)" };
+        for (auto form : forms)
+        {
+            known_directory_set directories;
+            simulated_directories fs;
+            fs.ensure(directories, LR"(\A\B\file.txt)");
+
+            // E.g. RemoveDirectory under LocalAppData\Packages, which isn't redirected
+            fs.remove(LR"(\\?\C:\Root\A\B)");
+            fs.remove(LR"(\\?\C:\Root\A)");
+            directories.invalidate(form);
+
+            fs.ensure(directories, LR"(\A\B\file.txt)");
+            UNIT_CHECK((fs.created == std::vector<std::wstring>{ LR"(\\?\C:\Root\A)", LR"(\\?\C:\Root\A\B)" }));
+            UNIT_CHECK(directories.statistics().stale_directories == 0);
+        }
+    });
+
+    unit_test("Invalidating a directory leaves its siblings alone", []
+    {
+        known_directory_set directories;
+        simulated_directories fs;
+        fs.ensure(directories, LR"(\A\file.txt)");
+        fs.ensure(directories, LR"(\AB\file.txt)");
+        directories.invalidate(LR"(C:\Root\A)");
+
+        fs.ensure(directories, LR"(\AB\file.txt)");
+        UNIT_CHECK(fs.created.empty());
+    });
+
+    unit_test("Directories removed without invalidation are created again", []
+    {
+        known_directory_set directories;
+        simulated_directories fs;
+        fs.ensure(directories, LR"(\A\B\file.txt)");
+
+        // E.g. removed by another process or by an API that isn't hooked
+        fs.remove(LR"(\\?\C:\Root\A\B)");
+        fs.remove(LR"(\\?\C:\Root\A)");
+
+        fs.ensure(directories, LR"(\A\B\file.txt)");
+        UNIT_CHECK((fs.created == std::vector<std::wstring>{ LR"(\\?\C:\Root\A)", LR"(\\?\C:\Root\A\B)" }));
+        UNIT_CHECK(directories.statistics().stale_directories == 2);
+
+        fs.ensure(directories, LR"(\A\B\file.txt)");
+        UNIT_CHECK(fs.created.empty());
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,243 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for package_file_index (FileRedirectionFixup/PackageFileIndex.h), which answers existence and attribute checks
+// for paths in the package without a syscall, built from a synthetic package on disk, and a benchmark of lookups in it
+// against asking the file system.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/PackageFileIndex.h"
+#include "unit_test.h"
+
+using lookup_status = package_file_index::lookup_status;
+
+static const std::wstring key = L"Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe";
+
+// Adds everything under 'root' to 'builder', as EnumeratePackageFiles does from FindFirstFileEx
+static void add_tree(const std::filesystem::path& root, package_file_index_builder& builder)
+{
+    for (auto& entry : std::filesystem::recursive_directory_iterator(root))
+    {
+        auto relativePath = entry.path().lexically_relative(root).wstring();
+        for (auto& ch : relativePath)
+        {
+            ch = (ch == L'/') ? L'\\' : ch;
+        }
+
+        if (entry.is_directory())
+        {
+            builder.add(relativePath, package_file_index::attribute_directory, 0);
+        }
+        else
+        {
+            builder.add(relativePath, 0x20 /* FILE_ATTRIBUTE_ARCHIVE */, entry.file_size());
+        }
+    }
+}
+
+static void write_file(const std::filesystem::path& path, std::size_t size)
+{
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary) << std::string(size, 'x');
+}
+
+int main()
+{
+    auto root = std::filesystem::temp_directory_path() / "psf_package_file_index_tests";
+    std::filesystem::remove_all(root);
+    write_file(root / "App.exe", 1234);
+    write_file(root / "Config" / "Settings.ini", 10);
+    write_file(root / "VFS" / "ProgramFilesX64" / "Contoso" / "App" / "data.bin", 70000);
+    write_file(root / "VFS" / "SystemX64" / "helper.dll", 5);
+    std::filesystem::create_directories(root / "Empty");
+
+    package_file_index_builder builder;
+    add_tree(root, builder);
+    auto data = builder.serialize(key);
+
+    unit_test("Files and directories are found with their attributes and sizes", [&]
+    {
+        package_file_index index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        UNIT_CHECK(index.size() == builder.size());
+
+        auto result = index.find(L"App.exe");
+        UNIT_CHECK((result.status == lookup_status::found) && (result.size == 1234) && (result.attributes == 0x20));
+
+        result = index.find(L"Config");
+        UNIT_CHECK(result.status == lookup_status::found);
+        UNIT_CHECK(result.attributes == package_file_index::attribute_directory);
+        UNIT_CHECK(index.find(L"Config\\").status == lookup_status::found);
+        UNIT_CHECK(index.find(L"Empty").status == lookup_status::found);
+        UNIT_CHECK(index.find(L"").status == lookup_status::found);
+
+        // A file named as if it were a directory is left to the file system
+        UNIT_CHECK(index.find(L"App.exe\\").status == lookup_status::unknown);
+    });
+
+    unit_test("ASCII names are compared without regard to case, and either separator is accepted", [&]
+    {
+        package_file_index index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        UNIT_CHECK(index.find(L"config\\SETTINGS.INI").size == 10);
+        UNIT_CHECK(index.find(L"CONFIG//settings.ini").status == lookup_status::found);
+        UNIT_CHECK(index.find(L"Config\\Setting.ini").status == lookup_status::not_found);
+    });
+
+    unit_test("VFS paths are answered like any other package path", [&]
+    {
+        package_file_index index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        auto result = index.find(L"VFS\\ProgramFilesX64\\Contoso\\App\\data.bin");
+        UNIT_CHECK((result.status == lookup_status::found) && (result.size == 70000));
+        UNIT_CHECK(index.find(L"vfs/systemx64/HELPER.DLL").status == lookup_status::found);
+
+        result = index.find(L"VFS\\SystemX64\\missing.dll");
+        UNIT_CHECK((result.status == lookup_status::not_found) && !result.parent_missing);
+        result = index.find(L"VFS\\ProgramFilesX86\\Contoso\\App.exe");
+        UNIT_CHECK((result.status == lookup_status::not_found) && result.parent_missing);
+    });
+
+    unit_test("Names the file system could match some other way are left to it", [&]
+    {
+        package_file_index index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        UNIT_CHECK(index.find(L"PROGRA~1").status == lookup_status::unknown);
+        UNIT_CHECK(index.find(L"App.exe.").status == lookup_status::unknown);
+        UNIT_CHECK(index.find(L"App.exe:stream").status == lookup_status::unknown);
+        UNIT_CHECK(index.find(L"Config\\..\\App.exe").status == lookup_status::unknown);
+        UNIT_CHECK(index.find(L"Conf*").status == lookup_status::unknown);
+        UNIT_CHECK(index.find(L"Été.txt").status == lookup_status::unknown);
+    });
+
+    unit_test("Nothing beneath a reparse point is answered", []
+    {
+        package_file_index_builder linkBuilder;
+        auto attributes = package_file_index::attribute_directory | package_file_index::attribute_reparse_point;
+        linkBuilder.add(L"Link", attributes, 0);
+        auto linkData = linkBuilder.serialize(key);
+        package_file_index index;
+        UNIT_CHECK(index.open(linkData.data(), linkData.size(), key));
+        UNIT_CHECK(index.find(L"Link").status == lookup_status::found);
+        UNIT_CHECK(index.find(L"Link\\anything").status == lookup_status::unknown);
+    });
+
+    unit_test("An index saved for another package version is not used", [&]
+    {
+        package_file_index index;
+        UNIT_CHECK(!index.open(data.data(), data.size(), L"Contoso.App_1.0.0.1_x64__8wekyb3d8bbwe"));
+        UNIT_CHECK(!index.open(data.data(), data.size(), key.substr(0, key.length() - 1)));
+        UNIT_CHECK(!index.is_open());
+        UNIT_CHECK(index.find(L"App.exe").status == lookup_status::unknown);
+    });
+
+    unit_test("Truncated or corrupt indexes are rejected, and never read out of bounds", [&]
+    {
+        package_file_index index;
+        for (std::size_t length = 0; length < data.size(); length += 7)
+        {
+            UNIT_CHECK(!index.open(data.data(), length, key));
+        }
+
+        auto longer = data;
+        longer.push_back(0);
+        UNIT_CHECK(!index.open(longer.data(), longer.size(), key));
+
+        // Any single corrupt byte either fails validation or still gives an index that can be searched safely
+        std::mt19937 random(5);
+        for (int i = 0; i < 5000; ++i)
+        {
+            auto corrupt = data;
+            corrupt[random() % corrupt.size()] = static_cast<std::uint8_t>(random());
+            if (index.open(corrupt.data(), corrupt.size(), key))
+            {
+                index.find(L"VFS\\ProgramFilesX64\\Contoso\\App\\data.bin");
+                index.find(L"Config\\Settings.ini");
+                index.find(L"zzz\\yyy");
+            }
+        }
+
+        // Entries are 32 bytes, after the 32 byte header and the key: the root's children pointing back at the root, and
+        // the first child's name lying outside the names
+        auto entriesOffset = (32 + key.length() * 2 + 7) & ~std::size_t(7);
+        auto cyclic = data;
+        std::uint32_t value = 0;
+        std::memcpy(cyclic.data() + entriesOffset + 16, &value, sizeof(value));
+        UNIT_CHECK(!index.open(cyclic.data(), cyclic.size(), key));
+
+        auto badName = data;
+        value = 0x10000;
+        std::memcpy(badName.data() + entriesOffset + 32 + 8, &value, sizeof(value));
+        UNIT_CHECK(!index.open(badName.data(), badName.size(), key));
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+    });
+
+    unit_test("Benchmark: checking 1,000 package paths, half of which exist", []
+    {
+        auto benchRoot = std::filesystem::temp_directory_path() / "psf_package_file_index_bench";
+        std::filesystem::remove_all(benchRoot);
+        std::vector<std::wstring> paths;
+        for (int dir = 0; dir < 50; ++dir)
+        {
+            auto parent = L"VFS\\ProgramFilesX64\\Dir" + std::to_wstring(dir);
+            std::filesystem::create_directories(benchRoot / "VFS" / "ProgramFilesX64" / ("Dir" + std::to_string(dir)));
+            for (int file = 0; file < 20; ++file)
+            {
+                auto name = L"file" + std::to_wstring(file) + L".dat";
+                std::ofstream(benchRoot / "VFS" / "ProgramFilesX64" / ("Dir" + std::to_string(dir)) / name);
+                paths.push_back(parent + L"\\" + ((file % 2) ? name : L"missing" + name));
+            }
+        }
+
+        package_file_index_builder benchBuilder;
+        add_tree(benchRoot, benchBuilder);
+        auto benchData = benchBuilder.serialize(key);
+        package_file_index index;
+        UNIT_CHECK(index.open(benchData.data(), benchData.size(), key));
+
+        // Before: a file system query for each
+        std::vector<std::filesystem::path> fsPaths;
+        for (auto& path : paths)
+        {
+            auto generic = path;
+            for (auto& ch : generic)
+            {
+                ch = (ch == L'\\') ? L'/' : ch;
+            }
+            fsPaths.push_back(benchRoot / generic);
+        }
+
+        std::size_t fsFound = 0;
+        auto fsNs = unit_benchmark_ns(fsPaths.size() * 10, [&](std::size_t i)
+        {
+            std::error_code ec;
+            fsFound += std::filesystem::exists(fsPaths[i % fsPaths.size()], ec);
+        });
+
+        std::size_t indexFound = 0;
+        auto indexNs = unit_benchmark_ns(paths.size() * 1000, [&](std::size_t i)
+        {
+            indexFound += index.find(paths[i % paths.size()]).status == lookup_status::found;
+        });
+
+        UNIT_CHECK(fsFound == fsPaths.size() * 10 / 2);
+        UNIT_CHECK(indexFound == paths.size() * 1000 / 2);
+        std::printf("    file system: %.0f ns\n", fsNs);
+        std::printf("    index:       %.0f ns\n", indexNs);
+        std::filesystem::remove_all(benchRoot);
+    });
+
+    std::filesystem::remove_all(root);
+    return unit_test_result();
+}
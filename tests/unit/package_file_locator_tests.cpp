@@ -0,0 +1,164 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for package_file_locator (PsfRuntime/package_file_locator.h), the index of every file in the package behind
+// PSFFindPackageFiles, and a benchmark of looking a file up in it against walking the package as the PsfRuntime did.
+//
+
+#include <clocale>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../../PsfRuntime/package_file_locator.h"
+#include "unit_test.h"
+
+static const std::wstring key = L"Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe";
+
+static bool opens(const std::vector<std::wstring>& relativePaths)
+{
+    package_file_locator_builder builder;
+    for (auto& path : relativePaths)
+    {
+        builder.add(path);
+    }
+    auto data = builder.serialize(key);
+    package_file_locator index;
+    return index.open(data.data(), data.size(), key);
+}
+
+int main()
+{
+    unit_test("Files are found by name, shallowest first", []
+    {
+        package_file_locator_builder builder;
+        builder.add(L"VFS\\ProgramFilesX64\\App\\config.json");
+        builder.add(L"config.json");
+        builder.add(L"App\\Config.json");
+        builder.add(L"App\\other.json");
+        auto data = builder.serialize(key);
+
+        package_file_locator index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        UNIT_CHECK(index.size() == 4);
+        auto paths = index.find(L"CONFIG.JSON");
+        UNIT_CHECK(paths.size() == 3);
+        UNIT_CHECK((paths.size() == 3) && (paths[0] == L"config.json") && (paths[1] == L"App\\Config.json") &&
+            (paths[2] == L"VFS\\ProgramFilesX64\\App\\config.json"));
+        UNIT_CHECK(index.find(L"missing.json").empty());
+        UNIT_CHECK(index.find(L"App").empty());
+    });
+
+    unit_test("Non-ASCII names are compared the way the file system compares them", []
+    {
+        // The CRT only folds non-ASCII letters in a Unicode locale; on Windows the fold doesn't depend on it
+        if (!std::setlocale(LC_CTYPE, "C.UTF-8"))
+        {
+            std::printf("    skipped; no C.UTF-8 locale\n");
+            return;
+        }
+
+        package_file_locator_builder builder;
+        builder.add(L"Données\\Été.txt");
+        auto data = builder.serialize(key);
+        std::setlocale(LC_CTYPE, "C");
+
+        // The index is read back in another locale, as it is by the next launch
+        package_file_locator index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+        std::setlocale(LC_CTYPE, "C.UTF-8");
+        UNIT_CHECK(index.find(L"éTÉ.TXT").size() == 1);
+        UNIT_CHECK(index.find(L"ete.txt").empty());
+        std::setlocale(LC_CTYPE, "C");
+    });
+
+    unit_test("An index for another package, or another format, is rejected", []
+    {
+        package_file_locator_builder builder;
+        builder.add(L"config.json");
+        auto data = builder.serialize(key);
+
+        package_file_locator index;
+        UNIT_CHECK(!index.open(data.data(), data.size(), L"Contoso.App_1.0.0.1_x64__8wekyb3d8bbwe"));
+        UNIT_CHECK(!index.open(data.data(), data.size() - 2, key));
+
+        // The version follows the magic
+        auto older = data;
+        older[4] = 1;
+        UNIT_CHECK(!index.open(older.data(), older.size(), key));
+        UNIT_CHECK(!index.is_open());
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+    });
+
+    unit_test("Paths that could lead out of the package are rejected", []
+    {
+        UNIT_CHECK(opens({ L"a.txt", L"App\\b.txt", L"App/c.txt" }));
+        UNIT_CHECK(!opens({ L"a.txt", L"..\\..\\Windows\\System32\\a.txt" }));
+        UNIT_CHECK(!opens({ L"App\\..\\..\\a.txt" }));
+        UNIT_CHECK(!opens({ L"App\\.\\a.txt" }));
+        UNIT_CHECK(!opens({ L"\\Windows\\a.txt" }));
+        UNIT_CHECK(!opens({ L"/Windows/a.txt" }));
+        UNIT_CHECK(!opens({ L"\\\\server\\share\\a.txt" }));
+        UNIT_CHECK(!opens({ L"C:\\Windows\\a.txt" }));
+        UNIT_CHECK(!opens({ L"C:a.txt" }));
+        UNIT_CHECK(!opens({ L"a.txt:stream" }));
+        UNIT_CHECK(!opens({ L"App\\\\a.txt" }));
+        UNIT_CHECK(!opens({ L"App\\" }));
+        UNIT_CHECK(!opens({ L"" }));
+    });
+
+    unit_test("Benchmark: finding a file in a 20,000 file package", []
+    {
+        auto root = std::filesystem::temp_directory_path() / "psf_package_file_locator_tests";
+        std::filesystem::remove_all(root);
+        package_file_locator_builder builder;
+        for (int dir = 0; dir < 200; ++dir)
+        {
+            auto parent = L"Dir" + std::to_wstring(dir % 20);
+            auto child = L"Sub" + std::to_wstring(dir);
+            std::filesystem::create_directories(root / parent / child);
+            for (int file = 0; file < 100; ++file)
+            {
+                auto name = L"file" + std::to_wstring(dir * 100 + file) + L".dat";
+                std::ofstream(root / parent / child / name);
+                builder.add(parent + L"\\" + child + L"\\" + name);
+            }
+        }
+        auto data = builder.serialize(key);
+        package_file_locator index;
+        UNIT_CHECK(index.open(data.data(), data.size(), key));
+
+        // Before: a recursive walk of the package until the file turns up
+        std::size_t walkFound = 0;
+        auto walkNs = unit_benchmark_ns(20, [&](std::size_t i)
+        {
+            auto name = L"file" + std::to_wstring(i * 997 % 20000) + L".dat";
+            for (auto& entry : std::filesystem::recursive_directory_iterator(root))
+            {
+                if (entry.path().filename() == name)
+                {
+                    ++walkFound;
+                    break;
+                }
+            }
+        });
+
+        std::size_t indexFound = 0;
+        auto indexNs = unit_benchmark_ns(20000, [&](std::size_t i)
+        {
+            indexFound += index.find(L"FILE" + std::to_wstring(i * 997 % 20000) + L".DAT").size();
+        });
+
+        UNIT_CHECK(walkFound == 20);
+        UNIT_CHECK(indexFound == 20000);
+        std::printf("    package walk: %.0f lookups/s\n", 1e9 / walkNs);
+        std::printf("    index:        %.0f lookups/s\n", 1e9 / indexNs);
+        std::filesystem::remove_all(root);
+    });
+
+    return unit_test_result();
+}
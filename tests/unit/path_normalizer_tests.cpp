@@ -0,0 +1,172 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for preprocess_path (FileRedirectionFixup/PathNormalizer.h), the textual half of NormalizePath, and a benchmark
+// of it against a stand-in for the UrlDecode/StripFileColonSlash chain of string copies that it replaced, counting heap
+// allocations as well as time.
+//
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "../../fixups/FileRedirectionFixup/PathNormalizer.h"
+#include "unit_test.h"
+
+static std::atomic<std::size_t> g_allocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+    ++g_allocations;
+    if (auto result = std::malloc(size ? size : 1))
+    {
+        return result;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+template <typename CharT>
+static std::basic_string<CharT> preprocess(const CharT* path, path_input_kind expectedKind = path_input_kind::path)
+{
+    path_buffer<CharT> buffer;
+    auto result = preprocess_path(path, buffer);
+    UNIT_CHECK(result.kind == expectedKind);
+    UNIT_CHECK(result.path.data()[result.path.length()] == 0);
+    return std::basic_string<CharT>(result.path);
+}
+
+// What NormalizePath did before: URL decode into a new string, then strip each prefix from a copy of a copy
+static std::string old_url_decode(std::string str)
+{
+    std::string ret;
+    for (std::size_t i = 0; i < str.length(); i++)
+    {
+        unsigned int ii;
+        if ((str[i] == '%') && (std::sscanf(str.substr(i + 1, 4).c_str(), "%x", &ii) == 1))
+        {
+            ret += static_cast<char>(ii);
+            i += (ii <= 255) ? 2 : 4;
+        }
+        else
+        {
+            ret += str[i];
+        }
+    }
+    return ret;
+}
+
+static std::string old_strip_at_start(std::string old_string, const char* toStrip)
+{
+    return (old_string.find(toStrip, 0) == 0) ? old_string.substr(std::strlen(toStrip)) : old_string;
+}
+
+static std::string old_preprocess(const char* path)
+{
+    auto result = old_url_decode(path);
+    for (auto prefix : { "file:\\\\", "file://", "FILE:\\\\", "FILE://", "\\\\file\\", "\\\\FILE\\" })
+    {
+        result = old_strip_at_start(result, prefix);
+    }
+    return result;
+}
+
+int main()
+{
+    unit_test("URL escapes are exactly two hex digits", []
+    {
+        UNIT_CHECK(preprocess(R"(C:\Program%20Files\App)") == R"(C:\Program Files\App)");
+        UNIT_CHECK(preprocess(LR"(C:\Program%20Files\App)") == LR"(C:\Program Files\App)");
+        UNIT_CHECK(preprocess(R"(C:\100%\a%2)") == R"(C:\100%\a%2)");
+        UNIT_CHECK(preprocess(R"(C:\%zz%4a%4A)") == R"(C:\%zzJJ)");
+        UNIT_CHECK(preprocess(R"(C:\%2541)") == R"(C:\%41)");
+        UNIT_CHECK(preprocess("") == "");
+    });
+
+    unit_test("\"file:\" prefixes are stripped, in sequence", []
+    {
+        UNIT_CHECK(preprocess(R"(file:\\C:\App\a.txt)") == R"(C:\App\a.txt)");
+        UNIT_CHECK(preprocess("file://C:/App/a.txt") == "C:/App/a.txt");
+        UNIT_CHECK(preprocess(LR"(FILE://C:\App)") == LR"(C:\App)");
+        UNIT_CHECK(preprocess(R"(\\file\C:\App)") == R"(C:\App)");
+        UNIT_CHECK(preprocess(R"(file://FILE:\\C:\App)") == R"(C:\App)");
+        UNIT_CHECK(preprocess("file%3A//C:/App") == "C:/App");
+        UNIT_CHECK(preprocess(R"(C:\file:\\App)") == R"(C:\file:\\App)");
+    });
+
+    unit_test("Shell namespace items and blobs are told apart from paths", []
+    {
+        UNIT_CHECK(preprocess("::{20D04FE0-3AEA-1069-A2D8-08002B30309D}", path_input_kind::colon_colon_guid) ==
+            "::{20D04FE0-3AEA-1069-A2D8-08002B30309D}");
+        UNIT_CHECK(preprocess(L"::{20D04FE0}") == L"::{20D04FE0}");
+        UNIT_CHECK(preprocess("blob:0123abcd", path_input_kind::blob) == "blob:0123abcd");
+        UNIT_CHECK(preprocess(L"BLOB:0123abcd", path_input_kind::blob) == L"BLOB:0123abcd");
+        UNIT_CHECK(preprocess("blob%3A0123", path_input_kind::blob) == "blob:0123");
+
+        path_buffer<char> buffer;
+        UNIT_CHECK(preprocess_path<char>(nullptr, buffer).path.empty());
+    });
+
+    unit_test("Paths longer than the inline buffer move to the heap intact", []
+    {
+        std::wstring path = LR"(\\?\C:)";
+        for (int i = 0; i < 100; ++i)
+        {
+            path += LR"(\Dir%20)" + std::to_wstring(i);
+        }
+
+        path_buffer<wchar_t, 16> buffer;
+        auto result = preprocess_path(path.c_str(), buffer);
+        UNIT_CHECK(buffer.capacity() > 16);
+        UNIT_CHECK(result.path.length() == path.length() - 200);
+        UNIT_CHECK(result.path.substr(0, 15) == LR"(\\?\C:\Dir 0\Di)");
+        UNIT_CHECK(result.path.data()[result.path.length()] == 0);
+    });
+
+    unit_test("Benchmark: preprocessing typical paths", []
+    {
+        const char* paths[] = { R"(C:\Program Files\WindowsApps\Contoso.App_1.0.0.0_x64__8wekyb3d8bbwe\App\config.ini)",
+            "file:///C:/Users/User/AppData/Local/Contoso/Cache%5Cindex.dat",
+            R"(C:\Users\User\AppData\Roaming\Contoso\Settings\user.json)" };
+        constexpr std::size_t iterations = 300000;
+
+        // Before: a chain of string copies
+        std::size_t oldLength = 0;
+        auto oldAllocations = g_allocations.load();
+        auto oldNs = unit_benchmark_ns(iterations, [&](std::size_t i)
+        {
+            oldLength += old_preprocess(paths[i % 3]).length();
+        });
+        oldAllocations = g_allocations - oldAllocations;
+
+        std::size_t newLength = 0;
+        auto newAllocations = g_allocations.load();
+        auto newNs = unit_benchmark_ns(iterations, [&](std::size_t i)
+        {
+            path_buffer<char> buffer;
+            newLength += preprocess_path(paths[i % 3], buffer).path.length();
+        });
+        newAllocations = g_allocations - newAllocations;
+
+        UNIT_CHECK(newLength == oldLength);
+        UNIT_CHECK(newAllocations == 0);
+        std::printf("    string copies:   %.0f ns, %.1f allocations per path\n", oldNs, double(oldAllocations) / iterations);
+        std::printf("    preprocess_path: %.0f ns, %.1f allocations per path\n", newNs, double(newAllocations) / iterations);
+    });
+
+    return unit_test_result();
+}
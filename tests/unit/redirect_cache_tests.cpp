@@ -0,0 +1,266 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for concurrent_path_cache (FileRedirectionFixup/RedirectCache.h), which remembers ShouldRedirect decisions,
+// with a stand-in for the entry PathRedirection.cpp keeps per path, and a benchmark of lookups from several threads
+// against a single map behind one lock.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/RedirectCache.h"
+#include "unit_test.h"
+
+// As redirect_cache_entry: one result per combination of redirect flags, and which of them are valid
+struct cache_entry
+{
+    std::uint16_t valid = 0;
+    std::wstring results[16];
+};
+
+static void remember(concurrent_path_cache<cache_entry>& cache, const std::wstring& key, std::size_t slot,
+    const std::wstring& redirectPath)
+{
+    cache.update(key, [&](cache_entry& entry)
+    {
+        entry.results[slot] = redirectPath;
+        entry.valid |= static_cast<std::uint16_t>(1u << slot);
+    });
+}
+
+static bool lookup(const concurrent_path_cache<cache_entry>& cache, const std::wstring& key, std::size_t slot,
+    std::wstring& redirectPath)
+{
+    return cache.find(key, [&](const cache_entry& entry)
+    {
+        if ((entry.valid & (1u << slot)) == 0)
+        {
+            return false;
+        }
+
+        redirectPath = entry.results[slot];
+        return true;
+    });
+}
+
+static std::wstring path(std::size_t i)
+{
+    return L"c:\\program files\\contoso\\app\\dir" + std::to_wstring(i % 50) + L"\\file" + std::to_wstring(i) + L".dat";
+}
+
+int main()
+{
+    unit_test("Hits and misses are counted by whether the cached value answered the request", []
+    {
+        concurrent_path_cache<cache_entry> cache;
+        std::wstring result;
+        UNIT_CHECK(!lookup(cache, path(1), 0, result));
+
+        remember(cache, path(1), 0, L"redirected");
+        UNIT_CHECK(lookup(cache, path(1), 0, result) && (result == L"redirected"));
+
+        // Cached, but not for this combination of flags
+        UNIT_CHECK(!lookup(cache, path(1), 3, result));
+
+        auto stats = cache.statistics();
+        UNIT_CHECK((stats.hits == 1) && (stats.misses == 2) && (stats.insertions == 1) && (stats.evictions == 0));
+
+        // Filling in another slot of an existing entry is not an insertion
+        remember(cache, path(1), 3, L"other");
+        UNIT_CHECK(cache.statistics().insertions == 1);
+        UNIT_CHECK(lookup(cache, path(1), 0, result) && (result == L"redirected"));
+    });
+
+    unit_test("Each shard holds its share of the capacity, evicting to make room", []
+    {
+        constexpr std::size_t capacity = 64;
+        concurrent_path_cache<cache_entry> cache(capacity);
+        for (std::size_t i = 0; i < 5000; ++i)
+        {
+            remember(cache, path(i), 0, L"x");
+        }
+
+        auto stats = cache.statistics();
+        auto live = stats.insertions - stats.evictions;
+        UNIT_CHECK(stats.insertions == 5000);
+        UNIT_CHECK(live <= capacity);
+
+        // With 5000 keys spread over the shards, every shard is full
+        UNIT_CHECK(live == capacity);
+
+        std::size_t found = 0;
+        std::wstring result;
+        for (std::size_t i = 0; i < 5000; ++i)
+        {
+            found += lookup(cache, path(i), 0, result);
+        }
+        UNIT_CHECK(found == live);
+
+        cache.clear();
+        UNIT_CHECK(cache.statistics().invalidations == live);
+        UNIT_CHECK(!lookup(cache, path(4999), 0, result));
+    });
+
+    unit_test("erase_if drops invalidated slots, and entries with none left", []
+    {
+        concurrent_path_cache<cache_entry> cache;
+        remember(cache, L"c:\\a\\one.txt", 0, L"c:\\redirected\\a\\one.txt");
+        remember(cache, L"c:\\a\\one.txt", 1, L"c:\\redirected\\b\\one.txt");
+        remember(cache, L"c:\\a\\two.txt", 0, L"c:\\redirected\\a\\two.txt");
+        remember(cache, L"c:\\c\\three.txt", 0, L"c:\\redirected\\c\\three.txt");
+
+        // As InvalidateRedirectCache, for a change to c:\redirected\a
+        const std::wstring changed = L"c:\\redirected\\a";
+        auto removed = cache.erase_if([&](const std::wstring&, cache_entry& entry)
+        {
+            for (std::size_t slot = 0; slot < 16; ++slot)
+            {
+                if ((entry.valid & (1u << slot)) && (entry.results[slot].compare(0, changed.length(), changed) == 0))
+                {
+                    entry.valid &= static_cast<std::uint16_t>(~(1u << slot));
+                }
+            }
+            return entry.valid == 0;
+        });
+
+        UNIT_CHECK(removed == 1);
+        UNIT_CHECK(cache.statistics().invalidations == 1);
+
+        std::wstring result;
+        UNIT_CHECK(!lookup(cache, L"c:\\a\\one.txt", 0, result));
+        UNIT_CHECK(lookup(cache, L"c:\\a\\one.txt", 1, result) && (result == L"c:\\redirected\\b\\one.txt"));
+        UNIT_CHECK(!lookup(cache, L"c:\\a\\two.txt", 0, result));
+        UNIT_CHECK(lookup(cache, L"c:\\c\\three.txt", 0, result));
+    });
+
+    unit_test("Concurrent lookups, updates and invalidations stay consistent", []
+    {
+        concurrent_path_cache<cache_entry> cache(256);
+        constexpr std::size_t threadCount = 8;
+        constexpr std::size_t iterations = 20000;
+        std::atomic<std::size_t> finds{ 0 };
+        std::atomic<std::size_t> mismatches{ 0 };
+        std::atomic<bool> done{ false };
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]
+            {
+                std::wstring result;
+                for (std::size_t i = 0; i < iterations; ++i)
+                {
+                    auto n = (i * 7 + t * 131) % 1000;
+                    auto key = path(n);
+                    if (lookup(cache, key, n % 4, result))
+                    {
+                        // A value is only ever stored under its own key
+                        mismatches += (result != key + L".redirected");
+                    }
+                    else
+                    {
+                        remember(cache, key, n % 4, key + L".redirected");
+                    }
+                    ++finds;
+                }
+            });
+        }
+
+        std::thread invalidator([&]
+        {
+            while (!done)
+            {
+                cache.erase_if([](const std::wstring& key, cache_entry&) { return key.find(L"\\dir3\\") != key.npos; });
+                std::this_thread::yield();
+            }
+        });
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        done = true;
+        invalidator.join();
+
+        auto stats = cache.statistics();
+        UNIT_CHECK(mismatches == 0);
+        UNIT_CHECK(stats.hits + stats.misses == finds);
+        UNIT_CHECK(stats.hits > 0);
+        UNIT_CHECK(stats.insertions - stats.evictions - stats.invalidations <= 256);
+    });
+
+    unit_test("Benchmark: 8 threads looking up 1,000 cached paths", []
+    {
+        constexpr std::size_t threadCount = 8;
+        constexpr std::size_t iterations = 200000;
+        std::vector<std::wstring> keys;
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            keys.push_back(path(i));
+        }
+
+        auto run = [&](auto&& find)
+        {
+            return unit_benchmark_ns(1, [&](std::size_t)
+            {
+                std::vector<std::thread> threads;
+                for (std::size_t t = 0; t < threadCount; ++t)
+                {
+                    threads.emplace_back([&, t]
+                    {
+                        for (std::size_t i = 0; i < iterations; ++i)
+                        {
+                            find(keys[(i + t * 97) % keys.size()]);
+                        }
+                    });
+                }
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+            }) / (threadCount * iterations);
+        };
+
+        // Before: one map behind one lock
+        std::mutex mutex;
+        std::unordered_map<std::wstring, cache_entry> map;
+        for (auto& key : keys)
+        {
+            map[key].results[0] = key;
+            map[key].valid = 1;
+        }
+        std::atomic<std::size_t> lockedHits{ 0 };
+        auto lockedNs = run([&](const std::wstring& key)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto itr = map.find(key);
+            lockedHits += (itr != map.end()) && (itr->second.valid & 1);
+        });
+
+        concurrent_path_cache<cache_entry> cache;
+        for (auto& key : keys)
+        {
+            remember(cache, key, 0, key);
+        }
+        auto shardedNs = run([&](const std::wstring& key)
+        {
+            cache.find(key, [](const cache_entry& entry) { return (entry.valid & 1) != 0; });
+        });
+
+        UNIT_CHECK(lockedHits == threadCount * iterations);
+        UNIT_CHECK(cache.statistics().hits == threadCount * iterations);
+        std::printf("    one lock: %.0f ns per lookup (%u hardware threads)\n", lockedNs, std::thread::hardware_concurrency());
+        std::printf("    sharded:  %.0f ns per lookup\n", shardedNs);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,175 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for redirection_rule_matcher (FileRedirectionFixup/RedirectionRuleMatcher.h), which finds the first
+// "redirectedPaths" rule that a path matches, checked against the linear std::wregex scan that ShouldRedirectImpl used
+// to do, and a benchmark of the two.
+//
+
+#include <cstdio>
+#include <cwctype>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "../../fixups/FileRedirectionFixup/RedirectionRuleMatcher.h"
+#include "unit_test.h"
+
+struct rule
+{
+    std::wstring base_path;
+    std::wstring pattern;
+    std::wregex regex;
+};
+
+// The original scan: the first rule whose base path is a prefix of the path, on a separator boundary, and whose
+// pattern matches the rest of it
+static std::size_t reference_match(const std::vector<rule>& rules, const std::wstring& path)
+{
+    auto isSeparator = [](wchar_t ch) { return (ch == L'\\') || (ch == L'/'); };
+    for (std::size_t i = 0; i < rules.size(); ++i)
+    {
+        auto& base = rules[i].base_path;
+        if (path.length() < base.length())
+        {
+            continue;
+        }
+
+        bool prefix = true;
+        for (std::size_t j = 0; prefix && (j < base.length()); ++j)
+        {
+            prefix = (std::towlower(base[j]) == std::towlower(path[j])) || (isSeparator(base[j]) && isSeparator(path[j]));
+        }
+        if (!prefix || ((path.length() > base.length()) && !isSeparator(path[base.length()])))
+        {
+            continue;
+        }
+
+        auto relativePath = path.c_str() + base.length();
+        if (isSeparator(*relativePath))
+        {
+            ++relativePath;
+        }
+        if (std::regex_match(relativePath, rules[i].regex))
+        {
+            return i;
+        }
+    }
+    return redirection_rule_matcher::npos;
+}
+
+int main()
+{
+    unit_test("The first matching rule wins, in the order the rules were added", []
+    {
+        redirection_rule_matcher matcher;
+        matcher.add(LR"(C:\Package\Config)", LR"(.*\.ini)");
+        matcher.add(LR"(C:\Package)", LR"(.*)");
+        matcher.add(LR"(C:\Package\Config)", LR"(.*)");
+
+        auto result = matcher.match(LR"(c:/PACKAGE/config/App.ini)");
+        UNIT_CHECK(result.index == 0);
+        UNIT_CHECK(result.relative_path && (std::wstring(result.relative_path) == L"App.ini"));
+        UNIT_CHECK(matcher.match(LR"(C:\Package\Config\App.json)").index == 1);
+        UNIT_CHECK(matcher.match(LR"(C:\PackageData\App.ini)").index == redirection_rule_matcher::npos);
+        UNIT_CHECK(matcher.match(LR"(D:\Package\App.ini)").index == redirection_rule_matcher::npos);
+    });
+
+    unit_test("A path equal to a base path matches with an empty relative path", []
+    {
+        redirection_rule_matcher matcher;
+        matcher.add(LR"(C:\Package\Logs)", LR"(.*)");
+        auto result = matcher.match(LR"(C:\Package\Logs)");
+        UNIT_CHECK((result.index == 0) && (*result.relative_path == L'\0'));
+        result = matcher.match(LR"(C:\Package\Logs\)");
+        UNIT_CHECK((result.index == 0) && (*result.relative_path == L'\0'));
+    });
+
+    unit_test("Common patterns avoid std::regex", []
+    {
+        redirection_rule_matcher matcher;
+        UNIT_CHECK(matcher.is_compiled(matcher.add(L"C:\\", L".*")));
+        UNIT_CHECK(matcher.is_compiled(matcher.add(L"C:\\", LR"(.*\.ini)")));
+        UNIT_CHECK(matcher.is_compiled(matcher.add(L"C:\\", LR"(^foo\.txt$)")));
+        UNIT_CHECK(matcher.is_compiled(matcher.add(L"C:\\", LR"(logs\\.+)")));
+        UNIT_CHECK(!matcher.is_compiled(matcher.add(L"C:\\", LR"(.*\.(ini|cfg))")));
+        UNIT_CHECK(!matcher.is_compiled(matcher.add(L"C:\\", LR"(\d+\.log)")));
+    });
+
+    unit_test("Matches agree with the linear std::wregex scan", []
+    {
+        const wchar_t* bases[] = { LR"(C:\Package)", LR"(C:\Package\Config)", LR"(C:\Package\VFS\AppData)", LR"(C:\Other)" };
+        const wchar_t* patterns[] = { L".*", LR"(.*\.ini)", LR"(.*\.log$)", LR"(^settings\.json)", LR"(logs\\.*)", L"a.c",
+            LR"(.+\\data\..*)", LR"(.*\.(ini|cfg))", LR"([a-z]+\.txt)", LR"(\w+\\.*\.dat)" };
+        const wchar_t* components[] = { L"Package", L"PACKAGE", L"Config", L"config", L"VFS", L"AppData", L"logs",
+            L"app.ini", L"App.INI", L"a.log", L"settings.json", L"abc", L"aXc", L"data.bin", L"x.cfg", L"note.txt",
+            L"Other", L"file.dat" };
+
+        std::mt19937 random(1);
+        for (int round = 0; round < 100; ++round)
+        {
+            std::vector<rule> rules;
+            redirection_rule_matcher matcher;
+            for (int i = 0; i < 8; ++i)
+            {
+                std::wstring base = bases[random() % std::size(bases)];
+                std::wstring pattern = patterns[random() % std::size(patterns)];
+                rules.push_back({ base, pattern, std::wregex(pattern) });
+                matcher.add(base, pattern);
+            }
+
+            for (int i = 0; i < 500; ++i)
+            {
+                std::wstring path = L"C:";
+                for (auto depth = 1 + random() % 5; depth > 0; --depth)
+                {
+                    path += (random() % 4) ? L'\\' : L'/';
+                    path += components[random() % std::size(components)];
+                }
+                UNIT_CHECK(matcher.match(path.c_str()).index == reference_match(rules, path));
+            }
+        }
+    });
+
+    unit_test("Benchmark: matching against 60 rules", []
+    {
+        std::vector<rule> rules;
+        redirection_rule_matcher matcher;
+        for (int i = 0; i < 60; ++i)
+        {
+            auto base = LR"(C:\Package\Dir)" + std::to_wstring(i);
+            std::wstring pattern = (i % 3 == 0) ? L".*" : (i % 3 == 1) ? LR"(.*\.ini)" : LR"(logs\\.*\.log)";
+            rules.push_back({ base, pattern, std::wregex(pattern) });
+            matcher.add(base, pattern);
+        }
+
+        std::vector<std::wstring> paths;
+        for (int i = 0; i < 1000; ++i)
+        {
+            paths.push_back(LR"(C:\Package\Dir)" + std::to_wstring(i % 70) + LR"(\logs\file)" + std::to_wstring(i) + L".log");
+        }
+
+        // Before: every rule, in order, until one matches
+        std::size_t scanMatches = 0;
+        auto scanNs = unit_benchmark_ns(paths.size(), [&](std::size_t i)
+        {
+            scanMatches += reference_match(rules, paths[i]) != redirection_rule_matcher::npos;
+        });
+
+        std::size_t matcherMatches = 0;
+        auto matcherNs = unit_benchmark_ns(paths.size() * 100, [&](std::size_t i)
+        {
+            matcherMatches += matcher.match(paths[i % paths.size()].c_str()).index != redirection_rule_matcher::npos;
+        });
+
+        UNIT_CHECK(matcherMatches == scanMatches * 100);
+        std::printf("    linear regex scan: %.0f ns\n", scanNs);
+        std::printf("    rule matcher:      %.0f ns\n", matcherNs);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,199 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for registry_redirect_trie (RegLegacyFixups/RegistryRules.h), which finds the Redirect record that a key or one
+// of its ancestors is named by, checked against a brute-force search of the configured keys, and a benchmark of a deep
+// lookup against the exact lookup that it replaced.
+//
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iterator>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../../fixups/RegLegacyFixups/RegistryRules.h"
+#include "unit_test.h"
+
+static std::string upper(std::string_view str)
+{
+    std::string result(str);
+    for (auto& ch : result)
+    {
+        ch = ((ch >= 'a') && (ch <= 'z')) ? static_cast<char>(ch - 'a' + 'A') : ch;
+    }
+    return result;
+}
+
+// What the trie should find: the longest configured key that is 'subkey' or a whole-component prefix of it
+static std::optional<std::string> reference_find(const std::vector<std::string>& keys, std::string_view subkey)
+{
+    std::optional<std::string> result;
+    std::size_t resultLength = 0;
+    auto folded = upper(subkey);
+    for (auto& key : keys)
+    {
+        auto foldedKey = upper(key);
+        if ((folded.compare(0, foldedKey.length(), foldedKey) == 0) &&
+            ((folded.length() == foldedKey.length()) || (folded[foldedKey.length()] == '\\')) &&
+            (!result || (key.length() > resultLength)))
+        {
+            result = key + std::string(subkey.substr(key.length()));
+            resultLength = key.length();
+        }
+    }
+    return result;
+}
+
+int main()
+{
+    Redirect_Registry first;
+    Redirect_Registry second;
+
+    unit_test("Keys are found whatever their case", [&]
+    {
+        std::string key = "Software\\Vendor\\App";
+        registry_redirect_trie trie;
+        trie.insert(key, &first);
+
+        auto result = trie.find("SOFTWARE\\vendor\\aPP");
+        UNIT_CHECK(result && (result->subkey == "Software\\Vendor\\App") && (result->record == &first));
+        UNIT_CHECK(trie.find("software\\vendor\\app"));
+        UNIT_CHECK(!trie.find("Software\\Vendor"));
+        UNIT_CHECK(!trie.find("Software\\Vendor\\Application"));
+        UNIT_CHECK(!trie.find("Software\\Ven"));
+    });
+
+    unit_test("Subkeys are redirected beneath the deepest configured key", [&]
+    {
+        std::string outer = "Software\\Vendor";
+        std::string inner = "Software\\Vendor\\App\\1.0";
+        registry_redirect_trie trie;
+        trie.insert(outer, &first);
+        trie.insert(inner, &second);
+
+        auto result = trie.find("software\\VENDOR\\App\\1.0\\Plugins\\Deep\\Er");
+        UNIT_CHECK(result && (result->subkey == "Software\\Vendor\\App\\1.0\\Plugins\\Deep\\Er") && (result->record == &second));
+
+        // The rest of the path keeps the app's spelling
+        result = trie.find("SOFTWARE\\VENDOR\\App\\2.0\\Settings");
+        UNIT_CHECK(result && (result->subkey == "Software\\Vendor\\App\\2.0\\Settings") && (result->record == &first));
+
+        result = trie.find("Software\\Vendor\\");
+        UNIT_CHECK(result && (result->subkey == "Software\\Vendor\\") && (result->record == &first));
+    });
+
+    unit_test("The first record that names a key wins", [&]
+    {
+        std::string key = "Software\\Vendor";
+        std::string differentCase = "SOFTWARE\\vendor";
+        registry_redirect_trie trie;
+        trie.insert(key, &first);
+        trie.insert(differentCase, &second);
+
+        auto result = trie.find("Software\\Vendor\\App");
+        UNIT_CHECK(result && (result->subkey == "Software\\Vendor\\App") && (result->record == &first));
+    });
+
+    unit_test("Non-ASCII characters must match exactly", [&]
+    {
+        std::string key = "Software\\Caf\xc3\xa9";
+        registry_redirect_trie trie;
+        trie.insert(key, &first);
+        UNIT_CHECK(trie.find("SOFTWARE\\CAF\xc3\xa9\\Menu"));
+        UNIT_CHECK(!trie.find("Software\\CAF\xc3\x89"));
+    });
+
+    unit_test("Lookups agree with a brute-force search", [&]
+    {
+        const char* components[] = { "Software", "Vendor", "App", "1.0", "Plugins", "Settings", "A", "B" };
+        std::mt19937 random(17);
+        auto randomPath = [&](std::size_t depth, bool mixCase)
+        {
+            std::string result;
+            for (std::size_t i = 0; i < depth; ++i)
+            {
+                std::string component = components[random() % std::size(components)];
+                if (mixCase)
+                {
+                    for (auto& ch : component)
+                    {
+                        ch = (random() % 2) ? upper(std::string(1, ch))[0] : static_cast<char>(std::tolower(ch));
+                    }
+                }
+                result += (i ? "\\" : "") + component;
+            }
+            return result;
+        };
+
+        for (int round = 0; round < 200; ++round)
+        {
+            // The trie keeps pointers to the keys, so they must not move
+            std::list<std::string> storage;
+            std::vector<std::string> keys;
+            std::unordered_set<std::string> folded;
+            registry_redirect_trie trie;
+            for (int i = 0; i < 10; ++i)
+            {
+                auto key = randomPath(1 + random() % 4, false);
+                if (folded.insert(upper(key)).second)
+                {
+                    keys.push_back(key);
+                    trie.insert(storage.emplace_back(key), &first);
+                }
+            }
+
+            for (int i = 0; i < 300; ++i)
+            {
+                auto subkey = randomPath(1 + random() % 6, true);
+                auto expected = reference_find(keys, subkey);
+                auto actual = trie.find(subkey);
+                UNIT_CHECK(expected.has_value() == actual.has_value());
+                if (expected && actual)
+                {
+                    UNIT_CHECK(*expected == actual->subkey);
+                }
+            }
+        }
+    });
+
+    unit_test("Benchmark: a deep, differently cased lookup among 200 redirected keys", [&]
+    {
+        std::list<std::string> keys;
+        std::unordered_set<std::string> exact;
+        registry_redirect_trie trie;
+        for (int i = 0; i < 200; ++i)
+        {
+            auto& key = keys.emplace_back("Software\\Vendor" + std::to_string(i % 20) + "\\App" + std::to_string(i));
+            exact.insert(key);
+            trie.insert(key, &first);
+        }
+
+        // Before: only the exact key, spelled as configured, was found
+        std::size_t exactFound = 0;
+        auto exactNs = unit_benchmark_ns(1000000, [&](std::size_t i)
+        {
+            exactFound += exact.count("Software\\Vendor" + std::to_string(i % 20) + "\\App" + std::to_string(i % 200));
+        });
+
+        std::size_t trieFound = 0;
+        auto trieNs = unit_benchmark_ns(1000000, [&](std::size_t i)
+        {
+            auto result = trie.find("SOFTWARE\\vendor" + std::to_string(i % 20) + "\\APP" + std::to_string(i % 200) + "\\Settings\\Window");
+            trieFound += result.has_value();
+        });
+
+        UNIT_CHECK(exactFound == 1000000);
+        UNIT_CHECK(trieFound == 1000000);
+        std::printf("    exact lookup: %.0f ns\n", exactNs);
+        std::printf("    trie lookup:  %.0f ns\n", trieNs);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,232 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// Tests for the compiled remediation patterns (RegLegacyFixups/Reg_Remediation_Spec.h) and their evaluation by
+// registry_rules (RegLegacyFixups/RegistryRules.h), and a benchmark of the RegOpenKeyEx decision (deletion marker, then
+// access) against a stand-in for the checks that built a std::wregex from every pattern on every call.
+//
+
+#include <cstdio>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "../../fixups/RegLegacyFixups/RegistryRules.h"
+#include "unit_test.h"
+
+// As CompileRegistryPattern in InitializeFixup.cpp
+static Reg_Key_Pattern pattern(const wchar_t* text)
+{
+    Reg_Key_Pattern result;
+    result.pattern = text;
+    try
+    {
+        result.regex = std::wregex(result.pattern, std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        result.valid = true;
+    }
+    catch (...)
+    {
+    }
+    return result;
+}
+
+static Reg_Remediation_Record modify_key_access(Modify_Key_Hive_Types hive, std::vector<const wchar_t*> patterns, Modify_Key_Access_Types access)
+{
+    Reg_Remediation_Record record = {};
+    record.remeditaionType = Reg_Remediation_Type_ModifyKeyAccess;
+    record.modifyKeyAccess.hive = hive;
+    record.modifyKeyAccess.access = access;
+    for (auto text : patterns)
+    {
+        record.modifyKeyAccess.patterns.push_back(pattern(text));
+    }
+    return record;
+}
+
+static Reg_Remediation_Record fake_delete(Modify_Key_Hive_Types hive, std::vector<const wchar_t*> patterns)
+{
+    Reg_Remediation_Record record = {};
+    record.remeditaionType = Reg_Remediation_Type_FakeDelete;
+    record.fakeDeleteKey.hive = hive;
+    for (auto text : patterns)
+    {
+        record.fakeDeleteKey.patterns.push_back(pattern(text));
+    }
+    return record;
+}
+
+static Reg_Remediation_Record deletion_marker(Modify_Key_Hive_Types hive, const wchar_t* key, std::vector<const wchar_t*> values)
+{
+    Reg_Remediation_Record record = {};
+    record.remeditaionType = Reg_Remediation_Type_DeletionMarker;
+    record.deletionMarker.hive = hive;
+    record.deletionMarker.key = pattern(key);
+    for (auto text : values)
+    {
+        record.deletionMarker.values.push_back(pattern(text));
+    }
+    return record;
+}
+
+// The spec measured in the original change: 3 ModifyKeyAccess records of 4 patterns each, 1 FakeDelete and 3
+// DeletionMarkers
+static std::vector<Reg_Remediation_Spec> realistic_specs()
+{
+    Reg_Remediation_Spec spec = {};
+    spec.remeditaionType = Reg_Remediation_Type_ModifyKeyAccess;
+    spec.remediationRecords.push_back(modify_key_access(Modify_Key_Hive_Type_HKCU,
+        { LR"(Software\\Vendor\\.*)", LR"(Software\\Vendor2\\.*)", LR"(Software\\Vendor3\\App.*)", LR"(.*\\Policies\\.*)" },
+        Modify_Key_Access_Type_Full2RW));
+    spec.remediationRecords.push_back(modify_key_access(Modify_Key_Hive_Type_HKLM,
+        { LR"(Software\\Vendor\\.*)", LR"(Software\\WOW6432Node\\Vendor\\.*)", LR"(SYSTEM\\.*)", LR"(.*\\Services\\App.*)" },
+        Modify_Key_Access_Type_Full2R));
+    spec.remediationRecords.push_back(modify_key_access(Modify_Key_Hive_Type_HKLM,
+        { LR"(Software\\Classes\\.*)", LR"(Software\\Other\\.*)", LR"(Software\\Third\\.*)", LR"(Software\\Fourth\\.*)" },
+        Modify_Key_Access_Type_RW2R));
+    spec.remediationRecords.push_back(fake_delete(Modify_Key_Hive_Type_HKCU, { LR"(Software\\Vendor\\Temp.*)" }));
+    spec.remediationRecords.push_back(deletion_marker(Modify_Key_Hive_Type_HKLM, LR"(Software\\Vendor\\Old.*)", {}));
+    spec.remediationRecords.push_back(deletion_marker(Modify_Key_Hive_Type_HKLM, LR"(Software\\Vendor\\App)", { L"Secret.*" }));
+    spec.remediationRecords.push_back(deletion_marker(Modify_Key_Hive_Type_HKCU, LR"(Software\\Vendor\\.*)", { L"Legacy" }));
+    return { spec };
+}
+
+// The old checks: every pattern of every record compiled on every call
+static bool old_match(const std::wstring& text, const std::wstring& subkey)
+{
+    try
+    {
+        return std::regex_match(subkey, std::wregex(text));
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+static bool old_open_key_decision(const std::vector<Reg_Remediation_Spec>& specs, Modify_Key_Hive_Types hive, const std::wstring& subkey)
+{
+    for (auto& spec : specs)
+    {
+        for (auto& record : spec.remediationRecords)
+        {
+            if ((record.remeditaionType == Reg_Remediation_Type_DeletionMarker) && (record.deletionMarker.hive == hive) &&
+                record.deletionMarker.values.empty() && old_match(record.deletionMarker.key.pattern, subkey))
+            {
+                return true;
+            }
+        }
+    }
+
+    for (auto& spec : specs)
+    {
+        for (auto& record : spec.remediationRecords)
+        {
+            if ((record.remeditaionType == Reg_Remediation_Type_ModifyKeyAccess) && (record.modifyKeyAccess.hive == hive))
+            {
+                for (auto& item : record.modifyKeyAccess.patterns)
+                {
+                    if (old_match(item.pattern, subkey))
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+int main()
+{
+    auto specs = realistic_specs();
+    registry_rules rules;
+    rules.compile(specs);
+
+    auto evaluate = [&](Modify_Key_Hive_Types hive, const std::wstring& subkey)
+    {
+        auto hiveName = (hive == Modify_Key_Hive_Type_HKCU) ? std::string("HKEY_CURRENT_USER\\") : std::string("HKEY_LOCAL_MACHINE\\");
+        return rules.evaluate(hiveName + std::string(subkey.begin(), subkey.end()), hive, subkey);
+    };
+
+    unit_test("The first ModifyKeyAccess record that matches, in the key's hive, wins", [&]
+    {
+        auto verdict = evaluate(Modify_Key_Hive_Type_HKLM, LR"(Software\Classes\CLSID)");
+        UNIT_CHECK((verdict.access_hive == Modify_Key_Hive_Type_HKLM) && (verdict.access == Modify_Key_Access_Type_RW2R));
+
+        verdict = evaluate(Modify_Key_Hive_Type_HKLM, LR"(Software\Vendor\App)");
+        UNIT_CHECK(verdict.access == Modify_Key_Access_Type_Full2R);
+
+        verdict = evaluate(Modify_Key_Hive_Type_HKCU, LR"(Software\Vendor\App)");
+        UNIT_CHECK((verdict.access_hive == Modify_Key_Hive_Type_HKCU) && (verdict.access == Modify_Key_Access_Type_Full2RW));
+
+        verdict = evaluate(Modify_Key_Hive_Type_HKCU, LR"(Software\Classes\CLSID)");
+        UNIT_CHECK(verdict.access == Modify_Key_Access_Type_Unknown);
+    });
+
+    unit_test("FakeDelete only applies to FakeDelete records of the key's hive", [&]
+    {
+        UNIT_CHECK(evaluate(Modify_Key_Hive_Type_HKCU, LR"(Software\Vendor\Temp1)").fake_delete);
+        UNIT_CHECK(!evaluate(Modify_Key_Hive_Type_HKLM, LR"(Software\Vendor\Temp1)").fake_delete);
+        UNIT_CHECK(!evaluate(Modify_Key_Hive_Type_HKCU, LR"(Software\Vendor\App)").fake_delete);
+    });
+
+    unit_test("Deletion markers hide keys, or only the values they name", [&]
+    {
+        auto verdict = evaluate(Modify_Key_Hive_Type_HKLM, LR"(Software\Vendor\OldSettings)");
+        UNIT_CHECK(verdict.hidden() && verdict.value_hidden(L"Anything"));
+
+        verdict = evaluate(Modify_Key_Hive_Type_HKLM, LR"(Software\Vendor\App)");
+        UNIT_CHECK(!verdict.hidden());
+        UNIT_CHECK(verdict.value_hidden(L"SecretKey"));
+        UNIT_CHECK(!verdict.value_hidden(L"Version"));
+
+        verdict = evaluate(Modify_Key_Hive_Type_HKCU, LR"(Software\Vendor\App)");
+        UNIT_CHECK(!verdict.hidden() && verdict.value_hidden(L"Legacy") && !verdict.value_hidden(L"Legacy2"));
+
+        UNIT_CHECK(rules.has_deletion_markers(Modify_Key_Hive_Type_HKLM));
+        UNIT_CHECK(!rules.has_deletion_markers(Modify_Key_Hive_Type_Unknown));
+    });
+
+    unit_test("A pattern that does not compile never matches", []
+    {
+        auto bad = pattern(LR"(Software\\Vendor\\(unclosed)");
+        UNIT_CHECK(!bad.valid);
+        UNIT_CHECK(!match_registry_pattern(bad, LR"(Software\Vendor\(unclosed)"));
+
+        // A DeletionMarker whose values are all bad still names values, so it doesn't hide the whole key
+        Reg_Remediation_Spec spec = {};
+        spec.remediationRecords.push_back(deletion_marker(Modify_Key_Hive_Type_HKCU, L".*", { L"[" }));
+        registry_rules badRules;
+        std::vector<Reg_Remediation_Spec> specs = { spec };
+        badRules.compile(specs);
+        auto verdict = badRules.evaluate("HKEY_CURRENT_USER\\Software", Modify_Key_Hive_Type_HKCU, L"Software");
+        UNIT_CHECK(!verdict.hidden() && !verdict.value_hidden(L"["));
+    });
+
+    unit_test("Benchmark: the RegOpenKeyEx decision for a key that no rule matches", [&]
+    {
+        const std::wstring subkey = LR"(Software\Microsoft\Windows\CurrentVersion\Explorer)";
+
+        // Before: every pattern compiled on every call
+        std::size_t oldMatches = 0;
+        auto oldNs = unit_benchmark_ns(200, [&](std::size_t)
+        {
+            oldMatches += old_open_key_decision(specs, Modify_Key_Hive_Type_HKLM, subkey);
+        });
+
+        std::size_t newMatches = 0;
+        auto newNs = unit_benchmark_ns(20000, [&](std::size_t)
+        {
+            auto verdict = evaluate(Modify_Key_Hive_Type_HKLM, subkey);
+            newMatches += verdict.hidden() || (verdict.access != Modify_Key_Access_Type_Unknown);
+        });
+
+        UNIT_CHECK((oldMatches == 0) && (newMatches == 0));
+        std::printf("    compiled per call: %.0f ns\n", oldNs);
+        std::printf("    compiled once:     %.0f ns\n", newNs);
+    });
+
+    return unit_test_result();
+}
@@ -0,0 +1,77 @@
+//-------------------------------------------------------------------------------------------------------
+// Copyright (C) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//-------------------------------------------------------------------------------------------------------
+//
+// A minimal harness for the unit tests in this directory. Unlike the scenario tests, these don't run inside a package
+// or talk to TestRunner; each test is a plain executable that exercises the portable parts of a fixup and exits with a
+// non-zero code if any check failed. See readme.md.
+//
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <string>
+
+inline int& unit_test_failures() noexcept
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define UNIT_CHECK(condition) \
+    ((condition) ? (void)0 : (std::printf("    FAILED: %s (%s:%d)\n", #condition, __FILE__, __LINE__), (void)++unit_test_failures()))
+
+template <typename TestFunc>
+void unit_test(const char* name, TestFunc&& test)
+{
+    auto failures = unit_test_failures();
+    std::printf("%s\n", name);
+    try
+    {
+        test();
+    }
+    catch (std::exception& e)
+    {
+        std::printf("    FAILED: unexpected exception: %s\n", e.what());
+        ++unit_test_failures();
+    }
+
+    if (unit_test_failures() != failures)
+    {
+        std::printf("    %d check(s) failed\n", unit_test_failures() - failures);
+    }
+}
+
+// Average nanoseconds per call of 'func' over 'iterations' calls
+template <typename Func>
+double unit_benchmark_ns(std::size_t iterations, Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+    {
+        func(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations);
+}
+
+// Keeps the optimizer from discarding a benchmark's result
+template <typename T>
+void unit_keep(const T& value) noexcept
+{
+    static volatile const void* sink;
+    sink = &value;
+}
+
+inline int unit_test_result() noexcept
+{
+    if (unit_test_failures() != 0)
+    {
+        std::printf("%d check(s) failed\n", unit_test_failures());
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}